@@ -0,0 +1,595 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Time the phases of ftwin on synthetic corpora, then checksum_file, filecmp,
+ * napr_hash and napr_heap on their own: make bench, or
+ * make bench_ftwin && ./bench_ftwin [scale [jobs [directory]]]
+ *
+ * Each measure is printed as a JSON record on its own line, e.g.
+ * {"label":"","version":"0.8.2","hash":"xxh3","jobs":1,"corpus":"tiny","phase":"add_files",
+ *  "seconds":0.412351,"items":100000,"bytes":3250000}
+ * so that the records of two commits can be joined on (corpus, phase). The
+ * label is taken from $FTWIN_BENCH_LABEL. The corpora are generated in a
+ * temporary directory removed at the end, or in directory, then kept and
+ * reused by the next runs. They are read from the page cache, the first
+ * phase after their generation aside.
+ */
+
+/* the phases are static in ftwin.c, its main is left aside */
+#define main ftwin_main
+#include "ftwin.c"
+#undef main
+
+#include <apr_time.h>
+
+#include "napr_heap.h"
+
+typedef struct bench_t
+{
+    apr_pool_t *pool;
+    FILE *out;			/* the records, stdout being ftwin's report */
+    const char *label;
+    const char *root;		/* where the corpora are generated */
+    unsigned long scale;
+    unsigned long nb_worker;
+    napr_threadpool_t *threadpool;
+    unsigned char *buf;
+} bench_t;
+
+#define BENCH_BUF_LEN (1024 * 1024)
+
+/* content of the key, a xorshift stream so that equal keys give equal files */
+static void bench_fill(unsigned char *buf, apr_size_t len, apr_uint64_t *state)
+{
+    apr_uint64_t x = *state;
+    apr_size_t i;
+
+    for (i = 0; i < len; i++) {
+	if (0 == (i & 0x7)) {
+	    x ^= x << 13;
+	    x ^= x >> 7;
+	    x ^= x << 17;
+	}
+	buf[i] = (unsigned char) (x >> ((i & 0x7) << 3));
+    }
+    *state = x;
+}
+
+static apr_uint64_t bench_seed(apr_uint64_t key)
+{
+    return (key + 1) * APR_UINT64_C(0x9E3779B97F4A7C15);
+}
+
+/* write size bytes of the content of key to path, the byte at flip (if < size) being changed */
+static int bench_write(bench_t *bench, const char *path, apr_off_t size, apr_uint64_t key, apr_off_t flip)
+{
+    apr_uint64_t state = bench_seed(key);
+    apr_off_t off;
+    apr_size_t len;
+    FILE *file;
+
+    if (NULL == (file = fopen(path, "wb"))) {
+	DEBUG_ERR("error calling fopen on %s: %s", path, strerror(errno));
+	return -1;
+    }
+    for (off = 0; off < size; off += len) {
+	len = (apr_size_t) FTWIN_MIN(size - off, BENCH_BUF_LEN);
+	bench_fill(bench->buf, len, &state);
+	if ((off <= flip) && (flip < off + (apr_off_t) len))
+	    bench->buf[flip - off] ^= 0xff;
+	if (len != fwrite(bench->buf, 1, len, file)) {
+	    DEBUG_ERR("error calling fwrite on %s: %s", path, strerror(errno));
+	    fclose(file);
+	    return -1;
+	}
+    }
+
+    return fclose(file);
+}
+
+static int bench_mkdir(const char *path)
+{
+    if ((0 != mkdir(path, 0755)) && (EEXIST != errno)) {
+	DEBUG_ERR("error calling mkdir on %s: %s", path, strerror(errno));
+	return -1;
+    }
+
+    return 0;
+}
+
+/* millions of tiny files, a hundred per directory, a quarter of them duplicates */
+static int bench_corpus_tiny(bench_t *bench, const char *dir)
+{
+    char path[PATH_MAX];
+    unsigned long i, nb_files = 100000 * bench->scale;
+    apr_uint64_t key;
+
+    for (i = 0; i < nb_files; i++) {
+	if (0 == (i % 100)) {
+	    apr_snprintf(path, sizeof(path), "%s/%lu", dir, i / 100);
+	    if (0 != bench_mkdir(path))
+		return -1;
+	}
+	key = i % (nb_files - nb_files / 4);
+	apr_snprintf(path, sizeof(path), "%s/%lu/f%lu", dir, i / 100, i);
+	if (0 != bench_write(bench, path, 1 + key % 64, key, -1))
+	    return -1;
+    }
+
+    return 0;
+}
+
+/* a few huge files: two twins, one differing in its last byte, one in its middle */
+static int bench_corpus_huge(bench_t *bench, const char *dir)
+{
+    apr_off_t size = (apr_off_t) 64 * 1024 * 1024 * bench->scale;
+
+    if ((0 != bench_write(bench, apr_pstrcat(bench->pool, dir, "/huge0", NULL), size, 0, -1))
+	|| (0 != bench_write(bench, apr_pstrcat(bench->pool, dir, "/huge1", NULL), size, 0, -1))
+	|| (0 != bench_write(bench, apr_pstrcat(bench->pool, dir, "/huge2", NULL), size, 0, size - 1)))
+	return -1;
+
+    return bench_write(bench, apr_pstrcat(bench->pool, dir, "/huge3", NULL), size, 0, size / 2);
+}
+
+/* a large class of the same size whose files differ in their first block, a tenth of them twins */
+static int bench_corpus_samesize(bench_t *bench, const char *dir)
+{
+    char path[PATH_MAX];
+    unsigned long i, nb_files = 4000 * bench->scale;
+
+    for (i = 0; i < nb_files; i++) {
+	apr_snprintf(path, sizeof(path), "%s/s%lu", dir, i);
+	if (0 != bench_write(bench, path, 16 * 1024, i % (nb_files - nb_files / 10), -1))
+	    return -1;
+    }
+
+    return 0;
+}
+
+/* two identical chains of directories, a few files at each level */
+static int bench_corpus_deep(bench_t *bench, const char *dir)
+{
+    char path[PATH_MAX];
+    unsigned long depth, level, i, chain;
+    apr_size_t len;
+
+    /* "/d" per level, the paths stay below PATH_MAX */
+    depth = FTWIN_MIN(256 * bench->scale, (PATH_MAX - strlen(dir) - 64) / 2);
+    for (chain = 0; chain < 2; chain++) {
+	len = apr_snprintf(path, sizeof(path), "%s/%lu", dir, chain);
+	for (level = 0; level < depth; level++) {
+	    if (0 != bench_mkdir(path))
+		return -1;
+	    for (i = 0; i < 4; i++) {
+		apr_snprintf(path + len, sizeof(path) - len, "/f%lu", i);
+		if (0 != bench_write(bench, path, 128, level * 4 + i, -1))
+		    return -1;
+	    }
+	    len += apr_snprintf(path + len, sizeof(path) - len, "/d");
+	}
+    }
+
+    return 0;
+}
+
+/* files of 4 KiB, each one linked in eight other directories, a quarter of them duplicates */
+static int bench_corpus_hardlinks(bench_t *bench, const char *dir)
+{
+    char path[PATH_MAX], linkpath[PATH_MAX];
+    unsigned long i, j, nb_files = 2000 * bench->scale;
+
+    for (j = 0; j < 9; j++) {
+	apr_snprintf(path, sizeof(path), "%s/%lu", dir, j);
+	if (0 != bench_mkdir(path))
+	    return -1;
+    }
+    for (i = 0; i < nb_files; i++) {
+	apr_snprintf(path, sizeof(path), "%s/0/f%lu", dir, i);
+	if (0 != bench_write(bench, path, 4096, i % (nb_files - nb_files / 4), -1))
+	    return -1;
+	for (j = 1; j < 9; j++) {
+	    apr_snprintf(linkpath, sizeof(linkpath), "%s/%lu/f%lu", dir, j, i);
+	    if ((0 != link(path, linkpath)) && (EEXIST != errno)) {
+		DEBUG_ERR("error calling link on %s: %s", linkpath, strerror(errno));
+		return -1;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+/* a ustar header for a member of size bytes */
+static void bench_tar_header(unsigned char *header, const char *name, apr_off_t size)
+{
+    unsigned int chksum, i;
+
+    memset(header, 0, 512);
+    apr_cpystrn((char *) header, name, 100);
+    snprintf((char *) header + 100, 8, "%07o", 0644);
+    snprintf((char *) header + 108, 8, "%07o", 0);
+    snprintf((char *) header + 116, 8, "%07o", 0);
+    snprintf((char *) header + 124, 12, "%011llo", (unsigned long long) size);
+    snprintf((char *) header + 136, 12, "%011o", 0);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    /* the checksum is computed with its own field made of spaces */
+    memset(header + 148, ' ', 8);
+    for (chksum = 0, i = 0; i < 512; i++)
+	chksum += header[i];
+    snprintf((char *) header + 148, 8, "%06o", chksum);
+}
+
+/* a tarball of nb_members members of 1 to 8 KiB, the member flip (if < nb_members) being changed */
+static int bench_tar(bench_t *bench, const char *path, unsigned long nb_members, unsigned long flip)
+{
+    unsigned char header[512];
+    char name[32];
+    apr_uint64_t state;
+    apr_size_t len, padded;
+    unsigned long i;
+    FILE *file;
+
+    if (NULL == (file = fopen(path, "wb"))) {
+	DEBUG_ERR("error calling fopen on %s: %s", path, strerror(errno));
+	return -1;
+    }
+    for (i = 0; i < nb_members; i++) {
+	len = 1024 * (1 + i % 8);
+	padded = (len + 511) & ~((apr_size_t) 511);
+	apr_snprintf(name, sizeof(name), "m%lu", i);
+	bench_tar_header(header, name, len);
+	state = bench_seed(i);
+	bench_fill(bench->buf, len, &state);
+	memset(bench->buf + len, 0, padded - len);
+	if (i == flip)
+	    bench->buf[0] ^= 0xff;
+	if ((512 != fwrite(header, 1, 512, file)) || (padded != fwrite(bench->buf, 1, padded, file))) {
+	    DEBUG_ERR("error calling fwrite on %s: %s", path, strerror(errno));
+	    fclose(file);
+	    return -1;
+	}
+    }
+    memset(header, 0, 512);
+    if ((512 != fwrite(header, 1, 512, file)) || (512 != fwrite(header, 1, 512, file))) {
+	DEBUG_ERR("error calling fwrite on %s: %s", path, strerror(errno));
+	fclose(file);
+	return -1;
+    }
+
+    return fclose(file);
+}
+
+/* big tarballs: two twins and one differing in a member */
+static int bench_corpus_tarball(bench_t *bench, const char *dir)
+{
+    unsigned long nb_members = 5000 * bench->scale;
+
+    if ((0 != bench_tar(bench, apr_pstrcat(bench->pool, dir, "/t0.tar", NULL), nb_members, ULONG_MAX))
+	|| (0 != bench_tar(bench, apr_pstrcat(bench->pool, dir, "/t1.tar", NULL), nb_members, ULONG_MAX)))
+	return -1;
+
+    return bench_tar(bench, apr_pstrcat(bench->pool, dir, "/t2.tar", NULL), nb_members, nb_members / 2);
+}
+
+typedef struct bench_corpus_t
+{
+    const char *name;
+    int (*make) (bench_t *bench, const char *dir);
+} bench_corpus_t;
+
+static const bench_corpus_t bench_corpora[] = {
+    {"tiny", bench_corpus_tiny},
+    {"huge", bench_corpus_huge},
+    {"samesize", bench_corpus_samesize},
+    {"deep", bench_corpus_deep},
+    {"hardlinks", bench_corpus_hardlinks},
+    {"tarball", bench_corpus_tarball},
+    {NULL, NULL}
+};
+
+static void bench_record(const bench_t *bench, const char *corpus, const char *phase, apr_time_t start,
+			 apr_size_t items, apr_off_t bytes)
+{
+    fprintf(bench->out, "{\"label\":\"%s\",\"version\":\"%s\",\"hash\":\"%s\",\"jobs\":%lu,\"corpus\":\"%s\","
+	    "\"phase\":\"%s\",\"seconds\":%.6f,\"items\":%" APR_SIZE_T_FMT ",\"bytes\":%" APR_OFF_T_FMT "}\n",
+	    bench->label, PACKAGE_VERSION, ft_hash_name(ft_hash_default()), bench->nb_worker, corpus, phase,
+	    (double) (apr_time_now() - start) / APR_USEC_PER_SEC, items, bytes);
+    fflush(bench->out);
+}
+
+/* the three phases of ftwin on the corpus in dir, set up as main does */
+static apr_status_t bench_phases(bench_t *bench, const bench_corpus_t *corpus, const char *dir)
+{
+    char errbuf[128];
+    ft_conf_t conf;
+    apr_pool_t *pool;
+    apr_off_t bytes;
+    apr_time_t start;
+    apr_status_t status;
+    int i;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&pool, bench->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    ft_conf_init(&conf, pool);
+    set_option(&conf.mask, OPTION_RECSD, 1);
+#if HAVE_ARCHIVE
+    if (0 == strcmp(corpus->name, "tarball"))
+	set_option(&conf.mask, OPTION_UNTAR, 1);
+#endif
+    conf.nb_worker = bench->nb_worker;
+    conf.threadpool = bench->threadpool;
+    conf.inodes = napr_inthash_make(pool, 4096);
+    if ((APR_SUCCESS != (status = apr_uid_current(&(conf.userid), &(conf.groupid), pool)))
+	|| (APR_SUCCESS != (status = apr_uid_name_get(&(conf.username), conf.userid, pool)))
+	|| (APR_SUCCESS != (status = fill_gids_ht(conf.username, conf.gids, pool)))) {
+	DEBUG_ERR("error resolving the current user: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(pool);
+	return status;
+    }
+
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = ft_conf_add_files(&conf, &dir, 1))) {
+	DEBUG_ERR("error calling ft_conf_add_files: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(pool);
+	return status;
+    }
+    for (i = 0, bytes = 0; i < conf.files->nelts; i++)
+	bytes += APR_ARRAY_IDX(conf.files, i, ft_file_t *)->size;
+    bench_record(bench, corpus->name, "add_files", start, conf.files->nelts, bytes);
+
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = ft_conf_process_sizes(&conf, pool))) {
+	DEBUG_ERR("error calling ft_conf_process_sizes: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(pool);
+	return status;
+    }
+    bench_record(bench, corpus->name, "process_sizes", start, conf.files->nelts, bytes);
+
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = ft_conf_twin_report(&conf))) {
+	DEBUG_ERR("error calling ft_conf_twin_report: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(pool);
+	return status;
+    }
+    fflush(stdout);
+    bench_record(bench, corpus->name, "twin_report", start, conf.files->nelts, bytes);
+    apr_pool_destroy(pool);
+
+    return APR_SUCCESS;
+}
+
+/* checksum_file and filecmp throughput on the huge corpus */
+static apr_status_t bench_file(bench_t *bench, const char *dir)
+{
+    char errbuf[128];
+    apr_uint32_t digest[HASHSTATE];
+    const char *huge0, *huge1, *huge2;
+    apr_finfo_t finfo;
+    ft_io_t io;
+    apr_time_t start;
+    apr_status_t status;
+    int rv;
+
+    huge0 = apr_pstrcat(bench->pool, dir, "/huge0", NULL);
+    huge1 = apr_pstrcat(bench->pool, dir, "/huge1", NULL);
+    huge2 = apr_pstrcat(bench->pool, dir, "/huge2", NULL);
+    if (APR_SUCCESS != (status = apr_stat(&finfo, huge0, APR_FINFO_SIZE, bench->pool))) {
+	DEBUG_ERR("error calling apr_stat: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    ft_io_init(&io);
+    ft_hash_impl(ft_hash_default());
+
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = checksum_file(huge0, finfo.size, &io, ft_hash_default(), digest, bench->pool))) {
+	DEBUG_ERR("error calling checksum_file: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    bench_record(bench, "huge", "checksum_file", start, 1, finfo.size);
+
+    /* io.excess_size switches off mmap */
+    io.excess_size = 0;
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = checksum_file(huge0, finfo.size, &io, ft_hash_default(), digest, bench->pool))) {
+	DEBUG_ERR("error calling checksum_file: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    bench_record(bench, "huge", "checksum_file_read", start, 1, finfo.size);
+    ft_io_init(&io);
+
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = filecmp(bench->pool, huge0, huge1, finfo.size, &io, &rv))) {
+	DEBUG_ERR("error calling filecmp: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    bench_record(bench, "huge", "filecmp_twins", start, 2, 2 * finfo.size);
+
+    start = apr_time_now();
+    if (APR_SUCCESS != (status = filecmp(bench->pool, huge0, huge2, finfo.size, &io, &rv))) {
+	DEBUG_ERR("error calling filecmp: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    bench_record(bench, "huge", "filecmp_last_byte", start, 2, 2 * finfo.size);
+
+    return APR_SUCCESS;
+}
+
+static int bench_heap_cmp(const void *param1, const void *param2)
+{
+    const apr_uint64_t *number1 = param1;
+    const apr_uint64_t *number2 = param2;
+
+    return (*number1 < *number2) ? -1 : ((*number2 < *number1) ? 1 : 0);
+}
+
+/* napr_hash on paths, as the ignore list is, and napr_heap on integers */
+static void bench_containers(bench_t *bench)
+{
+    char **keys;
+    apr_uint64_t *numbers, state = bench_seed(0);
+    napr_hash_t *hash;
+    napr_heap_t *heap;
+    apr_uint32_t hash_value;
+    apr_size_t i, nel = 1000000 * bench->scale, found;
+    apr_time_t start;
+
+    keys = apr_palloc(bench->pool, nel * sizeof(char *));
+    numbers = apr_palloc(bench->pool, nel * sizeof(apr_uint64_t));
+    for (i = 0; i < nel; i++) {
+	keys[i] = apr_psprintf(bench->pool, "/home/user/dir%" APR_SIZE_T_FMT "/file%" APR_SIZE_T_FMT, i / 100, i);
+	bench_fill((unsigned char *) &(numbers[i]), sizeof(apr_uint64_t), &state);
+    }
+
+    start = apr_time_now();
+    hash = napr_hash_str_make(bench->pool, 4096, 8);
+    for (i = 0; i < nel; i++)
+	if (NULL == napr_hash_search(hash, keys[i], strlen(keys[i]), &hash_value))
+	    napr_hash_set(hash, keys[i], hash_value);
+    bench_record(bench, "keys", "napr_hash_insert", start, nel, 0);
+
+    start = apr_time_now();
+    for (i = 0, found = 0; i < nel; i++)
+	found += (NULL != napr_hash_search(hash, keys[i], strlen(keys[i]), NULL));
+    bench_record(bench, "keys", "napr_hash_search", start, found, 0);
+
+    start = apr_time_now();
+    heap = napr_heap_make(bench->pool, bench_heap_cmp);
+    for (i = 0; i < nel; i++)
+	napr_heap_insert(heap, &(numbers[i]));
+    bench_record(bench, "keys", "napr_heap_insert", start, nel, 0);
+
+    start = apr_time_now();
+    for (i = 0; NULL != napr_heap_extract(heap); i++);
+    bench_record(bench, "keys", "napr_heap_extract", start, i, 0);
+}
+
+/* remove path and everything below it */
+static apr_status_t bench_rm(const char *path, apr_pool_t *pool)
+{
+    apr_finfo_t finfo;
+    apr_dir_t *dir;
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, pool)))
+	return status;
+    if (APR_SUCCESS != (status = apr_dir_open(&dir, path, gc_pool))) {
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    while (APR_SUCCESS == apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, dir)) {
+	if ((0 == strcmp(finfo.name, ".")) || (0 == strcmp(finfo.name, "..")))
+	    continue;
+	if (APR_DIR == finfo.filetype)
+	    status = bench_rm(apr_pstrcat(gc_pool, path, "/", finfo.name, NULL), gc_pool);
+	else
+	    status = apr_file_remove(apr_pstrcat(gc_pool, path, "/", finfo.name, NULL), gc_pool);
+	if (APR_SUCCESS != status)
+	    break;
+    }
+    apr_dir_close(dir);
+    if (APR_SUCCESS == status)
+	status = apr_dir_remove(path, gc_pool);
+    apr_pool_destroy(gc_pool);
+
+    return status;
+}
+
+int main(int argc, const char **argv)
+{
+    char errbuf[128];
+    char tmpdir[PATH_MAX];
+    const char *dir;
+    const bench_corpus_t *corpus;
+    bench_t bench;
+    apr_finfo_t finfo;
+    apr_time_t start;
+    apr_status_t status;
+    int keep;
+
+    if (APR_SUCCESS != (status = apr_initialize())) {
+	DEBUG_ERR("error calling apr_initialize: %s", apr_strerror(status, errbuf, 128));
+	return EXIT_FAILURE;
+    }
+    atexit(apr_terminate);
+    if (APR_SUCCESS != (status = apr_pool_create(&(bench.pool), NULL))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return EXIT_FAILURE;
+    }
+    bench.scale = (1 < argc) ? strtoul(argv[1], NULL, 10) : 1;
+    bench.nb_worker = (2 < argc) ? strtoul(argv[2], NULL, 10) : 1;
+    if ((0 == bench.scale) || (ULONG_MAX == bench.scale) || (0 == bench.nb_worker) || (ULONG_MAX == bench.nb_worker)) {
+	fprintf(stderr, "Usage: %s [scale [jobs [directory]]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+    keep = (3 < argc);
+    if (keep) {
+	bench.root = argv[3];
+	if (0 != bench_mkdir(bench.root))
+	    return EXIT_FAILURE;
+    }
+    else {
+	apr_snprintf(tmpdir, sizeof(tmpdir), "%s/ftwin-bench-XXXXXX", (NULL != getenv("TMPDIR")) ? getenv("TMPDIR") : "/tmp");
+	if (NULL == (bench.root = mkdtemp(tmpdir))) {
+	    DEBUG_ERR("error calling mkdtemp: %s", strerror(errno));
+	    return EXIT_FAILURE;
+	}
+    }
+    bench.label = (NULL != getenv("FTWIN_BENCH_LABEL")) ? getenv("FTWIN_BENCH_LABEL") : "";
+    bench.buf = apr_palloc(bench.pool, BENCH_BUF_LEN);
+    bench.threadpool = NULL;
+    if ((1 < bench.nb_worker)
+	&& (APR_SUCCESS != (status = napr_threadpool_init(&(bench.threadpool), NULL, bench.nb_worker, NULL, bench.pool)))) {
+	DEBUG_ERR("error calling napr_threadpool_init: %s", apr_strerror(status, errbuf, 128));
+	return EXIT_FAILURE;
+    }
+    ft_hash_impl(ft_hash_default());
+
+    /* the reports of ftwin are not part of the records */
+    if ((NULL == (bench.out = fdopen(dup(STDOUT_FILENO), "w"))) || (NULL == freopen("/dev/null", "w", stdout))) {
+	DEBUG_ERR("error redirecting stdout: %s", strerror(errno));
+	return EXIT_FAILURE;
+    }
+
+    for (corpus = bench_corpora; NULL != corpus->name; corpus++) {
+	dir = apr_pstrcat(bench.pool, bench.root, "/", corpus->name, NULL);
+	/* a corpus kept from a previous run is reused as is */
+	if (APR_SUCCESS != apr_stat(&finfo, dir, APR_FINFO_TYPE, bench.pool)) {
+	    start = apr_time_now();
+	    if ((0 != bench_mkdir(dir)) || (0 != corpus->make(&bench, dir)))
+		return EXIT_FAILURE;
+	    bench_record(&bench, corpus->name, "generate", start, 0, 0);
+	}
+	if (APR_SUCCESS != bench_phases(&bench, corpus, dir))
+	    return EXIT_FAILURE;
+	if ((0 == strcmp(corpus->name, "huge")) && (APR_SUCCESS != bench_file(&bench, dir)))
+	    return EXIT_FAILURE;
+    }
+    bench_containers(&bench);
+
+    if (!keep && (APR_SUCCESS != (status = bench_rm(bench.root, bench.pool))))
+	DEBUG_ERR("error removing %s: %s", bench.root, apr_strerror(status, errbuf, 128));
+    fclose(bench.out);
+    apr_pool_destroy(bench.pool);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compare napr_hash, keyed through callbacks, to napr_inthash on the integer
+ * keys ftwin uses: make bench_napr_hash && ./bench_napr_hash [nel]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <apr_general.h>
+#include <apr_time.h>
+
+#include "debug.h"
+#include "napr_hash.h"
+#include "napr_inthash.h"
+#include "lookup3.h"
+
+typedef struct bench_key_t
+{
+    apr_uint64_t device;
+    apr_uint64_t inode;
+} bench_key_t;
+
+static const void *bench_get_key(const void *opaque)
+{
+    return opaque;
+}
+
+/* keys have a fixed length, as in ftwin */
+static apr_size_t bench_get_key_len(const void *opaque)
+{
+    return 1;
+}
+
+static int bench_key_cmp(const void *key1, const void *key2, apr_size_t len)
+{
+    const bench_key_t *k1 = key1;
+    const bench_key_t *k2 = key2;
+
+    return ((k1->inode == k2->inode) && (k1->device == k2->device)) ? 0 : 1;
+}
+
+static apr_uint32_t bench_key_hash(const void *key, apr_size_t klen)
+{
+    return hashlittle(key, sizeof(struct bench_key_t), 0);
+}
+
+static double bench_elapsed(apr_time_t start)
+{
+    return (double) (apr_time_now() - start) / APR_USEC_PER_SEC;
+}
+
+int main(int argc, const char **argv)
+{
+    apr_pool_t *pool;
+    bench_key_t *keys, miss;
+    napr_hash_t *hash;
+    napr_inthash_t *inthash;
+    apr_uint32_t hash_value;
+    apr_size_t i, nel, found;
+    apr_time_t start;
+
+    nel = (1 < argc) ? strtoul(argv[1], NULL, 10) : 1000000;
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+
+    /* a few devices, inodes allocated in runs as file systems do */
+    keys = apr_palloc(pool, nel * sizeof(struct bench_key_t));
+    srandom(1337);
+    for (i = 0; i < nel; i++) {
+	keys[i].device = 2049 + (i % 4);
+	keys[i].inode = (i / 4) + ((apr_uint64_t) (random() % 16) << 20);
+    }
+    printf("%" APR_SIZE_T_FMT " keys\n", nel);
+
+    start = apr_time_now();
+    hash = napr_hash_make(pool, 4096, 8, bench_get_key, bench_get_key_len, bench_key_cmp, bench_key_hash);
+    for (i = 0; i < nel; i++)
+	if (NULL == napr_hash_search(hash, &(keys[i]), 1, &hash_value))
+	    napr_hash_set(hash, &(keys[i]), hash_value);
+    printf("napr_hash insert:    %.3fs\n", bench_elapsed(start));
+    start = apr_time_now();
+    for (i = 0, found = 0; i < nel; i++) {
+	found += (NULL != napr_hash_search(hash, &(keys[i]), 1, NULL));
+	miss.device = keys[i].device + 4;
+	miss.inode = keys[i].inode;
+	found -= (NULL != napr_hash_search(hash, &miss, 1, NULL));
+    }
+    printf("napr_hash search:    %.3fs (%" APR_SIZE_T_FMT " found)\n", bench_elapsed(start), found);
+
+    start = apr_time_now();
+    inthash = napr_inthash_make(pool, 4096);
+    for (i = 0; i < nel; i++)
+	if (NULL == napr_inthash_get(inthash, keys[i].device, keys[i].inode))
+	    napr_inthash_set(inthash, keys[i].device, keys[i].inode, &(keys[i]));
+    printf("napr_inthash insert: %.3fs\n", bench_elapsed(start));
+    start = apr_time_now();
+    for (i = 0, found = 0; i < nel; i++) {
+	found += (NULL != napr_inthash_get(inthash, keys[i].device, keys[i].inode));
+	found -= (NULL != napr_inthash_get(inthash, keys[i].device + 4, keys[i].inode));
+    }
+    printf("napr_inthash search: %.3fs (%" APR_SIZE_T_FMT " found)\n", bench_elapsed(start), found);
+
+    /* sized up front, as ftwin does once the files are walked */
+    start = apr_time_now();
+    inthash = napr_inthash_make(pool, nel);
+    for (i = 0; i < nel; i++)
+	if (NULL == napr_inthash_get(inthash, keys[i].device, keys[i].inode))
+	    napr_inthash_set(inthash, keys[i].device, keys[i].inode, &(keys[i]));
+    printf("napr_inthash insert, sized: %.3fs\n", bench_elapsed(start));
+
+    apr_pool_destroy(pool);
+
+    return EXIT_SUCCESS;
+}
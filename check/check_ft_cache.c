@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <apr_file_io.h>
+
+#include "checksum.h"
+#include "debug.h"
+#include "ft_cache.h"
+#include "ft_hash.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static const char *cache_path = "check_cache.db";
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+    apr_file_remove(cache_path, pool);
+}
+
+static void teardown(void)
+{
+    apr_file_remove(cache_path, pool);
+    apr_pool_destroy(pool);
+}
+
+START_TEST(test_ft_cache_roundtrip)
+{
+    apr_uint32_t digest[HASHSTATE], digest2[HASHSTATE];
+    const ft_hash_t *hash = ft_hash_default();
+    ft_cache_t *cache;
+    ft_cache_rec_t *rec, *rec2;
+    apr_status_t status;
+    int i;
+
+    status = ft_cache_open(&cache, cache_path, hash, 4, 4096, 0, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_open of a missing file failed");
+    fail_unless(0 == ft_cache_size(cache), "missing cache file is not empty");
+
+    for (i = 0; i < HASHSTATE; i++)
+	digest[i] = (i < 4) ? 0x01020304 * (i + 1) : 0;
+    rec = ft_cache_add(cache, 1, 42, 16384, 1000);
+    fail_unless(!ft_cache_has(cache, rec, 0), "unexpected digest in a new record");
+    ft_cache_put(cache, rec, 3, digest);
+    rec2 = ft_cache_add(cache, 1, 7, 16384, 1000);
+    ft_cache_put(cache, rec2, 0, digest);
+    /* a second link of the same file */
+    rec2 = ft_cache_add(cache, 1, 7, 16384, 1000);
+    ft_cache_put(cache, rec2, 1, digest);
+    /* nothing to remember */
+    ft_cache_add(cache, 2, 1, 16384, 1000);
+    status = ft_cache_save(cache, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_save failed");
+
+    status = ft_cache_open(&cache, cache_path, hash, 4, 4096, 0, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_open failed");
+    fail_unless(2 == ft_cache_size(cache), "unexpected number of records");
+
+    rec = ft_cache_add(cache, 1, 42, 16384, 1000);
+    fail_unless(!ft_cache_has(cache, rec, 0), "unexpected cached digest");
+    fail_unless(ft_cache_get(cache, rec, 3, digest2), "missing cached digest");
+    fail_unless(0 == memcmp(digest, digest2, sizeof(digest)), "mismatching cached digest");
+    rec = ft_cache_add(cache, 1, 7, 16384, 1000);
+    fail_unless(ft_cache_has(cache, rec, 0) && ft_cache_has(cache, rec, 1), "hard links records not merged");
+
+    /* changed files don't use the cached digests */
+    rec = ft_cache_add(cache, 1, 42, 16384, 1001);
+    fail_unless(!ft_cache_has(cache, rec, 3), "cached digest of a modified file");
+    rec = ft_cache_add(cache, 1, 42, 8192, 1000);
+    fail_unless(!ft_cache_has(cache, rec, 3), "cached digest of a resized file");
+    rec = ft_cache_add(cache, 2, 42, 16384, 1000);
+    fail_unless(!ft_cache_has(cache, rec, 3), "cached digest of another device");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_cache_slots)
+{
+    unsigned char data[100];
+    const unsigned char *slot;
+    ft_cache_t *cache;
+    ft_cache_rec_t *rec;
+    apr_status_t status;
+    int i;
+
+    status = ft_cache_open_slots(&cache, cache_path, "blobs", sizeof(data), 1, 13, 0, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_open_slots failed");
+    for (i = 0; i < sizeof(data); i++)
+	data[i] = (unsigned char) (i * 7);
+    rec = ft_cache_add(cache, 3, 9, 4096, 1000);
+    fail_unless(NULL == ft_cache_slot(cache, rec, 0), "unexpected slot in a new record");
+    ft_cache_put(cache, rec, 0, data);
+    status = ft_cache_save(cache, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_save failed");
+
+    status = ft_cache_open_slots(&cache, cache_path, "blobs", sizeof(data), 1, 13, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (1 == ft_cache_size(cache)), "ft_cache_open_slots failed");
+    rec = ft_cache_add(cache, 3, 9, 4096, 1000);
+    slot = ft_cache_slot(cache, rec, 0);
+    fail_unless((NULL != slot) && (0 == memcmp(slot, data, sizeof(data))), "mismatching cached slot");
+
+    /* another kind of slots, or the digests, don't read these ones */
+    status = ft_cache_open_slots(&cache, cache_path, "other", sizeof(data), 1, 13, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (0 == ft_cache_size(cache)), "other slots read");
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 1, 13, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (0 == ft_cache_size(cache)), "slots read as digests");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_cache_memory)
+{
+    apr_uint32_t digest[HASHSTATE], digest2[HASHSTATE];
+    ft_cache_t *cache;
+    ft_cache_rec_t *rec;
+    apr_finfo_t finfo;
+    apr_status_t status;
+
+    status = ft_cache_open(&cache, NULL, ft_hash_default(), 4, 4096, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (0 == ft_cache_size(cache)), "ft_cache_open in memory failed");
+    memset(digest, 0, sizeof(digest));
+    digest[0] = 0x5a5a5a5a;
+    rec = ft_cache_add(cache, 1, 42, 16384, 1000);
+    ft_cache_put(cache, rec, 2, digest);
+    fail_unless(ft_cache_get(cache, rec, 2, digest2) && (0 == memcmp(digest, digest2, sizeof(digest))),
+		"digest lost in memory");
+    status = ft_cache_save(cache, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_save in memory failed");
+    fail_unless(APR_SUCCESS != apr_stat(&finfo, cache_path, APR_FINFO_SIZE, pool), "cache in memory written");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_cache_invalidate)
+{
+    apr_uint32_t digest[HASHSTATE];
+    ft_cache_t *cache;
+    ft_cache_rec_t *rec;
+    apr_status_t status;
+
+    memset(digest, 0, sizeof(digest));
+    digest[0] = 1;
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 0, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_open failed");
+    rec = ft_cache_add(cache, 1, 42, 16384, 1000);
+    ft_cache_put(cache, rec, 0, digest);
+    ft_cache_put(cache, rec, 2, digest);
+    status = ft_cache_save(cache, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_save failed");
+
+    /* digests of another hash are useless */
+    status = ft_cache_open(&cache, cache_path, ft_hash_get("jenkins"), 4, 4096, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (0 == ft_cache_size(cache)), "cache of another hash used");
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 8192, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (0 == ft_cache_size(cache)), "cache of another block size used");
+
+    /* so are the ones of an ignored slot, but the others are kept */
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 3, pool);
+    fail_unless((APR_SUCCESS == status) && (1 == ft_cache_size(cache)), "ft_cache_open failed");
+    fail_unless(0 == ft_cache_nb_samples(cache), "unexpected nb_samples");
+    ft_cache_ignore_slot(cache, 2);
+    rec = ft_cache_add(cache, 1, 42, 16384, 1000);
+    fail_unless(ft_cache_has(cache, rec, 0) && !ft_cache_has(cache, rec, 2), "ignored slot used");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_cache_expire)
+{
+    apr_uint32_t digest[HASHSTATE];
+    ft_cache_t *cache;
+    ft_cache_rec_t *rec;
+    apr_status_t status;
+    int i;
+
+    memset(digest, 0, sizeof(digest));
+    digest[0] = 1;
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 0, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_open failed");
+    ft_cache_put(cache, ft_cache_add(cache, 1, 42, 16384, 1000), 0, digest);
+    ft_cache_put(cache, ft_cache_add(cache, 1, 43, 16384, 1000), 0, digest);
+    ft_cache_put(cache, ft_cache_add(cache, 2, 42, 16384, 1000), 0, digest);
+    status = ft_cache_save(cache, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_save failed");
+
+    /* 1/43 is deleted, device 2 is not walked */
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (3 == ft_cache_size(cache)), "ft_cache_open failed");
+    rec = ft_cache_add(cache, 1, 42, 16384, 1000);
+    fail_unless(ft_cache_has(cache, rec, 0), "missing cached digest");
+    status = ft_cache_save(cache, pool);
+    fail_unless(APR_SUCCESS == status, "ft_cache_save failed");
+
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (2 == ft_cache_size(cache)), "record of a deleted file kept");
+    rec = ft_cache_add(cache, 1, 43, 16384, 1000);
+    fail_unless(!ft_cache_has(cache, rec, 0), "record of a deleted file kept");
+    rec = ft_cache_add(cache, 2, 42, 16384, 1000);
+    fail_unless(ft_cache_has(cache, rec, 0), "record of a device not walked dropped");
+
+    /* until it is too old */
+    for (i = 0; i < 20; i++) {
+	status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 0, pool);
+	fail_unless(APR_SUCCESS == status, "ft_cache_open failed");
+	ft_cache_add(cache, 1, 42, 16384, 1000);
+	status = ft_cache_save(cache, pool);
+	fail_unless(APR_SUCCESS == status, "ft_cache_save failed");
+    }
+    status = ft_cache_open(&cache, cache_path, ft_hash_default(), 4, 4096, 0, pool);
+    fail_unless((APR_SUCCESS == status) && (1 == ft_cache_size(cache)), "old record of a device not walked kept");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_cache_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Cache");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_cache_roundtrip);
+    tcase_add_test(tc_core, test_ft_cache_invalidate);
+    tcase_add_test(tc_core, test_ft_cache_expire);
+    tcase_add_test(tc_core, test_ft_cache_memory);
+    tcase_add_test(tc_core, test_ft_cache_slots);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -16,19 +16,37 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 
 #include "checksum.h"
 #include "debug.h"
 #include "ft_file.h"
+#include "ft_hash.h"
 
 extern apr_pool_t *main_pool;
 apr_pool_t *pool;
 
+static const char *fname1 = CHECK_DIR "/tests/truerand";
+static apr_off_t size1 = 16384;
+static const char *fname2 = CHECK_DIR "/tests/copyrand";
+static const char *fname3 = CHECK_DIR "/tests/testrand";
+
+/* whole file mmap'ed, read in small blocks, or read bypassing the page cache */
+static ft_io_t mmap_io, read_io, direct_io;
+
 static void setup(void)
 {
     apr_status_t rs;
 
+    ft_io_init(&mmap_io);
+    ft_io_init(&read_io);
+    read_io.excess_size = size1 / 2;
+    read_io.block_len = 4096;
+    ft_io_init(&direct_io);
+    direct_io.block_len = 8192;
+    direct_io.flags = FT_IO_FADVISE | FT_IO_DIRECT;
+
     rs = apr_pool_create(&pool, main_pool);
     if (rs != APR_SUCCESS) {
 	DEBUG_ERR("Error creating pool");
@@ -41,41 +59,104 @@ static void teardown(void)
     apr_pool_destroy(pool);
 }
 
-static const char *fname1 = CHECK_DIR "/tests/truerand";
-static apr_off_t size1 = 16384;
-static const char *fname2 = CHECK_DIR "/tests/copyrand";
-static const char *fname3 = CHECK_DIR "/tests/testrand";
 
 START_TEST(test_checksum_file)
 {
+    static const char *const names[] = { "jenkins", "xxh3" };
+    const ft_hash_t *hash;
     apr_status_t status;
     apr_uint32_t val_array[HASHSTATE];
     apr_uint32_t val_array2[HASHSTATE];
+    int i, rv;
+
+    for (i = 0; i < 2; i++) {
+	hash = ft_hash_get(names[i]);
+	fail_unless(NULL != hash, "missing hash backend");
+
+	status = checksum_file(fname1, size1, &mmap_io, hash, val_array, pool);
+	fail_unless(APR_SUCCESS == status, "checksum small file failed");
+	status = checksum_file(fname2, size1, &mmap_io, hash, val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum small file failed");
+	rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
+	fail_unless(0 == rv, "mismatching checksums");
+
+	status = checksum_file(fname3, size1, &mmap_io, hash, val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum small file failed");
+	rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
+	fail_unless(0 != rv, "unexpected matching checksums");
+
+	/* mmap'ed or read, the digest is the same */
+	status = checksum_file(fname2, size1, &read_io, hash, val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
+	fail_unless(0 == rv, "mismatching small and big checksums");
+
+	status = checksum_file(fname3, size1, &read_io, hash, val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
+	fail_unless(0 != rv, "unexpected matching checksums");
+
+	/* O_DIRECT falls back to cached reads if the filesystem refuses it */
+	status = checksum_file(fname2, size1, &direct_io, hash, val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum direct file failed");
+	rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
+	fail_unless(0 == rv, "mismatching small and direct checksums");
+
+	/* a truncated read of the file */
+	status = checksum_file(fname2, size1 - 100, &direct_io, hash, val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum direct file failed");
+	rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
+	fail_unless(0 != rv, "unexpected matching checksums");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_checksum_file_blocks)
+{
+    const ft_hash_t *hash = ft_hash_default();
+    apr_status_t status;
+    apr_uint32_t val_array[HASHSTATE];
+    apr_uint32_t val_array2[HASHSTATE];
+    apr_uint32_t val_array3[HASHSTATE];
+    apr_off_t offsets[] = { 0, 8192 };
     int rv;
 
-    status = checksum_file(fname1, size1, 2 * size1, val_array, pool);
-    fail_unless(APR_SUCCESS == status, "checksum small file failed");
-    status = checksum_file(fname2, size1, 2 * size1, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
+    memset(val_array, 0, sizeof(val_array));
+    memset(val_array2, 0, sizeof(val_array2));
+    status = checksum_file_blocks(fname1, offsets, 2, 4096, &read_io, hash, val_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed");
+    status = checksum_file_blocks(fname2, offsets, 2, 4096, &read_io, hash, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed");
+    rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
     fail_unless(0 == rv, "mismatching checksums");
 
-    status = checksum_file(fname3, size1, 2 * size1, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
+    memset(val_array2, 0, sizeof(val_array2));
+    status = checksum_file_blocks(fname3, offsets, 2, 4096, &read_io, hash, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed");
+    rv = memcmp(val_array, val_array2, HASHSTATE * sizeof(apr_uint32_t));
     fail_unless(0 != rv, "unexpected matching checksums");
 
-    status = checksum_file(fname1, size1, size1 / 2, val_array, pool);
-    fail_unless(APR_SUCCESS == status, "checksum small file failed");
-    status = checksum_file(fname2, size1, size1 / 2, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
-    fail_unless(0 == rv, "mismatching checksums");
+    /* chained calls are seeded by the previous digest */
+    memcpy(val_array2, val_array, sizeof(val_array));
+    memcpy(val_array3, val_array, sizeof(val_array));
+    status = checksum_file_blocks(fname1, offsets + 1, 1, 4096, &read_io, hash, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed");
+    status = checksum_file_blocks(fname2, offsets + 1, 1, 4096, &read_io, hash, val_array3, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed");
+    rv = memcmp(val_array2, val_array3, HASHSTATE * sizeof(apr_uint32_t));
+    fail_unless(0 == rv, "mismatching chained checksums");
+    memset(val_array3, 0, sizeof(val_array3));
+    status = checksum_file_blocks(fname1, offsets + 1, 1, 4096, &read_io, hash, val_array3, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed");
+    rv = memcmp(val_array2, val_array3, HASHSTATE * sizeof(apr_uint32_t));
+    fail_unless(0 != rv, "chained checksum ignores the previous digest");
 
-    status = checksum_file(fname3, size1, size1 / 2, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
-    fail_unless(0 != rv, "unexpected matching checksums");
+    /* a block beyond the end of file hashes what is left */
+    offsets[1] = size1 - 100;
+    status = checksum_file_blocks(fname1, offsets + 1, 1, 4096, &read_io, hash, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum file blocks failed on a short block");
 }
 /* *INDENT-OFF* */
 END_TEST
@@ -86,13 +167,287 @@ START_TEST(test_filecmp)
     int rv;
     apr_status_t status;
 
-    status = filecmp(pool, fname1, fname2, size1, 2 * size1, &rv);
+    status = filecmp(pool, fname1, fname2, size1, &mmap_io, &rv);
     fail_unless(APR_SUCCESS == status, "filecmp small file failed");
-    status = filecmp(pool, fname1, fname2, size1, size1 / 2, &rv);
+    status = filecmp(pool, fname1, fname2, size1, &read_io, &rv);
     fail_unless((APR_SUCCESS == status) && (0 == rv), "filecmp big file failed");
 
-    status = filecmp(pool, fname1, fname3, size1, size1 / 2, &rv);
+    status = filecmp(pool, fname1, fname3, size1, &read_io, &rv);
     fail_unless((APR_SUCCESS == status) && (0 != rv), "filecmp big file failed");
+
+    status = filecmp(pool, fname1, fname2, size1, &direct_io, &rv);
+    fail_unless((APR_SUCCESS == status) && (0 == rv), "filecmp direct file failed");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+typedef struct files_ctx_t
+{
+    ft_checksum_job_t *jobs;
+    apr_size_t nb_jobs, next;
+    apr_status_t statuses[8];
+} files_ctx_t;
+
+static ft_checksum_job_t *files_next(void *ctx)
+{
+    files_ctx_t *files = ctx;
+
+    return (files->next < files->nb_jobs) ? &(files->jobs[files->next++]) : NULL;
+}
+
+static void files_done(void *ctx, ft_checksum_job_t *job, apr_status_t status)
+{
+    files_ctx_t *files = ctx;
+
+    files->statuses[job - files->jobs] = status;
+}
+
+START_TEST(test_checksum_files)
+{
+    static const apr_off_t offsets[] = { 0, 8192 };
+    const ft_hash_t *hash = ft_hash_default();
+    apr_uint32_t digests[6][HASHSTATE];
+    apr_uint32_t val_array[HASHSTATE];
+    ft_checksum_job_t jobs[6];
+    ft_io_t uring_io;
+    files_ctx_t files;
+    apr_status_t status;
+    int k, pass;
+
+    /* a ring shallower than the number of files, the engine falls back without io_uring */
+    ft_io_init(&uring_io);
+    uring_io.block_len = 4096;
+    if (APR_SUCCESS != ft_uring_create(&(uring_io.uring), 2, pool))
+	uring_io.uring = NULL;
+
+    for (pass = 0; pass < 2; pass++) {
+	memset(jobs, 0, sizeof(jobs));
+	memset(digests, 0, sizeof(digests));
+	jobs[0].filename = fname1;
+	jobs[1].filename = fname3;
+	jobs[2].filename = CHECK_DIR "/tests/missing";
+	jobs[3].filename = fname2;
+	jobs[4].filename = fname1;
+	jobs[5].filename = fname2;
+	for (k = 0; k < 6; k++) {
+	    jobs[k].size = size1;
+	    jobs[k].digest = digests[k];
+	}
+	for (k = 4; k < 6; k++) {
+	    jobs[k].offsets = offsets;
+	    jobs[k].nb_blocks = 2;
+	    jobs[k].block_len = 4096;
+	}
+	files.jobs = jobs;
+	files.nb_jobs = 6;
+	files.next = 0;
+	status = checksum_files((0 == pass) ? &read_io : &uring_io, hash, files_next, files_done, &files, pool);
+	fail_unless(APR_SUCCESS == status, "checksum_files failed");
+	fail_unless(APR_SUCCESS != files.statuses[2], "missing file not reported");
+
+	status = checksum_file(fname1, size1, &mmap_io, hash, val_array, pool);
+	fail_unless(APR_SUCCESS == status, "checksum_file failed");
+	fail_unless(APR_SUCCESS == files.statuses[0], "unexpected read error");
+	fail_unless(0 == memcmp(val_array, digests[0], sizeof(val_array)), "wrong digest of a whole file");
+	fail_unless(0 == memcmp(digests[0], digests[3], sizeof(val_array)), "same files with different digests");
+	fail_unless(0 != memcmp(digests[0], digests[1], sizeof(val_array)), "different files with the same digest");
+
+	memset(val_array, 0, sizeof(val_array));
+	status = checksum_file_blocks(fname1, offsets, 2, 4096, &read_io, hash, val_array, pool);
+	fail_unless(APR_SUCCESS == status, "checksum_file_blocks failed");
+	fail_unless(0 == memcmp(val_array, digests[4], sizeof(val_array)), "wrong digest of blocks");
+	fail_unless(0 == memcmp(digests[4], digests[5], sizeof(val_array)), "same blocks with different digests");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_filecmp_group)
+{
+    const char *names[] = { fname1, fname3, fname2, fname3, CHECK_DIR "/tests/missing" };
+    const char *many[150];
+    ft_io_t uring_io;
+    apr_size_t twins[150];
+    apr_status_t statuses[150];
+    apr_status_t status;
+    apr_size_t k;
+
+    status = filecmp_group(pool, names, 5, size1, &read_io, twins, statuses);
+    fail_unless(APR_SUCCESS == status, "filecmp_group failed");
+    fail_unless((0 == twins[0]) && (1 == twins[1]) && (0 == twins[2]) && (1 == twins[3]), "wrong twins");
+    fail_unless((APR_SUCCESS == statuses[0]) && (APR_SUCCESS == statuses[3]), "unexpected read error");
+    fail_unless((4 == twins[4]) && (APR_SUCCESS != statuses[4]), "missing file not reported");
+
+    /* more files than opened at once */
+    for (k = 0; k < 150; k++)
+	many[k] = (0 == k % 3) ? fname3 : ((1 == k % 3) ? fname1 : fname2);
+    status = filecmp_group(pool, many, 150, size1, &read_io, twins, statuses);
+    fail_unless(APR_SUCCESS == status, "filecmp_group failed");
+    for (k = 0; k < 150; k++) {
+	fail_unless(APR_SUCCESS == statuses[k], "unexpected read error");
+	fail_unless(twins[k] == ((0 == k % 3) ? 0 : 1), "wrong twins in a large group");
+    }
+
+    /* chunks read through a ring shallower than the group */
+    ft_io_init(&uring_io);
+    if (APR_SUCCESS == ft_uring_create(&(uring_io.uring), 8, pool)) {
+	status = filecmp_group(pool, many, 150, size1, &uring_io, twins, statuses);
+	fail_unless(APR_SUCCESS == status, "filecmp_group failed");
+	for (k = 0; k < 150; k++) {
+	    fail_unless(APR_SUCCESS == statuses[k], "unexpected read error");
+	    fail_unless(twins[k] == ((0 == k % 3) ? 0 : 1), "wrong twins read through io_uring");
+	}
+	status = filecmp_group(pool, names, 5, size1, &uring_io, twins, statuses);
+	fail_unless((0 == twins[0]) && (1 == twins[1]) && (0 == twins[2]) && (1 == twins[3]), "wrong twins");
+	fail_unless((4 == twins[4]) && (APR_SUCCESS != statuses[4]), "missing file not reported");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_filededupe_group)
+{
+    const char *names[] = { "check_dedupe_a", "check_dedupe_b", "check_dedupe_c", CHECK_DIR "/tests/missing" };
+    apr_size_t twins[4];
+    apr_status_t statuses[4];
+    apr_off_t deduped;
+    apr_status_t status;
+    apr_size_t k;
+
+    /* copies, the files of the tree are not to be deduplicated */
+    fail_unless(APR_SUCCESS == apr_file_copy(fname1, names[0], APR_OS_DEFAULT, pool), "apr_file_copy failed");
+    fail_unless(APR_SUCCESS == apr_file_copy(fname3, names[1], APR_OS_DEFAULT, pool), "apr_file_copy failed");
+    fail_unless(APR_SUCCESS == apr_file_copy(fname2, names[2], APR_OS_DEFAULT, pool), "apr_file_copy failed");
+
+    status = filededupe_group(pool, names, 4, size1, twins, statuses, &deduped);
+    /* the filesystem of the build tree may not deduplicate */
+    if (APR_ENOTIMPL != status) {
+	fail_unless(APR_SUCCESS == status, "filededupe_group failed");
+	fail_unless((0 == twins[0]) && (1 == twins[1]) && (0 == twins[2]), "wrong twins");
+	fail_unless((APR_SUCCESS == statuses[0]) && (APR_SUCCESS == statuses[2]), "unexpected error");
+	fail_unless((3 == twins[3]) && (APR_SUCCESS != statuses[3]), "missing file not reported");
+	fail_unless(size1 == deduped, "wrong number of bytes deduplicated");
+    }
+    for (k = 0; k < 3; k++)
+	apr_file_remove(names[k], pool);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* the odd files of the group are streamed, the last one being cut short */
+static apr_status_t stream_open(void *ctx, apr_size_t k, void **stream, apr_pool_t *pool)
+{
+    const char *const *names = ctx;
+    apr_file_t *fd;
+    apr_status_t status;
+
+    if (0 == k % 2)
+	return APR_SUCCESS;
+    if (APR_SUCCESS != (status = apr_file_open(&fd, names[k], APR_READ | APR_BINARY, APR_OS_DEFAULT, pool)))
+	return status;
+    *stream = fd;
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t stream_read(void *stream, unsigned char *buf, apr_size_t len, apr_size_t *rbytes)
+{
+    apr_off_t offset = 0;
+    apr_status_t status;
+
+    apr_file_seek(stream, APR_CUR, &offset);
+    if (offset + (apr_off_t) len > size1 / 2 + 1000)
+	len = (apr_size_t) (size1 / 2 + 1000 - offset);
+    status = apr_file_read_full(stream, buf, len, rbytes);
+
+    return (APR_EOF == status) ? APR_SUCCESS : status;
+}
+
+static void stream_close(void *stream)
+{
+    apr_file_close(stream);
+}
+
+START_TEST(test_filecmp_group_streams)
+{
+    const char *names[] = { fname1, fname3, fname2, fname1, fname3 };
+    ft_stream_ops_t ops = { stream_open, stream_read, stream_close };
+    apr_size_t twins[5];
+    apr_status_t statuses[5];
+    apr_status_t status;
+    apr_size_t k;
+
+    /* the streams are long enough for half of the files */
+    status = filecmp_group_streams(pool, names, 4, size1 / 2, &read_io, &ops, names, twins, statuses);
+    fail_unless(APR_SUCCESS == status, "filecmp_group_streams failed");
+    for (k = 0; k < 4; k++)
+	fail_unless(APR_SUCCESS == statuses[k], "unexpected read error");
+    fail_unless((0 == twins[0]) && (1 == twins[1]) && (0 == twins[2]) && (0 == twins[3]), "wrong twins");
+
+    /* streams shorter than the size are read errors */
+    status = filecmp_group_streams(pool, names, 5, size1, &mmap_io, &ops, names, twins, statuses);
+    fail_unless(APR_SUCCESS == status, "filecmp_group_streams failed");
+    fail_unless((0 == twins[0]) && (0 == twins[2]) && (4 == twins[4]), "wrong twins");
+    fail_unless((APR_SUCCESS != statuses[1]) && (APR_SUCCESS != statuses[3]), "short stream not reported");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* the first file can't be read once it was opened once */
+static int failing_opens;
+static char failing_stream;
+
+static apr_status_t failing_open(void *ctx, apr_size_t k, void **stream, apr_pool_t *pool)
+{
+    const char *const *names = ctx;
+
+    if ((0 == k) && (0 < failing_opens++)) {
+	*stream = &failing_stream;
+	return APR_SUCCESS;
+    }
+
+    return apr_file_open((apr_file_t **) stream, names[k], APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+}
+
+static apr_status_t failing_read(void *stream, unsigned char *buf, apr_size_t len, apr_size_t *rbytes)
+{
+    if (&failing_stream == stream)
+	return APR_EGENERAL;
+
+    return apr_file_read_full(stream, buf, len, rbytes);
+}
+
+static void failing_close(void *stream)
+{
+    if (&failing_stream != stream)
+	apr_file_close(stream);
+}
+
+START_TEST(test_filecmp_group_streams_batches)
+{
+    const char *names[100];
+    ft_stream_ops_t ops = { failing_open, failing_read, failing_close };
+    apr_size_t twins[100];
+    apr_status_t statuses[100];
+    apr_status_t status;
+    apr_size_t k;
+
+    /* more files than can be opened at once, the representative of the first batch fails in the next one */
+    for (k = 0; k < 100; k++)
+	names[k] = fname1;
+    failing_opens = 0;
+    status = filecmp_group_streams(pool, names, 100, size1, &read_io, &ops, names, twins, statuses);
+    fail_unless(APR_SUCCESS == status, "filecmp_group_streams failed");
+    fail_unless(1 < failing_opens, "the representative was not compared again");
+    for (k = 0; k < 100; k++)
+	fail_unless(APR_SUCCESS == statuses[k], "unexpected read error");
+    fail_unless((0 == twins[0]) && (0 == twins[1]) && (0 == twins[63]), "first batch lost its representative");
+    fail_unless((64 == twins[64]) && (64 == twins[99]), "wrong twins in the next batch");
 }
 /* *INDENT-OFF* */
 END_TEST
@@ -107,7 +462,13 @@ Suite *make_ft_file_suite(void)
 
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_checksum_file);
+    tcase_add_test(tc_core, test_checksum_file_blocks);
     tcase_add_test(tc_core, test_filecmp);
+    tcase_add_test(tc_core, test_checksum_files);
+    tcase_add_test(tc_core, test_filecmp_group);
+    tcase_add_test(tc_core, test_filecmp_group_streams);
+    tcase_add_test(tc_core, test_filecmp_group_streams_batches);
+    tcase_add_test(tc_core, test_filededupe_group);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "ft_filter.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static const char *filter_path = "check_filter.txt";
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_file_remove(filter_path, pool);
+    apr_pool_destroy(pool);
+}
+
+/* is the entry at relpath left out, its name being the part past the last '/' */
+static int entry_is_filtered(const ft_filter_t *filter, const char *relpath, int is_dir)
+{
+    const char *name = strrchr(relpath, '/');
+
+    name = (NULL != name) ? name + 1 : relpath;
+
+    return ft_filter_entry(filter, relpath, strlen(relpath), strlen(name), is_dir);
+}
+
+START_TEST(test_ft_filter_globs)
+{
+    ft_filter_t *filter = ft_filter_make(pool);
+
+    fail_unless(APR_SUCCESS == ft_filter_add_glob(filter, "*.o", 0), "ft_filter_add_glob failed");
+    fail_unless(APR_SUCCESS == ft_filter_add_glob(filter, "node_modules", 1), "ft_filter_add_glob failed");
+    fail_unless(APR_SUCCESS == ft_filter_add_glob(filter, "build/", 0), "ft_filter_add_glob failed");
+    fail_unless(APR_SUCCESS == ft_filter_add_glob(filter, "/top/*.tmp", 0), "ft_filter_add_glob failed");
+    fail_unless(APR_SUCCESS == ft_filter_add_glob(filter, "**/cache/?.bin", 0), "ft_filter_add_glob failed");
+    fail_unless(APR_SUCCESS == ft_filter_add_glob(filter, "v[!0-9]", 0), "ft_filter_add_glob failed");
+    fail_unless(APR_EINVAL == ft_filter_add_glob(filter, "/", 0), "empty glob accepted");
+    fail_unless(APR_SUCCESS == ft_filter_compile(filter), "ft_filter_compile failed");
+
+    /* on the name, wherever the entry is */
+    fail_unless(entry_is_filtered(filter, "a.o", 0), "name glob missed");
+    fail_unless(entry_is_filtered(filter, "src/lib/a.o", 0), "name glob missed below the root");
+    fail_unless(!entry_is_filtered(filter, "src/a.o.c", 0), "name glob matched a longer name");
+    fail_unless(!entry_is_filtered(filter, "src/aXo", 0), "'.' of a glob taken as a regex");
+    fail_unless(entry_is_filtered(filter, "vx", 0) && !entry_is_filtered(filter, "v1", 0), "bracket mishandled");
+
+    /* the directories only ones */
+    fail_unless(entry_is_filtered(filter, "a/node_modules", 1), "directory glob missed");
+    fail_unless(!entry_is_filtered(filter, "a/node_modules", 0), "directory glob matched a file");
+    fail_unless(entry_is_filtered(filter, "build", 1) && !entry_is_filtered(filter, "build", 0),
+		"trailing '/' not taken as a directory glob");
+
+    /* on the path relative to the root */
+    fail_unless(entry_is_filtered(filter, "top/x.tmp", 0), "anchored glob missed");
+    fail_unless(!entry_is_filtered(filter, "sub/top/x.tmp", 0), "anchored glob matched below the root");
+    fail_unless(!entry_is_filtered(filter, "top/sub/x.tmp", 0), "'*' matched a '/'");
+    fail_unless(entry_is_filtered(filter, "cache/a.bin", 0), "'**/' missed an empty prefix");
+    fail_unless(entry_is_filtered(filter, "x/y/cache/a.bin", 0), "'**/' missed directories");
+    fail_unless(!entry_is_filtered(filter, "x/cache/ab.bin", 0), "'?' matched two characters");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_filter_names_regex)
+{
+    ft_filter_t *filter = ft_filter_make(pool);
+
+    ft_filter_add_names(filter, ".svn,CVS");
+    fail_unless(APR_SUCCESS == ft_filter_set_regex(filter, "\\.bak$", 0, 1), "ft_filter_set_regex failed");
+    fail_unless(APR_SUCCESS == ft_filter_set_regex(filter, "^/data/", 1, 0), "ft_filter_set_regex failed");
+    fail_unless(APR_SUCCESS != ft_filter_set_regex(filter, "(", 0, 0), "bad regex accepted");
+    fail_unless(APR_SUCCESS == ft_filter_compile(filter), "ft_filter_compile failed");
+
+    fail_unless(ft_filter_name(filter, ".", 1) && ft_filter_name(filter, "..", 2), "looping directories not ignored");
+    fail_unless(ft_filter_name(filter, "CVS", 3) && ft_filter_name(filter, ".svn", 4), "ignore list lost");
+    fail_unless(!ft_filter_name(filter, "CV", 2), "prefix of an ignored name ignored");
+    /* no glob leaves anything out */
+    fail_unless(!entry_is_filtered(filter, "a/b", 1), "entry left out without any glob");
+
+    fail_unless(ft_filter_path(filter, "/data/x.BAK", 11), "caseless ignore regex missed");
+    fail_unless(!ft_filter_path(filter, "/data/x.bak.c", 13), "ignore regex matched");
+    fail_unless(ft_filter_path(filter, "/other/x.c", 10), "whitelist regex missed");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_filter_read)
+{
+    static const char *content = "# build outputs\n*.o \n\n  \nbuild/\r\n/doc/*.html";
+    ft_filter_t *filter = ft_filter_make(pool);
+    apr_file_t *fd;
+    apr_status_t status;
+
+    status = apr_file_open(&fd, filter_path, APR_WRITE | APR_CREATE | APR_TRUNCATE, APR_OS_DEFAULT, pool);
+    fail_unless(APR_SUCCESS == status, "apr_file_open failed");
+    fail_unless(APR_SUCCESS == apr_file_write_full(fd, content, strlen(content), NULL), "apr_file_write_full failed");
+    apr_file_close(fd);
+
+    fail_unless(APR_SUCCESS == ft_filter_read(filter, filter_path), "ft_filter_read failed");
+    fail_unless(APR_SUCCESS == ft_filter_compile(filter), "ft_filter_compile failed");
+    fail_unless(entry_is_filtered(filter, "src/a.o", 0), "trailing blanks kept");
+    fail_unless(entry_is_filtered(filter, "src/build", 1), "CRLF line lost");
+    fail_unless(entry_is_filtered(filter, "doc/index.html", 0), "last line lost");
+    fail_unless(!entry_is_filtered(filter, "# build outputs", 0), "comment taken as a glob");
+
+    /* negated globs are refused rather than misread */
+    status = apr_file_open(&fd, filter_path, APR_WRITE | APR_CREATE | APR_TRUNCATE, APR_OS_DEFAULT, pool);
+    fail_unless(APR_SUCCESS == status, "apr_file_open failed");
+    fail_unless(APR_SUCCESS == apr_file_write_full(fd, "*.c\n!main.c\n", 12, NULL), "apr_file_write_full failed");
+    apr_file_close(fd);
+    fail_unless(APR_EINVAL == ft_filter_read(ft_filter_make(pool), filter_path), "negated glob accepted");
+
+    fail_unless(APR_SUCCESS != ft_filter_read(filter, "check_filter.none"), "missing file read");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_filter_rel_offset)
+{
+    ft_filter_t *filter = ft_filter_make(pool);
+
+    ft_filter_add_root(filter, "data");
+    ft_filter_add_root(filter, "data/sub/");
+    ft_filter_add_root(filter, "/");
+
+    fail_unless(5 == ft_filter_rel_offset(filter, "data/x", 6), "root without its '/'");
+    fail_unless(9 == ft_filter_rel_offset(filter, "data/sub/x", 10), "the longest root not chosen");
+    fail_unless(1 == ft_filter_rel_offset(filter, "/tmp/x", 6), "root ending with '/'");
+    fail_unless(0 == ft_filter_rel_offset(filter, "database/x", 10), "prefix of a name taken as a root");
+    fail_unless(4 == ft_filter_rel_offset(filter, "data", 4), "root itself");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_filter_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Filter");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_filter_globs);
+    tcase_add_test(tc_core, test_ft_filter_names_regex);
+    tcase_add_test(tc_core, test_ft_filter_read);
+    tcase_add_test(tc_core, test_ft_filter_rel_offset);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
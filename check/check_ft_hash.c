@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "checksum.h"
+#include "ft_hash.h"
+#include "xxh3.h"
+
+static const char *fname1 = CHECK_DIR "/tests/truerand";
+static unsigned char data[16384];
+
+/* XXH3_128bits() of the first len bytes of truerand, computed with the reference implementation */
+static const struct
+{
+    apr_size_t len;
+    apr_uint64_t low64;
+    apr_uint64_t high64;
+} vectors[] = {
+    {0, APR_UINT64_C(0x6001c324468d497f), APR_UINT64_C(0x99aa06d3014798d8)},
+    {3, APR_UINT64_C(0x1256c2addde0a99b), APR_UINT64_C(0x1e61fa3ea1cce6ac)},
+    {16, APR_UINT64_C(0x61cf9c8aec55578c), APR_UINT64_C(0x021ec807cd9f27bf)},
+    {17, APR_UINT64_C(0x0343e7f5046c9602), APR_UINT64_C(0xf770a4971a834d7e)},
+    {128, APR_UINT64_C(0x6ca60b34fca57e99), APR_UINT64_C(0x91462999656734fe)},
+    {129, APR_UINT64_C(0xbdcdcf9b7264b38d), APR_UINT64_C(0x164f50add52da2a7)},
+    {240, APR_UINT64_C(0xb54bf35b41187190), APR_UINT64_C(0x991542c9fff8c27c)},
+    {241, APR_UINT64_C(0xe4bd3db89032024c), APR_UINT64_C(0xa1b62e77dae6b35a)},
+    {1000, APR_UINT64_C(0x47adcaca1f15405f), APR_UINT64_C(0x62ee9ee86bf1aacd)},
+    {16384, APR_UINT64_C(0x15f68143cf5393c7), APR_UINT64_C(0x76b7ed42f240eba2)},
+};
+
+static void setup(void)
+{
+    FILE *f;
+
+    if ((NULL == (f = fopen(fname1, "rb"))) || (sizeof(data) != fread(data, 1, sizeof(data), f))) {
+	fprintf(stderr, "unable to read %s\n", fname1);
+	exit(1);
+    }
+    fclose(f);
+}
+
+static void teardown(void)
+{
+}
+
+START_TEST(test_xxh3_128)
+{
+    apr_uint64_t low64, high64;
+    apr_size_t i;
+
+    fail_unless(NULL != xxh3_impl_name(), "no xxh3 implementation");
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+	xxh3_128(data, vectors[i].len, &low64, &high64);
+	fail_unless((vectors[i].low64 == low64) && (vectors[i].high64 == high64),
+		    "xxh3_128 mismatch");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_xxh3_128_streaming)
+{
+    xxh3_state_t state;
+    apr_uint64_t low64, high64;
+    apr_size_t i, off, chunk;
+
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+	/* odd chunk sizes cross the internal buffer and the stripes in every way */
+	xxh3_128_reset(&state);
+	for (off = 0, chunk = 1; off < vectors[i].len; off += chunk, chunk = (chunk * 7 + 3) % 311) {
+	    if (chunk > vectors[i].len - off)
+		chunk = vectors[i].len - off;
+	    xxh3_128_update(&state, data + off, chunk);
+	}
+	xxh3_128_digest(&state, &low64, &high64);
+	fail_unless((vectors[i].low64 == low64) && (vectors[i].high64 == high64),
+		    "streaming xxh3_128 mismatch");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* the kernels the CPU would not pick give the same digests */
+START_TEST(test_xxh3_128_impls)
+{
+    static const char *const names[] = { "scalar", "sse2", "avx2", "neon" };
+    xxh3_state_t state;
+    const char *picked;
+    apr_uint64_t low64, high64;
+    apr_size_t i, j, off;
+    int nb_tested = 0;
+
+    picked = xxh3_impl_name();
+    for (j = 0; j < sizeof(names) / sizeof(names[0]); j++) {
+	if (0 != xxh3_impl_force(names[j]))
+	    continue;
+	nb_tested++;
+	fail_unless(0 == strcmp(names[j], xxh3_impl_name()), "xxh3 implementation not forced");
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+	    xxh3_128(data, vectors[i].len, &low64, &high64);
+	    fail_unless((vectors[i].low64 == low64) && (vectors[i].high64 == high64), "xxh3_128 mismatch");
+	    xxh3_128_reset(&state);
+	    for (off = 0; off < vectors[i].len; off += 100)
+		xxh3_128_update(&state, data + off, (vectors[i].len - off < 100) ? vectors[i].len - off : 100);
+	    xxh3_128_digest(&state, &low64, &high64);
+	    fail_unless((vectors[i].low64 == low64) && (vectors[i].high64 == high64),
+			"streaming xxh3_128 mismatch");
+	}
+    }
+    fail_unless(0 == xxh3_impl_force(picked), "xxh3 implementation not restored");
+    fail_unless(0 != nb_tested, "no xxh3 implementation tested");
+#if defined(__x86_64__)
+    /* sse2 is part of x86_64 */
+    fail_unless(1 < nb_tested, "xxh3 sse2 implementation not tested");
+#endif
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_hash_get)
+{
+    const ft_hash_t *hash;
+
+    hash = ft_hash_get("xxh3");
+    fail_unless((NULL != hash) && (0 == strcmp("xxh3", ft_hash_name(hash))), "xxh3 backend not found");
+    fail_unless(hash == ft_hash_default(), "xxh3 is not the default backend");
+    hash = ft_hash_get("jenkins");
+    fail_unless((NULL != hash) && (0 == strcmp("jenkins", ft_hash_name(hash))), "jenkins backend not found");
+    fail_unless(NULL == ft_hash_get("bogus"), "unexpected bogus backend");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_hash_final)
+{
+    ft_hash_state_t state;
+    apr_uint32_t digest[HASHSTATE];
+    apr_uint32_t digest2[HASHSTATE];
+    const ft_hash_t *hash;
+    apr_size_t off, len;
+    int i;
+
+    hash = ft_hash_get("xxh3");
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, data, sizeof(data));
+    memset(digest, 0xff, sizeof(digest));
+    ft_hash_final(hash, &state, digest);
+    fail_unless((apr_uint32_t) vectors[9].low64 == digest[0], "bad xxh3 digest layout");
+    fail_unless((apr_uint32_t) (vectors[9].high64 >> 32) == digest[3], "bad xxh3 digest layout");
+    for (i = 4; i < HASHSTATE; i++)
+	fail_unless(0 == digest[i], "xxh3 digest is not zero padded");
+
+    /* jenkins digest only depends on the data, not on the way it is fed */
+    hash = ft_hash_get("jenkins");
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, data, sizeof(data));
+    ft_hash_final(hash, &state, digest);
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, data, 8192);
+    ft_hash_update(hash, &state, data + 8192, sizeof(data) - 8192);
+    ft_hash_final(hash, &state, digest2);
+    fail_unless(0 == memcmp(digest, digest2, sizeof(digest)), "jenkins digest depends on the chunks");
+
+    /* odd splits, across the chunks and within them */
+    ft_hash_init(hash, &state);
+    for (off = 0, len = 1; off < sizeof(data); off += len, len = (len * 7 + 3) % 5003) {
+	if (len > sizeof(data) - off)
+	    len = sizeof(data) - off;
+	ft_hash_update(hash, &state, data + off, len);
+    }
+    ft_hash_final(hash, &state, digest2);
+    fail_unless(0 == memcmp(digest, digest2, sizeof(digest)), "jenkins digest depends on odd splits");
+
+    /* a tail that does not start on a chunk, fed in pieces or at once */
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, data + 1000, sizeof(data) - 1000);
+    ft_hash_final(hash, &state, digest);
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, data + 1000, 3);
+    ft_hash_update(hash, &state, data + 1003, 5000);
+    ft_hash_update(hash, &state, data + 6003, sizeof(data) - 6003);
+    ft_hash_final(hash, &state, digest2);
+    fail_unless(0 == memcmp(digest, digest2, sizeof(digest)), "jenkins tail digest depends on the chunks");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_hash_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Hash");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_xxh3_128);
+    tcase_add_test(tc_core, test_xxh3_128_streaming);
+    tcase_add_test(tc_core, test_xxh3_128_impls);
+    tcase_add_test(tc_core, test_ft_hash_get);
+    tcase_add_test(tc_core, test_ft_hash_final);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
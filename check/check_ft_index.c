@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <apr_file_io.h>
+
+#include "checksum.h"
+#include "debug.h"
+#include "ft_hash.h"
+#include "ft_index.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static const char *index_path = "check_index.db";
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+    apr_file_remove(index_path, pool);
+}
+
+static void teardown(void)
+{
+    apr_file_remove(index_path, pool);
+    apr_pool_destroy(pool);
+}
+
+START_TEST(test_ft_index_roundtrip)
+{
+    static const char *paths[] = { "/data/a/big", "/data/a/big2", "/data/b/x.tar.gz", "/data/b/y", "/other" };
+    static const apr_off_t sizes[] = { 65536, 65536, 4096, 4096, 10 };
+    const ft_hash_t *hash = ft_hash_default();
+    ft_index_rec_t rec, rec2;
+    ft_index_t *index;
+    apr_status_t status;
+    apr_size_t i, nel = sizeof(paths) / sizeof(paths[0]);
+
+    status = ft_index_create(&index, index_path, "node1", hash, 4, 4096, 2, pool);
+    fail_unless(APR_SUCCESS == status, "ft_index_create failed");
+    for (i = 0; i < nel; i++) {
+	memset(&rec, 0, sizeof(rec));
+	rec.size = sizes[i];
+	rec.mtime = 1000 + i;
+	rec.mask = (4096 < sizes[i]) ? 0xf : 0x1;
+	rec.digests[0][0] = i;
+	rec.digests[3][0] = 0x01020304 * (i + 1);
+	rec.path = paths[i];
+	rec.subpath = (2 == i) ? "dir/member" : NULL;
+	fail_unless(APR_SUCCESS == ft_index_write(index, &rec), "ft_index_write failed");
+    }
+    /* the sizes must not grow */
+    rec.size = 11;
+    fail_unless(APR_EINVAL == ft_index_write(index, &rec), "larger size accepted");
+    fail_unless(APR_SUCCESS == ft_index_close(index), "ft_index_close failed");
+
+    status = ft_index_open(&index, index_path, pool);
+    fail_unless(APR_SUCCESS == status, "ft_index_open failed");
+    fail_unless(!strcmp("node1", ft_index_host(index)), "host lost");
+    fail_unless(!strcmp(ft_hash_name(hash), ft_index_hash_name(index)), "hash lost");
+    fail_unless(4 == ft_index_nb_slots(index), "nb_slots lost");
+    fail_unless(2 == ft_index_nb_samples(index), "nb_samples lost");
+    fail_unless(nel == ft_index_nb_recs(index), "bad number of records");
+    for (i = 0; i < nel; i++) {
+	fail_unless(APR_SUCCESS == ft_index_read(index, &rec2), "ft_index_read failed");
+	fail_unless(sizes[i] == rec2.size, "size lost");
+	fail_unless((apr_time_t) (1000 + i) == rec2.mtime, "mtime lost");
+	fail_unless(!strcmp(paths[i], rec2.path), "path lost");
+	fail_unless((2 == i) ? ((NULL != rec2.subpath) && !strcmp("dir/member", rec2.subpath)) : (NULL == rec2.subpath),
+		    "member lost");
+	fail_unless(((4096 < sizes[i]) ? 0xf : 0x1) == rec2.mask, "mask lost");
+	fail_unless(i == rec2.digests[0][0], "digest lost");
+	if (4096 < sizes[i])
+	    fail_unless(0x01020304 * (i + 1) == rec2.digests[3][0], "last digest lost");
+	else
+	    fail_unless(0 == rec2.digests[3][0], "digest not in the mask read");
+    }
+    fail_unless(APR_EOF == ft_index_read(index, &rec2), "record past the end");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_index_corrupted)
+{
+    const ft_hash_t *hash = ft_hash_default();
+    ft_index_rec_t rec;
+    ft_index_t *index;
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_status_t status;
+
+    status = ft_index_create(&index, index_path, "node1", hash, 4, 4096, 0, pool);
+    fail_unless(APR_SUCCESS == status, "ft_index_create failed");
+    memset(&rec, 0, sizeof(rec));
+    rec.size = 100;
+    rec.mask = 0x3;
+    rec.path = "/data/some/file";
+    fail_unless(APR_SUCCESS == ft_index_write(index, &rec), "ft_index_write failed");
+    fail_unless(APR_SUCCESS == ft_index_write(index, &rec), "ft_index_write failed");
+    fail_unless(APR_SUCCESS == ft_index_close(index), "ft_index_close failed");
+
+    /* the second record loses its last byte */
+    fail_unless(APR_SUCCESS == apr_stat(&finfo, index_path, APR_FINFO_SIZE, pool), "apr_stat failed");
+    status = apr_file_open(&fd, index_path, APR_WRITE | APR_BINARY, APR_OS_DEFAULT, pool);
+    fail_unless(APR_SUCCESS == status, "apr_file_open failed");
+    fail_unless(APR_SUCCESS == apr_file_trunc(fd, finfo.size - 1), "apr_file_trunc failed");
+    apr_file_close(fd);
+
+    fail_unless(APR_SUCCESS == ft_index_open(&index, index_path, pool), "ft_index_open failed");
+    fail_unless(APR_SUCCESS == ft_index_read(index, &rec), "first record lost");
+    fail_unless(APR_EGENERAL == ft_index_read(index, &rec), "truncated record read");
+
+    /* not an index */
+    fail_unless(APR_SUCCESS != ft_index_open(&index, CHECK_DIR "/tests/truerand", pool), "random file opened");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_index_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Index");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_index_roundtrip);
+    tcase_add_test(tc_core, test_ft_index_corrupted);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
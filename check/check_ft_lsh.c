@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "ft_lsh.h"
+
+#define SIG_LEN 544
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+static int has_pair(const ft_lsh_pair_t *pairs, apr_size_t nb_pairs, apr_uint32_t first, apr_uint32_t second)
+{
+    apr_size_t i;
+
+    for (i = 0; i < nb_pairs; i++)
+	if ((pairs[i].first == first) && (pairs[i].second == second))
+	    return 1;
+
+    return 0;
+}
+
+START_TEST(test_ft_lsh_pairs)
+{
+    apr_size_t i, j, nb_sigs = 1000, nb_pairs;
+    signed char *sigs;
+    ft_lsh_pair_t *pairs;
+    ft_lsh_t *lsh;
+    apr_status_t status;
+
+    status = ft_lsh_make(&lsh, 100, 10, pool);
+    fail_unless(APR_SUCCESS == status, "ft_lsh_make failed");
+    fail_unless(APR_SUCCESS != ft_lsh_make(&lsh, 100, FT_LSH_MAX_WORD_LEN + 1, pool), "word too long accepted");
+
+    sigs = apr_palloc(pool, nb_sigs * SIG_LEN);
+    srandom(1337);
+    for (i = 0; i < nb_sigs * SIG_LEN; i++)
+	sigs[i] = (signed char) (random() % 5) - 2;
+    /* a slightly altered copy of 10, and an exact copy of 20 */
+    memcpy(sigs + 900 * SIG_LEN, sigs + 10 * SIG_LEN, SIG_LEN);
+    for (i = 0; i < SIG_LEN; i += 25)
+	sigs[900 * SIG_LEN + i] = -sigs[900 * SIG_LEN + i];
+    memcpy(sigs + 30 * SIG_LEN, sigs + 20 * SIG_LEN, SIG_LEN);
+    for (i = 0; i < nb_sigs; i++)
+	ft_lsh_add(lsh, sigs + i * SIG_LEN, SIG_LEN, (apr_uint32_t) i);
+    fail_unless(nb_sigs == ft_lsh_count(lsh), "signatures lost");
+
+    status = ft_lsh_pairs(lsh, &pairs, &nb_pairs, pool);
+    fail_unless(APR_SUCCESS == status, "ft_lsh_pairs failed");
+    fail_unless(has_pair(pairs, nb_pairs, 10, 900), "altered copy not paired");
+    fail_unless(has_pair(pairs, nb_pairs, 20, 30), "copy not paired");
+    /* random signatures rarely share a word */
+    fail_unless(nb_pairs < nb_sigs * (nb_sigs - 1) / 2 / 100, "too many candidates");
+    for (i = 0; i < nb_pairs; i++) {
+	fail_unless(pairs[i].first < pairs[i].second, "unordered pair");
+	if (0 < i) {
+	    j = i - 1;
+	    fail_unless((pairs[j].first < pairs[i].first)
+			|| ((pairs[j].first == pairs[i].first) && (pairs[j].second < pairs[i].second)),
+			"unsorted or repeated pairs");
+	}
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_lsh_flat)
+{
+    signed char sig[SIG_LEN];
+    apr_size_t i, nb_pairs;
+    ft_lsh_pair_t *pairs;
+    ft_lsh_t *lsh;
+    apr_status_t status;
+
+    /* many copies share all their words, each one is paired with the first one only */
+    memset(sig, 0, sizeof(sig));
+    status = ft_lsh_make(&lsh, 100, 10, pool);
+    fail_unless(APR_SUCCESS == status, "ft_lsh_make failed");
+    for (i = 0; i <= FT_LSH_MAX_BUCKET; i++)
+	ft_lsh_add(lsh, sig, SIG_LEN, (apr_uint32_t) (FT_LSH_MAX_BUCKET - i));
+    status = ft_lsh_pairs(lsh, &pairs, &nb_pairs, pool);
+    fail_unless((APR_SUCCESS == status) && (FT_LSH_MAX_BUCKET == nb_pairs), "crowded copies not paired");
+    for (i = 0; i < nb_pairs; i++)
+	fail_unless((0 == pairs[i].first) && (i + 1 == pairs[i].second), "crowded copies not paired with the first");
+
+    /* a different one among them is chained to one of them */
+    sig[0] = 1;
+    ft_lsh_add(lsh, sig, SIG_LEN, (apr_uint32_t) (FT_LSH_MAX_BUCKET + 1));
+    status = ft_lsh_pairs(lsh, &pairs, &nb_pairs, pool);
+    fail_unless((APR_SUCCESS == status) && (FT_LSH_MAX_BUCKET + 1 == nb_pairs), "crowded signature not chained");
+    sig[0] = 0;
+
+    /* a few of them are paired */
+    status = ft_lsh_make(&lsh, 100, 10, pool);
+    fail_unless(APR_SUCCESS == status, "ft_lsh_make failed");
+    for (i = 0; i < 3; i++)
+	ft_lsh_add(lsh, sig, SIG_LEN, (apr_uint32_t) (2 - i));
+    status = ft_lsh_pairs(lsh, &pairs, &nb_pairs, pool);
+    fail_unless((APR_SUCCESS == status) && (3 == nb_pairs), "identical signatures not paired once");
+    fail_unless((0 == pairs[0].first) && (1 == pairs[0].second) && (2 == pairs[2].second), "bad pairs");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_lsh_components)
+{
+    signed char *sigs;
+    ft_lsh_pair_t *pairs;
+    ft_lsh_t *lsh;
+    unsigned char *keep;
+    apr_uint32_t *leader, *next, id;
+    apr_size_t i, nb_sigs = 2 * FT_LSH_MAX_BUCKET, nb_pairs, nb_groups, nb_members;
+    apr_status_t status;
+
+    /* a crowded word, the signatures only differing by a value, as a cluster of similar images */
+    sigs = apr_pcalloc(pool, (nb_sigs + 1) * SIG_LEN);
+    for (i = 0; i < nb_sigs; i++)
+	sigs[i * SIG_LEN + SIG_LEN - 1 - i % SIG_LEN] = (signed char) (1 + i / SIG_LEN);
+    status = ft_lsh_make(&lsh, 100, 10, pool);
+    fail_unless(APR_SUCCESS == status, "ft_lsh_make failed");
+    for (i = 0; i < nb_sigs; i++)
+	ft_lsh_add(lsh, sigs + i * SIG_LEN, SIG_LEN, (apr_uint32_t) i);
+    /* and a lone one */
+    memset(sigs + nb_sigs * SIG_LEN, 1, SIG_LEN);
+    ft_lsh_add(lsh, sigs + nb_sigs * SIG_LEN, SIG_LEN, (apr_uint32_t) nb_sigs);
+    status = ft_lsh_pairs(lsh, &pairs, &nb_pairs, pool);
+    fail_unless(APR_SUCCESS == status, "ft_lsh_pairs failed");
+    fail_unless(nb_pairs < nb_sigs * (nb_sigs - 1) / 2, "crowded word paired in full");
+
+    /* every candidate is similar */
+    keep = apr_palloc(pool, nb_pairs);
+    memset(keep, 1, nb_pairs);
+    leader = apr_palloc(pool, (nb_sigs + 1) * sizeof(apr_uint32_t));
+    next = apr_palloc(pool, (nb_sigs + 1) * sizeof(apr_uint32_t));
+    ft_lsh_components(pairs, keep, nb_pairs, leader, next, nb_sigs + 1);
+    for (i = 0, nb_groups = 0; i <= nb_sigs; i++) {
+	if ((leader[i] != i) || (next[i] == nb_sigs + 1))
+	    continue;
+	nb_groups++;
+	for (id = (apr_uint32_t) i, nb_members = 0; id != nb_sigs + 1; id = next[id], nb_members++)
+	    fail_unless((leader[id] == i) && ((0 == nb_members) || (id > i)), "bad group");
+	fail_unless(nb_sigs == nb_members, "crowded cluster split");
+    }
+    fail_unless(1 == nb_groups, "crowded cluster not one group");
+    fail_unless((leader[nb_sigs] == nb_sigs) && (next[nb_sigs] == nb_sigs + 1), "lone signature grouped");
+
+    /* without the pairs of 0, it is left alone */
+    for (i = 0; i < nb_pairs; i++)
+	keep[i] = (0 != pairs[i].first);
+    ft_lsh_components(pairs, keep, nb_pairs, leader, next, nb_sigs + 1);
+    fail_unless((0 == leader[0]) && (nb_sigs + 1 == next[0]), "unlinked signature grouped");
+    fail_unless(1 == leader[nb_sigs - 1], "crowded cluster split");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_lsh_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Lsh");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_lsh_pairs);
+    tcase_add_test(tc_core, test_ft_lsh_flat);
+    tcase_add_test(tc_core, test_ft_lsh_components);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "ft_spill.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+/* a run of the given sizes, the largest first, each record named after its size and run, NULL on error */
+static ft_spill_t *spill_make(const apr_off_t *sizes, apr_size_t nel, const void *dir)
+{
+    ft_spill_rec_t rec;
+    ft_spill_t *run;
+    apr_size_t i;
+
+    if (APR_SUCCESS != ft_spill_create(&run, ".", pool))
+	return NULL;
+    for (i = 0; i < nel; i++) {
+	memset(&rec, 0, sizeof(rec));
+	rec.size = sizes[i];
+	rec.mtime = 1000 + i;
+	rec.device = 1;
+	rec.inode = 100 + i;
+	rec.dir = dir;
+	rec.name = apr_psprintf(pool, "%" APR_OFF_T_FMT "-%p", sizes[i], dir);
+	rec.prioritized = (0 == i);
+	if (APR_SUCCESS != ft_spill_write(run, &rec))
+	    return NULL;
+    }
+
+    return run;
+}
+
+START_TEST(test_ft_spill_roundtrip)
+{
+    static const apr_off_t sizes[] = { 65536, 65536, 4096, 0 };
+    static int dir;
+    ft_spill_rec_t rec;
+    ft_spill_t *run;
+    apr_size_t i, nel = sizeof(sizes) / sizeof(sizes[0]);
+
+    fail_unless(NULL != (run = spill_make(sizes, nel, &dir)), "spill_make failed");
+    /* the sizes must not grow */
+    memset(&rec, 0, sizeof(rec));
+    rec.size = 1;
+    rec.name = "late";
+    fail_unless(APR_EINVAL == ft_spill_write(run, &rec), "larger size accepted");
+    fail_unless(nel == ft_spill_nb_recs(run), "wrong number of records");
+
+    fail_unless(APR_SUCCESS == ft_spill_rewind(run), "ft_spill_rewind failed");
+    for (i = 0; i < nel; i++) {
+	fail_unless(APR_SUCCESS == ft_spill_read(run, &rec), "ft_spill_read failed");
+	fail_unless((sizes[i] == rec.size) && (1000 + i == rec.mtime) && (100 + i == rec.inode), "record changed");
+	fail_unless((&dir == rec.dir) && (rec.prioritized == (0 == i)), "record changed");
+	fail_unless(0 == strcmp(apr_psprintf(pool, "%" APR_OFF_T_FMT "-%p", sizes[i], (void *) &dir), rec.name),
+		    "name changed");
+    }
+    fail_unless(APR_STATUS_IS_EOF(ft_spill_read(run, &rec)), "read past the last record");
+
+    /* read again from the start */
+    fail_unless(APR_SUCCESS == ft_spill_rewind(run), "ft_spill_rewind failed");
+    fail_unless((APR_SUCCESS == ft_spill_read(run, &rec)) && (65536 == rec.size), "rewind lost the records");
+    ft_spill_close(run);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_spill_merge)
+{
+    static const apr_off_t sizes1[] = { 900, 500, 500, 7 };
+    static const apr_off_t sizes2[] = { 1000, 500, 8 };
+    static int dirs[3];
+    ft_spill_t *runs[3];
+    ft_spill_merge_t *merge;
+    ft_spill_rec_t rec;
+    apr_off_t prev_size = -1;
+    apr_size_t nb = 0, nb_500 = 0;
+    apr_status_t status;
+
+    runs[0] = spill_make(sizes1, 4, &(dirs[0]));
+    runs[1] = spill_make(NULL, 0, &(dirs[1]));
+    runs[2] = spill_make(sizes2, 3, &(dirs[2]));
+    fail_unless((NULL != runs[0]) && (NULL != runs[1]) && (NULL != runs[2]), "spill_make failed");
+
+    fail_unless(APR_SUCCESS == ft_spill_merge_open(&merge, runs, 3, pool), "ft_spill_merge_open failed");
+    while (APR_SUCCESS == (status = ft_spill_merge_read(merge, &rec))) {
+	fail_unless((0 > prev_size) || (rec.size <= prev_size), "sizes not merged the largest first");
+	/* the run read ahead does not overwrite the name returned */
+	fail_unless(0 == strcmp(apr_psprintf(pool, "%" APR_OFF_T_FMT "-%p", rec.size, rec.dir), rec.name),
+		    "name of another record");
+	/* the runs are read in turn among a size */
+	if (500 == rec.size)
+	    fail_unless(((nb_500 < 2) ? &(dirs[0]) : &(dirs[2])) == rec.dir, "equal sizes not in the order of the runs");
+	prev_size = rec.size;
+	nb_500 += (500 == rec.size);
+	nb++;
+    }
+    fail_unless(APR_STATUS_IS_EOF(status), "ft_spill_merge_read failed");
+    fail_unless((7 == nb) && (3 == nb_500), "records lost by the merge");
+    fail_unless(7 == prev_size, "smallest size not last");
+
+    ft_spill_close(runs[0]);
+    ft_spill_close(runs[1]);
+    ft_spill_close(runs[2]);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_spill_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Spill");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_spill_roundtrip);
+    tcase_add_test(tc_core, test_ft_spill_merge);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* the walk is static in ftwin.c, its main is left aside as in bench_ftwin.c */
+#define main ftwin_main
+#include "ftwin.c"
+#undef main
+
+#include <stdlib.h>
+#include <check.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <apr_file_io.h>
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+static int walk_write(const char *path, const char *content)
+{
+    FILE *f;
+
+    if (NULL == (f = fopen(path, "w")))
+	return -1;
+    fputs(content, f);
+    fclose(f);
+
+    return chmod(path, 0644);
+}
+
+/* the files found under root by ft_conf_add_files -r as the current user, -1 on error */
+static int walk_count(const char *root)
+{
+    ft_conf_t conf;
+
+    ft_conf_init(&conf, pool);
+    set_option(&conf.mask, OPTION_RECSD, 1);
+    set_option(&conf.mask, OPTION_VERBO, 1);
+    conf.inodes = napr_inthash_make(pool, 64);
+    if ((APR_SUCCESS != apr_uid_current(&(conf.userid), &(conf.groupid), pool))
+	|| (APR_SUCCESS != apr_uid_name_get(&(conf.username), conf.userid, pool))
+	|| (APR_SUCCESS != fill_gids_ht(conf.username, conf.gids, pool)))
+	return -1;
+    if (APR_SUCCESS != ft_conf_add_files(&conf, &root, 1))
+	return -1;
+
+    return conf.files->nelts;
+}
+
+/* *INDENT-OFF* */
+START_TEST(test_ft_walk_unreadable_dir)
+{
+    const char *tmpdir, *secret;
+    char *root;
+    pid_t pid;
+    int wstatus, ok;
+
+    fail_unless(APR_SUCCESS == apr_temp_dir_get(&tmpdir, pool), "apr_temp_dir_get failed");
+    root = apr_pstrcat(pool, tmpdir, "/check_walk.XXXXXX", NULL);
+    fail_unless(NULL != mkdtemp(root), "mkdtemp failed");
+    secret = apr_pstrcat(pool, root, "/secret", NULL);
+    ok = (0 == chmod(root, 0755))
+	&& (0 == walk_write(apr_pstrcat(pool, root, "/a", NULL), "twin\n"))
+	&& (0 == walk_write(apr_pstrcat(pool, root, "/b", NULL), "twin\n"))
+	&& (0 == mkdir(secret, 0755))
+	&& (0 == walk_write(apr_pstrcat(pool, secret, "/c", NULL), "twin\n"))
+	&& (0 == chmod(secret, 0));
+
+    /* root reads anything, the walk is then run as nobody in a child */
+    wstatus = -1;
+    if (ok && (0 <= (pid = fork()))) {
+	if (0 == pid) {
+	    if ((0 == geteuid()) && (0 != setuid(65534)))
+		_exit(2);
+	    _exit((2 == walk_count(root)) ? 0 : 1);
+	}
+	waitpid(pid, &wstatus, 0);
+    }
+
+    chmod(secret, 0755);
+    apr_file_remove(apr_pstrcat(pool, secret, "/c", NULL), pool);
+    apr_dir_remove(secret, pool);
+    apr_file_remove(apr_pstrcat(pool, root, "/a", NULL), pool);
+    apr_file_remove(apr_pstrcat(pool, root, "/b", NULL), pool);
+    apr_dir_remove(root, pool);
+    fail_unless(ok, "error creating the tree");
+    fail_unless(WIFEXITED(wstatus) && (0 == WEXITSTATUS(wstatus)),
+		"an unreadable directory is not skipped by the walk");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_walk_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Walk");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_walk_unreadable_dir);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
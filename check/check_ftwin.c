@@ -34,6 +34,16 @@ apr_pool_t *main_pool = NULL;
 Suite *make_napr_heap_suite(void);
 Suite *make_apr_hash_suite(void);
 Suite *make_ft_file_suite(void);
+Suite *make_ft_hash_suite(void);
+Suite *make_ft_cache_suite(void);
+Suite *make_napr_radix_suite(void);
+Suite *make_napr_inthash_suite(void);
+Suite *make_napr_threadpool_suite(void);
+Suite *make_ft_lsh_suite(void);
+Suite *make_ft_index_suite(void);
+Suite *make_ft_filter_suite(void);
+Suite *make_ft_spill_suite(void);
+Suite *make_ft_walk_suite(void);
 
 int main(int argc, char **argv)
 {
@@ -71,6 +81,36 @@ int main(int argc, char **argv)
     if (!num || num == 3)
 	srunner_add_suite(sr, make_ft_file_suite());
 
+    if (!num || num == 4)
+	srunner_add_suite(sr, make_ft_hash_suite());
+
+    if (!num || num == 5)
+	srunner_add_suite(sr, make_ft_cache_suite());
+
+    if (!num || num == 6)
+	srunner_add_suite(sr, make_napr_radix_suite());
+
+    if (!num || num == 7)
+	srunner_add_suite(sr, make_napr_inthash_suite());
+
+    if (!num || num == 8)
+	srunner_add_suite(sr, make_napr_threadpool_suite());
+
+    if (!num || num == 9)
+	srunner_add_suite(sr, make_ft_lsh_suite());
+
+    if (!num || num == 10)
+	srunner_add_suite(sr, make_ft_index_suite());
+
+    if (!num || num == 11)
+	srunner_add_suite(sr, make_ft_filter_suite());
+
+    if (!num || num == 12)
+	srunner_add_suite(sr, make_ft_spill_suite());
+
+    if (!num || num == 13)
+	srunner_add_suite(sr, make_ft_walk_suite());
+
     srunner_set_fork_status(sr, CK_NOFORK);
     srunner_set_xml(sr, "check_log.xml");
 
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <check.h>
+
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "napr_inthash.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+START_TEST(test_napr_inthash_basic)
+{
+    apr_uint64_t keys[] = { 0, 1, 2, 0x100000001ULL, 0xffffffffffffffffULL };
+    napr_inthash_t *hash;
+    apr_size_t i, nel = sizeof(keys) / sizeof(apr_uint64_t);
+
+    hash = napr_inthash_make(pool, 0);
+    fail_unless(NULL != hash, "napr_inthash_make failed");
+    for (i = 0; i < nel; i++)
+	fail_unless(APR_SUCCESS == napr_inthash_set(hash, keys[i], 0, &(keys[i])), "napr_inthash_set failed");
+    fail_unless(nel == napr_inthash_count(hash), "bad count");
+
+    for (i = 0; i < nel; i++)
+	fail_unless(&(keys[i]) == napr_inthash_get(hash, keys[i], 0), "key lost");
+    /* the second word is part of the key, 0x100000001 is not (1, 1) */
+    fail_unless(NULL == napr_inthash_get(hash, 1, 1), "second word ignored");
+    fail_unless(NULL == napr_inthash_get(hash, 3, 0), "key never set found");
+
+    /* update, then removal */
+    fail_unless(APR_SUCCESS == napr_inthash_set(hash, 2, 0, &(keys[0])), "napr_inthash_set failed");
+    fail_unless(&(keys[0]) == napr_inthash_get(hash, 2, 0), "value not updated");
+    fail_unless(nel == napr_inthash_count(hash), "bad count after update");
+    fail_unless(APR_SUCCESS == napr_inthash_set(hash, 2, 0, NULL), "napr_inthash_set failed");
+    fail_unless(NULL == napr_inthash_get(hash, 2, 0), "key not removed");
+    fail_unless(nel - 1 == napr_inthash_count(hash), "bad count after removal");
+    for (i = 0; i < nel; i++)
+	if (2 != keys[i])
+	    fail_unless(&(keys[i]) == napr_inthash_get(hash, keys[i], 0), "key lost by removal");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* many keys go through several incremental resizes, with removals while the old tables are moved */
+START_TEST(test_napr_inthash_grow)
+{
+    apr_size_t i, nel = 100000;
+    napr_inthash_t *hash;
+
+    hash = napr_inthash_make(pool, 0);
+    fail_unless(NULL != hash, "napr_inthash_make failed");
+    for (i = 0; i < nel; i++) {
+	/* device like keys, few values of the second word */
+	fail_unless(APR_SUCCESS == napr_inthash_set(hash, i * 4096, i % 3, (void *) (i + 1)), "napr_inthash_set failed");
+	if ((0 == (i % 5)) && (0 < i))
+	    fail_unless(APR_SUCCESS == napr_inthash_set(hash, (i - 1) * 4096, (i - 1) % 3, NULL),
+			"napr_inthash_set failed");
+	fail_unless((void *) (i + 1) == napr_inthash_get(hash, i * 4096, i % 3), "key just set lost");
+    }
+    fail_unless(nel - (nel - 1) / 5 == napr_inthash_count(hash), "bad count");
+
+    for (i = 0; i < nel; i++) {
+	if ((4 == (i % 5)) && (i < nel - 1))
+	    fail_unless(NULL == napr_inthash_get(hash, i * 4096, i % 3), "removed key found");
+	else
+	    fail_unless((void *) (i + 1) == napr_inthash_get(hash, i * 4096, i % 3), "key lost");
+	fail_unless(NULL == napr_inthash_get(hash, i * 4096, (i + 1) % 3), "key never set found");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_inthash_reserve)
+{
+    apr_size_t i, nb_grow, nel = 10000;
+    napr_inthash_t *hash;
+
+    hash = napr_inthash_make(pool, 16);
+    fail_unless(NULL != hash, "napr_inthash_make failed");
+    for (i = 0; i < 100; i++)
+	napr_inthash_set(hash, i, 0, (void *) (i + 1));
+    nb_grow = napr_inthash_nb_grow(hash);
+    fail_unless(0 < nb_grow, "resizes not counted");
+    fail_unless(APR_SUCCESS == napr_inthash_reserve(hash, nel), "napr_inthash_reserve failed");
+    for (i = 100; i < nel; i++)
+	napr_inthash_set(hash, i, 0, (void *) (i + 1));
+    fail_unless(nel == napr_inthash_count(hash), "bad count");
+    /* the room was made once */
+    fail_unless(nb_grow + 1 == napr_inthash_nb_grow(hash), "resized after napr_inthash_reserve");
+    for (i = 0; i < nel; i++)
+	fail_unless((void *) (i + 1) == napr_inthash_get(hash, i, 0), "key lost");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_napr_inthash_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Inthash");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_napr_inthash_basic);
+    tcase_add_test(tc_core, test_napr_inthash_grow);
+    tcase_add_test(tc_core, test_napr_inthash_reserve);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <check.h>
+
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "napr_radix.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+START_TEST(test_napr_radix_sort)
+{
+    apr_uint64_t keys[] = { 193288, 6298, 0, 43601, 193288, 30460, 0x100000000ULL + 6298, 6298,
+	0xffffffffffffffffULL, 0x100000000ULL
+    };
+    apr_uint64_t sorted[] = { 0, 6298, 6298, 30460, 43601, 193288, 193288, 0x100000000ULL,
+	0x100000000ULL + 6298, 0xffffffffffffffffULL
+    };
+    apr_size_t nel = sizeof(keys) / sizeof(apr_uint64_t);
+    napr_radix_pair_t *pairs, *tmp;
+    apr_size_t i;
+
+    pairs = apr_palloc(pool, nel * sizeof(napr_radix_pair_t));
+    tmp = apr_palloc(pool, nel * sizeof(napr_radix_pair_t));
+    for (i = 0; i < nel; i++) {
+	pairs[i].key = keys[i];
+	pairs[i].value = &(keys[i]);
+    }
+    napr_radix_sort(pairs, tmp, nel);
+
+    for (i = 0; i < nel; i++) {
+	fail_unless(pairs[i].key == sorted[i], "bad ordered");
+	fail_unless(*(apr_uint64_t *) pairs[i].value == pairs[i].key, "value lost");
+    }
+    /* equal keys keep their order */
+    fail_unless((pairs[1].value == &(keys[1])) && (pairs[2].value == &(keys[7])), "unstable sort");
+    fail_unless((pairs[5].value == &(keys[0])) && (pairs[6].value == &(keys[4])), "unstable sort");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_radix_sort_random)
+{
+    apr_size_t i, nel = 100000;
+    napr_radix_pair_t *pairs, *tmp;
+
+    pairs = apr_palloc(pool, nel * sizeof(napr_radix_pair_t));
+    tmp = apr_palloc(pool, nel * sizeof(napr_radix_pair_t));
+    srandom(1337);
+    for (i = 0; i < nel; i++) {
+	pairs[i].key = (((apr_uint64_t) random()) << 20) ^ (apr_uint64_t) random();
+	/* some keys shared, to see them stay in order */
+	if (0 == (i % 7))
+	    pairs[i].key = i % 1000;
+	pairs[i].value = (void *) (i + 1);
+    }
+    napr_radix_sort(pairs, tmp, nel);
+
+    for (i = 1; i < nel; i++) {
+	fail_unless(pairs[i - 1].key <= pairs[i].key, "bad ordered");
+	if (pairs[i - 1].key == pairs[i].key)
+	    fail_unless(pairs[i - 1].value < pairs[i].value, "unstable sort");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_napr_radix_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Radix");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_napr_radix_sort);
+    tcase_add_test(tc_core, test_napr_radix_sort_random);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <check.h>
+
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "napr_threadpool.h"
+
+extern apr_pool_t *main_pool;
+static apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+typedef struct tp_ctx_t
+{
+    napr_threadpool_t *threadpool;
+    apr_size_t nb_processed;
+    apr_size_t nb_done;
+    apr_size_t sum;
+} tp_ctx_t;
+
+static apr_status_t tp_process_sum(void *ctx, void *data)
+{
+    tp_ctx_t *tp_ctx = ctx;
+
+    __atomic_add_fetch(&(tp_ctx->sum), *(apr_size_t *) data, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&(tp_ctx->nb_processed), 1, __ATOMIC_SEQ_CST);
+
+    return (0 == (*(apr_size_t *) data % 2)) ? APR_SUCCESS : APR_EGENERAL;
+}
+
+/* counts the odd values, the ones processing fails on */
+static void tp_done(void *ctx, void *data, apr_status_t status)
+{
+    tp_ctx_t *tp_ctx = ctx;
+
+    if (APR_SUCCESS != status)
+	__atomic_add_fetch(&(tp_ctx->nb_done), 1, __ATOMIC_SEQ_CST);
+}
+
+/* a node of depth d has 4 children of depth d - 1, added by the thread processing it */
+static apr_status_t tp_process_tree(void *ctx, void *data)
+{
+    tp_ctx_t *tp_ctx = ctx;
+    apr_size_t depth = (apr_size_t) data;
+    void *children[4];
+    int i;
+
+    __atomic_add_fetch(&(tp_ctx->nb_processed), 1, __ATOMIC_SEQ_CST);
+    if (0 != --depth) {
+	for (i = 0; i < 4; i++)
+	    children[i] = (void *) depth;
+	/* half of them one by one */
+	napr_threadpool_add(tp_ctx->threadpool, children[0]);
+	napr_threadpool_add_job(tp_ctx->threadpool, children[1], tp_done);
+	napr_threadpool_add_batch(tp_ctx->threadpool, children + 2, 2, NULL);
+    }
+
+    return APR_SUCCESS;
+}
+
+START_TEST(test_napr_threadpool_batch)
+{
+    tp_ctx_t tp_ctx;
+    apr_size_t *values, i, nb_timed, nel = 100000;
+    apr_interval_time_t queued, idle;
+    void **data;
+    apr_status_t status;
+
+    memset(&tp_ctx, 0, sizeof(tp_ctx));
+    status = napr_threadpool_init(&(tp_ctx.threadpool), &tp_ctx, 4, tp_process_sum, pool);
+    fail_unless(APR_SUCCESS == status, "napr_threadpool_init failed");
+    napr_threadpool_set_timed(tp_ctx.threadpool, 1);
+    values = apr_palloc(pool, nel * sizeof(apr_size_t));
+    data = apr_palloc(pool, nel * sizeof(void *));
+    for (i = 0; i < nel; i++) {
+	values[i] = i;
+	data[i] = &(values[i]);
+    }
+
+    status = napr_threadpool_add_batch(tp_ctx.threadpool, data, nel, tp_done);
+    fail_unless(APR_SUCCESS == status, "napr_threadpool_add_batch failed");
+    /* a batch smaller than the number of threads */
+    status = napr_threadpool_add_batch(tp_ctx.threadpool, data + 1, 2, tp_done);
+    fail_unless(APR_SUCCESS == status, "napr_threadpool_add_batch failed");
+    fail_unless(APR_SUCCESS == napr_threadpool_wait(tp_ctx.threadpool), "napr_threadpool_wait failed");
+
+    fail_unless(nel + 2 == tp_ctx.nb_processed, "jobs lost");
+    fail_unless(nel / 2 + 1 == tp_ctx.nb_done, "done callbacks lost");
+    fail_unless(nel * (nel - 1) / 2 + 3 == tp_ctx.sum, "jobs processed twice");
+    napr_threadpool_times(tp_ctx.threadpool, &nb_timed, &queued, &idle);
+    fail_unless(nel + 2 == nb_timed, "jobs not timed");
+    fail_unless((0 <= queued) && (0 <= idle), "negative times");
+
+    /* nothing added, nothing to wait for */
+    fail_unless(APR_SUCCESS == napr_threadpool_wait(tp_ctx.threadpool), "napr_threadpool_wait failed");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* jobs added by the callbacks, the same threads being reused for another callback afterward */
+START_TEST(test_napr_threadpool_reuse)
+{
+    tp_ctx_t tp_ctx, tp_ctx2;
+    apr_size_t value = 2;
+    apr_status_t status;
+    int phase;
+
+    memset(&tp_ctx, 0, sizeof(tp_ctx));
+    status = napr_threadpool_init(&(tp_ctx.threadpool), NULL, 3, NULL, pool);
+    fail_unless(APR_SUCCESS == status, "napr_threadpool_init failed");
+
+    for (phase = 0; phase < 3; phase++) {
+	tp_ctx.nb_processed = 0;
+	tp_ctx.nb_done = 0;
+	napr_threadpool_set_process(tp_ctx.threadpool, &tp_ctx, tp_process_tree);
+	fail_unless(APR_SUCCESS == napr_threadpool_add(tp_ctx.threadpool, (void *) 8), "napr_threadpool_add failed");
+	fail_unless(APR_SUCCESS == napr_threadpool_wait(tp_ctx.threadpool), "napr_threadpool_wait failed");
+	/* (4^8 - 1) / 3 nodes, the done callbacks only count the failures */
+	fail_unless(21845 == tp_ctx.nb_processed, "jobs lost");
+	fail_unless(0 == tp_ctx.nb_done, "done callback of a successful job");
+
+	memset(&tp_ctx2, 0, sizeof(tp_ctx2));
+	napr_threadpool_set_process(tp_ctx.threadpool, &tp_ctx2, tp_process_sum);
+	fail_unless(APR_SUCCESS == napr_threadpool_add_job(tp_ctx.threadpool, &value, tp_done),
+		    "napr_threadpool_add_job failed");
+	fail_unless(APR_SUCCESS == napr_threadpool_wait(tp_ctx.threadpool), "napr_threadpool_wait failed");
+	fail_unless((1 == tp_ctx2.nb_processed) && (2 == tp_ctx2.sum), "job lost after reuse");
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_napr_threadpool_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Threadpool");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_napr_threadpool_batch);
+    tcase_add_test(tc_core, test_napr_threadpool_reuse);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,416 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_mmap.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "debug.h"
+#include "ft_cache.h"
+
+#define FT_CACHE_MAGIC 0x46544331	/* "FTC1", also tells the byte order */
+#define FT_CACHE_VERSION 2	/* 2: jenkins digests buffered across the reads */
+#define FT_CACHE_HASH_NAME_LEN 16
+/* saves a record of a device not walked is kept by without its file being seen */
+#define FT_CACHE_MAX_AGE 16
+
+typedef struct ft_cache_header_t
+{
+    apr_uint32_t magic;
+    apr_uint32_t version;
+    char hash[FT_CACHE_HASH_NAME_LEN];	/* or the name of what the slots hold, see ft_cache_open_slots */
+    apr_uint32_t digest_len;
+    apr_uint32_t nb_slots;
+    apr_uint32_t block_len;
+    apr_uint32_t nb_samples;
+    apr_uint32_t generation;	/* incremented by each save */
+    apr_uint32_t pad;
+    apr_uint64_t nb_recs;
+} ft_cache_header_t;
+
+struct ft_cache_rec_t
+{
+    apr_uint64_t device;
+    apr_uint64_t inode;
+    apr_uint64_t size;
+    apr_int64_t mtime;
+    apr_uint32_t mask;		/* bit n is set if the digest of slot n is there */
+    apr_uint32_t generation;	/* of the last save the file was seen by */
+    unsigned char digests[];	/* nb_slots digests of digest_len bytes */
+};
+
+struct ft_cache_t
+{
+    apr_pool_t *pool;
+    const char *path;
+    const char *name;		/* of the hash of the digests */
+    apr_mmap_t *mm;		/* NULL if the cache file is missing or unusable */
+    const unsigned char *recs;	/* records of the cache file */
+    apr_size_t nb_recs;
+    apr_size_t rec_len;
+    apr_size_t digest_len;
+    apr_uint32_t nb_slots;
+    apr_uint32_t block_len;
+    apr_uint32_t nb_samples;
+    apr_uint32_t file_nb_samples;
+    apr_uint32_t generation;	/* of the cache file */
+    apr_uint32_t valid_mask;	/* slots of the cache file records that can be trusted */
+    apr_array_header_t *added;	/* ft_cache_rec_t * of this run */
+};
+
+#define FT_CACHE_REC(cache, i) ((const ft_cache_rec_t *) ((cache)->recs + (i) * (cache)->rec_len))
+
+static int ft_cache_key_cmp(const ft_cache_rec_t *rec, apr_uint64_t device, apr_uint64_t inode)
+{
+    if (rec->device != device)
+	return (rec->device < device) ? -1 : 1;
+    if (rec->inode != inode)
+	return (rec->inode < inode) ? -1 : 1;
+
+    return 0;
+}
+
+static int ft_cache_rec_cmp(const void *param1, const void *param2)
+{
+    const ft_cache_rec_t *rec1 = *(ft_cache_rec_t * const *) param1;
+    const ft_cache_rec_t *rec2 = *(ft_cache_rec_t * const *) param2;
+
+    return ft_cache_key_cmp(rec1, rec2->device, rec2->inode);
+}
+
+static apr_status_t ft_cache_load(ft_cache_t *cache)
+{
+    char errbuf[128];
+    const ft_cache_header_t *header;
+    apr_finfo_t finfo;
+    apr_file_t *fd = NULL;
+    apr_status_t status;
+
+    if (NULL == cache->path)
+	return APR_SUCCESS;
+    status = apr_file_open(&fd, cache->path, APR_READ | APR_BINARY, APR_OS_DEFAULT, cache->pool);
+    if (APR_STATUS_IS_ENOENT(status))
+	return APR_SUCCESS;
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_open(%s): %s", cache->path, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd))) {
+	DEBUG_ERR("error calling apr_file_info_get: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
+	return status;
+    }
+    /* too short to be a cache file, it will be overwritten */
+    if (finfo.size < (apr_off_t) sizeof(ft_cache_header_t)) {
+	apr_file_close(fd);
+	return APR_SUCCESS;
+    }
+    status = apr_mmap_create(&(cache->mm), fd, 0, (apr_size_t) finfo.size, APR_MMAP_READ, cache->pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_mmap_create(%s): %s", cache->path, apr_strerror(status, errbuf, 128));
+	cache->mm = NULL;
+	apr_file_close(fd);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    header = cache->mm->mm;
+    if ((FT_CACHE_MAGIC != header->magic) || (FT_CACHE_VERSION != header->version)
+	|| (0 != strncmp(header->hash, cache->name, FT_CACHE_HASH_NAME_LEN))
+	|| (cache->digest_len != header->digest_len) || (cache->nb_slots != header->nb_slots)
+	|| (cache->block_len != header->block_len)
+	|| ((apr_uint64_t) finfo.size != sizeof(ft_cache_header_t) + header->nb_recs * cache->rec_len)) {
+	/* written by another version or with other options, start from scratch */
+	apr_mmap_delete(cache->mm);
+	cache->mm = NULL;
+	return APR_SUCCESS;
+    }
+    cache->recs = (const unsigned char *) cache->mm->mm + sizeof(ft_cache_header_t);
+    cache->nb_recs = header->nb_recs;
+    cache->file_nb_samples = header->nb_samples;
+    cache->generation = header->generation;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_cache_open_slots(ft_cache_t **cache, const char *path, const char *name,
+					apr_size_t slot_len, apr_uint32_t nb_slots, apr_uint32_t block_len,
+					apr_uint32_t nb_samples, apr_pool_t *pool)
+{
+    ft_cache_t *result;
+    apr_status_t status;
+
+    result = apr_pcalloc(pool, sizeof(struct ft_cache_t));
+    result->pool = pool;
+    result->path = (NULL != path) ? apr_pstrdup(pool, path) : NULL;
+    result->name = apr_pstrdup(pool, name);
+    result->digest_len = slot_len;
+    result->nb_slots = nb_slots;
+    result->block_len = block_len;
+    result->nb_samples = nb_samples;
+    result->valid_mask = (1U << nb_slots) - 1;
+    /* keep the records 8 bytes aligned in the file so that the mmap'ed ones are */
+    result->rec_len = (offsetof(struct ft_cache_rec_t, digests) + nb_slots * result->digest_len + 7) & ~(apr_size_t) 7;
+    result->added = apr_array_make(pool, 1024, sizeof(ft_cache_rec_t *));
+
+    if (APR_SUCCESS != (status = ft_cache_load(result)))
+	return status;
+
+    *cache = result;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_cache_open(ft_cache_t **cache, const char *path, const ft_hash_t *hash,
+				  apr_uint32_t nb_slots, apr_uint32_t block_len, apr_uint32_t nb_samples,
+				  apr_pool_t *pool)
+{
+    return ft_cache_open_slots(cache, path, ft_hash_name(hash), ft_hash_digest_len(hash), nb_slots, block_len,
+			       nb_samples, pool);
+}
+
+extern apr_size_t ft_cache_size(const ft_cache_t *cache)
+{
+    return cache->nb_recs;
+}
+
+extern apr_uint32_t ft_cache_nb_samples(const ft_cache_t *cache)
+{
+    return cache->file_nb_samples;
+}
+
+extern void ft_cache_ignore_slot(ft_cache_t *cache, apr_uint32_t slot)
+{
+    cache->valid_mask &= ~(1U << slot);
+}
+
+static const ft_cache_rec_t *ft_cache_lookup(const ft_cache_t *cache, apr_uint64_t device, apr_uint64_t inode)
+{
+    const ft_cache_rec_t *rec;
+    apr_size_t lo, hi, mid;
+    int rv;
+
+    for (lo = 0, hi = cache->nb_recs; lo < hi;) {
+	mid = lo + (hi - lo) / 2;
+	rec = FT_CACHE_REC(cache, mid);
+	if (0 == (rv = ft_cache_key_cmp(rec, device, inode)))
+	    return rec;
+	if (rv < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return NULL;
+}
+
+extern ft_cache_rec_t *ft_cache_add(ft_cache_t *cache, apr_uint64_t device, apr_uint64_t inode, apr_off_t size,
+				    apr_time_t mtime)
+{
+    const ft_cache_rec_t *old;
+    ft_cache_rec_t *rec;
+
+    rec = apr_pcalloc(cache->pool, cache->rec_len);
+    rec->device = device;
+    rec->inode = inode;
+    rec->size = size;
+    rec->mtime = mtime;
+    old = ft_cache_lookup(cache, device, inode);
+    if ((NULL != old) && (old->size == rec->size) && (old->mtime == rec->mtime)) {
+	memcpy(rec->digests, old->digests, cache->nb_slots * cache->digest_len);
+	rec->mask = old->mask & cache->valid_mask;
+    }
+    APR_ARRAY_PUSH(cache->added, ft_cache_rec_t *) = rec;
+
+    return rec;
+}
+
+extern int ft_cache_has(const ft_cache_t *cache, const ft_cache_rec_t *rec, apr_uint32_t slot)
+{
+    return 0 != (rec->mask & (1U << slot));
+}
+
+extern int ft_cache_get(const ft_cache_t *cache, const ft_cache_rec_t *rec, apr_uint32_t slot, apr_uint32_t *digest)
+{
+    if (!ft_cache_has(cache, rec, slot))
+	return 0;
+
+    memset(digest, 0, HASHSTATE * sizeof(apr_uint32_t));
+    memcpy(digest, rec->digests + slot * cache->digest_len, cache->digest_len);
+
+    return 1;
+}
+
+extern const void *ft_cache_slot(const ft_cache_t *cache, const ft_cache_rec_t *rec, apr_uint32_t slot)
+{
+    return ft_cache_has(cache, rec, slot) ? rec->digests + slot * cache->digest_len : NULL;
+}
+
+extern void ft_cache_put(const ft_cache_t *cache, ft_cache_rec_t *rec, apr_uint32_t slot, const void *digest)
+{
+    memcpy(rec->digests + slot * cache->digest_len, digest, cache->digest_len);
+    rec->mask |= 1U << slot;
+}
+
+static apr_status_t ft_cache_write_rec(apr_file_t *fd, const ft_cache_t *cache, const ft_cache_rec_t *rec,
+				       apr_uint64_t *nb_recs)
+{
+    char errbuf[128];
+    apr_status_t status;
+
+    /* nothing to remember about this file */
+    if (0 == rec->mask)
+	return APR_SUCCESS;
+
+    if (APR_SUCCESS != (status = apr_file_write_full(fd, rec, cache->rec_len, NULL))) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    *nb_recs += 1;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_cache_save(ft_cache_t *cache, apr_pool_t *gc_pool)
+{
+    char errbuf[128];
+    ft_cache_header_t header;
+    ft_cache_rec_t **added, *rec, *old;
+    const char *tmp_path;
+    apr_file_t *fd = NULL;
+    apr_off_t offset;
+    apr_size_t i, j, k, nb_added;
+    apr_uint32_t slot;
+    apr_status_t status;
+    int rv;
+
+    if (NULL == cache->path)
+	return APR_SUCCESS;
+    added = (ft_cache_rec_t **) cache->added->elts;
+    nb_added = cache->added->nelts;
+    qsort(added, nb_added, sizeof(ft_cache_rec_t *), ft_cache_rec_cmp);
+
+    tmp_path = apr_pstrcat(gc_pool, cache->path, ".tmp", NULL);
+    status = apr_file_open(&fd, tmp_path, APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BUFFERED | APR_BINARY,
+			   APR_OS_DEFAULT, gc_pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_open(%s): %s", tmp_path, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FT_CACHE_MAGIC;
+    header.version = FT_CACHE_VERSION;
+    apr_cpystrn(header.hash, cache->name, FT_CACHE_HASH_NAME_LEN);
+    header.digest_len = cache->digest_len;
+    header.nb_slots = cache->nb_slots;
+    header.block_len = cache->block_len;
+    header.nb_samples = cache->nb_samples;
+    header.generation = cache->generation + 1;
+    if (APR_SUCCESS != (status = apr_file_write_full(fd, &header, sizeof(header), NULL))) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
+	return status;
+    }
+
+    /*
+     * merge the two sorted sets, the records of this run replace the old ones.
+     * An old record of a device walked by this run is the one of a file that
+     * is gone, or no longer a candidate, it is dropped. The others are kept
+     * until they are FT_CACHE_MAX_AGE saves old.
+     */
+    old = apr_palloc(gc_pool, cache->rec_len);
+    for (i = 0, j = 0, k = 0; (APR_SUCCESS == status) && ((i < cache->nb_recs) || (j < nb_added));) {
+	if (j < nb_added) {
+	    rv = (i < cache->nb_recs) ? ft_cache_key_cmp(FT_CACHE_REC(cache, i), added[j]->device,
+							 added[j]->inode) : 1;
+	}
+	else {
+	    rv = -1;
+	}
+
+	if (rv < 0) {
+	    memcpy(old, FT_CACHE_REC(cache, i), cache->rec_len);
+	    i++;
+	    /* both sets are sorted by device first */
+	    for (; (k < nb_added) && (added[k]->device < old->device); k++);
+	    if (((k < nb_added) && (added[k]->device == old->device))
+		|| (FT_CACHE_MAX_AGE <= header.generation - old->generation))
+		continue;
+	    old->mask &= cache->valid_mask;
+	    status = ft_cache_write_rec(fd, cache, old, &(header.nb_recs));
+	    continue;
+	}
+	if (0 == rv)
+	    i++;
+
+	/* hard links of a same file share their record */
+	rec = added[j];
+	for (j++; (j < nb_added) && (0 == ft_cache_rec_cmp(&rec, &(added[j]))); j++)
+	    for (slot = 0; slot < cache->nb_slots; slot++)
+		if (!ft_cache_has(cache, rec, slot) && ft_cache_has(cache, added[j], slot))
+		    ft_cache_put(cache, rec, slot, added[j]->digests + slot * cache->digest_len);
+	rec->generation = header.generation;
+	status = ft_cache_write_rec(fd, cache, rec, &(header.nb_recs));
+    }
+    if (APR_SUCCESS != status) {
+	apr_file_close(fd);
+	return status;
+    }
+
+    offset = 0;
+    if (APR_SUCCESS != (status = apr_file_seek(fd, APR_SET, &offset))) {
+	DEBUG_ERR("error calling apr_file_seek: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_write_full(fd, &header, sizeof(header), NULL))) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    if (NULL != cache->mm) {
+	if (APR_SUCCESS != (status = apr_mmap_delete(cache->mm))) {
+	    DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	cache->mm = NULL;
+	cache->recs = NULL;
+	cache->nb_recs = 0;
+    }
+    cache->generation = header.generation;
+    if (APR_SUCCESS != (status = apr_file_rename(tmp_path, cache->path, gc_pool))) {
+	DEBUG_ERR("error calling apr_file_rename(%s, %s): %s", tmp_path, cache->path,
+		  apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
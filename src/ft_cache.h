@@ -0,0 +1,88 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_CACHE_H
+#define FT_CACHE_H
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+#include "ft_hash.h"
+
+/*
+ * Persistent checksum cache: a header followed by fixed-size records sorted
+ * by (device, inode), so that it is mmap'ed and binary searched as is. A
+ * record is only used if the size and the mtime of the file did not change.
+ * Each record holds up to nb_slots digests, one per stage of ftwin.
+ */
+
+typedef struct ft_cache_t ft_cache_t;
+typedef struct ft_cache_rec_t ft_cache_rec_t;
+
+/*
+ * Map the cache file at path, a missing file or a file written with another
+ * hash, slot number or block size is an empty cache. A NULL path is a cache
+ * kept in memory for this run only, ft_cache_save does nothing then.
+ */
+apr_status_t ft_cache_open(ft_cache_t **cache, const char *path, const ft_hash_t *hash, apr_uint32_t nb_slots,
+			   apr_uint32_t block_len, apr_uint32_t nb_samples, apr_pool_t *pool);
+
+/*
+ * Same as ft_cache_open for slots of slot_len bytes that are not digests,
+ * name (at most 15 characters) telling them apart from other caches.
+ */
+apr_status_t ft_cache_open_slots(ft_cache_t **cache, const char *path, const char *name, apr_size_t slot_len,
+				 apr_uint32_t nb_slots, apr_uint32_t block_len, apr_uint32_t nb_samples,
+				 apr_pool_t *pool);
+
+/* number of records read from the cache file */
+apr_size_t ft_cache_size(const ft_cache_t *cache);
+
+/* nb_samples of the cache file, 0 if it is empty */
+apr_uint32_t ft_cache_nb_samples(const ft_cache_t *cache);
+
+/* forget the digests of this slot, i.e. the ones that depend on an option that changed */
+void ft_cache_ignore_slot(ft_cache_t *cache, apr_uint32_t slot);
+
+/*
+ * Record of a file for this run, holding the digests of the cache file if the
+ * file is unchanged. Not thread safe.
+ */
+ft_cache_rec_t *ft_cache_add(ft_cache_t *cache, apr_uint64_t device, apr_uint64_t inode, apr_off_t size,
+			     apr_time_t mtime);
+
+/* does rec hold a digest for slot */
+int ft_cache_has(const ft_cache_t *cache, const ft_cache_rec_t *rec, apr_uint32_t slot);
+
+/* copy the digest of slot to digest (HASHSTATE apr_uint32_t), returns 0 if there is none */
+int ft_cache_get(const ft_cache_t *cache, const ft_cache_rec_t *rec, apr_uint32_t slot, apr_uint32_t *digest);
+
+/* the slot_len bytes of slot, NULL if there are none */
+const void *ft_cache_slot(const ft_cache_t *cache, const ft_cache_rec_t *rec, apr_uint32_t slot);
+
+/* store the digest, or the slot_len bytes, of slot, distinct records may be set from distinct threads */
+void ft_cache_put(const ft_cache_t *cache, ft_cache_rec_t *rec, apr_uint32_t slot, const void *digest);
+
+/*
+ * Write the records of this run, merged with the ones of the cache file that
+ * were not seen, to a temporary file renamed to the cache path. The records
+ * not seen of a device that has records in this run are dropped, the others
+ * once they were not seen by several saves.
+ */
+apr_status_t ft_cache_save(ft_cache_t *cache, apr_pool_t *gc_pool);
+
+#endif /* FT_CACHE_H */
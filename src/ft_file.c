@@ -5,9 +5,9 @@
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  * 	http://www.apache.org/licenses/LICENSE-2.0
- * 
+ *
  * Unless required by applicable law or agreed to in writing, software
  * distributed under the License is distributed on an "AS IS" BASIS,
  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
@@ -15,55 +15,327 @@
  * limitations under the License.
  */
 
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_MADVISE
+#include <sys/mman.h>
+#endif
+#if HAVE_DECL_FIDEDUPERANGE
+#include <sys/ioctl.h>
+#include <linux/fs.h>		/* FIDEDUPERANGE */
+#endif
+
 #include <apr_file_io.h>
 #include <apr_mmap.h>
+#include <apr_portable.h>
 
 #include "checksum.h"
 #include "debug.h"
 #include "ft_file.h"
-
-static apr_status_t checksum_big_file(const char *filename, apr_off_t size, apr_uint32_t *state, apr_pool_t *gc_pool);
-static apr_status_t big_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i);
+#include "ft_hash.h"
 
 /*#define HUGE_LEN 8192*/
 #define HUGE_LEN 4096
 
-static apr_status_t checksum_small_file(const char *filename, apr_off_t size, apr_uint32_t *state, apr_pool_t *gc_pool)
+/* O_DIRECT buffers, offsets and lengths are aligned on this */
+#define FT_IO_ALIGN 4096
+/* mmap windows are a multiple of this, so that they start on a page whatever its size */
+#define FT_IO_MMAP_ALIGN (64 * 1024)
+
+/* page cache hints, only used with FT_IO_FADVISE */
+static void ft_fadvise_sequential(apr_os_file_t fd)
+{
+#if HAVE_POSIX_FADVISE
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+static void ft_fadvise_dontneed(apr_os_file_t fd, apr_off_t offset, apr_off_t len)
+{
+#if HAVE_POSIX_FADVISE
+    posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+extern void ft_io_init(ft_io_t *io)
+{
+    io->excess_size = 50 * 1024 * 1024;
+    io->block_len = FT_IO_BLOCK_LEN;
+    io->mmap_window = FT_IO_MMAP_WINDOW;
+    io->flags = 0;
+    io->uring = NULL;
+}
+
+/*
+ * Sequential reader of a file, through mmap windows if the file is smaller
+ * than io->excess_size and reads of io->block_len bytes otherwise.
+ */
+typedef struct ft_reader_t
+{
+    const ft_io_t *io;
+    apr_pool_t *pool;
+    apr_file_t *fd;
+    apr_os_file_t os_fd;
+    apr_mmap_t *mm;		/* current window, NULL if not mapped */
+    apr_off_t mm_offset;
+    apr_size_t mm_len;
+    int use_mmap;
+    int direct;			/* the file was opened with O_DIRECT */
+    unsigned char *buf;		/* read buffer, aligned for O_DIRECT */
+    apr_size_t buf_len;
+    apr_off_t size;		/* as stat'ed, the file is not read past it */
+    apr_off_t offset;		/* of the next chunk */
+} ft_reader_t;
+
+static void ft_reader_drop(ft_reader_t *rd, apr_off_t offset, apr_off_t len)
+{
+    if (rd->io->flags & FT_IO_FADVISE)
+	ft_fadvise_dontneed(rd->os_fd, offset, len);
+}
+
+static void ft_reader_unmap(ft_reader_t *rd)
+{
+    if (NULL != rd->mm) {
+	apr_mmap_delete(rd->mm);
+	rd->mm = NULL;
+	ft_reader_drop(rd, rd->mm_offset, rd->mm_len);
+    }
+}
+
+static apr_status_t ft_reader_open(ft_reader_t *rd, const ft_io_t *io, const char *filename, apr_off_t size,
+				   apr_pool_t *pool)
+{
+    apr_status_t status;
+#ifdef O_DIRECT
+    apr_os_file_t os_fd;
+#endif
+
+    rd->io = io;
+    rd->pool = pool;
+    rd->fd = NULL;
+    rd->mm = NULL;
+    rd->mm_offset = 0;
+    rd->mm_len = 0;
+    rd->direct = 0;
+    rd->buf = NULL;
+    rd->buf_len = 0;
+    rd->size = size;
+    rd->offset = 0;
+    /* a ring reads ahead asynchronously, which page faults on a mapping can't do */
+    rd->use_mmap = (size < io->excess_size) && (0 != io->mmap_window) && !(io->flags & FT_IO_DIRECT)
+	&& (NULL == io->uring);
+
+#ifdef O_DIRECT
+    if (io->flags & FT_IO_DIRECT) {
+	/* some filesystems refuse O_DIRECT, the page cache is used then */
+	if (0 <= (os_fd = open(filename, O_RDONLY | O_DIRECT | O_CLOEXEC))) {
+	    if (APR_SUCCESS != (status = apr_os_file_put(&(rd->fd), &os_fd, APR_READ, pool))) {
+		close(os_fd);
+		return status;
+	    }
+	    rd->direct = 1;
+	}
+	else if (EINVAL != errno) {
+	    return APR_FROM_OS_ERROR(errno);
+	}
+    }
+#endif
+    if (NULL == rd->fd) {
+	status = apr_file_open(&(rd->fd), filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+	if (APR_SUCCESS != status)
+	    return status;
+    }
+    apr_os_file_get(&(rd->os_fd), rd->fd);
+    if (io->flags & FT_IO_FADVISE)
+	ft_fadvise_sequential(rd->os_fd);
+
+    return APR_SUCCESS;
+}
+
+/* map the window holding rd->offset, returns non-zero if the file has to be read instead */
+static int ft_reader_map(ft_reader_t *rd)
+{
+    apr_size_t align, window;
+
+    ft_reader_unmap(rd);
+    /* both are powers of two, so that a chunk never spans two windows */
+    align = (rd->io->block_len > FT_IO_MMAP_ALIGN) ? rd->io->block_len : FT_IO_MMAP_ALIGN;
+    window = rd->io->mmap_window - rd->io->mmap_window % align;
+    if (0 == window)
+	window = align;
+    rd->mm_offset = rd->offset - rd->offset % window;
+    rd->mm_len = (apr_size_t) FTWIN_MIN((apr_off_t) window, rd->size - rd->mm_offset);
+    if (APR_SUCCESS != apr_mmap_create(&(rd->mm), rd->fd, rd->mm_offset, rd->mm_len, APR_MMAP_READ, rd->pool)) {
+	rd->mm = NULL;
+	return 1;
+    }
+#if HAVE_MADVISE
+    madvise(rd->mm->mm, rd->mm_len, MADV_SEQUENTIAL);
+#endif
+
+    return 0;
+}
+
+static void ft_reader_buffer(ft_reader_t *rd)
+{
+    if (NULL == rd->buf) {
+	rd->buf_len = rd->io->block_len + FT_IO_ALIGN - 1;
+	rd->buf_len -= rd->buf_len % FT_IO_ALIGN;
+	rd->buf = apr_palloc(rd->pool, rd->buf_len + FT_IO_ALIGN);
+	rd->buf += (FT_IO_ALIGN - ((apr_uintptr_t) rd->buf) % FT_IO_ALIGN) % FT_IO_ALIGN;
+    }
+}
+
+/*
+ * Point data to the next chunk, at most io->block_len bytes. It is shorter
+ * than asked only if the file was truncated, APR_EOF meaning nothing is left.
+ */
+static apr_status_t ft_reader_next(ft_reader_t *rd, const unsigned char **data, apr_size_t *len)
+{
+    apr_size_t want, rbytes, more;
+    apr_off_t offset;
+    apr_status_t status;
+
+    *len = 0;
+    if (rd->offset >= rd->size)
+	return APR_EOF;
+    want = (apr_size_t) FTWIN_MIN((apr_off_t) rd->io->block_len, rd->size - rd->offset);
+
+    if (rd->use_mmap) {
+	if ((NULL != rd->mm) && (rd->offset < rd->mm_offset + (apr_off_t) rd->mm_len)) {
+	    *data = (const unsigned char *) rd->mm->mm + (rd->offset - rd->mm_offset);
+	    *len = (apr_size_t) FTWIN_MIN((apr_off_t) want, rd->mm_offset + (apr_off_t) rd->mm_len - rd->offset);
+	    rd->offset += *len;
+	    return APR_SUCCESS;
+	}
+	if (0 == ft_reader_map(rd))
+	    return ft_reader_next(rd, data, len);
+	/* can't be mapped, go on reading it */
+	rd->use_mmap = 0;
+	offset = rd->offset;
+	if (APR_SUCCESS != (status = apr_file_seek(rd->fd, APR_SET, &offset)))
+	    return status;
+    }
+
+    ft_reader_buffer(rd);
+#ifdef O_DIRECT
+    if (rd->direct) {
+	/* whole aligned blocks are read, the tail of a file that grew is ignored */
+	rbytes = rd->buf_len;
+	status = apr_file_read(rd->fd, rd->buf, &rbytes);
+	if ((APR_SUCCESS == status) && (0 < rbytes) && (rbytes < want)) {
+	    /* the next read would not be aligned, finish without O_DIRECT */
+	    fcntl(rd->os_fd, F_SETFL, fcntl(rd->os_fd, F_GETFL) & ~O_DIRECT);
+	    rd->direct = 0;
+	    status = apr_file_read_full(rd->fd, rd->buf + rbytes, want - rbytes, &more);
+	    rbytes += more;
+	}
+	if (rbytes > want)
+	    rbytes = want;
+    }
+    else
+#endif
+	status = apr_file_read_full(rd->fd, rd->buf, want, &rbytes);
+    if ((APR_SUCCESS != status) && (APR_EOF != status))
+	return status;
+    if (0 == rbytes)
+	return APR_EOF;
+    ft_reader_drop(rd, rd->offset, rbytes);
+    *data = rd->buf;
+    *len = rbytes;
+    rd->offset += rbytes;
+
+    return APR_SUCCESS;
+}
+
+/* go on from offset, an aligned one for O_DIRECT, up to end at most */
+static apr_status_t ft_reader_seek(ft_reader_t *rd, apr_off_t offset, apr_off_t end)
+{
+    rd->offset = offset;
+    rd->size = end;
+    if (rd->use_mmap)
+	return APR_SUCCESS;
+
+    return apr_file_seek(rd->fd, APR_SET, &offset);
+}
+
+static apr_status_t ft_reader_close(ft_reader_t *rd)
+{
+    ft_reader_unmap(rd);
+
+    return apr_file_close(rd->fd);
+}
+
+extern apr_status_t checksum_file(const char *filename, apr_off_t size, const ft_io_t *io, const ft_hash_t *hash,
+				  apr_uint32_t *digest, apr_pool_t *gc_pool)
 {
     char errbuf[128];
-    apr_file_t *fd = NULL;
-    apr_mmap_t *mm;
+    ft_hash_state_t state;
+    ft_reader_t rd;
+    const unsigned char *data;
+    apr_size_t len;
     apr_status_t status;
-    apr_uint32_t i;
-    apr_off_t rbytes;
 
-    status = apr_file_open(&fd, filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, gc_pool);
-    if (APR_SUCCESS != status) {
+    if (APR_SUCCESS != (status = ft_reader_open(&rd, io, filename, size, gc_pool)))
+	return status;
+
+    ft_hash_init(hash, &state);
+    while (APR_SUCCESS == (status = ft_reader_next(&rd, &data, &len)))
+	ft_hash_update(hash, &state, data, len);
+    if (APR_EOF != status) {
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
+	ft_reader_close(&rd);
 	return status;
     }
+    ft_hash_final(hash, &state, digest);
 
-    status = apr_mmap_create(&mm, fd, 0, (apr_size_t) size, APR_MMAP_READ, gc_pool);
-    if (APR_SUCCESS != status) {
-	apr_file_close(fd);
-	return checksum_big_file(filename, size, state, gc_pool);
+    if (APR_SUCCESS != (status = ft_reader_close(&rd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
     }
 
-    for (i = 0; i < HASHSTATE; ++i)
-	state[i] = 1;
+    return APR_SUCCESS;
+}
 
-    rbytes = 0;
-    do {
-	hash(mm->mm + rbytes, FTWIN_MIN(HUGE_LEN, size), state);
-	rbytes += FTWIN_MIN(HUGE_LEN, size);
-	size -= HUGE_LEN;
-    } while (size > 0);
+/* checksum_file_blocks of blocks large and aligned enough to be read as files are, see ft_reader_t */
+static apr_status_t checksum_file_ranges(const char *filename, const apr_off_t *offsets, apr_size_t nb_blocks,
+					 apr_size_t block_len, const ft_io_t *io, const ft_hash_t *hash,
+					 apr_uint32_t *digest, apr_pool_t *gc_pool)
+{
+    char errbuf[128];
+    ft_hash_state_t state;
+    ft_reader_t rd;
+    const unsigned char *data;
+    apr_off_t end = 0;
+    apr_size_t i, len;
+    apr_status_t status;
 
-    if (APR_SUCCESS != (status = apr_mmap_delete(mm))) {
-	DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
-	apr_file_close(fd);
+    for (i = 0; i < nb_blocks; i++)
+	end = FTWIN_MAX(end, offsets[i] + (apr_off_t) block_len);
+    if (APR_SUCCESS != (status = ft_reader_open(&rd, io, filename, end, gc_pool)))
 	return status;
+
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, (const unsigned char *) digest, HASHSTATE * sizeof(apr_uint32_t));
+    for (i = 0, status = APR_EOF; (i < nb_blocks) && (APR_EOF == status); i++) {
+	if (APR_SUCCESS != (status = ft_reader_seek(&rd, offsets[i], offsets[i] + (apr_off_t) block_len)))
+	    break;
+	/* the file may have been truncated since it was stat'ed, hash what is left */
+	while (APR_SUCCESS == (status = ft_reader_next(&rd, &data, &len)))
+	    ft_hash_update(hash, &state, data, len);
     }
-    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+    if (APR_EOF != status) {
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
+	ft_reader_close(&rd);
+	return status;
+    }
+    ft_hash_final(hash, &state, digest);
+
+    if (APR_SUCCESS != (status = ft_reader_close(&rd))) {
 	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
@@ -71,35 +343,57 @@ static apr_status_t checksum_small_file(const char *filename, apr_off_t size, ap
     return APR_SUCCESS;
 }
 
-static apr_status_t checksum_big_file(const char *filename, apr_off_t size, apr_uint32_t *state, apr_pool_t *gc_pool)
+extern apr_status_t checksum_file_blocks(const char *filename, const apr_off_t *offsets, apr_size_t nb_blocks,
+					 apr_size_t block_len, const ft_io_t *io, const ft_hash_t *hash,
+					 apr_uint32_t *digest, apr_pool_t *gc_pool)
 {
     unsigned char data_chunk[HUGE_LEN];
     char errbuf[128];
-    apr_size_t rbytes;
+    ft_hash_state_t state;
+    apr_size_t i, len, rbytes;
+    apr_off_t offset;
     apr_file_t *fd = NULL;
+    apr_os_file_t os_fd;
     apr_status_t status;
-    apr_uint32_t i;
+
+    /* chunks of the full stage, rather than a few sampled blocks */
+    for (i = 0; (i < nb_blocks) && (0 == offsets[i] % FT_IO_ALIGN); i++);
+    if ((i == nb_blocks) && (block_len >= io->block_len))
+	return checksum_file_ranges(filename, offsets, nb_blocks, block_len, io, hash, digest, gc_pool);
 
     status = apr_file_open(&fd, filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, gc_pool);
     if (APR_SUCCESS != status) {
 	return status;
     }
+    apr_os_file_get(&os_fd, fd);
 
-    for (i = 0; i < HASHSTATE; ++i)
-	state[i] = 1;
-
-    do {
-	rbytes = HUGE_LEN;
-	status = apr_file_read(fd, data_chunk, &rbytes);
-	if (APR_SUCCESS == status) {
-	    hash(data_chunk, rbytes, state);
+    /* the previous digest seeds the new one */
+    ft_hash_init(hash, &state);
+    ft_hash_update(hash, &state, (const unsigned char *) digest, HASHSTATE * sizeof(apr_uint32_t));
+    for (i = 0; i < nb_blocks; i++) {
+	offset = offsets[i];
+	if (APR_SUCCESS != (status = apr_file_seek(fd, APR_SET, &offset))) {
+	    DEBUG_ERR("error calling apr_file_seek: %s", apr_strerror(status, errbuf, 128));
+	    apr_file_close(fd);
+	    return status;
 	}
-    } while (APR_SUCCESS == status);
-    if (APR_EOF != status) {
-	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
-	apr_file_close(fd);
-	return status;
+	/* the file may have been truncated since it was stat'ed, hash what is left */
+	for (len = block_len; 0 < len; len -= rbytes) {
+	    status = apr_file_read_full(fd, data_chunk, FTWIN_MIN(HUGE_LEN, len), &rbytes);
+	    if (0 < rbytes)
+		ft_hash_update(hash, &state, data_chunk, rbytes);
+	    if (APR_SUCCESS != status)
+		break;
+	}
+	if ((APR_SUCCESS != status) && (APR_EOF != status)) {
+	    DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
+	    apr_file_close(fd);
+	    return status;
+	}
+	if (io->flags & FT_IO_FADVISE)
+	    ft_fadvise_dontneed(os_fd, offsets[i], block_len);
     }
+    ft_hash_final(hash, &state, digest);
 
     if (APR_SUCCESS != (status = apr_file_close(fd))) {
 	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
@@ -109,141 +403,685 @@ static apr_status_t checksum_big_file(const char *filename, apr_off_t size, apr_
     return APR_SUCCESS;
 }
 
-extern apr_status_t checksum_file(const char *filename, apr_off_t size, apr_off_t excess_size, apr_uint32_t *state,
-				  apr_pool_t *gc_pool)
+/* a file of checksum_files being read through a ring */
+typedef struct ft_async_slot_t
+{
+    ft_checksum_job_t *job;	/* NULL if the slot is free */
+    ft_hash_state_t state;
+    int fd;
+    unsigned char *buf;
+    apr_size_t block;		/* being read, a whole file is a single block */
+    apr_off_t offset;		/* of the read in flight */
+    apr_off_t end;		/* of the block */
+    struct ft_async_slot_t *next_free;
+} ft_async_slot_t;
+
+typedef struct ft_async_t
+{
+    const ft_io_t *io;
+    const ft_hash_t *hash;
+    ft_checksum_done_fn_t *done;
+    void *ctx;
+    apr_size_t buf_len;
+    ft_async_slot_t *free;
+} ft_async_t;
+
+/* point the slot to its current block, returns 0 once they were all read */
+static int ft_async_block(ft_async_slot_t *slot)
+{
+    ft_checksum_job_t *job = slot->job;
+
+    if (NULL == job->offsets) {
+	if (0 != slot->block)
+	    return 0;
+	slot->offset = 0;
+	slot->end = job->size;
+    }
+    else {
+	if (slot->block >= job->nb_blocks)
+	    return 0;
+	slot->offset = job->offsets[slot->block];
+	slot->end = slot->offset + (apr_off_t) job->block_len;
+    }
+
+    return 1;
+}
+
+static void ft_async_release(ft_async_t *async, ft_async_slot_t *slot, apr_status_t status)
 {
-    if (size < excess_size)
-	return checksum_small_file(filename, size, state, gc_pool);
+    ft_checksum_job_t *job = slot->job;
 
-    return checksum_big_file(filename, size, state, gc_pool);
+    if (0 <= slot->fd)
+	close(slot->fd);
+    slot->job = NULL;
+    slot->next_free = async->free;
+    async->free = slot;
+    async->done(async->ctx, job, status);
 }
 
-static apr_status_t small_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i)
+/* queue the next read of the slot, or finish its job if everything was hashed */
+static apr_status_t ft_async_next(ft_async_t *async, ft_async_slot_t *slot)
 {
-    char errbuf[128];
-    apr_file_t *fd1 = NULL, *fd2 = NULL;
-    apr_mmap_t *mm1, *mm2;
+    apr_size_t len;
     apr_status_t status;
 
-    if (0 == size) {
-	*i = 0;
+    if (slot->offset >= slot->end) {
+	for (slot->block++; ft_async_block(slot) && (slot->offset >= slot->end); slot->block++);
+    }
+    if (slot->offset >= slot->end) {
+	ft_hash_final(async->hash, &(slot->state), slot->job->digest);
+	ft_async_release(async, slot, APR_SUCCESS);
 	return APR_SUCCESS;
     }
 
-    status = apr_file_open(&fd1, fname1, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
-    if (APR_SUCCESS != status) {
+    len = (apr_size_t) FTWIN_MIN((apr_off_t) async->buf_len, slot->end - slot->offset);
+    if (APR_SUCCESS != (status = ft_uring_read(async->io->uring, slot->fd, slot->buf, len, slot->offset, slot))) {
+	ft_async_release(async, slot, status);
 	return status;
     }
 
-    status = apr_mmap_create(&mm1, fd1, 0, (apr_size_t) size, APR_MMAP_READ, pool);
-    if (APR_SUCCESS != status) {
-	apr_file_close(fd1);
-	return big_filecmp(pool, fname1, fname2, size, i);
+    return APR_SUCCESS;
+}
+
+static apr_status_t ft_async_start(ft_async_t *async, ft_checksum_job_t *job)
+{
+    ft_async_slot_t *slot = async->free;
+
+    async->free = slot->next_free;
+    slot->job = job;
+    if (0 > (slot->fd = open(job->filename, O_RDONLY | O_CLOEXEC))) {
+	ft_async_release(async, slot, APR_FROM_OS_ERROR(errno));
+	return APR_SUCCESS;
     }
+    if (async->io->flags & FT_IO_FADVISE)
+	ft_fadvise_sequential(slot->fd);
 
-    status = apr_file_open(&fd2, fname2, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
-    if (APR_SUCCESS != status) {
-	apr_mmap_delete(mm1);
-	apr_file_close(fd1);
-	return status;
+    ft_hash_init(async->hash, &(slot->state));
+    /* the previous digest seeds the new one */
+    if (NULL != job->offsets)
+	ft_hash_update(async->hash, &(slot->state), (const unsigned char *) job->digest,
+		       HASHSTATE * sizeof(apr_uint32_t));
+    slot->block = 0;
+    if (!ft_async_block(slot))
+	slot->offset = slot->end = 0;
+
+    return ft_async_next(async, slot);
+}
+
+/*
+ * Every file being checksummed has a read in flight, so that the ring is kept
+ * full whatever the size of the files, and each completion is hashed at once.
+ */
+static apr_status_t checksum_files_async(const ft_io_t *io, const ft_hash_t *hash, ft_checksum_next_fn_t *next,
+					 ft_checksum_done_fn_t *done, void *ctx, apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_async_t async;
+    ft_async_slot_t *slots, *slot;
+    ft_checksum_job_t *job = NULL;
+    apr_size_t i, nb_slots, rbytes;
+    apr_status_t status, rv;
+    void *data;
+
+    async.io = io;
+    async.hash = hash;
+    async.done = done;
+    async.ctx = ctx;
+    async.buf_len = io->block_len;
+    async.free = NULL;
+    nb_slots = ft_uring_depth(io->uring);
+    slots = apr_palloc(pool, nb_slots * sizeof(struct ft_async_slot_t));
+    for (i = 0; i < nb_slots; i++) {
+	slots[i].job = NULL;
+	slots[i].buf = apr_palloc(pool, async.buf_len);
+	slots[i].next_free = async.free;
+	async.free = &(slots[i]);
+    }
+
+    status = APR_SUCCESS;
+    for (;;) {
+	while ((NULL != async.free) && (NULL != (job = next(ctx)))) {
+	    if (APR_SUCCESS != (status = ft_async_start(&async, job)))
+		break;
+	}
+	if ((APR_SUCCESS != status) || (0 == ft_uring_pending(io->uring)))
+	    break;
+
+	if (APR_SUCCESS != (status = ft_uring_wait(io->uring, &data, &rbytes, &rv)))
+	    break;
+	slot = data;
+	if (APR_SUCCESS != rv) {
+	    DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", slot->job->filename, apr_strerror(rv, errbuf, 128));
+	    ft_async_release(&async, slot, rv);
+	    continue;
+	}
+	if (0 < rbytes) {
+	    ft_hash_update(hash, &(slot->state), slot->buf, rbytes);
+	    if (io->flags & FT_IO_FADVISE)
+		ft_fadvise_dontneed(slot->fd, slot->offset, (apr_off_t) rbytes);
+	    slot->offset += rbytes;
+	}
+	else {
+	    /* the file may have been truncated since it was stat'ed, hash what is left */
+	    slot->offset = slot->end;
+	}
+	if (APR_SUCCESS != (status = ft_async_next(&async, slot)))
+	    break;
     }
 
-    status = apr_mmap_create(&mm2, fd2, 0, size, APR_MMAP_READ, pool);
     if (APR_SUCCESS != status) {
-	apr_file_close(fd2);
-	apr_mmap_delete(mm1);
-	apr_file_close(fd1);
-	return big_filecmp(pool, fname1, fname2, size, i);
+	ft_uring_drain(io->uring);
+	for (i = 0; i < nb_slots; i++) {
+	    if (NULL != slots[i].job)
+		ft_async_release(&async, &(slots[i]), status);
+	}
     }
 
-    *i = memcmp(mm1->mm, mm2->mm, size);
+    return status;
+}
+
+extern apr_status_t checksum_files(const ft_io_t *io, const ft_hash_t *hash, ft_checksum_next_fn_t *next,
+				   ft_checksum_done_fn_t *done, void *ctx, apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_checksum_job_t *job;
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+
+    if (NULL != io->uring)
+	return checksum_files_async(io, hash, next, done, ctx, pool);
 
-    if (APR_SUCCESS != (status = apr_mmap_delete(mm2))) {
-	DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
-	apr_file_close(fd2);
-	apr_mmap_delete(mm1);
-	apr_file_close(fd1);
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
-    if (APR_SUCCESS != (status = apr_file_close(fd2))) {
-	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
-	apr_mmap_delete(mm1);
-	apr_file_close(fd1);
-	return status;
+    while (NULL != (job = next(ctx))) {
+	if (NULL == job->offsets)
+	    status = checksum_file(job->filename, job->size, io, hash, job->digest, gc_pool);
+	else
+	    status = checksum_file_blocks(job->filename, job->offsets, job->nb_blocks, job->block_len, io, hash,
+					  job->digest, gc_pool);
+	apr_pool_clear(gc_pool);
+	done(ctx, job, status);
     }
+    apr_pool_destroy(gc_pool);
+
+    return APR_SUCCESS;
+}
+
+/* files of a group read together, a soft limit since a file per content found so far is added to them */
+#define FILECMP_GROUP_MAX_OPEN 64
+
+typedef struct filecmp_member_t
+{
+    ft_reader_t rd;
+    int open;			/* reset once the member can't have a twin in the group anymore */
+    const unsigned char *chunk;
+    apr_size_t got;		/* bytes of the chunk already read through the ring */
+    apr_status_t status;	/* of the chunk */
+    apr_size_t idx;		/* in names */
+    apr_size_t cls;		/* member leading its class, the first one with the same content so far */
+    apr_size_t prev;		/* cls before the last chunk */
+    void *stream;		/* read through ops instead of rd if not NULL, rd only lending its buffer */
+    const ft_stream_ops_t *ops;
+} filecmp_member_t;
 
-    if (APR_SUCCESS != (status = apr_mmap_delete(mm1))) {
-	DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
-	apr_file_close(fd1);
+static apr_status_t filecmp_member_open(filecmp_member_t *member, const ft_io_t *io, const char *name,
+					apr_off_t size, const ft_stream_ops_t *ops, void *ctx, apr_pool_t *pool)
+{
+    apr_status_t status;
+
+    member->stream = NULL;
+    member->ops = ops;
+    if ((NULL != ops) && (APR_SUCCESS != (status = ops->open(ctx, member->idx, &(member->stream), pool))))
 	return status;
-    }
-    if (APR_SUCCESS != (status = apr_file_close(fd1))) {
-	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+    if (NULL == member->stream)
+	return ft_reader_open(&(member->rd), io, name, size, pool);
+
+    member->rd.io = io;
+    member->rd.pool = pool;
+    member->rd.use_mmap = 0;
+    member->rd.direct = 0;
+    member->rd.buf = NULL;
+    ft_reader_buffer(&(member->rd));
+
+    return APR_SUCCESS;
+}
+
+/* as ft_reader_next, for a chunk of len bytes */
+static apr_status_t filecmp_member_next(filecmp_member_t *member, apr_size_t len, apr_size_t *rbytes)
+{
+    apr_status_t status;
+
+    if (NULL == member->stream)
+	return ft_reader_next(&(member->rd), &(member->chunk), rbytes);
+
+    if (APR_SUCCESS != (status = member->ops->read(member->stream, member->rd.buf, len, rbytes)))
 	return status;
+    member->chunk = member->rd.buf;
+
+    return (0 == *rbytes) ? APR_EOF : APR_SUCCESS;
+}
+
+static void filecmp_member_close(filecmp_member_t *member)
+{
+    if (NULL == member->stream)
+	ft_reader_close(&(member->rd));
+    else
+	member->ops->close(member->stream);
+}
+
+static apr_status_t filecmp_member_submit(const ft_io_t *io, filecmp_member_t *member, apr_size_t len)
+{
+    return ft_uring_read(io->uring, member->rd.os_fd, member->rd.buf + member->got, len - member->got,
+			 member->rd.offset + (apr_off_t) member->got, member);
+}
+
+/* a read of a member landed, the rest of its chunk is queued if it was short */
+static apr_status_t filecmp_member_complete(const ft_io_t *io, apr_size_t len)
+{
+    filecmp_member_t *member;
+    apr_size_t rbytes;
+    apr_status_t status, rv;
+    void *data;
+
+    if (APR_SUCCESS != (status = ft_uring_wait(io->uring, &data, &rbytes, &rv)))
+	return status;
+    member = data;
+    /* the file may have been truncated since it was stat'ed */
+    if ((APR_SUCCESS == rv) && (0 == rbytes))
+	rv = APR_EOF;
+    if (APR_SUCCESS != rv) {
+	member->status = rv;
+	return APR_SUCCESS;
     }
+    member->got += rbytes;
+    if (member->got < len)
+	return filecmp_member_submit(io, member, len);
+    member->chunk = member->rd.buf;
+    ft_reader_drop(&(member->rd), member->rd.offset, (apr_off_t) len);
+    member->rd.offset += len;
 
     return APR_SUCCESS;
 }
 
-static apr_status_t big_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i)
+/*
+ * Read the next chunk of len bytes of the open members, all at once through
+ * the ring if there is one, except for the ones read with O_DIRECT whose reads
+ * have to stay aligned.
+ */
+static apr_status_t filecmp_members_read(filecmp_member_t *members, apr_size_t nb_members, apr_size_t len,
+					 const ft_io_t *io)
 {
-    unsigned char data_chunk1[HUGE_LEN], data_chunk2[HUGE_LEN];
-    char errbuf[128];
-    apr_size_t rbytes1, rbytes2;
-    apr_file_t *fd1 = NULL, *fd2 = NULL;
-    apr_status_t status1, status2;
+    apr_size_t m, want;
+    apr_status_t status;
 
-    if (0 == size) {
-	*i = 0;
-	return APR_SUCCESS;
+    for (m = 0; m < nb_members; m++) {
+	if (!members[m].open)
+	    continue;
+	if ((NULL == io->uring) || members[m].rd.direct || members[m].rd.use_mmap || (NULL != members[m].stream)) {
+	    status = filecmp_member_next(&(members[m]), len, &want);
+	    if ((APR_SUCCESS == status) && (len != want))
+		status = APR_EOF;
+	    members[m].status = status;
+	    continue;
+	}
+	ft_reader_buffer(&(members[m].rd));
+	members[m].got = 0;
+	members[m].status = APR_SUCCESS;
+	/* more members than the depth of the ring, wait for room */
+	while (APR_EAGAIN == (status = filecmp_member_submit(io, &(members[m]), len))) {
+	    if (APR_SUCCESS != (status = filecmp_member_complete(io, len)))
+		return status;
+	}
+	if (APR_SUCCESS != status)
+	    return status;
     }
+    while ((NULL != io->uring) && (0 != ft_uring_pending(io->uring))) {
+	if (APR_SUCCESS != (status = filecmp_member_complete(io, len)))
+	    return status;
+    }
+
+    return APR_SUCCESS;
+}
 
-    status1 = apr_file_open(&fd1, fname1, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
-    if (APR_SUCCESS != status1) {
-	return status1;
+/*
+ * The members are read from the start of the files in lockstep chunks, a
+ * class being split as soon as the chunks of its members differ, and a
+ * member left alone in its class is not read anymore. A member that cannot
+ * be read is closed, statuses[m] telling why.
+ */
+static apr_status_t filecmp_members(filecmp_member_t *members, apr_size_t nb_members, apr_off_t size,
+				    const ft_io_t *io, const char *const *names, apr_status_t *statuses,
+				    apr_size_t *counts)
+{
+    char errbuf[128];
+    apr_off_t offset;
+    apr_size_t m, l, len, nb_alive;
+    apr_status_t status = APR_SUCCESS;
+
+    /* the members that could be opened start in the same class */
+    for (m = 0, l = nb_members, nb_alive = 0; m < nb_members; m++) {
+	if (!members[m].open) {
+	    members[m].cls = m;
+	    continue;
+	}
+	if (nb_members == l)
+	    l = m;
+	members[m].cls = l;
+	nb_alive++;
     }
 
-    status1 = apr_file_open(&fd2, fname2, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
-    if (APR_SUCCESS != status1) {
-	apr_file_close(fd1);
-	return status1;
+    for (offset = 0; (offset < size) && (1 < nb_alive); offset += len) {
+	len = (apr_size_t) FTWIN_MIN(size - offset, (apr_off_t) io->block_len);
+	if (APR_SUCCESS != (status = filecmp_members_read(members, nb_members, len, io))) {
+	    ft_uring_drain(io->uring);
+	    break;
+	}
+	for (m = 0; m < nb_members; m++) {
+	    if (members[m].open && (APR_SUCCESS != members[m].status)) {
+		DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", names[members[m].idx],
+			  apr_strerror(members[m].status, errbuf, 128));
+		statuses[m] = members[m].status;
+		filecmp_member_close(&(members[m]));
+		members[m].open = 0;
+	    }
+	}
+	for (m = 0; m < nb_members; m++)
+	    members[m].prev = members[m].cls;
+	for (m = 0; m < nb_members; m++) {
+	    counts[m] = 0;
+	    if (!members[m].open) {
+		members[m].cls = m;
+		continue;
+	    }
+	    /* compare with the leaders of the classes already split from the same class */
+	    members[m].cls = m;
+	    for (l = members[m].prev; l < m; l++) {
+		if ((members[l].open) && (l == members[l].cls) && (members[l].prev == members[m].prev)
+		    && (0 == memcmp(members[l].chunk, members[m].chunk, len))) {
+		    members[m].cls = l;
+		    break;
+		}
+	    }
+	}
+
+	for (m = 0; m < nb_members; m++) {
+	    if (members[m].open)
+		counts[members[m].cls]++;
+	}
+	for (m = 0, nb_alive = 0; m < nb_members; m++) {
+	    if (!members[m].open)
+		continue;
+	    if (1 == counts[members[m].cls]) {
+		filecmp_member_close(&(members[m]));
+		members[m].open = 0;
+		continue;
+	    }
+	    nb_alive++;
+	}
     }
 
-    do {
-	rbytes1 = HUGE_LEN;
-	status1 = apr_file_read(fd1, data_chunk1, &rbytes1);
-	rbytes2 = rbytes1;
-	status2 = apr_file_read(fd2, data_chunk2, &rbytes2);
-	if ((APR_SUCCESS == status1) && (APR_SUCCESS == status2) && (rbytes2 == rbytes1)) {
-	    *i = memcmp(data_chunk1, data_chunk2, rbytes1);
+    for (m = 0; m < nb_members; m++) {
+	if (members[m].open) {
+	    filecmp_member_close(&(members[m]));
+	    members[m].open = 0;
 	}
-    } while ((APR_SUCCESS == status1) && (APR_SUCCESS == status2) && (0 == *i) && (rbytes2 == rbytes1));
+    }
+
+    return status;
+}
 
-    if ((APR_EOF != status1) && (APR_EOF != status2) && (0 == *i)) {
-	DEBUG_ERR("1:unable to read %s (%" APR_SIZE_T_FMT "): %s", fname1, rbytes1, apr_strerror(status1, errbuf, 128));
-	DEBUG_ERR("2:unable to read %s (%" APR_SIZE_T_FMT "): %s", fname2, rbytes2, apr_strerror(status2, errbuf, 128));
-	return status1;
+extern apr_status_t filecmp_group(apr_pool_t *pool, const char *const *names, apr_size_t nb_files, apr_off_t size,
+				  const ft_io_t *io, apr_size_t *twins, apr_status_t *statuses)
+{
+    return filecmp_group_streams(pool, names, nb_files, size, io, NULL, NULL, twins, statuses);
+}
+
+extern apr_status_t filecmp_group_streams(apr_pool_t *pool, const char *const *names, apr_size_t nb_files,
+					  apr_off_t size, const ft_io_t *io, const ft_stream_ops_t *ops, void *ctx,
+					  apr_size_t *twins, apr_status_t *statuses)
+{
+    char errbuf[128];
+    filecmp_member_t *members;
+    apr_status_t *batch;
+    apr_size_t *reps, *counts;
+    apr_size_t k, m, nb_reps, nb_members, first, nb_new;
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+
+    for (k = 0; k < nb_files; k++) {
+	twins[k] = (0 == size) ? 0 : k;
+	statuses[k] = APR_SUCCESS;
     }
+    if ((0 == size) || (2 > nb_files))
+	return APR_SUCCESS;
 
-    if (APR_SUCCESS != (status1 = apr_file_close(fd2))) {
-	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status1, errbuf, 128));
-	apr_file_close(fd1);
-	return status1;
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
     }
+    members = apr_palloc(pool, nb_files * sizeof(struct filecmp_member_t));
+    counts = apr_palloc(pool, nb_files * sizeof(apr_size_t));
+    reps = apr_palloc(pool, nb_files * sizeof(apr_size_t));
+    batch = apr_palloc(pool, nb_files * sizeof(apr_status_t));
+    nb_reps = 0;
+
+    /*
+     * too many files are compared a few at a time, against a file of each
+     * content found so far. The outcome of a representative is the one of its
+     * first batch: if it cannot be read again, only the files of the later
+     * batch miss it, the ones already mapped to it stay its twins.
+     */
+    for (first = 0; first < nb_files; first += nb_new) {
+	nb_new = FILECMP_GROUP_MAX_OPEN - FTWIN_MIN(nb_reps, FILECMP_GROUP_MAX_OPEN / 2);
+	nb_new = FTWIN_MIN(nb_new, nb_files - first);
+	nb_members = nb_reps + nb_new;
+	for (m = 0; m < nb_members; m++) {
+	    members[m].idx = (m < nb_reps) ? reps[m] : first + m - nb_reps;
+	    batch[m] = filecmp_member_open(&(members[m]), io, names[members[m].idx], size, ops, ctx, gc_pool);
+	    members[m].open = (APR_SUCCESS == batch[m]);
+	}
+
+	if (APR_SUCCESS != (status = filecmp_members(members, nb_members, size, io, names, batch, counts))) {
+	    DEBUG_ERR("error calling filecmp_members: %s", apr_strerror(status, errbuf, 128));
+	    apr_pool_destroy(gc_pool);
+	    return status;
+	}
 
-    if (APR_SUCCESS != (status1 = apr_file_close(fd1))) {
-	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status1, errbuf, 128));
-	return status1;
+	/* a representative that failed is not tried again */
+	for (m = 0, k = 0; m < nb_reps; m++) {
+	    if (APR_SUCCESS == batch[m])
+		reps[k++] = reps[m];
+	}
+	nb_reps = k;
+	for (m = nb_members - nb_new; m < nb_members; m++) {
+	    k = members[m].idx;
+	    if (APR_SUCCESS != (statuses[k] = batch[m]))
+		continue;
+	    twins[k] = members[members[m].cls].idx;
+	    if (k == twins[k])
+		reps[nb_reps++] = k;
+	}
+	apr_pool_clear(gc_pool);
     }
+    apr_pool_destroy(gc_pool);
 
     return APR_SUCCESS;
 }
 
-extern apr_status_t filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, apr_off_t excess_size,
-			    int *i)
+extern apr_status_t filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size,
+			    const ft_io_t *io, int *i)
 {
-    if (size < excess_size)
-	return small_filecmp(pool, fname1, fname2, size, i);
+    const char *names[2];
+    apr_size_t twins[2];
+    apr_status_t statuses[2];
+    apr_status_t status;
 
-    return big_filecmp(pool, fname1, fname2, size, i);
+    names[0] = fname1;
+    names[1] = fname2;
+    if (APR_SUCCESS != (status = filecmp_group(pool, names, 2, size, io, twins, statuses)))
+	return status;
+    if (APR_SUCCESS != statuses[0])
+	return statuses[0];
+    if (APR_SUCCESS != statuses[1])
+	return statuses[1];
+    *i = (0 == twins[1]) ? 0 : 1;
+
+    return APR_SUCCESS;
+}
+
+#if HAVE_DECL_FIDEDUPERANGE
+/* bytes of a range, btrfs deduplicates at most 16 MiB per call */
+#define FILEDEDUPE_LEN (16 * 1024 * 1024)
+/* destinations of a call, its argument has to fit in a page */
+#define FILEDEDUPE_MAX_DESTS 120
+
+/*
+ * Deduplicate the nb_dests files opened as fds with the file opened as src,
+ * range by range, a destination being left out of the next ranges as soon as
+ * it differs, differs[d] being set for it. The kernel may stop short of a
+ * range: the next one starts where it stopped for all the destinations, so
+ * that only the bytes it compared count as deduplicated.
+ */
+static apr_status_t filededupe_dests(int src, const int *fds, apr_size_t nb_dests, apr_off_t size,
+				     struct file_dedupe_range *range, unsigned char *differs, apr_off_t *deduped)
+{
+    apr_size_t left[FILEDEDUPE_MAX_DESTS];
+    apr_size_t d, nb_left;
+    apr_off_t offset, done;
+
+    for (d = 0; d < nb_dests; d++) {
+	differs[d] = 0;
+	left[d] = d;
+    }
+    nb_left = nb_dests;
+    for (offset = 0; (offset < size) && (0 < nb_left); offset += done) {
+	memset(range, 0, sizeof(struct file_dedupe_range) + nb_left * sizeof(struct file_dedupe_range_info));
+	range->src_offset = offset;
+	range->src_length = FTWIN_MIN(size - offset, FILEDEDUPE_LEN);
+	range->dest_count = nb_left;
+	for (d = 0; d < nb_left; d++) {
+	    range->info[d].dest_fd = fds[left[d]];
+	    range->info[d].dest_offset = offset;
+	}
+	/* not supported by the filesystem, or across filesystems */
+	if (0 != ioctl(src, FIDEDUPERANGE, range))
+	    return APR_ENOTIMPL;
+	done = range->src_length;
+	for (d = 0; d < range->dest_count; d++) {
+	    if (0 > range->info[d].status)
+		return APR_ENOTIMPL;
+	    if ((FILE_DEDUPE_RANGE_SAME == range->info[d].status) && ((apr_off_t) range->info[d].bytes_deduped < done))
+		done = range->info[d].bytes_deduped;
+	}
+	/* no progress, the files are compared instead */
+	if (0 == done)
+	    return APR_ENOTIMPL;
+	for (d = 0, nb_left = 0; d < range->dest_count; d++) {
+	    if (FILE_DEDUPE_RANGE_SAME == range->info[d].status) {
+		*deduped += done;
+		left[nb_left++] = left[d];
+	    }
+	    else {
+		differs[left[d]] = 1;
+	    }
+	}
+    }
+
+    return APR_SUCCESS;
+}
+#endif
+
+extern apr_status_t filededupe_group(apr_pool_t *pool, const char *const *names, apr_size_t nb_files, apr_off_t size,
+				     apr_size_t *twins, apr_status_t *statuses, apr_off_t *deduped)
+{
+#if HAVE_DECL_FIDEDUPERANGE
+    char errbuf[128];
+    struct file_dedupe_range *range;
+    apr_file_t *fd;
+    apr_os_file_t src;
+    apr_size_t *dests;
+    int *fds;
+    unsigned char *decided, *differs;
+    apr_size_t k, d, s, first, nb_dests;
+    apr_pool_t *src_pool, *gc_pool;
+    apr_status_t status;
+#endif
+    apr_size_t i;
+
+    *deduped = 0;
+    for (i = 0; i < nb_files; i++) {
+	twins[i] = (0 == size) ? 0 : i;
+	statuses[i] = APR_SUCCESS;
+    }
+    if ((0 == size) || (2 > nb_files))
+	return APR_SUCCESS;
+
+#if HAVE_DECL_FIDEDUPERANGE
+    if (APR_SUCCESS != (status = apr_pool_create(&src_pool, pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(src_pool);
+	return status;
+    }
+    range = apr_palloc(pool, sizeof(struct file_dedupe_range)
+		       + FILEDEDUPE_MAX_DESTS * sizeof(struct file_dedupe_range_info));
+    dests = apr_palloc(pool, FILEDEDUPE_MAX_DESTS * sizeof(apr_size_t));
+    fds = apr_palloc(pool, FILEDEDUPE_MAX_DESTS * sizeof(int));
+    differs = apr_palloc(pool, FILEDEDUPE_MAX_DESTS);
+    decided = apr_pcalloc(pool, nb_files);
+
+    /* each file left is the source of the ones left after it, those that differ being left for the next one */
+    for (s = 0; s < nb_files; s++) {
+	if (decided[s])
+	    continue;
+	decided[s] = 1;
+	if (APR_SUCCESS != (status = apr_file_open(&fd, names[s], APR_READ | APR_BINARY, APR_OS_DEFAULT, src_pool))) {
+	    statuses[s] = status;
+	    continue;
+	}
+	apr_os_file_get(&src, fd);
+	/* the destinations are opened a call at a time */
+	for (first = s + 1; first < nb_files; first = k) {
+	    for (k = first, nb_dests = 0; (k < nb_files) && (nb_dests < FILEDEDUPE_MAX_DESTS); k++) {
+		if (decided[k])
+		    continue;
+		/* the owner of a file may deduplicate it read-only */
+		status = apr_file_open(&fd, names[k], APR_READ | APR_WRITE | APR_BINARY, APR_OS_DEFAULT, gc_pool);
+		if (APR_SUCCESS != status)
+		    status = apr_file_open(&fd, names[k], APR_READ | APR_BINARY, APR_OS_DEFAULT, gc_pool);
+		if (APR_SUCCESS != status) {
+		    decided[k] = 1;
+		    statuses[k] = status;
+		    continue;
+		}
+		apr_os_file_get(&(fds[nb_dests]), fd);
+		dests[nb_dests++] = k;
+	    }
+	    if (APR_SUCCESS != (status = filededupe_dests(src, fds, nb_dests, size, range, differs, deduped))) {
+		apr_pool_destroy(gc_pool);
+		apr_pool_destroy(src_pool);
+		return status;
+	    }
+	    for (d = 0; d < nb_dests; d++) {
+		if (!differs[d]) {
+		    twins[dests[d]] = s;
+		    decided[dests[d]] = 1;
+		}
+	    }
+	    apr_pool_clear(gc_pool);
+	}
+	apr_pool_clear(src_pool);
+    }
+    apr_pool_destroy(gc_pool);
+    apr_pool_destroy(src_pool);
+
+    return APR_SUCCESS;
+#else
+    return APR_ENOTIMPL;
+#endif
 }
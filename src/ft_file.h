@@ -20,13 +20,111 @@
 
 #include <apr_pools.h>
 
-#define FTWIN_MIN(a,b) ((a)<(b)) ? (a) : (b)
+#define FTWIN_MIN(a,b) (((a)<(b)) ? (a) : (b))
+#define FTWIN_MAX(a,b) (((a)>(b)) ? (a) : (b))
 
-/* hash result is not the same for a same file whether it is considered as big or small, so use carefully */
-apr_status_t checksum_file(const char *filename, apr_off_t size, apr_off_t excess_size, apr_uint32_t *state,
-			   apr_pool_t *gc_pool);
+#include "ft_hash.h"
+#include "ft_uring.h"
 
-apr_status_t filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, apr_off_t excess_size,
+/* I/O settings of the reads done to checksum and compare files */
+typedef struct ft_io_t
+{
+    apr_off_t excess_size;	/* files of at least this size are never mmap'ed */
+    apr_size_t block_len;	/* read size, a power of two */
+    apr_size_t mmap_window;	/* files are mmap'ed this many bytes at a time, 0 to always read them */
+    int flags;			/* FT_IO_* */
+    ft_uring_t *uring;		/* reads are asynchronous through it if not NULL, from a single thread then */
+} ft_io_t;
+
+/* advise sequential reads, and drop the pages read from the page cache */
+#define FT_IO_FADVISE 0x1
+/* read with O_DIRECT, bypassing the page cache, instead of mmap'ing or reading through it */
+#define FT_IO_DIRECT 0x2
+
+#define FT_IO_BLOCK_LEN (64 * 1024)
+#define FT_IO_MMAP_WINDOW (16 * 1024 * 1024)
+
+/* default settings */
+void ft_io_init(ft_io_t *io);
+
+/* digest does not depend on io, i.e. on the way the file is read */
+apr_status_t checksum_file(const char *filename, apr_off_t size, const ft_io_t *io, const ft_hash_t *hash,
+			   apr_uint32_t *digest, apr_pool_t *gc_pool);
+
+/*
+ * hash nb_blocks blocks of block_len bytes starting at the given offsets, seeded with the previous value of digest,
+ * so that calls can be chained.
+ */
+apr_status_t checksum_file_blocks(const char *filename, const apr_off_t *offsets, apr_size_t nb_blocks,
+				  apr_size_t block_len, const ft_io_t *io, const ft_hash_t *hash, apr_uint32_t *digest,
+				  apr_pool_t *gc_pool);
+
+/* a file to checksum with checksum_files */
+typedef struct ft_checksum_job_t
+{
+    const char *filename;
+    apr_off_t size;
+    const apr_off_t *offsets;	/* of the blocks to hash as checksum_file_blocks does, NULL to hash the whole file */
+    apr_size_t nb_blocks;
+    apr_size_t block_len;
+    apr_uint32_t *digest;	/* seed of the blocks digest, then the result */
+    void *data;			/* for the caller */
+} ft_checksum_job_t;
+
+/* next file to checksum, NULL if there is none left */
+typedef ft_checksum_job_t *(ft_checksum_next_fn_t) (void *ctx);
+
+/* called once per job, when its digest is computed or status tells why it could not be */
+typedef void (ft_checksum_done_fn_t) (void *ctx, ft_checksum_job_t *job, apr_status_t status);
+
+/*
+ * Checksum the files handed out by next until it returns NULL, with the same
+ * digests as checksum_file and checksum_file_blocks. Through io->uring, up to
+ * its depth files are read at once and each file is hashed as its reads
+ * complete, otherwise they are read one after the other. A job belongs to the
+ * caller again once done is called for it.
+ */
+apr_status_t checksum_files(const ft_io_t *io, const ft_hash_t *hash, ft_checksum_next_fn_t *next,
+			    ft_checksum_done_fn_t *done, void *ctx, apr_pool_t *pool);
+
+/* *i is 0 if the files have the same content */
+apr_status_t filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, const ft_io_t *io,
 		     int *i);
 
+/*
+ * Compare the nb_files files of names, of size bytes each, in a single pass:
+ * they are read together, chunk by chunk, and split as soon as their chunks
+ * differ. On return, twins[k] is the index of the first file with the same
+ * content as names[k], k itself if there is none before it or if it could not
+ * be read, statuses[k] telling why.
+ */
+apr_status_t filecmp_group(apr_pool_t *pool, const char *const *names, apr_size_t nb_files, apr_off_t size,
+			   const ft_io_t *io, apr_size_t *twins, apr_status_t *statuses);
+
+/* contents that are not plain files, such as archive members, compared by filecmp_group_streams */
+typedef struct ft_stream_ops_t
+{
+    /* open the content k of the group, *stream being left NULL if it is the plain file names[k] */
+    apr_status_t (*open) (void *ctx, apr_size_t k, void **stream, apr_pool_t *pool);
+    /* read the next len bytes of stream into buf, *rbytes is shorter only at its end */
+    apr_status_t (*read) (void *stream, unsigned char *buf, apr_size_t len, apr_size_t *rbytes);
+    void (*close) (void *stream);
+} ft_stream_ops_t;
+
+/* as filecmp_group, the contents opened as streams by ops being read from start to end through it */
+apr_status_t filecmp_group_streams(apr_pool_t *pool, const char *const *names, apr_size_t nb_files, apr_off_t size,
+				   const ft_io_t *io, const ft_stream_ops_t *ops, void *ctx, apr_size_t *twins,
+				   apr_status_t *statuses);
+
+/*
+ * As filecmp_group, but the files are deduplicated by the kernel instead of
+ * being read (FIDEDUPERANGE): the first file of each content shares its
+ * extents with its twins, the kernel comparing their bytes range by range.
+ * *deduped is the number of bytes it deduplicated. APR_ENOTIMPL if the
+ * filesystem or the kernel can't deduplicate these files, in which case some
+ * of them may have been deduplicated and they are to be compared instead.
+ */
+apr_status_t filededupe_group(apr_pool_t *pool, const char *const *names, apr_size_t nb_files, apr_off_t size,
+			      apr_size_t *twins, apr_status_t *statuses, apr_off_t *deduped);
+
 #endif /* FT_FILE_H */
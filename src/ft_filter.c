@@ -0,0 +1,408 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <pcre.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "debug.h"
+#include "ft_filter.h"
+#include "napr_hash.h"
+
+/* pcre >= 8.20 compiles the studied regexes to machine code */
+#ifdef PCRE_STUDY_JIT_COMPILE
+#define FT_PCRE_STUDY PCRE_STUDY_JIT_COMPILE
+#else
+#define FT_PCRE_STUDY 0
+#endif
+
+struct ft_regex_t
+{
+    pcre *code;
+    pcre_extra *extra;		/* NULL if the study found nothing to speed it up */
+};
+
+/* the kinds of globs, each one is gathered in an alternation */
+enum
+{
+    FT_GLOB_NAME = 0,
+    FT_GLOB_NAME_DIR,
+    FT_GLOB_PATH,
+    FT_GLOB_PATH_DIR,
+    FT_GLOB_NB
+};
+
+struct ft_filter_t
+{
+    apr_pool_t *pool;
+    napr_hash_t *names;
+    char *globs[FT_GLOB_NB];	/* the regexes translated from the globs, until compiled */
+    ft_regex_t *sets[FT_GLOB_NB];
+    ft_regex_t *ignore;
+    ft_regex_t *whitelist;
+    apr_array_header_t *roots;	/* const char * */
+};
+
+static apr_status_t ft_regex_cleanup(void *data)
+{
+    ft_regex_t *re = data;
+
+    if (NULL != re->extra)
+#ifdef PCRE_STUDY_JIT_COMPILE
+	pcre_free_study(re->extra);
+#else
+	pcre_free(re->extra);
+#endif
+    pcre_free(re->code);
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_regex_compile(ft_regex_t **re, const char *regex, int caseless, apr_pool_t *pool)
+{
+    const char *errptr;
+    int erroffset, options = PCRE_DOLLAR_ENDONLY | PCRE_DOTALL;
+    ft_regex_t *result;
+
+    if (caseless)
+	options |= PCRE_CASELESS;
+
+    result = apr_palloc(pool, sizeof(struct ft_regex_t));
+    result->code = pcre_compile(regex, options, &errptr, &erroffset, NULL);
+    if (NULL == result->code) {
+	DEBUG_ERR("can't parse %s at [%.*s]: %s", regex, erroffset, regex, errptr);
+	return APR_EINVAL;
+    }
+    /* the study is only an optimization, the regex is used without it if it fails */
+    result->extra = pcre_study(result->code, FT_PCRE_STUDY, &errptr);
+    if (NULL != errptr)
+	DEBUG_ERR("can't study %s: %s", regex, errptr);
+    apr_pool_cleanup_register(pool, result, ft_regex_cleanup, apr_pool_cleanup_null);
+    *re = result;
+
+    return APR_SUCCESS;
+}
+
+extern int ft_regex_match(const ft_regex_t *re, const char *subject, apr_size_t len)
+{
+    return 0 <= pcre_exec(re->code, re->extra, subject, len, 0, 0, NULL, 0);
+}
+
+extern ft_filter_t *ft_filter_make(apr_pool_t *pool)
+{
+    ft_filter_t *result;
+    apr_uint32_t hash_value;
+    int i;
+
+    result = apr_palloc(pool, sizeof(struct ft_filter_t));
+    result->pool = pool;
+    result->names = napr_hash_str_make(pool, 32, 8);
+    for (i = 0; i < FT_GLOB_NB; i++) {
+	result->globs[i] = NULL;
+	result->sets[i] = NULL;
+    }
+    result->ignore = NULL;
+    result->whitelist = NULL;
+    result->roots = apr_array_make(pool, 4, sizeof(const char *));
+
+    /* To avoid endless loop, ignore looping directory ;) */
+    napr_hash_search(result->names, ".", 1, &hash_value);
+    napr_hash_set(result->names, ".", hash_value);
+    napr_hash_search(result->names, "..", 2, &hash_value);
+    napr_hash_set(result->names, "..", hash_value);
+
+    return result;
+}
+
+extern void ft_filter_add_names(ft_filter_t *filter, const char *list)
+{
+    const char *filename, *end;
+    apr_uint32_t hash_value;
+    char *tmp;
+
+    filename = list;
+    do {
+	end = strchr(filename, ',');
+	if (NULL != end) {
+	    tmp = apr_pstrndup(filter->pool, filename, end - filename);
+	}
+	else {
+	    tmp = apr_pstrdup(filter->pool, filename);
+	}
+	if (NULL == napr_hash_search(filter->names, tmp, strlen(tmp), &hash_value))
+	    napr_hash_set(filter->names, tmp, hash_value);
+
+	filename = end + 1;
+    } while ((NULL != end) && ('\0' != *filename));
+}
+
+/* append c to the regex at out, escaped if it means something to a regex */
+static char *ft_glob_literal(char *out, char c)
+{
+    if (NULL != strchr(".^$|()+{}[]*?\\", c))
+	*out++ = '\\';
+    *out++ = c;
+
+    return out;
+}
+
+/* the regex matching the same strings as the len bytes of glob */
+static char *ft_glob_to_regex(const char *glob, apr_size_t len, apr_pool_t *pool)
+{
+    char *result, *out;
+    apr_size_t i, j, start;
+
+    /* a byte of the glob takes 5 bytes of regex at most, for a '*' */
+    result = out = apr_palloc(pool, 5 * len + 1);
+    for (i = 0; i < len; i++) {
+	switch (glob[i]) {
+	case '*':
+	    if ((i + 1 < len) && ('*' == glob[i + 1])) {
+		i++;
+		if ((i + 1 < len) && ('/' == glob[i + 1])) {
+		    i++;
+		    memcpy(out, "(.*/)?", 6);
+		    out += 6;
+		}
+		else {
+		    memcpy(out, ".*", 2);
+		    out += 2;
+		}
+	    }
+	    else {
+		memcpy(out, "[^/]*", 5);
+		out += 5;
+	    }
+	    break;
+	case '?':
+	    memcpy(out, "[^/]", 4);
+	    out += 4;
+	    break;
+	case '[':
+	    /* a bracket expression is kept as is, a lone '[' is literal */
+	    start = i + 1;
+	    if ((start < len) && (('!' == glob[start]) || ('^' == glob[start])))
+		start++;
+	    for (j = start + ((start < len) && (']' == glob[start])); (j < len) && (']' != glob[j]); j++);
+	    if (j >= len) {
+		out = ft_glob_literal(out, '[');
+		break;
+	    }
+	    *out++ = '[';
+	    if (start != i + 1)
+		*out++ = '^';
+	    memcpy(out, glob + start, j - start);
+	    out += j - start;
+	    *out++ = ']';
+	    i = j;
+	    break;
+	case '\\':
+	    if (i + 1 < len)
+		i++;
+	    out = ft_glob_literal(out, glob[i]);
+	    break;
+	default:
+	    out = ft_glob_literal(out, glob[i]);
+	    break;
+	}
+    }
+    *out = '\0';
+
+    return result;
+}
+
+extern apr_status_t ft_filter_add_glob(ft_filter_t *filter, const char *glob, int dirs_only)
+{
+    char *regex;
+    apr_size_t len = strlen(glob);
+    int kind, anchored;
+
+    for (; (0 < len) && ('/' == glob[len - 1]); len--)
+	dirs_only = 1;
+    anchored = (0 < len) && ('/' == *glob);
+    if (anchored) {
+	glob++;
+	len--;
+    }
+    if (0 == len) {
+	DEBUG_ERR("empty glob");
+	return APR_EINVAL;
+    }
+
+    kind = (anchored || (NULL != memchr(glob, '/', len))) ? FT_GLOB_PATH : FT_GLOB_NAME;
+    if (dirs_only)
+	kind++;
+    regex = ft_glob_to_regex(glob, len, filter->pool);
+    if (NULL == filter->globs[kind])
+	filter->globs[kind] = regex;
+    else
+	filter->globs[kind] = apr_pstrcat(filter->pool, filter->globs[kind], "|", regex, NULL);
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_filter_read(ft_filter_t *filter, const char *path)
+{
+    char errbuf[128];
+    apr_finfo_t finfo;
+    apr_file_t *fd;
+    apr_pool_t *gc_pool;
+    char *buf, *line, *end;
+    apr_size_t len, nb_lines;
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, filter->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    status = apr_file_open(&fd, path, APR_READ | APR_BINARY, APR_OS_DEFAULT, gc_pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_open(%s): %s", path, apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd))) {
+	DEBUG_ERR("error calling apr_file_info_get(%s): %s", path, apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    buf = apr_palloc(gc_pool, finfo.size + 1);
+    if ((0 < finfo.size) && (APR_SUCCESS != (status = apr_file_read_full(fd, buf, finfo.size, NULL)))) {
+	DEBUG_ERR("error calling apr_file_read_full(%s): %s", path, apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    buf[finfo.size] = '\0';
+
+    for (line = buf, nb_lines = 1; (APR_SUCCESS == status) && ('\0' != *line); line = end, nb_lines++) {
+	if (NULL != (end = strchr(line, '\n')))
+	    *end++ = '\0';
+	else
+	    end = line + strlen(line);
+	/* the trailing blanks are not part of the glob */
+	for (len = strlen(line); (0 < len) && (NULL != strchr(" \t\r", line[len - 1])); len--);
+	line[len] = '\0';
+	if ((0 == len) || ('#' == *line))
+	    continue;
+	if ('!' == *line) {
+	    DEBUG_ERR("%s:%" APR_SIZE_T_FMT ": negated globs are not supported", path, nb_lines);
+	    status = APR_EINVAL;
+	}
+	else if (APR_SUCCESS != (status = ft_filter_add_glob(filter, line, 0))) {
+	    DEBUG_ERR("%s:%" APR_SIZE_T_FMT ": can't use %s", path, nb_lines, line);
+	}
+    }
+    apr_pool_destroy(gc_pool);
+
+    return status;
+}
+
+extern apr_status_t ft_filter_set_regex(ft_filter_t *filter, const char *regex, int whitelist, int caseless)
+{
+    return ft_regex_compile(whitelist ? &(filter->whitelist) : &(filter->ignore), regex, caseless, filter->pool);
+}
+
+extern void ft_filter_add_root(ft_filter_t *filter, const char *root)
+{
+    APR_ARRAY_PUSH(filter->roots, const char *) = apr_pstrdup(filter->pool, root);
+}
+
+extern apr_status_t ft_filter_compile(ft_filter_t *filter)
+{
+    apr_status_t status;
+    int i;
+
+    for (i = 0; i < FT_GLOB_NB; i++) {
+	if (NULL == filter->globs[i])
+	    continue;
+	/* each glob matches the whole name or relative path */
+	status = ft_regex_compile(&(filter->sets[i]), apr_pstrcat(filter->pool, "^(", filter->globs[i], ")$", NULL),
+				  0, filter->pool);
+	if (APR_SUCCESS != status)
+	    return status;
+	filter->globs[i] = NULL;
+    }
+
+    return APR_SUCCESS;
+}
+
+extern int ft_filter_name(const ft_filter_t *filter, const char *name, apr_size_t len)
+{
+    return NULL != napr_hash_search(filter->names, name, len, NULL);
+}
+
+extern apr_size_t ft_filter_rel_offset(const ft_filter_t *filter, const char *path, apr_size_t len)
+{
+    const char *root;
+    apr_size_t result = 0, root_len;
+    int i;
+
+    for (i = 0; i < filter->roots->nelts; i++) {
+	root = APR_ARRAY_IDX(filter->roots, i, const char *);
+	root_len = strlen(root);
+	if ((root_len > len) || (0 != memcmp(path, root, root_len)))
+	    continue;
+	/* the root is followed by a '/' unless it ends with one */
+	if ((root_len < len) && ('/' != root[root_len - 1])) {
+	    if ('/' != path[root_len])
+		continue;
+	    root_len++;
+	}
+	if (root_len > result)
+	    result = root_len;
+    }
+
+    return result;
+}
+
+extern int ft_filter_entry(const ft_filter_t *filter, const char *relpath, apr_size_t rel_len, apr_size_t name_len,
+			   int is_dir)
+{
+    const char *name = relpath + rel_len - name_len;
+
+    if ((NULL != filter->sets[FT_GLOB_NAME]) && ft_regex_match(filter->sets[FT_GLOB_NAME], name, name_len))
+	return 1;
+    if (is_dir && (NULL != filter->sets[FT_GLOB_NAME_DIR])
+	&& ft_regex_match(filter->sets[FT_GLOB_NAME_DIR], name, name_len))
+	return 1;
+    if ((NULL != filter->sets[FT_GLOB_PATH]) && ft_regex_match(filter->sets[FT_GLOB_PATH], relpath, rel_len))
+	return 1;
+    if (is_dir && (NULL != filter->sets[FT_GLOB_PATH_DIR])
+	&& ft_regex_match(filter->sets[FT_GLOB_PATH_DIR], relpath, rel_len))
+	return 1;
+
+    return 0;
+}
+
+extern int ft_filter_path(const ft_filter_t *filter, const char *path, apr_size_t len)
+{
+    if ((NULL != filter->ignore) && ft_regex_match(filter->ignore, path, len))
+	return 1;
+
+    if ((NULL != filter->whitelist) && !ft_regex_match(filter->whitelist, path, len))
+	return 1;
+
+    return 0;
+}
+
+extern apr_size_t ft_filter_nb_rebuild(const ft_filter_t *filter)
+{
+    return napr_hash_get_nb_rebuild(filter->names);
+}
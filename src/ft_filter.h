@@ -0,0 +1,83 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_FILTER_H
+#define FT_FILTER_H
+
+#include <apr_pools.h>
+
+/* a pcre compiled once, studied and JIT compiled where pcre can */
+typedef struct ft_regex_t ft_regex_t;
+
+apr_status_t ft_regex_compile(ft_regex_t **re, const char *regex, int caseless, apr_pool_t *pool);
+
+/* does subject, of len bytes, match re (no substring is captured) */
+int ft_regex_match(const ft_regex_t *re, const char *subject, apr_size_t len);
+
+/*
+ * The rules leaving entries out of the walk, all compiled once:
+ * - the names ignored (-i), looked up in a hash table,
+ * - the globs of an exclusion file or of --prune, matched against the name
+ *   of an entry, or against its path relative to the root it was found
+ *   below if they hold a '/', gathered in a single regex per kind,
+ * - the ignore and whitelist regexes (-e / -w), matched against the path
+ *   of the files.
+ * A directory left out is never opened, nor anything below it.
+ */
+typedef struct ft_filter_t ft_filter_t;
+
+ft_filter_t *ft_filter_make(apr_pool_t *pool);
+
+/* ignore the entries named in the comma-separated list */
+void ft_filter_add_names(ft_filter_t *filter, const char *list);
+
+/*
+ * Leave out the entries matching the glob (*, ? and [...] do not match a
+ * '/', ** matches anything), or only the directories if dirs_only is set
+ * or if the glob ends with a '/'. A leading '/' anchors it at the root.
+ */
+apr_status_t ft_filter_add_glob(ft_filter_t *filter, const char *glob, int dirs_only);
+
+/* add the globs of an exclusion file, one per line, blank lines and lines starting with '#' skipped */
+apr_status_t ft_filter_read(ft_filter_t *filter, const char *path);
+
+/* the path of a file matching regex is ignored, or not matching it if whitelist is set */
+apr_status_t ft_filter_set_regex(ft_filter_t *filter, const char *regex, int whitelist, int caseless);
+
+/* the globs holding a '/' are relative to the roots of the walk */
+void ft_filter_add_root(ft_filter_t *filter, const char *root);
+
+/* compile the globs, the filter is read only from then on */
+apr_status_t ft_filter_compile(ft_filter_t *filter);
+
+/* is name, of len bytes, in the ignore list */
+int ft_filter_name(const ft_filter_t *filter, const char *name, apr_size_t len);
+
+/* the offset of the path relative to the longest root path starts with, 0 if there is none */
+apr_size_t ft_filter_rel_offset(const ft_filter_t *filter, const char *path, apr_size_t len);
+
+/* is the entry matched by a glob, relpath is its path relative to its root, ending with its name */
+int ft_filter_entry(const ft_filter_t *filter, const char *relpath, apr_size_t rel_len, apr_size_t name_len,
+		    int is_dir);
+
+/* is the file at path ignored by the -e / -w regexes */
+int ft_filter_path(const ft_filter_t *filter, const char *path, apr_size_t len);
+
+/* rebuilds of the table of the ignored names */
+apr_size_t ft_filter_nb_rebuild(const ft_filter_t *filter);
+
+#endif /* FT_FILTER_H */
@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "checksum.h"
+#include "ft_hash.h"
+#include "xxh3.h"
+
+struct ft_hash_t
+{
+    const char *name;
+    apr_size_t digest_len;	/* significant bytes of the digest */
+    const char *(*impl) (void);
+    void (*init) (ft_hash_state_t *state);
+    void (*update) (ft_hash_state_t *state, const unsigned char *data, apr_size_t len);
+    void (*final) (ft_hash_state_t *state, apr_uint32_t *digest);
+};
+
+static const char *jenkins_impl(void)
+{
+    return "scalar";
+}
+
+static void jenkins_init(ft_hash_state_t *state)
+{
+    int i;
+
+    for (i = 0; i < HASHSTATE; ++i)
+	state->jenkins.state[i] = 1;
+    state->jenkins.buffered = 0;
+}
+
+static void jenkins_update(ft_hash_state_t *state, const unsigned char *data, apr_size_t len)
+{
+    ft_jenkins_state_t *jenkins = &(state->jenkins);
+    apr_size_t chunk;
+
+    /* complete the chunk left by the previous update first */
+    if (0 != jenkins->buffered) {
+	chunk = FT_JENKINS_CHUNK_LEN - jenkins->buffered;
+	if (len < chunk)
+	    chunk = len;
+	memcpy(jenkins->buf + jenkins->buffered, data, chunk);
+	jenkins->buffered += chunk;
+	data += chunk;
+	len -= chunk;
+	if (FT_JENKINS_CHUNK_LEN != jenkins->buffered)
+	    return;
+	hash((ub1 *) jenkins->buf, FT_JENKINS_CHUNK_LEN, jenkins->state);
+	jenkins->buffered = 0;
+    }
+
+    for (; len >= FT_JENKINS_CHUNK_LEN; data += FT_JENKINS_CHUNK_LEN, len -= FT_JENKINS_CHUNK_LEN)
+	hash((ub1 *) data, FT_JENKINS_CHUNK_LEN, jenkins->state);
+
+    memcpy(jenkins->buf, data, len);
+    jenkins->buffered = len;
+}
+
+static void jenkins_final(ft_hash_state_t *state, apr_uint32_t *digest)
+{
+    ft_jenkins_state_t *jenkins = &(state->jenkins);
+
+    if (0 != jenkins->buffered) {
+	hash((ub1 *) jenkins->buf, (apr_uint32_t) jenkins->buffered, jenkins->state);
+	jenkins->buffered = 0;
+    }
+    memcpy(digest, jenkins->state, HASHSTATE * sizeof(apr_uint32_t));
+}
+
+static void xxh3_init(ft_hash_state_t *state)
+{
+    xxh3_128_reset(&(state->xxh3));
+}
+
+static void xxh3_update(ft_hash_state_t *state, const unsigned char *data, apr_size_t len)
+{
+    xxh3_128_update(&(state->xxh3), data, len);
+}
+
+static void xxh3_final(ft_hash_state_t *state, apr_uint32_t *digest)
+{
+    apr_uint64_t low64, high64;
+
+    xxh3_128_digest(&(state->xxh3), &low64, &high64);
+    memset(digest, 0, HASHSTATE * sizeof(apr_uint32_t));
+    digest[0] = (apr_uint32_t) low64;
+    digest[1] = (apr_uint32_t) (low64 >> 32);
+    digest[2] = (apr_uint32_t) high64;
+    digest[3] = (apr_uint32_t) (high64 >> 32);
+}
+
+static const ft_hash_t hashes[] = {
+    {"xxh3", 4 * sizeof(apr_uint32_t), xxh3_impl_name, xxh3_init, xxh3_update, xxh3_final},
+    {"jenkins", HASHSTATE * sizeof(apr_uint32_t), jenkins_impl, jenkins_init, jenkins_update, jenkins_final},
+};
+
+extern const ft_hash_t *ft_hash_get(const char *name)
+{
+    apr_size_t i;
+
+    for (i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++)
+	if (0 == strcmp(name, hashes[i].name))
+	    return &(hashes[i]);
+
+    return NULL;
+}
+
+extern const ft_hash_t *ft_hash_default(void)
+{
+    return &(hashes[0]);
+}
+
+extern const char *ft_hash_name(const ft_hash_t *hash)
+{
+    return hash->name;
+}
+
+extern apr_size_t ft_hash_digest_len(const ft_hash_t *hash)
+{
+    return hash->digest_len;
+}
+
+extern const char *ft_hash_impl(const ft_hash_t *hash)
+{
+    return hash->impl();
+}
+
+extern void ft_hash_init(const ft_hash_t *hash, ft_hash_state_t *state)
+{
+    hash->init(state);
+}
+
+extern void ft_hash_update(const ft_hash_t *hash, ft_hash_state_t *state, const unsigned char *data, apr_size_t len)
+{
+    hash->update(state, data, len);
+}
+
+extern void ft_hash_final(const ft_hash_t *hash, ft_hash_state_t *state, apr_uint32_t *digest)
+{
+    hash->final(state, digest);
+}
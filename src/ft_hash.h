@@ -0,0 +1,72 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_HASH_H
+#define FT_HASH_H
+
+#include <apr.h>
+
+#include "checksum.h"
+#include "xxh3.h"
+
+/* Content hash backends behind checksum_file(), picked at runtime */
+
+/*
+ * Bob Jenkins' hash() result depends on the way the input is split, it is
+ * always fed with chunks of this size, buffered across the updates, so that
+ * digests don't depend on the way the content is read.
+ */
+#define FT_JENKINS_CHUNK_LEN 4096
+
+typedef struct ft_jenkins_state_t
+{
+    apr_uint32_t state[HASHSTATE];
+    apr_size_t buffered;	/* bytes of buf waiting for a chunk to be full */
+    unsigned char buf[FT_JENKINS_CHUNK_LEN];
+} ft_jenkins_state_t;
+
+typedef union ft_hash_state_t
+{
+    ft_jenkins_state_t jenkins;
+    xxh3_state_t xxh3;
+} ft_hash_state_t;
+
+typedef struct ft_hash_t ft_hash_t;
+
+/* comma-separated list of the available backends, for usage */
+#define FT_HASH_NAMES "jenkins, xxh3"
+
+/* returns the backend called name, NULL if there is none */
+const ft_hash_t *ft_hash_get(const char *name);
+
+/* returns the backend used when none is asked */
+const ft_hash_t *ft_hash_default(void);
+
+const char *ft_hash_name(const ft_hash_t *hash);
+
+/* number of significant bytes at the start of the digest, the others are zero */
+apr_size_t ft_hash_digest_len(const ft_hash_t *hash);
+
+/* name of the implementation picked according to the CPU features, call it before using the hash in threads */
+const char *ft_hash_impl(const ft_hash_t *hash);
+
+void ft_hash_init(const ft_hash_t *hash, ft_hash_state_t *state);
+void ft_hash_update(const ft_hash_t *hash, ft_hash_state_t *state, const unsigned char *data, apr_size_t len);
+/* digest is HASHSTATE apr_uint32_t long whatever the backend, unused bits are zeroed */
+void ft_hash_final(const ft_hash_t *hash, ft_hash_state_t *state, apr_uint32_t *digest);
+
+#endif /* FT_HASH_H */
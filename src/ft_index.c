@@ -0,0 +1,323 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "ft_index.h"
+
+#define FT_INDEX_MAGIC 0x46544931	/* "FTI1", also tells the byte order */
+#define FT_INDEX_VERSION 3	/* 2: full digests chained over growing chunks, 3: jenkins ones buffered across the reads */
+#define FT_INDEX_HASH_NAME_LEN 16
+#define FT_INDEX_HOST_LEN 256
+/* longer names are a corrupted file */
+#define FT_INDEX_MAX_NAME_LEN (1 << 20)
+
+typedef struct ft_index_header_t
+{
+    apr_uint32_t magic;
+    apr_uint32_t version;
+    char hash[FT_INDEX_HASH_NAME_LEN];
+    char host[FT_INDEX_HOST_LEN];
+    apr_uint32_t digest_len;
+    apr_uint32_t nb_slots;
+    apr_uint32_t block_len;
+    apr_uint32_t nb_samples;
+    apr_uint64_t nb_recs;
+} ft_index_header_t;
+
+/* followed by the digests of the mask, the suffix of the path and the member name */
+typedef struct ft_index_file_rec_t
+{
+    apr_uint64_t size;
+    apr_int64_t mtime;
+    apr_uint32_t mask;
+    apr_uint32_t prefix_len;	/* bytes shared with the path of the previous record */
+    apr_uint32_t suffix_len;
+    apr_uint32_t subpath_len;	/* 0 for a file, the length of the member name + 1 for an archive member */
+} ft_index_file_rec_t;
+
+struct ft_index_t
+{
+    apr_pool_t *pool;
+    const char *path;
+    const char *tmp_path;	/* NULL if the index is read */
+    apr_file_t *fd;
+    ft_index_header_t header;
+    apr_uint64_t nb_done;	/* records written or read */
+    apr_off_t last_size;
+    char *path_buf;		/* path of the previous record */
+    apr_size_t path_len;
+    apr_size_t path_size;
+    char *subpath_buf;
+    apr_size_t subpath_size;
+};
+
+/* grow *buf to hold len bytes and a '\0', the contents being kept */
+static void ft_index_reserve(ft_index_t *index, char **buf, apr_size_t *size, apr_size_t len)
+{
+    char *tmp;
+
+    if (*size > len)
+	return;
+    tmp = apr_palloc(index->pool, 2 * (len + 1));
+    if (NULL != *buf)
+	memcpy(tmp, *buf, *size);
+    *buf = tmp;
+    *size = 2 * (len + 1);
+}
+
+extern apr_status_t ft_index_create(ft_index_t **index, const char *path, const char *host, const ft_hash_t *hash,
+				    apr_uint32_t nb_slots, apr_uint32_t block_len, apr_uint32_t nb_samples,
+				    apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_index_t *result;
+    apr_status_t status;
+
+    if (FT_INDEX_MAX_SLOTS < nb_slots)
+	return APR_EINVAL;
+    result = apr_pcalloc(pool, sizeof(struct ft_index_t));
+    result->pool = pool;
+    result->path = apr_pstrdup(pool, path);
+    result->tmp_path = apr_pstrcat(pool, path, ".tmp", NULL);
+    result->header.magic = FT_INDEX_MAGIC;
+    result->header.version = FT_INDEX_VERSION;
+    apr_cpystrn(result->header.hash, ft_hash_name(hash), FT_INDEX_HASH_NAME_LEN);
+    apr_cpystrn(result->header.host, host, FT_INDEX_HOST_LEN);
+    result->header.digest_len = ft_hash_digest_len(hash);
+    result->header.nb_slots = nb_slots;
+    result->header.block_len = block_len;
+    result->header.nb_samples = nb_samples;
+    result->last_size = -1;
+
+    status = apr_file_open(&(result->fd), result->tmp_path,
+			   APR_WRITE | APR_CREATE | APR_TRUNCATE | APR_BUFFERED | APR_BINARY, APR_OS_DEFAULT, pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_open(%s): %s", result->tmp_path, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    /* written again with the number of records once they are all written */
+    status = apr_file_write_full(result->fd, &(result->header), sizeof(ft_index_header_t), NULL);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(result->fd);
+	return status;
+    }
+    *index = result;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_index_write(ft_index_t *index, const ft_index_rec_t *rec)
+{
+    char errbuf[128];
+    ft_index_file_rec_t frec;
+    apr_size_t len, prefix_len, subpath_len;
+    apr_uint32_t slot;
+    apr_status_t status;
+
+    if (((0 <= index->last_size) && (rec->size > index->last_size))
+	|| (0 != (rec->mask & ~((1U << index->header.nb_slots) - 1))))
+	return APR_EINVAL;
+
+    len = strlen(rec->path);
+    subpath_len = (NULL != rec->subpath) ? strlen(rec->subpath) : 0;
+    if ((FT_INDEX_MAX_NAME_LEN <= len) || (FT_INDEX_MAX_NAME_LEN <= subpath_len))
+	return APR_EINVAL;
+    for (prefix_len = 0; (prefix_len < len) && (prefix_len < index->path_len)
+	 && (rec->path[prefix_len] == index->path_buf[prefix_len]); prefix_len++);
+
+    memset(&frec, 0, sizeof(frec));
+    frec.size = rec->size;
+    frec.mtime = rec->mtime;
+    frec.mask = rec->mask;
+    frec.prefix_len = prefix_len;
+    frec.suffix_len = len - prefix_len;
+    frec.subpath_len = (NULL != rec->subpath) ? subpath_len + 1 : 0;
+    status = apr_file_write_full(index->fd, &frec, sizeof(frec), NULL);
+    for (slot = 0; (APR_SUCCESS == status) && (slot < index->header.nb_slots); slot++)
+	if (0 != (rec->mask & (1U << slot)))
+	    status = apr_file_write_full(index->fd, rec->digests[slot], index->header.digest_len, NULL);
+    if ((APR_SUCCESS == status) && (len != prefix_len))
+	status = apr_file_write_full(index->fd, rec->path + prefix_len, len - prefix_len, NULL);
+    if ((APR_SUCCESS == status) && (0 != subpath_len))
+	status = apr_file_write_full(index->fd, rec->subpath, subpath_len, NULL);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    ft_index_reserve(index, &(index->path_buf), &(index->path_size), len);
+    memcpy(index->path_buf + prefix_len, rec->path + prefix_len, len - prefix_len + 1);
+    index->path_len = len;
+    index->last_size = rec->size;
+    index->nb_done++;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_index_close(ft_index_t *index)
+{
+    char errbuf[128];
+    apr_off_t offset = 0;
+    apr_status_t status;
+
+    index->header.nb_recs = index->nb_done;
+    if (APR_SUCCESS != (status = apr_file_seek(index->fd, APR_SET, &offset))) {
+	DEBUG_ERR("error calling apr_file_seek: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(index->fd);
+	return status;
+    }
+    status = apr_file_write_full(index->fd, &(index->header), sizeof(ft_index_header_t), NULL);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	apr_file_close(index->fd);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_close(index->fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_rename(index->tmp_path, index->path, index->pool))) {
+	DEBUG_ERR("error calling apr_file_rename(%s, %s): %s", index->tmp_path, index->path,
+		  apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_index_open(ft_index_t **index, const char *path, apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_index_t *result;
+    apr_status_t status;
+
+    result = apr_pcalloc(pool, sizeof(struct ft_index_t));
+    result->pool = pool;
+    result->path = apr_pstrdup(pool, path);
+    result->last_size = -1;
+    status = apr_file_open(&(result->fd), path, APR_READ | APR_BUFFERED | APR_BINARY, APR_OS_DEFAULT, pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_open(%s): %s", path, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    status = apr_file_read_full(result->fd, &(result->header), sizeof(ft_index_header_t), NULL);
+    if ((APR_SUCCESS != status) && !APR_STATUS_IS_EOF(status)) {
+	DEBUG_ERR("error calling apr_file_read_full: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if ((APR_SUCCESS != status) || (FT_INDEX_MAGIC != result->header.magic)
+	|| (FT_INDEX_VERSION != result->header.version) || (FT_INDEX_MAX_SLOTS < result->header.nb_slots)
+	|| (HASHSTATE * sizeof(apr_uint32_t) < result->header.digest_len)) {
+	DEBUG_ERR("%s is not an index of this version", path);
+	return APR_EGENERAL;
+    }
+    result->header.hash[FT_INDEX_HASH_NAME_LEN - 1] = '\0';
+    result->header.host[FT_INDEX_HOST_LEN - 1] = '\0';
+    *index = result;
+
+    return APR_SUCCESS;
+}
+
+extern const char *ft_index_host(const ft_index_t *index)
+{
+    return index->header.host;
+}
+
+extern const char *ft_index_hash_name(const ft_index_t *index)
+{
+    return index->header.hash;
+}
+
+extern apr_uint32_t ft_index_nb_slots(const ft_index_t *index)
+{
+    return index->header.nb_slots;
+}
+
+extern apr_uint32_t ft_index_nb_samples(const ft_index_t *index)
+{
+    return index->header.nb_samples;
+}
+
+extern apr_uint64_t ft_index_nb_recs(const ft_index_t *index)
+{
+    return index->header.nb_recs;
+}
+
+extern apr_status_t ft_index_read(ft_index_t *index, ft_index_rec_t *rec)
+{
+    char errbuf[128];
+    ft_index_file_rec_t frec;
+    apr_size_t len;
+    apr_uint32_t slot;
+    apr_status_t status;
+
+    if (index->nb_done == index->header.nb_recs)
+	return APR_EOF;
+
+    status = apr_file_read_full(index->fd, &frec, sizeof(frec), NULL);
+    if ((APR_SUCCESS == status) && ((frec.prefix_len > index->path_len) || (FT_INDEX_MAX_NAME_LEN <= frec.suffix_len)
+				    || (FT_INDEX_MAX_NAME_LEN < frec.subpath_len)
+				    || (0 != (frec.mask & ~((1U << index->header.nb_slots) - 1)))
+				    || ((0 <= index->last_size) && ((apr_off_t) frec.size > index->last_size))))
+	status = APR_EGENERAL;
+    memset(rec, 0, sizeof(ft_index_rec_t));
+    rec->size = frec.size;
+    rec->mtime = frec.mtime;
+    rec->mask = frec.mask;
+    for (slot = 0; (APR_SUCCESS == status) && (slot < index->header.nb_slots); slot++)
+	if (0 != (frec.mask & (1U << slot)))
+	    status = apr_file_read_full(index->fd, rec->digests[slot], index->header.digest_len, NULL);
+    if (APR_SUCCESS == status) {
+	len = frec.prefix_len + frec.suffix_len;
+	ft_index_reserve(index, &(index->path_buf), &(index->path_size), len);
+	/* a read of nothing is an EOF */
+	if (0 != frec.suffix_len)
+	    status = apr_file_read_full(index->fd, index->path_buf + frec.prefix_len, frec.suffix_len, NULL);
+	index->path_buf[len] = '\0';
+	index->path_len = len;
+    }
+    if ((APR_SUCCESS == status) && (1 < frec.subpath_len)) {
+	ft_index_reserve(index, &(index->subpath_buf), &(index->subpath_size), frec.subpath_len - 1);
+	status = apr_file_read_full(index->fd, index->subpath_buf, frec.subpath_len - 1, NULL);
+	index->subpath_buf[frec.subpath_len - 1] = '\0';
+    }
+    else if (1 == frec.subpath_len) {
+	ft_index_reserve(index, &(index->subpath_buf), &(index->subpath_size), 0);
+	index->subpath_buf[0] = '\0';
+    }
+    if (APR_SUCCESS != status) {
+	if (!APR_STATUS_IS_EOF(status) && (APR_EGENERAL != status))
+	    DEBUG_ERR("error calling apr_file_read_full: %s", apr_strerror(status, errbuf, 128));
+	else
+	    DEBUG_ERR("%s is truncated or corrupted", index->path);
+	/* the previous path is lost */
+	index->path_len = 0;
+	return APR_STATUS_IS_EOF(status) ? APR_EGENERAL : status;
+    }
+    rec->path = index->path_buf;
+    rec->subpath = (0 != frec.subpath_len) ? index->subpath_buf : NULL;
+    index->last_size = rec->size;
+    index->nb_done++;
+
+    return APR_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_INDEX_H
+#define FT_INDEX_H
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+#include "ft_hash.h"
+
+/*
+ * Scan index, exported by a host to be merged with the ones of other hosts:
+ * a header naming the host and the hash, followed by a record per path, the
+ * largest sizes first, so that several indexes are merged as streams. Each
+ * record holds the size, the mtime, up to nb_slots digests and the path, whose
+ * bytes shared with the path of the previous record are not repeated.
+ */
+
+typedef struct ft_index_t ft_index_t;
+
+#define FT_INDEX_MAX_SLOTS 8
+
+typedef struct ft_index_rec_t
+{
+    apr_off_t size;
+    apr_time_t mtime;
+    apr_uint32_t mask;		/* bit n is set if the digest of slot n is there */
+    apr_uint32_t digests[FT_INDEX_MAX_SLOTS][HASHSTATE];	/* the bytes past the digest length are zero */
+    const char *path;
+    const char *subpath;	/* the member of the archive at path, NULL for a file */
+} ft_index_rec_t;
+
+/*
+ * Start writing an index of host to a temporary file, renamed to path by
+ * ft_index_close. The other arguments are the ones of ft_cache_open.
+ */
+apr_status_t ft_index_create(ft_index_t **index, const char *path, const char *host, const ft_hash_t *hash,
+			     apr_uint32_t nb_slots, apr_uint32_t block_len, apr_uint32_t nb_samples, apr_pool_t *pool);
+
+/* append a record, APR_EINVAL if it is larger than the previous one */
+apr_status_t ft_index_write(ft_index_t *index, const ft_index_rec_t *rec);
+
+/* write the number of records in the header and rename the file to its path */
+apr_status_t ft_index_close(ft_index_t *index);
+
+/* open an index to read its records, APR_EGENERAL if it is not one of this version and byte order */
+apr_status_t ft_index_open(ft_index_t **index, const char *path, apr_pool_t *pool);
+
+const char *ft_index_host(const ft_index_t *index);
+const char *ft_index_hash_name(const ft_index_t *index);
+apr_uint32_t ft_index_nb_slots(const ft_index_t *index);
+apr_uint32_t ft_index_nb_samples(const ft_index_t *index);
+apr_uint64_t ft_index_nb_recs(const ft_index_t *index);
+
+/*
+ * Read the next record, APR_EOF once they are all read, APR_EGENERAL if the
+ * file is truncated or corrupted. The paths are valid until the next call.
+ */
+apr_status_t ft_index_read(ft_index_t *index, ft_index_rec_t *rec);
+
+#endif /* FT_INDEX_H */
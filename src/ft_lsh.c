@@ -0,0 +1,220 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "debug.h"
+#include "ft_lsh.h"
+#include "napr_radix.h"
+
+struct ft_lsh_t
+{
+    apr_size_t nb_words;
+    apr_size_t word_len;
+    apr_array_header_t *keys;	/* nb_words apr_uint32_t per signature */
+    apr_array_header_t *ids;	/* apr_uint32_t per signature */
+};
+
+extern apr_status_t ft_lsh_make(ft_lsh_t **lsh, apr_size_t nb_words, apr_size_t word_len, apr_pool_t *pool)
+{
+    ft_lsh_t *result;
+
+    if ((0 == nb_words) || (0 == word_len) || (FT_LSH_MAX_WORD_LEN < word_len))
+	return APR_EINVAL;
+
+    result = apr_palloc(pool, sizeof(struct ft_lsh_t));
+    result->nb_words = nb_words;
+    result->word_len = word_len;
+    result->keys = apr_array_make(pool, 1024 * nb_words, sizeof(apr_uint32_t));
+    result->ids = apr_array_make(pool, 1024, sizeof(apr_uint32_t));
+    *lsh = result;
+
+    return APR_SUCCESS;
+}
+
+extern void ft_lsh_add(ft_lsh_t *lsh, const signed char *vec, apr_size_t len, apr_uint32_t id)
+{
+    apr_uint32_t key;
+    apr_size_t w, i, offset, end;
+
+    /* the words overlap to span the whole signature */
+    for (w = 0; w < lsh->nb_words; w++) {
+	offset = ((len > lsh->word_len) && (1 < lsh->nb_words)) ? w * (len - lsh->word_len) / (lsh->nb_words - 1) : 0;
+	end = (offset + lsh->word_len < len) ? offset + lsh->word_len : len;
+	for (i = offset, key = 0; i < end; i++)
+	    key = (key << 2) | ((0 < vec[i]) ? 2 : (0 > vec[i]) ? 1 : 0);
+	APR_ARRAY_PUSH(lsh->keys, apr_uint32_t) = key;
+    }
+    APR_ARRAY_PUSH(lsh->ids, apr_uint32_t) = id;
+}
+
+extern apr_size_t ft_lsh_count(const ft_lsh_t *lsh)
+{
+    return lsh->ids->nelts;
+}
+
+/* a signature of a crowded word, see FT_LSH_MAX_BUCKET */
+typedef struct ft_lsh_member_t
+{
+    const apr_uint32_t *keys;
+    apr_size_t nb_words;
+    apr_uint32_t id;
+} ft_lsh_member_t;
+
+static int ft_lsh_member_cmp(const void *param1, const void *param2)
+{
+    const ft_lsh_member_t *member1 = param1;
+    const ft_lsh_member_t *member2 = param2;
+    int i;
+
+    if (0 != (i = memcmp(member1->keys, member2->keys, member1->nb_words * sizeof(apr_uint32_t))))
+	return i;
+
+    return (member1->id < member2->id) ? -1 : ((member2->id < member1->id) ? 1 : 0);
+}
+
+static void ft_lsh_pair(apr_array_header_t *candidates, apr_uint32_t a, apr_uint32_t b)
+{
+    napr_radix_pair_t *found;
+
+    if (a == b)
+	return;
+    found = apr_array_push(candidates);
+    found->key = (a < b) ? ((apr_uint64_t) a << 32) | b : ((apr_uint64_t) b << 32) | a;
+    found->value = NULL;
+}
+
+extern apr_status_t ft_lsh_pairs(ft_lsh_t *lsh, ft_lsh_pair_t **pairs, apr_size_t *nb_pairs, apr_pool_t *pool)
+{
+    char errbuf[128];
+    const apr_uint32_t *keys = (const apr_uint32_t *) lsh->keys->elts;
+    apr_uint32_t *ids = (apr_uint32_t *) lsh->ids->elts;
+    napr_radix_pair_t *column, *tmp, *found;
+    ft_lsh_member_t *members;
+    apr_array_header_t *candidates;
+    apr_size_t nb_sigs = lsh->ids->nelts, w, s, i, j, k, l, n;
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    column = apr_palloc(gc_pool, (nb_sigs ? nb_sigs : 1) * sizeof(napr_radix_pair_t));
+    tmp = apr_palloc(gc_pool, (nb_sigs ? nb_sigs : 1) * sizeof(napr_radix_pair_t));
+    candidates = apr_array_make(gc_pool, nb_sigs ? nb_sigs : 1, sizeof(napr_radix_pair_t));
+    members = apr_palloc(gc_pool, (nb_sigs ? nb_sigs : 1) * sizeof(ft_lsh_member_t));
+
+    /* the signatures of each word position are sorted by word, each run of a word gives its pairs */
+    for (w = 0; w < lsh->nb_words; w++) {
+	for (s = 0; s < nb_sigs; s++) {
+	    column[s].key = keys[s * lsh->nb_words + w];
+	    column[s].value = &(ids[s]);
+	}
+	napr_radix_sort(column, tmp, nb_sigs);
+	for (i = 0; i < nb_sigs; i = j) {
+	    for (j = i + 1; (j < nb_sigs) && (column[j].key == column[i].key); j++);
+	    if (2 > j - i)
+		continue;
+	    if (FT_LSH_MAX_BUCKET >= j - i) {
+		for (k = i; k < j; k++) {
+		    for (l = k + 1; l < j; l++)
+			ft_lsh_pair(candidates, *(apr_uint32_t *) column[k].value, *(apr_uint32_t *) column[l].value);
+		}
+		continue;
+	    }
+	    for (k = i; k < j; k++) {
+		s = (apr_uint32_t *) column[k].value - ids;
+		members[k - i].keys = keys + s * lsh->nb_words;
+		members[k - i].nb_words = lsh->nb_words;
+		members[k - i].id = ids[s];
+	    }
+	    qsort(members, j - i, sizeof(ft_lsh_member_t), ft_lsh_member_cmp);
+	    /* l is the first of the signatures equal to the one of k, the lowest id of them */
+	    for (k = 1, l = 0; k < j - i; k++) {
+		if (memcmp(members[l].keys, members[k].keys, lsh->nb_words * sizeof(apr_uint32_t))) {
+		    ft_lsh_pair(candidates, members[k - 1].id, members[k].id);
+		    l = k;
+		}
+		else {
+		    ft_lsh_pair(candidates, members[l].id, members[k].id);
+		}
+	    }
+	}
+    }
+
+    /* a pair sharing several words is kept once */
+    found = (napr_radix_pair_t *) candidates->elts;
+    n = candidates->nelts;
+    napr_radix_sort(found, apr_palloc(gc_pool, (n ? n : 1) * sizeof(napr_radix_pair_t)), n);
+    *pairs = apr_palloc(pool, (n ? n : 1) * sizeof(struct ft_lsh_pair_t));
+    for (i = 0, *nb_pairs = 0; i < n; i++) {
+	if ((0 < i) && (found[i].key == found[i - 1].key))
+	    continue;
+	(*pairs)[*nb_pairs].first = (apr_uint32_t) (found[i].key >> 32);
+	(*pairs)[*nb_pairs].second = (apr_uint32_t) found[i].key;
+	(*nb_pairs)++;
+    }
+    apr_pool_destroy(gc_pool);
+
+    return APR_SUCCESS;
+}
+
+static apr_uint32_t ft_lsh_find(apr_uint32_t *leader, apr_uint32_t id)
+{
+    /* path halving */
+    while (leader[id] != id) {
+	leader[id] = leader[leader[id]];
+	id = leader[id];
+    }
+
+    return id;
+}
+
+extern void ft_lsh_components(const ft_lsh_pair_t *pairs, const unsigned char *keep, apr_size_t nb_pairs,
+			      apr_uint32_t *leader, apr_uint32_t *next, apr_size_t nb_ids)
+{
+    apr_uint32_t a, b;
+    apr_size_t i, k;
+
+    for (i = 0; i < nb_ids; i++) {
+	leader[i] = (apr_uint32_t) i;
+	next[i] = (apr_uint32_t) nb_ids;
+    }
+    /* the lowest root becomes the one of both */
+    for (k = 0; k < nb_pairs; k++) {
+	if (!keep[k])
+	    continue;
+	a = ft_lsh_find(leader, pairs[k].first);
+	b = ft_lsh_find(leader, pairs[k].second);
+	if (a < b)
+	    leader[b] = a;
+	else if (b < a)
+	    leader[a] = b;
+    }
+    /* going down, each id is put in front of the list of its leader, held by next[leader] until its turn */
+    for (i = nb_ids; i-- > 0;) {
+	leader[i] = ft_lsh_find(leader, (apr_uint32_t) i);
+	if (leader[i] != i) {
+	    next[i] = next[leader[i]];
+	    next[leader[i]] = (apr_uint32_t) i;
+	}
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_LSH_H
+#define FT_LSH_H
+
+#include <apr_pools.h>
+
+/*
+ * Candidate pairs of similar signatures, such as the libpuzzle ones: each
+ * signature is cut in overlapping words of a few values reduced to their
+ * sign, and two signatures are candidates if they share a word at the same
+ * position, as libpuzzle suggests to search a database of signatures. Only
+ * the candidates have to be compared exactly.
+ */
+
+/* values per word, each one takes 2 bits of a 32 bits key */
+#define FT_LSH_MAX_WORD_LEN 16
+
+/*
+ * Signatures sharing a word beyond this are too many to pair them all, e.g.
+ * a flat area or many copies of an image: they are sorted by their whole
+ * signature instead, the equal ones paired with the lowest id of them, and
+ * each signature with the next different one.
+ */
+#define FT_LSH_MAX_BUCKET 128
+
+typedef struct ft_lsh_t ft_lsh_t;
+
+typedef struct ft_lsh_pair_t
+{
+    apr_uint32_t first;		/* the lowest id */
+    apr_uint32_t second;
+} ft_lsh_pair_t;
+
+/* an index of nb_words words of word_len values per signature */
+apr_status_t ft_lsh_make(ft_lsh_t **lsh, apr_size_t nb_words, apr_size_t word_len, apr_pool_t *pool);
+
+/* index the signature vec of len values under id, not thread safe */
+void ft_lsh_add(ft_lsh_t *lsh, const signed char *vec, apr_size_t len, apr_uint32_t id);
+
+/* number of signatures indexed */
+apr_size_t ft_lsh_count(const ft_lsh_t *lsh);
+
+/*
+ * The pairs of ids sharing at least a word, each one once, sorted by first
+ * then second id, allocated from pool.
+ */
+apr_status_t ft_lsh_pairs(ft_lsh_t *lsh, ft_lsh_pair_t **pairs, apr_size_t *nb_pairs, apr_pool_t *pool);
+
+/*
+ * Join the ids 0 to nb_ids - 1 of the pairs kept (keep[k] non zero) in
+ * connected components, since a crowded word only pairs each signature with
+ * its neighbours: leader[id] is the lowest id of the component of id, and
+ * next[id] the following id of the component, nb_ids after the last one.
+ */
+void ft_lsh_components(const ft_lsh_pair_t *pairs, const unsigned char *keep, apr_size_t nb_pairs,
+		       apr_uint32_t *leader, apr_uint32_t *next, apr_size_t nb_ids);
+
+#endif /* FT_LSH_H */
@@ -0,0 +1,262 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "ft_spill.h"
+#include "napr_heap.h"
+
+/* longer names are a corrupted file */
+#define FT_SPILL_MAX_NAME_LEN (1 << 20)
+
+/* followed by the name */
+typedef struct ft_spill_file_rec_t
+{
+    apr_uint64_t size;
+    apr_int64_t mtime;
+    apr_uint64_t device;
+    apr_uint64_t inode;
+    const void *dir;
+    apr_uint32_t name_len;
+    apr_uint32_t prioritized;
+} ft_spill_file_rec_t;
+
+struct ft_spill_t
+{
+    apr_pool_t *pool;		/* of the run only, destroyed by ft_spill_close */
+    apr_file_t *fd;
+    apr_uint64_t nb_recs;
+    apr_uint64_t nb_done;	/* records read */
+    apr_off_t last_size;
+    char *name_buf;
+    apr_size_t name_size;
+};
+
+/* a run being merged, its next record read ahead */
+typedef struct ft_spill_src_t
+{
+    ft_spill_t *run;
+    ft_spill_rec_t rec;
+} ft_spill_src_t;
+
+struct ft_spill_merge_t
+{
+    napr_heap_t *heap;
+    ft_spill_src_t *last;	/* its record was the last one returned, its run is read on the next call */
+};
+
+extern apr_status_t ft_spill_create(ft_spill_t **run, const char *tmpdir, apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_spill_t *result;
+    apr_pool_t *run_pool;
+    char *template;
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&run_pool, pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    result = apr_pcalloc(run_pool, sizeof(struct ft_spill_t));
+    result->pool = run_pool;
+    result->last_size = -1;
+    template = apr_pstrcat(run_pool, tmpdir, "/ftwin.XXXXXX", NULL);
+    status = apr_file_mktemp(&(result->fd), template,
+			     APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_DELONCLOSE | APR_BUFFERED | APR_BINARY,
+			     run_pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_mktemp(%s): %s", template, apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(run_pool);
+	return status;
+    }
+    *run = result;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_spill_write(ft_spill_t *run, const ft_spill_rec_t *rec)
+{
+    char errbuf[128];
+    ft_spill_file_rec_t frec;
+    apr_size_t len;
+    apr_status_t status;
+
+    if ((0 <= run->last_size) && (rec->size > run->last_size))
+	return APR_EINVAL;
+    len = strlen(rec->name);
+    if (FT_SPILL_MAX_NAME_LEN <= len)
+	return APR_EINVAL;
+
+    memset(&frec, 0, sizeof(frec));
+    frec.size = rec->size;
+    frec.mtime = rec->mtime;
+    frec.device = rec->device;
+    frec.inode = rec->inode;
+    frec.dir = rec->dir;
+    frec.name_len = len;
+    frec.prioritized = rec->prioritized;
+    status = apr_file_write_full(run->fd, &frec, sizeof(frec), NULL);
+    if ((APR_SUCCESS == status) && (0 != len))
+	status = apr_file_write_full(run->fd, rec->name, len, NULL);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_write_full: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    run->last_size = rec->size;
+    run->nb_recs++;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_spill_rewind(ft_spill_t *run)
+{
+    char errbuf[128];
+    apr_off_t offset = 0;
+    apr_status_t status;
+
+    /* flushes what is left buffered */
+    if (APR_SUCCESS != (status = apr_file_seek(run->fd, APR_SET, &offset))) {
+	DEBUG_ERR("error calling apr_file_seek: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    run->nb_done = 0;
+    run->last_size = -1;
+
+    return APR_SUCCESS;
+}
+
+extern apr_uint64_t ft_spill_nb_recs(const ft_spill_t *run)
+{
+    return run->nb_recs;
+}
+
+extern apr_status_t ft_spill_read(ft_spill_t *run, ft_spill_rec_t *rec)
+{
+    char errbuf[128];
+    ft_spill_file_rec_t frec;
+    apr_status_t status;
+
+    if (run->nb_done == run->nb_recs)
+	return APR_EOF;
+
+    status = apr_file_read_full(run->fd, &frec, sizeof(frec), NULL);
+    if ((APR_SUCCESS == status) && ((FT_SPILL_MAX_NAME_LEN <= frec.name_len)
+				    || ((0 <= run->last_size) && ((apr_off_t) frec.size > run->last_size))))
+	status = APR_EGENERAL;
+    if (APR_SUCCESS == status) {
+	if (run->name_size <= frec.name_len) {
+	    run->name_size = 2 * (frec.name_len + 1);
+	    run->name_buf = apr_palloc(run->pool, run->name_size);
+	}
+	/* a read of nothing is an EOF */
+	if (0 != frec.name_len)
+	    status = apr_file_read_full(run->fd, run->name_buf, frec.name_len, NULL);
+	run->name_buf[frec.name_len] = '\0';
+    }
+    if (APR_SUCCESS != status) {
+	if (!APR_STATUS_IS_EOF(status) && (APR_EGENERAL != status))
+	    DEBUG_ERR("error calling apr_file_read_full: %s", apr_strerror(status, errbuf, 128));
+	else
+	    DEBUG_ERR("spilled run truncated");
+	return APR_STATUS_IS_EOF(status) ? APR_EGENERAL : status;
+    }
+    rec->size = frec.size;
+    rec->mtime = frec.mtime;
+    rec->device = frec.device;
+    rec->inode = frec.inode;
+    rec->dir = frec.dir;
+    rec->name = run->name_buf;
+    rec->prioritized = frec.prioritized;
+    run->last_size = rec->size;
+    run->nb_done++;
+
+    return APR_SUCCESS;
+}
+
+extern void ft_spill_close(ft_spill_t *run)
+{
+    /* the file is closed, and so removed, with the pool */
+    apr_pool_destroy(run->pool);
+}
+
+/* the largest size first, then the record of the first run */
+static int ft_spill_src_cmp(const void *param1, const void *param2)
+{
+    const ft_spill_src_t *src1 = param1;
+    const ft_spill_src_t *src2 = param2;
+
+    if (src1->rec.size != src2->rec.size)
+	return (src1->rec.size < src2->rec.size) ? -1 : 1;
+
+    return (src1 < src2) ? 1 : ((src2 < src1) ? -1 : 0);
+}
+
+extern apr_status_t ft_spill_merge_open(ft_spill_merge_t **merge, ft_spill_t *const *runs, apr_size_t nb_runs,
+					apr_pool_t *pool)
+{
+    ft_spill_merge_t *result;
+    ft_spill_src_t *srcs;
+    apr_size_t i;
+    apr_status_t status;
+
+    result = apr_palloc(pool, sizeof(struct ft_spill_merge_t));
+    result->last = NULL;
+    if (NULL == (result->heap = napr_heap_make(pool, ft_spill_src_cmp))) {
+	DEBUG_ERR("error calling napr_heap_make");
+	return APR_ENOMEM;
+    }
+    srcs = apr_palloc(pool, (nb_runs ? nb_runs : 1) * sizeof(ft_spill_src_t));
+    for (i = 0; i < nb_runs; i++) {
+	srcs[i].run = runs[i];
+	if (APR_SUCCESS != (status = ft_spill_rewind(runs[i])))
+	    return status;
+	status = ft_spill_read(runs[i], &(srcs[i].rec));
+	if (APR_SUCCESS == status)
+	    napr_heap_insert(result->heap, &(srcs[i]));
+	else if (!APR_STATUS_IS_EOF(status))
+	    return status;
+    }
+    *merge = result;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_spill_merge_read(ft_spill_merge_t *merge, ft_spill_rec_t *rec)
+{
+    ft_spill_src_t *src;
+    apr_status_t status;
+
+    /* the name returned last is overwritten by this read only */
+    if (NULL != (src = merge->last)) {
+	merge->last = NULL;
+	status = ft_spill_read(src->run, &(src->rec));
+	if (APR_SUCCESS == status)
+	    napr_heap_insert(merge->heap, src);
+	else if (!APR_STATUS_IS_EOF(status))
+	    return status;
+    }
+    if (NULL == (src = napr_heap_extract(merge->heap)))
+	return APR_EOF;
+    merge->last = src;
+    *rec = src->rec;
+
+    return APR_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_SPILL_H
+#define FT_SPILL_H
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+/*
+ * Runs of scan records spilled to disk once they exceed the memory budget:
+ * each run is a temporary file, removed once closed, holding its records the
+ * largest size first, so that several runs are merged as streams. A run is
+ * private to the process that wrote it, the directory of a record is kept
+ * as a pointer.
+ */
+
+typedef struct ft_spill_t ft_spill_t;
+
+typedef struct ft_spill_rec_t
+{
+    apr_off_t size;
+    apr_time_t mtime;
+    apr_uint64_t device;
+    apr_uint64_t inode;
+    const void *dir;		/* of the file, NULL if name is its full path */
+    const char *name;
+    int prioritized;
+} ft_spill_rec_t;
+
+/* start writing a run to a temporary file of tmpdir */
+apr_status_t ft_spill_create(ft_spill_t **run, const char *tmpdir, apr_pool_t *pool);
+
+/* append a record, APR_EINVAL if it is larger than the previous one */
+apr_status_t ft_spill_write(ft_spill_t *run, const ft_spill_rec_t *rec);
+
+/* done writing, the records are read from the first one */
+apr_status_t ft_spill_rewind(ft_spill_t *run);
+
+apr_uint64_t ft_spill_nb_recs(const ft_spill_t *run);
+
+/*
+ * Read the next record, APR_EOF once they are all read, APR_EGENERAL if the
+ * file is truncated. The name is valid until the next call.
+ */
+apr_status_t ft_spill_read(ft_spill_t *run, ft_spill_rec_t *rec);
+
+/* remove the file, the memory of the run is released */
+void ft_spill_close(ft_spill_t *run);
+
+/* several runs read as a single one, the largest first, the first runs first among a size */
+typedef struct ft_spill_merge_t ft_spill_merge_t;
+
+/* rewind the runs, read from then on by ft_spill_merge_read only */
+apr_status_t ft_spill_merge_open(ft_spill_merge_t **merge, ft_spill_t *const *runs, apr_size_t nb_runs,
+				 apr_pool_t *pool);
+
+/* read the next record of the runs, as ft_spill_read */
+apr_status_t ft_spill_merge_read(ft_spill_merge_t *merge, ft_spill_rec_t *rec);
+
+#endif /* FT_SPILL_H */
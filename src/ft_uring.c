@@ -0,0 +1,254 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#if HAVE_LINUX_IO_URING_H && HAVE_DECL_SYS_IO_URING_SETUP && HAVE_DECL_SYS_IO_URING_ENTER
+#define FT_URING 1
+#endif
+
+#if FT_URING
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <apr_strings.h>
+
+#include "debug.h"
+#include "ft_uring.h"
+
+#if FT_URING
+
+struct ft_uring_t
+{
+    int fd;
+    unsigned int depth;
+    unsigned int nb_queued;	/* filled in the submission ring, not submitted yet */
+    unsigned int nb_pending;	/* queued or in flight */
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned int *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    struct iovec *iovecs;	/* one per submission entry, readv is the oldest read of io_uring */
+};
+
+static apr_status_t ft_uring_cleanup(void *data)
+{
+    ft_uring_t *ring = data;
+
+    if (NULL != ring->sqes)
+	munmap(ring->sqes, ring->sqes_len);
+    if ((NULL != ring->cq_ptr) && (ring->cq_ptr != ring->sq_ptr))
+	munmap(ring->cq_ptr, ring->cq_len);
+    if (NULL != ring->sq_ptr)
+	munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+
+    return APR_SUCCESS;
+}
+
+static void *ft_uring_mmap(int fd, size_t len, off_t offset)
+{
+    void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    return (MAP_FAILED == ptr) ? NULL : ptr;
+}
+
+extern int ft_uring_is_supported(void)
+{
+    return 1;
+}
+
+extern apr_status_t ft_uring_create(ft_uring_t **ring, unsigned int depth, apr_pool_t *pool)
+{
+    struct io_uring_params params;
+    ft_uring_t *r;
+    apr_status_t status;
+    int fd;
+
+    memset(&params, 0, sizeof(params));
+    if (0 > (fd = (int) syscall(SYS_io_uring_setup, depth, &params))) {
+	/* ENOSYS without kernel support, EPERM if it is disabled by the administrator */
+	status = APR_FROM_OS_ERROR(errno);
+	return ((ENOSYS == errno) || (EPERM == errno)) ? APR_ENOTIMPL : status;
+    }
+
+    r = apr_pcalloc(pool, sizeof(struct ft_uring_t));
+    r->fd = fd;
+    /* the kernel may round the entries up, depth still bounds the reads in flight so that no completion is lost */
+    r->depth = depth;
+    r->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    r->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	if (r->cq_len > r->sq_len)
+	    r->sq_len = r->cq_len;
+	r->cq_len = r->sq_len;
+    }
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    apr_pool_cleanup_register(pool, r, ft_uring_cleanup, apr_pool_cleanup_null);
+
+    if (NULL == (r->sq_ptr = ft_uring_mmap(fd, r->sq_len, IORING_OFF_SQ_RING)))
+	return APR_FROM_OS_ERROR(errno);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+	r->cq_ptr = r->sq_ptr;
+    else if (NULL == (r->cq_ptr = ft_uring_mmap(fd, r->cq_len, IORING_OFF_CQ_RING)))
+	return APR_FROM_OS_ERROR(errno);
+    if (NULL == (r->sqes = ft_uring_mmap(fd, r->sqes_len, IORING_OFF_SQES)))
+	return APR_FROM_OS_ERROR(errno);
+
+    r->sq_tail = (unsigned int *) ((char *) r->sq_ptr + params.sq_off.tail);
+    r->sq_mask = (unsigned int *) ((char *) r->sq_ptr + params.sq_off.ring_mask);
+    r->sq_array = (unsigned int *) ((char *) r->sq_ptr + params.sq_off.array);
+    r->cq_head = (unsigned int *) ((char *) r->cq_ptr + params.cq_off.head);
+    r->cq_tail = (unsigned int *) ((char *) r->cq_ptr + params.cq_off.tail);
+    r->cq_mask = (unsigned int *) ((char *) r->cq_ptr + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ptr + params.cq_off.cqes);
+    r->iovecs = apr_palloc(pool, params.sq_entries * sizeof(struct iovec));
+    *ring = r;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_uring_read(ft_uring_t *ring, apr_os_file_t fd, void *buf, apr_size_t len, apr_off_t offset,
+				  void *data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail, idx;
+
+    if (ring->nb_pending >= ring->depth)
+	return APR_EAGAIN;
+
+    /* only this thread writes the tail, the kernel reads it once it is released */
+    tail = *ring->sq_tail;
+    idx = tail & *ring->sq_mask;
+    sqe = &(ring->sqes[idx]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->iovecs[idx].iov_base = buf;
+    ring->iovecs[idx].iov_len = len;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (unsigned long) &(ring->iovecs[idx]);
+    sqe->len = 1;
+    sqe->user_data = (unsigned long) data;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->nb_queued++;
+    ring->nb_pending++;
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t ft_uring_wait(ft_uring_t *ring, void **data, apr_size_t *rbytes, apr_status_t *rv)
+{
+    char errbuf[128];
+    struct io_uring_cqe *cqe;
+    unsigned int head;
+    apr_status_t status;
+    int rc;
+
+    if (0 == ring->nb_pending)
+	return APR_EOF;
+
+    for (;;) {
+	head = *ring->cq_head;
+	if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	    break;
+	/* submit what is queued and sleep until something completes */
+	rc = (int) syscall(SYS_io_uring_enter, ring->fd, ring->nb_queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	if (0 > rc) {
+	    if ((EINTR == errno) || (EAGAIN == errno) || (EBUSY == errno))
+		continue;
+	    status = APR_FROM_OS_ERROR(errno);
+	    DEBUG_ERR("error calling io_uring_enter: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	ring->nb_queued -= (unsigned int) rc;
+    }
+
+    cqe = &(ring->cqes[head & *ring->cq_mask]);
+    *data = (void *) (unsigned long) cqe->user_data;
+    if (0 > cqe->res) {
+	*rbytes = 0;
+	*rv = APR_FROM_OS_ERROR(-cqe->res);
+    }
+    else {
+	*rbytes = (apr_size_t) cqe->res;
+	*rv = APR_SUCCESS;
+    }
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->nb_pending--;
+
+    return APR_SUCCESS;
+}
+
+#else /* !FT_URING */
+
+struct ft_uring_t
+{
+    unsigned int depth;
+    unsigned int nb_pending;
+};
+
+extern int ft_uring_is_supported(void)
+{
+    return 0;
+}
+
+extern apr_status_t ft_uring_create(ft_uring_t **ring, unsigned int depth, apr_pool_t *pool)
+{
+    return APR_ENOTIMPL;
+}
+
+extern apr_status_t ft_uring_read(ft_uring_t *ring, apr_os_file_t fd, void *buf, apr_size_t len, apr_off_t offset,
+				  void *data)
+{
+    return APR_ENOTIMPL;
+}
+
+extern apr_status_t ft_uring_wait(ft_uring_t *ring, void **data, apr_size_t *rbytes, apr_status_t *rv)
+{
+    return APR_ENOTIMPL;
+}
+
+#endif /* FT_URING */
+
+extern unsigned int ft_uring_depth(const ft_uring_t *ring)
+{
+    return ring->depth;
+}
+
+extern unsigned int ft_uring_pending(const ft_uring_t *ring)
+{
+    return ring->nb_pending;
+}
+
+extern void ft_uring_drain(ft_uring_t *ring)
+{
+    apr_size_t rbytes;
+    apr_status_t rv;
+    void *data;
+
+    while ((0 != ring->nb_pending) && (APR_SUCCESS == ft_uring_wait(ring, &data, &rbytes, &rv)));
+}
@@ -0,0 +1,61 @@
+/*
+ *
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FT_URING_H
+#define FT_URING_H
+
+#include <apr_pools.h>
+#include <apr_portable.h>
+
+/*
+ * Asynchronous reads through a Linux io_uring, driven by the system calls
+ * directly so that liburing is not needed. A ring is not thread safe: it is
+ * meant to keep many reads in flight from a single thread.
+ */
+
+typedef struct ft_uring_t ft_uring_t;
+
+/* is there a io_uring in this build, ft_uring_create may still fail if the kernel has none */
+int ft_uring_is_supported(void);
+
+/* set a ring up for depth reads in flight, APR_ENOTIMPL if io_uring is not available */
+apr_status_t ft_uring_create(ft_uring_t **ring, unsigned int depth, apr_pool_t *pool);
+
+/* number of reads the ring can hold */
+unsigned int ft_uring_depth(const ft_uring_t *ring);
+
+/* number of reads queued or in flight */
+unsigned int ft_uring_pending(const ft_uring_t *ring);
+
+/*
+ * Queue a read of at most len bytes of fd at offset into buf, data being
+ * given back with its completion. APR_EAGAIN if depth reads are pending.
+ */
+apr_status_t ft_uring_read(ft_uring_t *ring, apr_os_file_t fd, void *buf, apr_size_t len, apr_off_t offset,
+			   void *data);
+
+/*
+ * Submit the queued reads and wait until one of them completes, its data
+ * being returned with the number of bytes read, or in *rv why it failed.
+ * The returned status is the one of the ring itself.
+ */
+apr_status_t ft_uring_wait(ft_uring_t *ring, void **data, apr_size_t *rbytes, apr_status_t *rv);
+
+/* forget the pending reads, once they landed since their buffers may be freed next */
+void ft_uring_drain(ft_uring_t *ring);
+
+#endif /* FT_URING_H */
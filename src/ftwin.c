@@ -15,23 +15,47 @@
  * limitations under the License.
  */
 
-#include <pcre.h>
-
 #include <unistd.h>		/* getegid */
 #include <stdio.h>		/* fgetgrent */
 #include <sys/stat.h>		/* umask */
 #include <sys/types.h>		/* fgetgrent */
 #include <grp.h>		/* fgetgrent */
+#include <errno.h>
+#include <sys/resource.h>	/* getrusage */
 
 #include <apr_file_info.h>
 #include <apr_file_io.h>
 #include <apr_getopt.h>
+#include <apr_network_io.h>	/* apr_gethostname */
 #include <napr_hash.h>
 #include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_thread_mutex.h>
 #include <apr_user.h>
 
 #include "config.h"
 
+#if HAVE_OPENAT && HAVE_FSTATAT && HAVE_DECL_SYS_GETDENTS64
+#define FT_DIRFD_SCAN 1
+#include <dirent.h>		/* DT_* */
+#include <fcntl.h>		/* openat */
+#include <sys/syscall.h>	/* SYS_getdents64 */
+#endif
+
+#if HAVE_SYS_INOTIFY_H
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <apr_signal.h>
+#endif
+
+#if HAVE_LINUX_FIEMAP_H
+#include <fcntl.h>		/* open */
+#include <sys/ioctl.h>
+#include <linux/fs.h>		/* FS_IOC_FIEMAP */
+#include <linux/fiemap.h>
+#endif
+
 #if HAVE_PUZZLE
 #include <puzzle.h>
 #endif
@@ -43,8 +67,17 @@
 
 #include "checksum.h"
 #include "debug.h"
+#include "ft_cache.h"
+#include "ft_hash.h"
 #include "ft_file.h"
+#include "ft_filter.h"
+#include "ft_index.h"
+#include "ft_lsh.h"
+#include "ft_spill.h"
+#include "lookup3.h"
 #include "napr_heap.h"
+#include "napr_inthash.h"
+#include "napr_radix.h"
 #include "napr_threadpool.h"
 
 #define is_option_set(mask, option)  ((mask & option) == option)
@@ -65,6 +98,11 @@
 #define OPTION_OPMEM 0x0010
 #define OPTION_REGEX 0x0020
 #define OPTION_SIZED 0x0040
+#define OPTION_HLINK 0x0200	/* hide hardlinks */
+#define OPTION_PHYS 0x0400	/* read files in physical order, see --schedule */
+#define OPTION_DIRS 0x0800	/* report whole identical directories, see ft_conf_dirs_report */
+#define OPTION_DIRSO 0x1000	/* only report identical directories, see ft_conf_dirs_prune */
+#define OPTION_DEDUP 0x2000	/* deduplicate the twins instead of comparing them, see ft_conf_cmp_run */
 
 #if HAVE_PUZZLE
 #define OPTION_PUZZL 0x0080
@@ -74,18 +112,86 @@
 #define OPTION_UNTAR 0x0100
 #endif
 
+/* long options without short equivalent */
+#define OPT_SAMPLES 256
+#define OPT_HASH 257
+#define OPT_CACHE 258
+#define OPT_HARDLINKS 259
+#define OPT_BLOCK_SIZE 260
+#define OPT_DIRECT_IO 261
+#define OPT_FADVISE 262
+#define OPT_MMAP_WINDOW 263
+#define OPT_IO_URING 264
+#define OPT_SCHEDULE 265
+#define OPT_STREAM 266
+#define OPT_DIRS 267
+#define OPT_DIRS_ONLY 268
+#define OPT_STATS 269
+#define OPT_FORMAT 270
+#define OPT_WATCH 271
+#define OPT_EXPORT 272
+#define OPT_MERGE 273
+#define OPT_VERIFY 274
+#define OPT_DEDUPE 275
+#define OPT_EXCLUDE_FROM 276
+#define OPT_PRUNE 277
+#define OPT_MEM_LIMIT 278
+
+/*
+ * Size classes of 3+ files are split by cheap digests before their members are
+ * fully hashed, see ft_conf_process_sizes.
+ */
+#define FT_STAGE_HEAD 0
+#define FT_STAGE_TAIL 1
+#define FT_STAGE_SAMPLES 2
+#define FT_STAGE_FULL 3
+#define FT_STAGE_NB 4
+
+#define FT_STAGE_BLOCK_LEN 4096
+#define FT_STAGE_MAX_SAMPLES 64
+
+/*
+ * The full stage hashes its files in rounds of growing chunks, 1 MiB then
+ * four times more at each round, the last one hashing the rest of the file,
+ * and splits them after each round: a file left alone is not read further.
+ * Each round's digest is seeded with the previous one, so that the last one
+ * is the digest of the whole content. The digests of the rounds before the
+ * last one have their own cache slots, after the ones of the stages.
+ */
+#define FT_CHUNK_LEN (1024 * 1024)
+#define FT_CHUNK_NB 6
+#define FT_SLOT_NB (FT_STAGE_NB + FT_CHUNK_NB - 1)
+
+#define FT_URING_MAX_DEPTH 4096
+
+static const char *const ft_stage_name[FT_STAGE_NB] = { "head", "tail", "samples", "full" };
+
 typedef struct ft_file_t
 {
     apr_off_t size;
-    char *path;
+    apr_time_t mtime;
+    apr_dev_t device;
+    apr_ino_t inode;
+    apr_uint64_t location;	/* on the device, 0 until ft_file_location is known, see --schedule */
+    char *path;			/* the name in dir, or the full path if dir is NULL */
+    const struct ft_dir_t *dir;	/* the directory holding the file under -o, see ft_file_path */
+    const struct ft_dir_t *parent;	/* the directory holding the file, NULL if it was given on the command line */
+    struct ft_file_t *twin;	/* under --dirs, first file verified of the same content, NULL if there is none */
+    ft_cache_rec_t *cache_rec;	/* NULL if the digests are not cached */
+    struct ft_file_t *links;	/* other paths of the same inode, only this file is hashed and compared */
+    struct ft_file_t *clones;	/* under --dedupe, the next file of another inode sharing all its extents */
 #if HAVE_ARCHIVE
     char *subpath;
+    apr_uint32_t *ar_digests;	/* of the slots of the member, computed while the archive is walked */
 #endif
 #if HAVE_PUZZLE
     PuzzleCvec cvec;
     int cvec_ok:1;
 #endif
     int prioritized:1;
+    int fresh:1;		/* referenced, or given a hardlink, since the last report of --stream */
+    int reported:1;		/* printed by a previous report of --stream */
+    int gone:1;			/* forgotten by --watch, see ft_watch_forget */
 } ft_file_t;
 
 typedef struct ft_chksum_t
@@ -100,8 +206,84 @@ typedef struct ft_fsize_t
     ft_chksum_t *chksum_array;
     apr_uint32_t nb_files;
     apr_uint32_t nb_checksumed;
+    apr_uint32_t nb_active;	/* chksum_array[0 .. nb_active - 1] still have to go through the next stage */
 } ft_fsize_t;
 
+typedef struct ft_stage_stats_t
+{
+    apr_size_t nb_hashed;
+    apr_size_t nb_cached;	/* digests found in the cache, not read */
+    apr_size_t nb_ruled_out;
+    apr_off_t bytes_read;
+    apr_off_t bytes_avoided;	/* compared to a full hash of every file of the class */
+} ft_stage_stats_t;
+
+/*
+ * --stats: the phases timed, a phase run from another one (the rounds of
+ * --stream from the walk) is not counted in it, see ft_stats_phase.
+ */
+#define FT_PHASE_WALK 0
+#define FT_PHASE_SIZES 1
+#define FT_PHASE_STAGE 2	/* + FT_STAGE_* */
+#define FT_PHASE_VERIFY (FT_PHASE_STAGE + FT_STAGE_NB)
+#define FT_PHASE_DIRS (FT_PHASE_VERIFY + 1)
+#define FT_PHASE_NB (FT_PHASE_DIRS + 1)
+
+static const char *const ft_phase_name[FT_PHASE_NB] = { "walk", "sizes", "head", "tail", "samples", "full", "verify",
+    "dirs"
+};
+
+/* counted by each walker on its own, summed once the walk is over */
+typedef struct ft_walk_stats_t
+{
+    apr_size_t nb_dirs;		/* browsed */
+    apr_size_t nb_files;	/* regular files and followed links met */
+    apr_size_t nb_stats;	/* stat, fstat and fstatat calls */
+    apr_size_t nb_pruned;	/* directories left out, with all their entries */
+} ft_walk_stats_t;
+
+typedef struct ft_stats_t
+{
+    int json;
+    int phase;			/* being timed, -1 if none */
+    apr_time_t wall_mark;	/* when it started being timed */
+    apr_interval_time_t cpu_mark;
+    apr_interval_time_t wall[FT_PHASE_NB];
+    apr_interval_time_t cpu[FT_PHASE_NB];
+    ft_walk_stats_t walk;
+    ft_stage_stats_t stages[FT_STAGE_NB];	/* summed over the rounds of --stream */
+    apr_size_t nb_alone;	/* files alone of their size, never read */
+    apr_off_t alone_bytes;
+    apr_size_t nb_dropped;	/* files found under -o alone of their size, never referenced */
+    apr_off_t dropped_bytes;
+    apr_size_t nb_spilled;	/* records written to the runs of --mem-limit */
+    apr_size_t nb_spills;	/* runs written, merged ones included */
+    apr_size_t nb_batches;	/* of size classes read back from the runs */
+    apr_off_t links_bytes;	/* of the hardlinks of files already referenced */
+    apr_size_t nb_runs;		/* groups compared byte by byte */
+    apr_size_t nb_compared;
+    apr_off_t compared_bytes;	/* at most, the comparison of a group stops once its files differ */
+} ft_stats_t;
+
+/*
+ * The twins are written to stdout through a buffer, flushed once full and at
+ * the end of each report. Besides the text of -s and -d, a group is a record
+ * of NUL-terminated fields (--format=null) or a json object on its own line
+ * (--format=jsonl), see ft_out_group.
+ */
+#define FT_FORMAT_TEXT 0
+#define FT_FORMAT_NULL 1
+#define FT_FORMAT_JSONL 2
+#define FT_OUT_LEN (1 << 20)
+
+typedef struct ft_out_t
+{
+    char *buf;
+    apr_size_t len;
+    int format;
+    apr_size_t nb_paths;	/* written in the current group */
+} ft_out_t;
+
 typedef struct ft_gid_t
 {
     gid_t val;
@@ -110,895 +292,5325 @@ typedef struct ft_gid_t
 typedef struct ft_conf_t
 {
     apr_off_t minsize;
-    apr_off_t excess_size;	/* Switch off mmap behavior */
+    ft_io_t io;			/* how files are read, io.excess_size switches off mmap behavior */
 #if HAVE_PUZZLE
     double threshold;
 #endif
     apr_pool_t *pool;		/* Always needed somewhere ;) */
-    napr_heap_t *heap;		/* Will holds the files */
-    napr_hash_t *sizes;		/* will holds the sizes hashed with http://www.burtleburtle.net/bob/hash/integer.html */
-    napr_hash_t *gids;		/* will holds the gids hashed with http://www.burtleburtle.net/bob/hash/integer.html */
-    napr_hash_t *ig_files;
-    pcre *ig_regex;
-    pcre *wl_regex;
-    pcre *ar_regex;		/* archive regex */
+    apr_array_header_t *files;	/* ft_file_t * referenced, a single one per inode */
+    ft_fsize_t *fsizes;		/* sizes shared by several files, the largest first, see ft_conf_group_sizes */
+    apr_size_t nb_fsizes;
+    napr_inthash_t *gids;	/* the gids of the user, searched for each file */
+    napr_inthash_t *inodes;	/* first file referenced of each (device, inode), NULL in image cmp mode */
+    ft_filter_t *filter;	/* the entries left out of the walk */
+    ft_regex_t *ar_regex;	/* archive regex */
     char *p_path;		/* priority path */
     char *username;
     apr_size_t p_path_len;
     apr_uid_t userid;
     apr_gid_t groupid;
+    unsigned long nb_worker;	/* number of threads used to checksum */
+    napr_threadpool_t *threadpool;	/* nb_worker threads shared by the walk and the checksums, NULL for a single one */
+    unsigned int nb_samples;	/* number of blocks sampled in the middle of large files */
+    const ft_hash_t *hash;	/* content hash backend */
+    ft_cache_t *cache;		/* NULL if the digests are not cached */
+    ft_index_t *index;		/* written by --export, NULL otherwise, see ft_conf_export */
+    apr_size_t nb_links;	/* files referenced as a hardlink of a previous one */
+    apr_size_t nb_clones;	/* files sharing all their extents with a previous one, under --dedupe */
+    apr_off_t deduped_bytes;	/* by the kernel under --dedupe */
+    apr_size_t stream_len;	/* files walked between two reports under --stream, 0 to report once at the end */
+    apr_off_t mem_limit;	/* bytes of records held in memory under --mem-limit, 0 without it */
+    const char *spill_dir;	/* where the runs are written under --mem-limit */
+    apr_array_header_t *spills;	/* ft_spill_t * written by the walk, see ft_walker_spill */
+    int spill_merging;		/* a walker merges some spills, NULL in their place, see ft_conf_spill_add */
+    apr_array_header_t *dirs;	/* ft_dir_t * browsed under --dirs or --watch, NULL otherwise */
+    struct ft_dirsum_t *dirsums;	/* one per directory of dirs, the shallowest first, see ft_conf_dirs_make */
+    apr_size_t nb_dirsums;
+    struct ft_dirent_t *dirents;	/* entries of the dirsums, each one's in a row sorted by name */
+    apr_size_t nb_dirents;
+    int dirs_report;		/* under --dirs: 0 while the twins are verified, 1 once they are reported */
+    ft_stats_t *stats;		/* NULL without --stats */
+    ft_out_t out;
+    char *path_buf;		/* paths rebuilt to be reported, see ft_file_path */
+    apr_size_t path_size;
     unsigned short int mask;
     char sep;
 } ft_conf_t;
 
-struct stats
+/* the cpu time of the process, all its threads included */
+static apr_interval_time_t ft_stats_cpu(void)
 {
-    struct stats const *parent;
-    apr_finfo_t stat;
-};
+    struct rusage usage;
+
+    if (0 != getrusage(RUSAGE_SELF, &usage))
+	return 0;
+
+    return apr_time_from_sec(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + usage.ru_utime.tv_usec
+	+ usage.ru_stime.tv_usec;
+}
 
-static int ft_file_cmp(const void *param1, const void *param2)
+/*
+ * Under --stats, charge the time elapsed since the previous call to the
+ * phase being timed, then time phase (-1 for none) from now on. The phase
+ * that was timed is returned, to be timed again once phase is over.
+ */
+static int ft_stats_phase(ft_conf_t *conf, int phase)
 {
-    const ft_file_t *file1 = param1;
-    const ft_file_t *file2 = param2;
+    ft_stats_t *stats = conf->stats;
+    apr_interval_time_t cpu;
+    apr_time_t now;
+    int previous;
 
-    if (file1->size < file2->size)
+    if (NULL == stats)
 	return -1;
-    else if (file2->size < file1->size)
-	return 1;
+    now = apr_time_now();
+    cpu = ft_stats_cpu();
+    if (0 <= (previous = stats->phase)) {
+	stats->wall[previous] += now - stats->wall_mark;
+	stats->cpu[previous] += cpu - stats->cpu_mark;
+    }
+    stats->phase = phase;
+    stats->wall_mark = now;
+    stats->cpu_mark = cpu;
 
-    return 0;
+    return previous;
 }
 
-static const void *ft_fsize_get_key(const void *opaque)
+/*
+ * The directories are browsed as work items, by the threads of a pool if
+ * several workers are requested or from an explicit stack otherwise, so the
+ * depth of the tree is never limited by the one of the call stack.
+ */
+
+/*
+ * A directory waiting to be browsed, its ancestors are kept for loop
+ * detection. Under -o, the directories also are the table the paths of the
+ * files are interned in: a file or a directory found in a directory only
+ * keeps its name, the full path is rebuilt from its ancestors when needed.
+ */
+typedef struct ft_dir_t
 {
-    const ft_fsize_t *fsize = opaque;
+    const struct ft_dir_t *parent;
+    const char *path;		/* the name in parent if named, the full path otherwise */
+    apr_dev_t device;
+    apr_ino_t inode;
+    struct ft_dirsum_t *sum;	/* under --dirs, once the walk is over */
+    int checked:1;		/* permissions and loops checked, device and inode known */
+    int named:1;
+} ft_dir_t;
 
-    return &(fsize->val);
+/*
+ * Under --dirs, a directory browsed and what its entries tell: a directory
+ * has the same content as another one if their entries have the same names,
+ * the same contents for the files, and the same contents for the
+ * subdirectories, recursively. The digest of the (name, content) of the
+ * entries tells the candidates, checked entry by entry.
+ */
+typedef struct ft_dirsum_t
+{
+    ft_dir_t *dir;
+    const char *path;
+    apr_size_t depth;		/* 0 for the directories given on the command line */
+    apr_size_t first_entry;	/* in conf->dirents */
+    apr_size_t nb_entries;
+    apr_size_t nb_files;	/* below it, subdirectories included */
+    apr_off_t size;		/* of the files below it */
+    apr_uint32_t digest[HASHSTATE];
+    struct ft_dirsum_t *rep;	/* first directory found with the same content, itself if there is none */
+    struct ft_dirsum_t *shown;	/* of a rep, the first directory of its content that is reported */
+    apr_size_t nb_shown;	/* of a rep, the directories of its content that are reported */
+    int matched:1;		/* under --dirs-only, another directory has the same names and sizes */
+    int collapsed:1;		/* reported as the twin of another directory, or below one */
+} ft_dirsum_t;
+
+/* an entry of a directory, sorted by name (then archive member) among the ones of its directory */
+typedef struct ft_dirent_t
+{
+    ft_dirsum_t *parent;
+    const char *name;
+    const char *subpath;	/* of an archive member, NULL otherwise */
+    ft_file_t *file;		/* the one holding the content of the inode, NULL for a subdirectory */
+    ft_dirsum_t *sub;		/* the subdirectory, NULL for a file */
+} ft_dirent_t;
+
+/* is file below a directory reported as the twin of another one under --dirs */
+static int ft_file_is_collapsed(const ft_conf_t *conf, const ft_file_t *file)
+{
+    return (NULL != conf->dirsums) && (NULL != file->parent) && (NULL != file->parent->sum)
+	&& file->parent->sum->collapsed;
 }
 
-static const void *ft_gids_get_key(const void *opaque)
+/* has file to be reported even without a twin of another inode, its clones being verified twins */
+static int ft_file_has_listed_links(const ft_conf_t *conf, const ft_file_t *file)
 {
-    const ft_gid_t *gid = opaque;
+    const ft_file_t *link;
 
-    return &(gid->val);
-}
+    for (link = file->clones; NULL != link; link = link->clones) {
+	if (!ft_file_is_collapsed(conf, link))
+	    return 1;
+    }
+    if (is_option_set(conf->mask, OPTION_HLINK))
+	return 0;
+    for (link = file->links; NULL != link; link = link->links) {
+	if (!ft_file_is_collapsed(conf, link))
+	    return 1;
+    }
 
+    return 0;
+}
 
-static apr_size_t get_one(const void *opaque)
+/* is a '/' needed between the path of dir and the name of an entry */
+static int ft_dir_needs_sep(const ft_dir_t *dir)
 {
-    return 1;
+    return dir->named || ('/' != dir->path[strlen(dir->path) - 1]);
 }
 
-static int apr_uint32_key_cmp(const void *key1, const void *key2, apr_size_t len)
+/*
+ * Build the path of name, found in dir (NULL if name is a full path), in
+ * *buf, reallocated from pool if it is smaller than *size.
+ * @return The length of the path.
+ */
+static apr_size_t ft_path_build(const ft_dir_t *dir, const char *name, char **buf, apr_size_t *size,
+				apr_pool_t *pool)
 {
-    apr_uint32_t i1 = *(apr_uint32_t *) key1;
-    apr_uint32_t i2 = *(apr_uint32_t *) key2;
+    const ft_dir_t *d;
+    apr_size_t len, pos, l;
+
+    /* the components are copied from the end, up to the first ancestor holding a full path */
+    l = strlen(name);
+    len = l;
+    for (d = dir; NULL != d; d = d->named ? d->parent : NULL)
+	len += strlen(d->path) + ft_dir_needs_sep(d);
+    if (*size < len + 1) {
+	*size = 2 * (len + 1);
+	*buf = apr_palloc(pool, *size);
+    }
+    pos = len - l;
+    memcpy(*buf + pos, name, l + 1);
+    for (d = dir; NULL != d; d = d->named ? d->parent : NULL) {
+	if (ft_dir_needs_sep(d))
+	    (*buf)[--pos] = '/';
+	l = strlen(d->path);
+	pos -= l;
+	memcpy(*buf + pos, d->path, l);
+    }
+
+    return len;
+}
 
-    return (i1 == i2) ? 0 : 1;
+static apr_size_t ft_dir_path_buf(const ft_dir_t *dir, char **buf, apr_size_t *size, apr_pool_t *pool)
+{
+    return ft_path_build(dir->named ? dir->parent : NULL, dir->path, buf, size, pool);
 }
 
-/* http://www.burtleburtle.net/bob/hash/integer.html */
-static apr_uint32_t apr_uint32_key_hash(const void *key, apr_size_t klen)
+static const char *ft_file_path(const ft_file_t *file, apr_pool_t *pool)
 {
-    apr_uint32_t i = *(apr_uint32_t *) key;
+    char *buf = NULL;
+    apr_size_t size = 0;
 
-    i = (i + 0x7ed55d16) + (i << 12);
-    i = (i ^ 0xc761c23c) ^ (i >> 19);
-    i = (i + 0x165667b1) + (i << 5);
-    i = (i + 0xd3a2646c) ^ (i << 9);
-    i = (i + 0xfd7046c5) + (i << 3);
-    i = (i ^ 0xb55a4f09) ^ (i >> 16);
+    if (NULL == file->dir)
+	return file->path;
+    ft_path_build(file->dir, file->path, &buf, &size, pool);
 
-    return i;
+    return buf;
 }
 
-static void ft_hash_add_ignore_list(napr_hash_t *hash, const char *file_list)
+/* the path of file, valid until the next call, only for the reporting thread */
+static const char *ft_conf_file_path(ft_conf_t *conf, const ft_file_t *file)
 {
-    const char *filename, *end;
-    apr_uint32_t hash_value;
-    apr_pool_t *pool;
-    char *tmp;
-
-    pool = napr_hash_pool_get(hash);
-    filename = file_list;
-    do {
-	end = strchr(filename, ',');
-	if (NULL != end) {
-	    tmp = apr_pstrndup(pool, filename, end - filename);
-	}
-	else {
-	    tmp = apr_pstrdup(pool, filename);
-	}
-	napr_hash_search(hash, tmp, strlen(tmp), &hash_value);
-	napr_hash_set(hash, tmp, hash_value);
+    if (NULL == file->dir)
+	return file->path;
+    ft_path_build(file->dir, file->path, &(conf->path_buf), &(conf->path_size), conf->pool);
 
-	filename = end + 1;
-    } while ((NULL != end) && ('\0' != *filename));
+    return conf->path_buf;
 }
 
-/**
- * The function used to add recursively or not file and dirs.
- * @param conf Configuration structure.
- * @param filename name of a file or directory to add to the list of twinchecker.
- * @param gc_pool garbage collecting pool, will be cleaned by the caller.
- * @return APR_SUCCESS if no error occured.
+/*
+ * A pool of the jobs of the threads: without a parent, it relies on the
+ * (locked) global allocator, so it is safe to create and destroy it from any
+ * thread.
  */
-#define MATCH_VECTOR_SIZE 210
-static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_pool_t *gc_pool, struct stats const *stats)
+static apr_status_t ft_job_pool_create(apr_pool_t **pool)
 {
-    int ovector[MATCH_VECTOR_SIZE];
-    char errbuf[128];
-    apr_finfo_t finfo;
-    apr_dir_t *dir;
-    apr_int32_t statmask =
-	APR_FINFO_SIZE | APR_FINFO_TYPE | APR_FINFO_USER | APR_FINFO_GROUP | APR_FINFO_UPROT | APR_FINFO_GPROT;
-    apr_size_t fname_len = 0;
-    apr_uint32_t hash_value;
-    apr_status_t status;
-    int rc;
+    return apr_pool_create(pool, NULL);
+}
 
-    /* Step 1 : Check if it's a directory and get the size if not */
-    if (!is_option_set(conf->mask, OPTION_FSYML))
-	statmask |= APR_FINFO_LINK;
+/* whether path is under the priority path of -p */
+static int ft_conf_is_prioritized(const ft_conf_t *conf, const char *path)
+{
+    apr_size_t len = strlen(path);
 
-    if (APR_SUCCESS != (status = apr_stat(&finfo, filename, statmask, gc_pool))) {
-	if (is_option_set(conf->mask, OPTION_FSYML)) {
-	    statmask ^= APR_FINFO_LINK;
-	    if ((APR_SUCCESS == apr_stat(&finfo, filename, statmask, gc_pool)) && (finfo.filetype & APR_LNK)) {
-		if (is_option_set(conf->mask, OPTION_VERBO))
-		    fprintf(stderr, "Skipping : [%s] (broken link)\n", filename);
-		return APR_SUCCESS;
-	    }
-	}
+    return (NULL != conf->p_path) && (len >= conf->p_path_len)
+	&& ((is_option_set(conf->mask, OPTION_ICASE) && !strncasecmp(path, conf->p_path, conf->p_path_len))
+	    || (!is_option_set(conf->mask, OPTION_ICASE) && !memcmp(path, conf->p_path, conf->p_path_len)));
+}
 
-	DEBUG_ERR("error calling apr_stat on filename %s : %s", filename, apr_strerror(status, errbuf, 128));
-	return status;
+static void ft_out_flush(ft_conf_t *conf)
+{
+    if (0 != conf->out.len) {
+	fwrite(conf->out.buf, 1, conf->out.len, stdout);
+	conf->out.len = 0;
     }
+    fflush(stdout);
+}
 
-    /* Step 1-bis, if we don't own the right to read it, skip it */
-    if (0 != conf->userid) {
-	if (finfo.user == conf->userid) {
-	    if (!(APR_UREAD & finfo.protection)) {
-		if (is_option_set(conf->mask, OPTION_VERBO))
-		    fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
-		return APR_SUCCESS;
-	    }
-	}
-	else if (NULL != napr_hash_search(conf->gids, &finfo.group, 1, &hash_value)) {
-	    if (!(APR_GREAD & finfo.protection)) {
-		if (is_option_set(conf->mask, OPTION_VERBO))
-		    fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
-		return APR_SUCCESS;
-	    }
-	}
-	else if (!(APR_WREAD & finfo.protection)) {
-	    if (is_option_set(conf->mask, OPTION_VERBO))
-		fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
-	    return APR_SUCCESS;
+static void ft_out_write(ft_conf_t *conf, const char *str, apr_size_t len)
+{
+    if (FT_OUT_LEN - conf->out.len < len) {
+	ft_out_flush(conf);
+	/* too long to be buffered */
+	if (FT_OUT_LEN < len) {
+	    fwrite(str, 1, len, stdout);
+	    return;
 	}
     }
+    memcpy(conf->out.buf + conf->out.len, str, len);
+    conf->out.len += len;
+}
 
-    /* Step 2: If it is, browse it */
-    if (APR_DIR == finfo.filetype) {
-	if (0 != conf->userid) {
-	    if (finfo.user == conf->userid) {
-		if (!(APR_UEXECUTE & finfo.protection)) {
-		    if (is_option_set(conf->mask, OPTION_VERBO))
-			fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
-		    return APR_SUCCESS;
-		}
-	    }
-	    else if (NULL != napr_hash_search(conf->gids, &finfo.group, 1, &hash_value)) {
-		if (!(APR_GEXECUTE & finfo.protection)) {
-		    if (is_option_set(conf->mask, OPTION_VERBO))
-			fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
-		    return APR_SUCCESS;
-		}
-	    }
-	    else if (!(APR_WEXECUTE & finfo.protection)) {
-		if (is_option_set(conf->mask, OPTION_VERBO))
-		    fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
-		return APR_SUCCESS;
-	    }
-	}
-
-	if (APR_SUCCESS != (status = apr_dir_open(&dir, filename, gc_pool))) {
-	    DEBUG_ERR("error calling apr_dir_open(%s): %s", filename, apr_strerror(status, errbuf, 128));
-	    return status;
-	}
-	fname_len = strlen(filename);
-	while ((APR_SUCCESS == (status = apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, dir)))
-	       && (NULL != finfo.name)) {
-	    /* Check if it has to be ignored */
-	    char *fullname;
-	    apr_size_t fullname_len;
-	    /* for recursive loop detection */
-	    struct stats child;
-	    struct stats const *ancestor;
-
-	    if (NULL != napr_hash_search(conf->ig_files, finfo.name, strlen(finfo.name), NULL))
-		continue;
-
-	    if (APR_DIR == finfo.filetype && !is_option_set(conf->mask, OPTION_RECSD))
-		continue;
-
-	    fullname = apr_pstrcat(gc_pool, filename, ('/' == filename[fname_len - 1]) ? "" : "/", finfo.name, NULL);
-	    fullname_len = strlen(fullname);
+static void ft_out_str(ft_conf_t *conf, const char *str)
+{
+    ft_out_write(conf, str, strlen(str));
+}
 
-	    if ((NULL != conf->ig_regex) && (APR_DIR != finfo.filetype)
-		&& (0 <= (rc = pcre_exec(conf->ig_regex, NULL, fullname, fullname_len, 0, 0, ovector, MATCH_VECTOR_SIZE))))
-		continue;
+static void ft_out_char(ft_conf_t *conf, char c)
+{
+    ft_out_write(conf, &c, 1);
+}
 
-	    if ((NULL != conf->wl_regex) && (APR_DIR != finfo.filetype)
-		&& (0 > (rc = pcre_exec(conf->wl_regex, NULL, fullname, fullname_len, 0, 0, ovector, MATCH_VECTOR_SIZE))))
-		continue;
+/* Length of the well-formed UTF-8 sequence str starts with, 0 if it is not one */
+static apr_size_t ft_utf8_len(const unsigned char *str)
+{
+    apr_uint32_t c;
+    apr_size_t len, i;
 
-	    if (stats) {
-		if (stats->stat.inode)
-		    for (ancestor = stats; (ancestor = ancestor->parent) != 0;)
-			if (ancestor->stat.inode == stats->stat.inode && ancestor->stat.device == stats->stat.device) {
-			    if (is_option_set(conf->mask, OPTION_VERBO))
-				fprintf(stderr, "Warning: %s: recursive directory loop\n", filename);
-			    /* skip it */
-			    return APR_SUCCESS;
-			}
-	    }
-	    child.parent = stats;
-	    child.stat = finfo;
+    if (str[0] < 0x80)
+	return 1;
+    if ((str[0] & 0xe0) == 0xc0) {
+	len = 2;
+	c = str[0] & 0x1f;
+    }
+    else if ((str[0] & 0xf0) == 0xe0) {
+	len = 3;
+	c = str[0] & 0x0f;
+    }
+    else if ((str[0] & 0xf8) == 0xf0) {
+	len = 4;
+	c = str[0] & 0x07;
+    }
+    else {
+	return 0;
+    }
+    /* the terminating NUL is not a continuation byte */
+    for (i = 1; i < len; i++) {
+	if ((str[i] & 0xc0) != 0x80)
+	    return 0;
+	c = (c << 6) | (str[i] & 0x3f);
+    }
+    /* overlong forms, surrogates and what lies beyond U+10FFFF */
+    if (((2 == len) && (c < 0x80)) || ((3 == len) && (c < 0x800)) || ((4 == len) && (c < 0x10000))
+	|| ((c >= 0xd800) && (c <= 0xdfff)) || (c > 0x10ffff))
+	return 0;
 
-	    status = ft_conf_add_file(conf, fullname, gc_pool, &child);
+    return len;
+}
 
-	    if (APR_SUCCESS != status) {
-		DEBUG_ERR("error recursively calling ft_conf_add_file: %s", apr_strerror(status, errbuf, 128));
-		return status;
-	    }
+/*
+ * Write str escaped in a json string: quotes, backslashes and control
+ * characters are escaped, the bytes that are not UTF-8 are replaced by
+ * U+FFFD. Return 1 if any was, the exact bytes are then to be written as
+ * well, see ft_out_json_b64.
+ */
+static int ft_out_json_chars(ft_conf_t *conf, const char *str)
+{
+    char esc[8];
+    const char *p;
+    apr_size_t len;
+    int lossy = 0;
+
+    for (p = str; '\0' != *p; p += len) {
+	len = 1;
+	if (('"' == *p) || ('\\' == *p)) {
+	    esc[0] = '\\';
+	    esc[1] = *p;
+	    ft_out_write(conf, esc, 2);
 	}
-	if ((APR_SUCCESS != status) && (APR_ENOENT != status)) {
-	    DEBUG_ERR("error calling apr_dir_read: %s", apr_strerror(status, errbuf, 128));
-	    return status;
+	else if ((unsigned char) *p < 0x20) {
+	    apr_snprintf(esc, sizeof(esc), "\\u%04x", (unsigned int) (unsigned char) *p);
+	    ft_out_write(conf, esc, 6);
 	}
-
-	if (APR_SUCCESS != (status = apr_dir_close(dir))) {
-	    DEBUG_ERR("error calling apr_dir_close: %s", apr_strerror(status, errbuf, 128));
-	    return status;
+	else if (0 != (len = ft_utf8_len((const unsigned char *) p))) {
+	    ft_out_write(conf, p, len);
 	}
-    }
-    else if (APR_REG == finfo.filetype || ((APR_LNK == finfo.filetype) && (is_option_set(conf->mask, OPTION_FSYML)))) {
-	apr_off_t finfosize;
-	char *fname;
-#if HAVE_ARCHIVE
-	const char *subpath;
-	/* XXX La */
-	struct archive *a = NULL;
-	struct archive_entry *entry = NULL;
-	int rv;
-#endif
-
-	fname = apr_pstrdup(conf->pool, filename);
-	finfosize = finfo.size;
-#if HAVE_ARCHIVE
-	subpath = NULL;
-	fname_len = strlen(filename);
-	if (is_option_set(conf->mask, OPTION_UNTAR)) {
-	    if ((NULL != conf->ar_regex)
-		&& (0 <= (rc = pcre_exec(conf->ar_regex, NULL, filename, fname_len, 0, 0, ovector, MATCH_VECTOR_SIZE)))) {
-		a = archive_read_new();
-		if (NULL == a) {
-		    DEBUG_ERR("error calling archive_read_new()");
-		    return APR_EGENERAL;
-		}
-		rv = archive_read_support_filter_all(a);
-		if (0 != rv) {
-		    DEBUG_ERR("error calling archive_read_support_filter_all(): %s", archive_error_string(a));
-		    return APR_EGENERAL;
-		}
-		rv = archive_read_support_format_all(a);
-		if (0 != rv) {
-		    DEBUG_ERR("error calling archive_read_support_format_all(): %s", archive_error_string(a));
-		    return APR_EGENERAL;
-		}
-		rv = archive_read_open_filename(a, filename, 10240);
-		if (0 != rv) {
-		    DEBUG_ERR("error calling archive_read_open_filename(%s): %s", filename, archive_error_string(a));
-		    return APR_EGENERAL;
-		}
-	    }
+	else {
+	    ft_out_str(conf, "\\ufffd");
+	    lossy = 1;
+	    len = 1;
 	}
+    }
 
-	do {
-#endif
-	    if (finfosize >= conf->minsize
-#if HAVE_ARCHIVE
-		&& ((NULL == a) || ((NULL != entry) && !(AE_IFDIR & archive_entry_filetype(entry))))
-#endif
-		) {
-		ft_file_t *file;
-		ft_fsize_t *fsize;
+    return lossy;
+}
 
-		file = apr_palloc(conf->pool, sizeof(struct ft_file_t));
-		file->path = fname;
-		file->size = finfosize;
-#if HAVE_ARCHIVE
-		if (subpath) {
-		    file->subpath = apr_pstrdup(conf->pool, subpath);
-		}
-		else {
-		    file->subpath = NULL;
-		}
-#endif
-		if ((conf->p_path) && (fname_len >= conf->p_path_len)
-		    && ((is_option_set(conf->mask, OPTION_ICASE) && !strncasecmp(filename, conf->p_path, conf->p_path_len))
-			|| (!is_option_set(conf->mask, OPTION_ICASE) && !memcmp(filename, conf->p_path, conf->p_path_len)))) {
-		    file->prioritized |= 0x1;
-		}
-		else {
-		    file->prioritized &= 0x0;
-		}
-#if HAVE_PUZZLE
-		file->cvec_ok &= 0x0;
-#endif
-		napr_heap_insert(conf->heap, file);
+/* Write the base64 encoding of the bytes of str followed by the ones of suffix */
+static void ft_out_json_b64(ft_conf_t *conf, const char *str, const char *suffix)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const char *parts[2];
+    unsigned char in[3];
+    char out[4];
+    const char *p;
+    apr_size_t n = 0;
+    int i;
 
-		if (NULL == (fsize = napr_hash_search(conf->sizes, &finfosize, 1, &hash_value))) {
-		    fsize = apr_palloc(conf->pool, sizeof(struct ft_fsize_t));
-		    fsize->val = finfosize;
-		    fsize->chksum_array = NULL;
-		    fsize->nb_checksumed = 0;
-		    fsize->nb_files = 0;
-		    napr_hash_set(conf->sizes, fsize, hash_value);
-		}
-		fsize->nb_files++;
-	    }
-#if HAVE_ARCHIVE
-	    if (a) {
-		rv = archive_read_next_header(a, &entry);
-		if (ARCHIVE_EOF != rv) {
-		    if (ARCHIVE_OK == rv) {
-			finfosize = archive_entry_size(entry);
-			subpath = archive_entry_pathname(entry);
-		    }
-		    else {
-			/*
-			 * if this is the first all to read_next_header, we may
-			 * be processing a bad file, ignore it silently.
-			 */
-			if (NULL != subpath) {
-			    DEBUG_ERR("error calling archive_read_next_header(%s): %s", fname, archive_error_string(a));
-			    return APR_EGENERAL;
-			}
-			else {
-			    break;
-			}
-		    }
-		}
+    parts[0] = str;
+    parts[1] = (NULL != suffix) ? suffix : "";
+    for (i = 0; i < 2; i++) {
+	for (p = parts[i]; '\0' != *p; p++) {
+	    in[n++] = (unsigned char) *p;
+	    if (3 == n) {
+		out[0] = digits[in[0] >> 2];
+		out[1] = digits[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+		out[2] = digits[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+		out[3] = digits[in[2] & 0x3f];
+		ft_out_write(conf, out, 4);
+		n = 0;
 	    }
-	} while (a && (ARCHIVE_EOF != rv));
-	if (a)
-	    archive_read_free(a);
-#endif
+	}
+    }
+    if (0 != n) {
+	in[1] = (2 == n) ? in[1] : 0;
+	out[0] = digits[in[0] >> 2];
+	out[1] = digits[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+	out[2] = (2 == n) ? digits[(in[1] & 0x0f) << 2] : '=';
+	out[3] = '=';
+	ft_out_write(conf, out, 4);
     }
-
-    return APR_SUCCESS;
 }
 
-#if HAVE_ARCHIVE
-static int copy_data(struct archive *ar, struct archive *aw)
+/*
+ * Start a group of twins of the given type (files, dirs or images), size
+ * being -1 and digest NULL when they are unknown.
+ */
+static void ft_out_group(ft_conf_t *conf, const char *type, apr_off_t size, const apr_uint32_t *digest)
 {
-    const void *buff;
-    off_t offset;
-    size_t size;
-    int rv;
-
-    for (;;) {
-	rv = archive_read_data_block(ar, &buff, &size, &offset);
-	if (rv == ARCHIVE_EOF) {
-	    return ARCHIVE_OK;
+    char buf[HASHSTATE * 8 + 64];
+    apr_size_t len, i, nb_words;
+
+    /* the significant words of the digest only */
+    nb_words = (ft_hash_digest_len(conf->hash) + sizeof(apr_uint32_t) - 1) / sizeof(apr_uint32_t);
+    conf->out.nb_paths = 0;
+    switch (conf->out.format) {
+    case FT_FORMAT_NULL:
+	ft_out_str(conf, type);
+	ft_out_char(conf, '\0');
+	len = (0 <= size) ? apr_snprintf(buf, sizeof(buf), "%" APR_OFF_T_FMT, size) : 0;
+	buf[len++] = '\0';
+	if (NULL != digest)
+	    for (i = 0; i < nb_words; i++)
+		len += apr_snprintf(buf + len, sizeof(buf) - len, "%08x", digest[i]);
+	buf[len++] = '\0';
+	ft_out_write(conf, buf, len);
+	break;
+    case FT_FORMAT_JSONL:
+	ft_out_str(conf, "{\"type\":\"");
+	ft_out_str(conf, type);
+	ft_out_char(conf, '"');
+	if (0 <= size) {
+	    len = apr_snprintf(buf, sizeof(buf), ",\"size\":%" APR_OFF_T_FMT, size);
+	    ft_out_write(conf, buf, len);
 	}
-	if (rv != ARCHIVE_OK) {
-	    DEBUG_ERR("error calling archive_read_data_block(): %s", archive_error_string(ar));
-	    return rv;
+	if (NULL != digest) {
+	    ft_out_str(conf, ",\"digest\":\"");
+	    for (i = 0, len = 0; i < nb_words; i++)
+		len += apr_snprintf(buf + len, sizeof(buf) - len, "%08x", digest[i]);
+	    ft_out_write(conf, buf, len);
+	    ft_out_char(conf, '"');
 	}
-	rv = archive_write_data_block(aw, buff, size, offset);
-	if (rv != ARCHIVE_OK) {
-	    DEBUG_ERR("error calling archive_write_data_block(): %s", archive_error_string(aw));
-	    return rv;
+	ft_out_str(conf, ",\"paths\":[");
+	break;
+    default:
+	if (is_option_set(conf->mask, OPTION_SIZED) && (0 <= size)) {
+	    len = apr_snprintf(buf, sizeof(buf), "size [%" APR_OFF_T_FMT "]:\n", size);
+	    ft_out_write(conf, buf, len);
 	}
+	break;
     }
 }
 
-static char *ft_untar_file(ft_file_t *file, apr_pool_t *p)
+/*
+ * Write a path of the current group: under --format=null, a field made of
+ * '+' for a path under -p or '-' otherwise, followed by the path, then a
+ * field holding the member of an archive, empty for a plain file, so that
+ * no byte of a path is ever taken as a separator.
+ */
+static void ft_out_path(ft_conf_t *conf, const char *path, const char *subpath, const char *suffix, int prioritized)
 {
-    struct archive *a = NULL;
-    struct archive *ext = NULL;
-    struct archive_entry *entry = NULL;
-    char *tmpfile = NULL;
-    int rv;
-
-    a = archive_read_new();
-    if (NULL == a) {
-	DEBUG_ERR("error calling archive_read_new()");
-	return NULL;
-    }
-    rv = archive_read_support_filter_all(a);
-    if (0 != rv) {
-	DEBUG_ERR("error calling archive_read_support_filter_all(): %s", archive_error_string(a));
-	return NULL;
-    }
-    rv = archive_read_support_format_all(a);
-    if (0 != rv) {
-	DEBUG_ERR("error calling archive_read_support_format_all(): %s", archive_error_string(a));
-	return NULL;
-    }
-    rv = archive_read_open_filename(a, file->path, 10240);
-    if (0 != rv) {
-	DEBUG_ERR("error calling archive_read_open_filename(%s): %s", file->path, archive_error_string(a));
-	return NULL;
-    }
-
-    ext = archive_write_disk_new();
-    if (NULL == ext) {
-	DEBUG_ERR("error calling archive_write_disk_new()");
-	return NULL;
-    }
-
-    for (;;) {
-	rv = archive_read_next_header(a, &entry);
-	if (rv == ARCHIVE_EOF) {
-	    DEBUG_ERR("subpath [%s] not found in archive [%s]", file->subpath, file->path);
-	    return NULL;
+    int lossy;
+
+    switch (conf->out.format) {
+    case FT_FORMAT_NULL:
+	ft_out_char(conf, prioritized ? '+' : '-');
+	ft_out_str(conf, path);
+	ft_out_str(conf, suffix);
+	ft_out_char(conf, '\0');
+	if (NULL != subpath)
+	    ft_out_str(conf, subpath);
+	ft_out_char(conf, '\0');
+	break;
+    case FT_FORMAT_JSONL:
+	ft_out_str(conf, (0 == conf->out.nb_paths) ? "{\"path\":\"" : ",{\"path\":\"");
+	lossy = ft_out_json_chars(conf, path);
+	lossy |= ft_out_json_chars(conf, suffix);
+	ft_out_char(conf, '"');
+	if (lossy) {
+	    ft_out_str(conf, ",\"path_b64\":\"");
+	    ft_out_json_b64(conf, path, suffix);
+	    ft_out_char(conf, '"');
 	}
-	if (rv != ARCHIVE_OK) {
-	    DEBUG_ERR("error in archive (%s): %s", file->path, archive_error_string(a));
-	    return NULL;
-	}
-
-	if (!strcmp(file->subpath, archive_entry_pathname(entry))) {
-	    mode_t current_mode = umask(S_IRWXG | S_IRWXO);
-
-	    /*
-	     * All I want is only a temporary filename, but gcc outputs me an
-	     * ugly warning if I use tempnam...
-	     * tmpfile = tempnam("/tmp/", "ftwin");
-	     */
-	    tmpfile = apr_pstrdup(p, "/tmp/ftwinXXXXXX");
-	    rv = mkstemp(tmpfile);
-	    if (rv < 0) {
-		DEBUG_ERR("error creating tmpfile %s", tmpfile);
-		return NULL;
-	    }
-	    umask(current_mode);
-	    close(rv);
-
-	    archive_entry_copy_pathname(entry, tmpfile);
-
-	    rv = archive_write_header(ext, entry);
-	    if (rv == ARCHIVE_OK) {
-		rv = copy_data(a, ext);
-		if (rv != ARCHIVE_OK) {
-		    DEBUG_ERR("error while copying data from archive (%s)", file->path);
-		    apr_file_remove(tmpfile, p);
-		    return NULL;
-		}
-	    }
-	    else {
-		DEBUG_ERR("error in archive (%s): %s", file->path, archive_error_string(a));
-		apr_file_remove(tmpfile, p);
-		return NULL;
+	if (NULL != subpath) {
+	    ft_out_str(conf, ",\"member\":\"");
+	    lossy = ft_out_json_chars(conf, subpath);
+	    ft_out_char(conf, '"');
+	    if (lossy) {
+		ft_out_str(conf, ",\"member_b64\":\"");
+		ft_out_json_b64(conf, subpath, NULL);
+		ft_out_char(conf, '"');
 	    }
-
-	    break;
 	}
+	ft_out_str(conf, prioritized ? ",\"priority\":true}" : ",\"priority\":false}");
+	break;
+    default:
+	if (0 != conf->out.nb_paths)
+	    ft_out_char(conf, conf->sep);
+	ft_out_str(conf, path);
+	if (NULL != subpath) {
+	    ft_out_char(conf, (':' != conf->sep) ? ':' : '|');
+	    ft_out_str(conf, subpath);
+	}
+	ft_out_str(conf, suffix);
+	break;
     }
+    conf->out.nb_paths++;
+}
 
-    archive_write_free(ext);
-    archive_read_free(a);
+/* Start a record of an event of --watch, followed by the paths it is about */
+static void ft_out_event(ft_conf_t *conf, const char *type)
+{
+    conf->out.nb_paths = 0;
+    switch (conf->out.format) {
+    case FT_FORMAT_NULL:
+	/* a group without size nor digest */
+	ft_out_str(conf, type);
+	ft_out_write(conf, "\0\0\0", 3);
+	break;
+    case FT_FORMAT_JSONL:
+	ft_out_str(conf, "{\"type\":\"");
+	ft_out_str(conf, type);
+	ft_out_str(conf, "\",\"paths\":[");
+	break;
+    default:
+	ft_out_str(conf, type);
+	ft_out_str(conf, ":\n");
+	break;
+    }
+}
 
-    return tmpfile;
+static void ft_out_group_end(ft_conf_t *conf)
+{
+    switch (conf->out.format) {
+    case FT_FORMAT_NULL:
+	ft_out_char(conf, '\0');
+	break;
+    case FT_FORMAT_JSONL:
+	ft_out_str(conf, "]}\n");
+	break;
+    default:
+	ft_out_str(conf, "\n\n");
+	break;
+    }
 }
 
+/*
+ * Files found under -o, kept as columns rather than as ft_file_t: once the
+ * walk is over, only the ones sharing their size with another file become a
+ * ft_file_t, see ft_conf_add_files.
+ */
+#define FT_FILES_CHUNK 4096
+#define FT_NAMES_LEN 65536
+
+typedef struct ft_files_chunk_t
+{
+    struct ft_files_chunk_t *next;
+    apr_size_t nb_files;
+    apr_off_t size[FT_FILES_CHUNK];
+    apr_time_t mtime[FT_FILES_CHUNK];
+    apr_dev_t device[FT_FILES_CHUNK];
+    apr_ino_t inode[FT_FILES_CHUNK];
+    const ft_dir_t *dir[FT_FILES_CHUNK];
+    char *name[FT_FILES_CHUNK];
+    unsigned char prioritized[FT_FILES_CHUNK];
+} ft_files_chunk_t;
+
+/* bytes held by a record, its name aside, with what ft_walker_spill sorts it with */
+#define FT_RECORD_LEN (sizeof(struct ft_files_chunk_t) / FT_FILES_CHUNK + 3 * sizeof(napr_radix_pair_t))
+
+/* What is needed to browse a directory, used by one thread at a time */
+typedef struct ft_walker_t
+{
+    struct ft_walker_t *next;	/* in the free list */
+    apr_pool_t *pool;		/* holds the files and the directories found, lives as long as conf->pool */
+    apr_pool_t *gc_pool;	/* cleared after each directory */
+    apr_array_header_t *files;	/* ft_file_t * found, merged in conf once the walk is over */
+    apr_pool_t *chunk_pool;	/* holds the chunks, destroyed once they are merged */
+    ft_files_chunk_t *chunks;	/* files found under -o, in the order they were found */
+    ft_files_chunk_t *last_chunk;
+    char *names;		/* room left for the names of the files found under -o */
+    apr_size_t names_len;
+    apr_pool_t *names_pool;	/* holds the names, a pool of its own under --mem-limit, pool otherwise */
+    apr_size_t nb_records;	/* in chunks */
+    apr_size_t records_len;	/* bytes held by the chunks and the names, see --mem-limit */
+    apr_array_header_t *dirs;	/* ft_dir_t * browsed under --dirs, merged in conf with the files */
+    ft_walk_stats_t stats;
+#if HAVE_ARCHIVE
+    unsigned char *ar_samples;	/* blocks sampled in the archive member being digested */
 #endif
+#if FT_DIRFD_SCAN
+    char *dents;		/* getdents64 buffer */
+    char *fullname;		/* path of the current entry, only duplicated if the entry is kept */
+    apr_size_t fullname_size;
+#endif
+} ft_walker_t;
 
-static apr_status_t ft_conf_process_sizes(ft_conf_t *conf)
+typedef struct ft_walk_ctx_t
 {
-    char errbuf[128];
+    ft_conf_t *conf;
+    napr_threadpool_t *threadpool;	/* NULL if the directories are browsed from stack */
+    apr_array_header_t *stack;	/* ft_dir_t * waiting to be browsed, without threadpool or under --stream */
+    ft_walker_t *walkers;
+    apr_size_t nb_walkers;
+    /* This mutex protects the fields below */
+    apr_thread_mutex_t *mutex;
+    ft_walker_t *free_walkers;
+    apr_status_t status;	/* first error met, the walk stops on it */
+} ft_walk_ctx_t;
+
+static ft_walker_t *ft_walker_get(ft_walk_ctx_t *walk)
+{
+    ft_walker_t *walker;
+
+    apr_thread_mutex_lock(walk->mutex);
+    /* there are more walkers than threads browsing at the same time */
+    walker = walk->free_walkers;
+    walk->free_walkers = walker->next;
+    apr_thread_mutex_unlock(walk->mutex);
+
+    return walker;
+}
+
+static void ft_walker_put(ft_walk_ctx_t *walk, ft_walker_t *walker, apr_status_t rv)
+{
+    apr_pool_clear(walker->gc_pool);
+    apr_thread_mutex_lock(walk->mutex);
+    walker->next = walk->free_walkers;
+    walk->free_walkers = walker;
+    if ((APR_SUCCESS != rv) && (APR_SUCCESS == walk->status))
+	walk->status = rv;
+    apr_thread_mutex_unlock(walk->mutex);
+}
+
+static apr_status_t ft_walk_push(ft_walk_ctx_t *walk, ft_dir_t *dir)
+{
+    char errbuf[128];
+    apr_status_t status;
+
+    if (NULL == walk->threadpool) {
+	APR_ARRAY_PUSH(walk->stack, ft_dir_t *) = dir;
+	return APR_SUCCESS;
+    }
+    /* the threads are only given a few directories at a time, see ft_walk_stream */
+    if (0 != walk->conf->stream_len) {
+	apr_thread_mutex_lock(walk->mutex);
+	APR_ARRAY_PUSH(walk->stack, ft_dir_t *) = dir;
+	apr_thread_mutex_unlock(walk->mutex);
+	return APR_SUCCESS;
+    }
+
+    if (APR_SUCCESS != (status = napr_threadpool_add(walk->threadpool, dir))) {
+	DEBUG_ERR("error calling napr_threadpool_add: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
+
+/* Is the user (conf->userid) granted the right, given as owner, group and other masks, on the file */
+static int ft_conf_is_granted(const ft_conf_t *conf, const apr_finfo_t *finfo, apr_fileperms_t uperm,
+			      apr_fileperms_t gperm, apr_fileperms_t wperm)
+{
+    if (0 == conf->userid)
+	return 1;
+
+    if (finfo->user == conf->userid)
+	return 0 != (uperm & finfo->protection);
+
+    if (NULL != napr_inthash_get(conf->gids, (apr_uint64_t) finfo->group, 0))
+	return 0 != (gperm & finfo->protection);
+
+    return 0 != (wperm & finfo->protection);
+}
+
+/* Keep the name of a file found under -o, packed with the others */
+static char *ft_walker_name(ft_walker_t *walker, const char *name, apr_size_t len)
+{
+    char *result;
+
+    if (walker->names_len < len + 1) {
+	walker->names_len = (FT_NAMES_LEN < len + 1) ? len + 1 : FT_NAMES_LEN;
+	walker->names = apr_palloc(walker->names_pool, walker->names_len);
+    }
+    result = walker->names;
+    memcpy(result, name, len + 1);
+    walker->names += len + 1;
+    walker->names_len -= len + 1;
+
+    return result;
+}
+
+static void ft_walker_add_record(ft_walker_t *walker, const char *filename, apr_size_t fname_len,
+				 const apr_finfo_t *finfo, const ft_dir_t *parent, int prioritized)
+{
+    ft_files_chunk_t *chunk = walker->last_chunk;
+    const char *name = filename;
+    apr_size_t i;
+
+    if ((NULL == chunk) || (FT_FILES_CHUNK == chunk->nb_files)) {
+	chunk = apr_palloc(walker->chunk_pool, sizeof(struct ft_files_chunk_t));
+	chunk->next = NULL;
+	chunk->nb_files = 0;
+	if (NULL == walker->last_chunk)
+	    walker->chunks = chunk;
+	else
+	    walker->last_chunk->next = chunk;
+	walker->last_chunk = chunk;
+    }
+    /* the files of the command line keep their full path */
+    if (NULL != parent)
+	name = strrchr(filename, '/') + 1;
+    i = chunk->nb_files++;
+    chunk->size[i] = finfo->size;
+    chunk->mtime[i] = finfo->mtime;
+    chunk->device[i] = finfo->device;
+    chunk->inode[i] = finfo->inode;
+    chunk->dir[i] = parent;
+    chunk->name[i] = ft_walker_name(walker, name, fname_len - (name - filename));
+    chunk->prioritized[i] = prioritized;
+    walker->nb_records++;
+    walker->records_len += FT_RECORD_LEN + fname_len - (name - filename) + 1;
+}
+
+/* runs of --mem-limit merged at once, see ft_conf_spill_add */
+#define FT_SPILL_MAX_RUNS 64
+
+/* a record of a walker, while they are sorted by ft_walker_spill */
+typedef struct ft_record_ref_t
+{
+    const ft_files_chunk_t *chunk;
+    apr_size_t i;
+} ft_record_ref_t;
+
+/*
+ * Keep a run spilled by a walker, the mutex shared by the walkers not being
+ * held. Once there are too many of them, half of them in a row, the ones
+ * holding the fewest records, are merged into a single run in their place: the
+ * runs left are merged at once by ft_conf_spill_report, a record is written
+ * again a few times only and the records of a size keep the order they were
+ * found in. The runs merged are taken out of conf->spills, so that the other
+ * walkers go on spilling meanwhile, a single merge being done at a time.
+ */
+static apr_status_t ft_conf_spill_add(ft_conf_t *conf, apr_thread_mutex_t *mutex, ft_spill_t *run)
+{
+    char errbuf[128];
+    ft_spill_t *runs[FT_SPILL_MAX_RUNS], *merged = NULL;
+    ft_spill_merge_t *merge;
+    ft_spill_rec_t rec;
+    apr_pool_t *gc_pool;
+    apr_uint64_t nb_recs, min_recs;
+    apr_size_t i, first, nb_merged;
+    apr_status_t status;
+
+    apr_thread_mutex_lock(mutex);
+    APR_ARRAY_PUSH(conf->spills, ft_spill_t *) = run;
+    if (NULL != conf->stats) {
+	conf->stats->nb_spilled += ft_spill_nb_recs(run);
+	conf->stats->nb_spills++;
+    }
+    while (!conf->spill_merging && (FT_SPILL_MAX_RUNS <= conf->spills->nelts)) {
+	nb_merged = FT_SPILL_MAX_RUNS / 2;
+	for (i = 0, nb_recs = 0; i < nb_merged; i++)
+	    nb_recs += ft_spill_nb_recs(APR_ARRAY_IDX(conf->spills, i, ft_spill_t *));
+	for (i = nb_merged, first = 0, min_recs = nb_recs; i < conf->spills->nelts; i++) {
+	    nb_recs += ft_spill_nb_recs(APR_ARRAY_IDX(conf->spills, i, ft_spill_t *));
+	    nb_recs -= ft_spill_nb_recs(APR_ARRAY_IDX(conf->spills, i - nb_merged, ft_spill_t *));
+	    if (nb_recs < min_recs) {
+		min_recs = nb_recs;
+		first = i - nb_merged + 1;
+	    }
+	}
+	/* the runs are children of conf->pool, shared by the walkers */
+	if (APR_SUCCESS != (status = ft_spill_create(&merged, conf->spill_dir, conf->pool))) {
+	    DEBUG_ERR("error calling ft_spill_create: %s", apr_strerror(status, errbuf, 128));
+	    apr_thread_mutex_unlock(mutex);
+	    return status;
+	}
+	memcpy(runs, (ft_spill_t **) conf->spills->elts + first, nb_merged * sizeof(ft_spill_t *));
+	APR_ARRAY_IDX(conf->spills, first, ft_spill_t *) = NULL;
+	memmove((ft_spill_t **) conf->spills->elts + first + 1, (ft_spill_t **) conf->spills->elts + first + nb_merged,
+		(conf->spills->nelts - first - nb_merged) * sizeof(ft_spill_t *));
+	conf->spills->nelts -= nb_merged - 1;
+	conf->spill_merging = 1;
+	apr_thread_mutex_unlock(mutex);
+
+	if (APR_SUCCESS == (status = ft_job_pool_create(&gc_pool))) {
+	    if (APR_SUCCESS == (status = ft_spill_merge_open(&merge, runs, nb_merged, gc_pool)))
+		while ((APR_SUCCESS == (status = ft_spill_merge_read(merge, &rec)))
+		       && (APR_SUCCESS == (status = ft_spill_write(merged, &rec))));
+	    apr_pool_destroy(gc_pool);
+	}
+
+	apr_thread_mutex_lock(mutex);
+	conf->spill_merging = 0;
+	for (i = 0; (i < conf->spills->nelts) && (NULL != APR_ARRAY_IDX(conf->spills, i, ft_spill_t *)); i++);
+	if (!APR_STATUS_IS_EOF(status)) {
+	    DEBUG_ERR("error merging the spilled runs: %s", apr_strerror(status, errbuf, 128));
+	    memmove((ft_spill_t **) conf->spills->elts + i, (ft_spill_t **) conf->spills->elts + i + 1,
+		    (conf->spills->nelts - i - 1) * sizeof(ft_spill_t *));
+	    conf->spills->nelts--;
+	    for (i = 0; i < nb_merged; i++)
+		ft_spill_close(runs[i]);
+	    ft_spill_close(merged);
+	    apr_thread_mutex_unlock(mutex);
+	    return status;
+	}
+	APR_ARRAY_IDX(conf->spills, i, ft_spill_t *) = merged;
+	for (i = 0; i < nb_merged; i++)
+	    ft_spill_close(runs[i]);
+	if (NULL != conf->stats)
+	    conf->stats->nb_spills++;
+    }
+    apr_thread_mutex_unlock(mutex);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Under --mem-limit, write the records of walker to a run, the largest size
+ * first, and forget them: their chunks and names are released with
+ * chunk_pool, the directories they point to are kept.
+ */
+static apr_status_t ft_walker_spill(ft_walk_ctx_t *walk, ft_walker_t *walker)
+{
+    char errbuf[128];
+    ft_conf_t *conf = walk->conf;
+    napr_radix_pair_t *pairs, *tmp;
+    ft_record_ref_t *refs;
+    const ft_record_ref_t *ref;
+    const ft_files_chunk_t *chunk;
+    ft_spill_rec_t rec;
+    ft_spill_t *run;
+    apr_size_t i, nb;
+    apr_status_t status;
+
+    if (0 == walker->nb_records)
+	return APR_SUCCESS;
+
+    pairs = apr_palloc(walker->chunk_pool, walker->nb_records * sizeof(napr_radix_pair_t));
+    tmp = apr_palloc(walker->chunk_pool, walker->nb_records * sizeof(napr_radix_pair_t));
+    refs = apr_palloc(walker->chunk_pool, walker->nb_records * sizeof(ft_record_ref_t));
+    for (chunk = walker->chunks, nb = 0; NULL != chunk; chunk = chunk->next) {
+	for (i = 0; i < chunk->nb_files; i++, nb++) {
+	    refs[nb].chunk = chunk;
+	    refs[nb].i = i;
+	    /* the largest first, the records of a size in the order they were found */
+	    pairs[nb].key = ~(apr_uint64_t) chunk->size[i];
+	    pairs[nb].value = &(refs[nb]);
+	}
+    }
+    napr_radix_sort(pairs, tmp, nb);
+
+    /* the runs are children of conf->pool, shared by the walkers */
+    apr_thread_mutex_lock(walk->mutex);
+    status = ft_spill_create(&run, conf->spill_dir, conf->pool);
+    apr_thread_mutex_unlock(walk->mutex);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling ft_spill_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    for (i = 0; (i < nb) && (APR_SUCCESS == status); i++) {
+	ref = pairs[i].value;
+	rec.size = ref->chunk->size[ref->i];
+	rec.mtime = ref->chunk->mtime[ref->i];
+	rec.device = ref->chunk->device[ref->i];
+	rec.inode = ref->chunk->inode[ref->i];
+	rec.dir = ref->chunk->dir[ref->i];
+	rec.name = ref->chunk->name[ref->i];
+	rec.prioritized = ref->chunk->prioritized[ref->i];
+	status = ft_spill_write(run, &rec);
+    }
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling ft_spill_write: %s", apr_strerror(status, errbuf, 128));
+	apr_thread_mutex_lock(walk->mutex);
+	ft_spill_close(run);
+	apr_thread_mutex_unlock(walk->mutex);
+    }
+    else {
+	status = ft_conf_spill_add(conf, walk->mutex, run);
+    }
+
+    apr_pool_clear(walker->chunk_pool);
+    apr_pool_clear(walker->names_pool);
+    walker->chunks = NULL;
+    walker->last_chunk = NULL;
+    walker->names = NULL;
+    walker->names_len = 0;
+    walker->nb_records = 0;
+    walker->records_len = 0;
+
+    return status;
+}
+
+/*
+ * Number of bytes a stage reads in each file of the given size, 0 if the stage
+ * is useless for that size (i.e. the previous stages already hashed the whole
+ * content).
+ */
+static apr_off_t ft_stage_len(const ft_conf_t *conf, int stage, apr_off_t size)
+{
+    switch (stage) {
+    case FT_STAGE_HEAD:
+	return FTWIN_MIN(FT_STAGE_BLOCK_LEN, size);
+    case FT_STAGE_TAIL:
+	return (size > FT_STAGE_BLOCK_LEN) ? FTWIN_MIN(FT_STAGE_BLOCK_LEN, size - FT_STAGE_BLOCK_LEN) : 0;
+    case FT_STAGE_SAMPLES:
+	if ((0 == conf->nb_samples) || (size <= (apr_off_t) (conf->nb_samples + 2) * FT_STAGE_BLOCK_LEN))
+	    return 0;
+	return (apr_off_t) conf->nb_samples * FT_STAGE_BLOCK_LEN;
+    case FT_STAGE_FULL:
+	return (size > 2 * FT_STAGE_BLOCK_LEN) ? size : 0;
+    }
+
+    return 0;
+}
+
+/* end of the chunk hashed by a round of the full stage in a file of the given size */
+static apr_off_t ft_chunk_end(int round, apr_off_t size)
+{
+    apr_off_t end = 0, len = FT_CHUNK_LEN;
+    int r;
+
+    if (FT_CHUNK_NB - 1 <= round)
+	return size;
+    for (r = 0; r <= round; r++, len *= 4)
+	end += len;
+
+    return FTWIN_MIN(end, size);
+}
+
+/* number of rounds of the full stage for a file of the given size */
+static int ft_chunk_nb(apr_off_t size)
+{
+    int round;
+
+    for (round = 0; ft_chunk_end(round, size) < size; round++);
+
+    return round + 1;
+}
+
+/* bytes read by a round of a stage (0 for the stages read at once), 0 if there is no such round */
+static apr_off_t ft_round_len(const ft_conf_t *conf, int stage, int round, apr_off_t size)
+{
+    if (FT_STAGE_FULL != stage)
+	return (0 == round) ? ft_stage_len(conf, stage, size) : 0;
+    if ((0 == ft_stage_len(conf, stage, size)) || (round >= ft_chunk_nb(size)))
+	return 0;
+
+    return ft_chunk_end(round, size) - ((0 == round) ? 0 : ft_chunk_end(round - 1, size));
+}
+
+/* cache slot of the digest of a round of a stage, the stage's own for its last round */
+static apr_uint32_t ft_round_slot(int stage, int round, apr_off_t size)
+{
+    if ((FT_STAGE_FULL != stage) || (round == ft_chunk_nb(size) - 1))
+	return (apr_uint32_t) stage;
+
+    return (apr_uint32_t) (FT_STAGE_NB + round);
+}
+
+/* whether the files of fsize go through the stages, or are only compared */
+static int ft_fsize_is_hashed(const ft_conf_t *conf, const ft_fsize_t *fsize)
+{
+    /* no multiple check, just a memcmp will be needed, don't call checksum on 0-length file too */
+    /* ... unless the digests are cached, they may spare that cmp next time */
+    /* ... and nothing to compare if the only inode of this size is reported for its links */
+    /* under --export, each file is hashed for the twins it may have on other hosts */
+    if (NULL != conf->index)
+	return 0 != fsize->val;
+    return !(((2 == fsize->nb_files) && (NULL == conf->cache)) || (1 == fsize->nb_files) || (0 == fsize->val));
+}
+
+static int ft_stage_is_last(const ft_conf_t *conf, int stage, int round, apr_off_t size)
+{
+    if (0 != ft_round_len(conf, stage, round + 1, size))
+	return 0;
+    for (stage++; stage < FT_STAGE_NB; stage++)
+	if (0 != ft_stage_len(conf, stage, size))
+	    return 0;
+
+    return 1;
+}
+
+/* Offsets of the blocks read by a round of a stage, returns their number */
+static apr_size_t ft_stage_offsets(const ft_conf_t *conf, int stage, int round, apr_off_t size, apr_off_t *offsets)
+{
+    apr_size_t i;
+
+    switch (stage) {
+    case FT_STAGE_HEAD:
+	offsets[0] = 0;
+	return 1;
+    case FT_STAGE_TAIL:
+	offsets[0] = size - ft_stage_len(conf, stage, size);
+	return 1;
+    case FT_STAGE_SAMPLES:
+	/* evenly spread and block aligned, strictly between the head and the tail blocks */
+	for (i = 0; i < conf->nb_samples; i++)
+	    offsets[i] = (size / (conf->nb_samples + 1) * (i + 1)) / FT_STAGE_BLOCK_LEN * FT_STAGE_BLOCK_LEN;
+	return conf->nb_samples;
+    case FT_STAGE_FULL:
+	offsets[0] = (0 == round) ? 0 : ft_chunk_end(round - 1, size);
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Set the digest a round of a stage starts from: the stage digests are
+ * chained, so that each stage refines the previous ones, the full one starts
+ * afresh. Both the sync and the io_uring paths go through it.
+ */
+static void ft_stage_seed(int stage, int round, apr_uint32_t *digest)
+{
+    if ((FT_STAGE_HEAD == stage) || ((FT_STAGE_FULL == stage) && (0 == round)))
+	memset(digest, 0, HASHSTATE * sizeof(apr_uint32_t));
+}
+
+#if HAVE_ARCHIVE
+static struct archive *ft_archive_open(const char *filename)
+{
+    struct archive *a;
+    int rv;
+
+    a = archive_read_new();
+    if (NULL == a) {
+	DEBUG_ERR("error calling archive_read_new()");
+	return NULL;
+    }
+    rv = archive_read_support_filter_all(a);
+    if (0 != rv) {
+	DEBUG_ERR("error calling archive_read_support_filter_all(): %s", archive_error_string(a));
+	archive_read_free(a);
+	return NULL;
+    }
+    rv = archive_read_support_format_all(a);
+    if (0 != rv) {
+	DEBUG_ERR("error calling archive_read_support_format_all(): %s", archive_error_string(a));
+	archive_read_free(a);
+	return NULL;
+    }
+    rv = archive_read_open_filename(a, filename, 10240);
+    if (0 != rv) {
+	DEBUG_ERR("error calling archive_read_open_filename(%s): %s", filename, archive_error_string(a));
+	archive_read_free(a);
+	return NULL;
+    }
+
+    return a;
+}
+
+/* the data of the current entry of an archive, handed out in order with its holes as zeros */
+typedef struct ft_archive_data_t
+{
+    struct archive *a;
+    apr_off_t size;		/* of the entry, nothing is handed out past it */
+    apr_off_t pos;		/* of the next byte handed out */
+    const void *buff;		/* the last block read, NULL once they are all read */
+    size_t buff_len;
+    off_t buff_offset;
+    int eof;
+} ft_archive_data_t;
+
+static void ft_archive_data_init(ft_archive_data_t *ad, struct archive *a, apr_off_t size)
+{
+    ad->a = a;
+    ad->size = size;
+    ad->pos = 0;
+    ad->buff = NULL;
+    ad->buff_len = 0;
+    ad->buff_offset = 0;
+    ad->eof = 0;
+}
+
+/* point data to at most max next bytes of the entry, APR_EOF meaning nothing is left */
+static apr_status_t ft_archive_data_next(ft_archive_data_t *ad, apr_size_t max, const unsigned char **data,
+					 apr_size_t *len)
+{
+    static const unsigned char zeros[FT_STAGE_BLOCK_LEN];
+    apr_off_t end;
+    int rv;
+
+    *len = 0;
+    if (ad->pos >= ad->size)
+	return APR_EOF;
+    max = (apr_size_t) FTWIN_MIN((apr_off_t) max, ad->size - ad->pos);
+
+    while (!ad->eof && ((NULL == ad->buff) || (ad->pos >= ad->buff_offset + (apr_off_t) ad->buff_len))) {
+	rv = archive_read_data_block(ad->a, &(ad->buff), &(ad->buff_len), &(ad->buff_offset));
+	if (ARCHIVE_EOF == rv) {
+	    ad->buff = NULL;
+	    ad->eof = 1;
+	}
+	else if (ARCHIVE_OK != rv) {
+	    DEBUG_ERR("error calling archive_read_data_block(): %s", archive_error_string(ad->a));
+	    return APR_EGENERAL;
+	}
+    }
+
+    if ((NULL != ad->buff) && (ad->pos >= ad->buff_offset)) {
+	*data = (const unsigned char *) ad->buff + (ad->pos - ad->buff_offset);
+	*len = (apr_size_t) FTWIN_MIN((apr_off_t) max, ad->buff_offset + (apr_off_t) ad->buff_len - ad->pos);
+    }
+    else {
+	/* a hole of a sparse entry, up to the next block or the end of the entry */
+	end = (NULL != ad->buff) ? ad->buff_offset : ad->size;
+	*data = zeros;
+	*len = (apr_size_t) FTWIN_MIN(FTWIN_MIN((apr_off_t) max, (apr_off_t) sizeof(zeros)), end - ad->pos);
+    }
+    ad->pos += *len;
+
+    return APR_SUCCESS;
+}
+
+/* hash the part of [pos, pos + len) of data that falls in [start, start + block_len) */
+static void ft_archive_hash_overlap(const ft_hash_t *hash, ft_hash_state_t *state, apr_off_t start,
+				    apr_off_t block_len, apr_off_t pos, const unsigned char *data, apr_size_t len)
+{
+    apr_off_t from = FTWIN_MAX(start, pos), to = FTWIN_MIN(start + block_len, pos + (apr_off_t) len);
+
+    if (from < to)
+	ft_hash_update(hash, state, data + (from - pos), (apr_size_t) (to - from));
+}
+
+/*
+ * The digests of all the slots of the current member of an archive, computed
+ * in a single pass over its data: they are the ones the stages and the rounds
+ * of the full stage get for a plain file of the same content, chained the
+ * same way.
+ */
+static apr_status_t ft_archive_digests(const ft_conf_t *conf, struct archive *a, apr_off_t size,
+				       unsigned char *samples, apr_uint32_t *digests)
+{
+    apr_off_t offsets[FT_STAGE_MAX_SAMPLES];
+    ft_hash_state_t head, tail, full;
+    ft_archive_data_t ad;
+    const unsigned char *data;
+    apr_off_t head_len, tail_len, samples_len, full_len, tail_start, chunk_end = 0, from, to, pos;
+    apr_size_t i, len, nb_samples;
+    apr_status_t status;
+    int head_done = 0, round = 0;
+
+    memset(digests, 0, FT_SLOT_NB * HASHSTATE * sizeof(apr_uint32_t));
+    head_len = ft_stage_len(conf, FT_STAGE_HEAD, size);
+    tail_len = ft_stage_len(conf, FT_STAGE_TAIL, size);
+    tail_start = size - tail_len;
+    samples_len = ft_stage_len(conf, FT_STAGE_SAMPLES, size);
+    nb_samples = (0 != samples_len) ? ft_stage_offsets(conf, FT_STAGE_SAMPLES, 0, size, offsets) : 0;
+    full_len = ft_stage_len(conf, FT_STAGE_FULL, size);
+
+    /* the head and the first round are seeded with a zeroed digest, as a first stage is */
+    ft_hash_init(conf->hash, &head);
+    ft_hash_update(conf->hash, &head, (const unsigned char *) digests, HASHSTATE * sizeof(apr_uint32_t));
+    if (0 != full_len) {
+	ft_hash_init(conf->hash, &full);
+	ft_hash_update(conf->hash, &full, (const unsigned char *) digests, HASHSTATE * sizeof(apr_uint32_t));
+	chunk_end = ft_chunk_end(0, size);
+    }
+
+    ft_archive_data_init(&ad, a, size);
+    for (pos = 0; APR_SUCCESS == (status = ft_archive_data_next(&ad, FT_IO_BLOCK_LEN, &data, &len)); pos += len) {
+	/* each round ends on its chunk, the next one being seeded with its digest */
+	for (from = pos; (0 != full_len) && (from < pos + (apr_off_t) len);) {
+	    to = FTWIN_MIN(chunk_end, pos + (apr_off_t) len);
+	    ft_hash_update(conf->hash, &full, data + (from - pos), (apr_size_t) (to - from));
+	    from = to;
+	    if (to == chunk_end) {
+		ft_hash_final(conf->hash, &full, digests + ft_round_slot(FT_STAGE_FULL, round, size) * HASHSTATE);
+		if (chunk_end == size)
+		    break;
+		ft_hash_init(conf->hash, &full);
+		ft_hash_update(conf->hash, &full,
+			       (const unsigned char *) (digests + ft_round_slot(FT_STAGE_FULL, round, size) * HASHSTATE),
+			       HASHSTATE * sizeof(apr_uint32_t));
+		chunk_end = ft_chunk_end(++round, size);
+	    }
+	}
+	ft_archive_hash_overlap(conf->hash, &head, 0, head_len, pos, data, len);
+	if (!head_done && (pos + (apr_off_t) len >= head_len)) {
+	    ft_hash_final(conf->hash, &head, digests + FT_STAGE_HEAD * HASHSTATE);
+	    head_done = 1;
+	}
+	/* the tail never starts before the end of the head */
+	if ((0 != tail_len) && (pos + (apr_off_t) len > tail_start)) {
+	    if (pos <= tail_start) {
+		ft_hash_init(conf->hash, &tail);
+		ft_hash_update(conf->hash, &tail, (const unsigned char *) (digests + FT_STAGE_HEAD * HASHSTATE),
+			       HASHSTATE * sizeof(apr_uint32_t));
+	    }
+	    ft_archive_hash_overlap(conf->hash, &tail, tail_start, tail_len, pos, data, len);
+	}
+	/* the samples are hashed once the tail digest seeding them is known */
+	for (i = 0; i < nb_samples; i++) {
+	    from = FTWIN_MAX(offsets[i], pos);
+	    to = FTWIN_MIN(offsets[i] + FT_STAGE_BLOCK_LEN, pos + (apr_off_t) len);
+	    if (from < to)
+		memcpy(samples + i * FT_STAGE_BLOCK_LEN + (from - offsets[i]), data + (from - pos), (size_t) (to - from));
+	}
+    }
+    if (APR_EOF != status)
+	return status;
+    /* the entry was cut short */
+    if (pos != size)
+	return APR_EOF;
+
+    if (0 != tail_len)
+	ft_hash_final(conf->hash, &tail, digests + FT_STAGE_TAIL * HASHSTATE);
+    if (0 != nb_samples) {
+	ft_hash_init(conf->hash, &tail);
+	ft_hash_update(conf->hash, &tail, (const unsigned char *) (digests + FT_STAGE_TAIL * HASHSTATE),
+		       HASHSTATE * sizeof(apr_uint32_t));
+	ft_hash_update(conf->hash, &tail, samples, nb_samples * FT_STAGE_BLOCK_LEN);
+	ft_hash_final(conf->hash, &tail, digests + FT_STAGE_SAMPLES * HASHSTATE);
+    }
+
+    return APR_SUCCESS;
+}
+#endif
+
+static apr_status_t ft_walk_file(ft_walk_ctx_t *walk, ft_walker_t *walker, const char *filename,
+				 const apr_finfo_t *finfo, const ft_dir_t *parent)
+{
+    ft_conf_t *conf = walk->conf;
+    apr_off_t finfosize;
+    apr_size_t fname_len;
+    char *fname;
+    int prioritized;
+#if HAVE_ARCHIVE
+    const char *subpath;
+    /* XXX La */
+    struct archive *a = NULL;
+    struct archive_entry *entry = NULL;
+    int rv;
+#endif
+
+    walker->stats.nb_files++;
+    /* only duplicated if the file is kept */
+    fname = NULL;
+    fname_len = strlen(filename);
+    finfosize = finfo->size;
+    prioritized = ft_conf_is_prioritized(conf, filename);
+#if HAVE_ARCHIVE
+    subpath = NULL;
+    if (is_option_set(conf->mask, OPTION_UNTAR)) {
+	if ((NULL != conf->ar_regex) && ft_regex_match(conf->ar_regex, filename, fname_len)) {
+	    if (NULL == (a = ft_archive_open(filename)))
+		return APR_EGENERAL;
+	}
+    }
+
+    do {
+#endif
+	if (finfosize >= conf->minsize
+#if HAVE_ARCHIVE
+	    && ((NULL == a) || ((NULL != entry) && !(AE_IFDIR & archive_entry_filetype(entry))))
+#endif
+	    ) {
+	    ft_file_t *file;
+
+	    /* archived files are not worth the saving, there are a few of them per archive */
+#if HAVE_ARCHIVE
+	    if (is_option_set(conf->mask, OPTION_OPMEM) && (NULL == a)) {
+#else
+	    if (is_option_set(conf->mask, OPTION_OPMEM)) {
+#endif
+		ft_walker_add_record(walker, filename, fname_len, finfo, parent, prioritized);
+		/* the walkers share the budget of --mem-limit */
+		if ((0 != conf->mem_limit) && ((apr_off_t) walker->records_len > conf->mem_limit / walk->nb_walkers))
+		    return ft_walker_spill(walk, walker);
+		return APR_SUCCESS;
+	    }
+
+	    if (NULL == fname)
+		fname = apr_pstrdup(walker->pool, filename);
+	    file = apr_palloc(walker->pool, sizeof(struct ft_file_t));
+	    file->path = fname;
+	    file->dir = NULL;
+	    file->parent = parent;
+	    file->twin = NULL;
+	    file->size = finfosize;
+	    file->mtime = finfo->mtime;
+	    file->device = finfo->device;
+	    file->inode = finfo->inode;
+	    file->location = 0;
+	    file->cache_rec = NULL;
+	    file->links = NULL;
+	    file->clones = NULL;
+#if HAVE_ARCHIVE
+	    if (subpath) {
+		file->subpath = apr_pstrdup(walker->pool, subpath);
+	    }
+	    else {
+		file->subpath = NULL;
+	    }
+	    file->ar_digests = NULL;
+	    /* the member is digested now, as the archive is read anyway, a member that can't be is not compared */
+	    if (NULL != a) {
+		if (NULL == walker->ar_samples)
+		    walker->ar_samples = apr_palloc(walker->pool, FT_STAGE_MAX_SAMPLES * FT_STAGE_BLOCK_LEN);
+		file->ar_digests = apr_palloc(walker->pool, FT_SLOT_NB * HASHSTATE * sizeof(apr_uint32_t));
+		if (APR_SUCCESS != ft_archive_digests(conf, a, finfosize, walker->ar_samples, file->ar_digests))
+		    file->ar_digests = NULL;
+	    }
+#endif
+	    if (prioritized) {
+		file->prioritized |= 0x1;
+	    }
+	    else {
+		file->prioritized &= 0x0;
+	    }
+#if HAVE_PUZZLE
+	    file->cvec_ok &= 0x0;
+#endif
+	    APR_ARRAY_PUSH(walker->files, ft_file_t *) = file;
+	}
+#if HAVE_ARCHIVE
+	if (a) {
+	    rv = archive_read_next_header(a, &entry);
+	    if (ARCHIVE_EOF != rv) {
+		if (ARCHIVE_OK == rv) {
+		    finfosize = archive_entry_size(entry);
+		    subpath = archive_entry_pathname(entry);
+		}
+		else {
+		    /*
+		     * if this is the first all to read_next_header, we may
+		     * be processing a bad file, ignore it silently.
+		     */
+		    if (NULL != subpath) {
+			DEBUG_ERR("error calling archive_read_next_header(%s): %s", filename, archive_error_string(a));
+			return APR_EGENERAL;
+		    }
+		    else {
+			break;
+		    }
+		}
+	    }
+	}
+    } while (a && (ARCHIVE_EOF != rv));
+    if (a)
+	archive_read_free(a);
+#endif
+
+    return APR_SUCCESS;
+}
+
+static int ft_walk_is_loop(const ft_dir_t *parent, apr_dev_t device, apr_ino_t inode)
+{
+    const ft_dir_t *ancestor;
+
+    for (ancestor = parent; NULL != ancestor; ancestor = ancestor->parent)
+	if ((ancestor->inode == inode) && (ancestor->device == device))
+	    return 1;
+
+    return 0;
+}
+
+/**
+ * Add a file, or queue a directory so that it is browsed later.
+ * @param walk The walk context.
+ * @param walker The walker of the calling thread.
+ * @param filename name of a file or directory to add to the list of twinchecker.
+ * @param finfo The stat of filename.
+ * @param parent The directory holding filename, NULL for the ones given on the command line.
+ * @return APR_SUCCESS if no error occured.
+ */
+static apr_status_t ft_walk_stated(ft_walk_ctx_t *walk, ft_walker_t *walker, const char *filename,
+				   const apr_finfo_t *finfo, const ft_dir_t *parent)
+{
+    ft_conf_t *conf = walk->conf;
+    ft_dir_t *dir;
+
+    /* Step 1-bis, if we don't own the right to read it, skip it */
+    if (!ft_conf_is_granted(conf, finfo, APR_UREAD, APR_GREAD, APR_WREAD)) {
+	if (is_option_set(conf->mask, OPTION_VERBO))
+	    fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
+	return APR_SUCCESS;
+    }
+
+    /* Step 2: If it is, queue it to be browsed */
+    if (APR_DIR == finfo->filetype) {
+	if (!ft_conf_is_granted(conf, finfo, APR_UEXECUTE, APR_GEXECUTE, APR_WEXECUTE)) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "Skipping : [%s] (bad permission)\n", filename);
+	    return APR_SUCCESS;
+	}
+
+	if (ft_walk_is_loop(parent, finfo->device, finfo->inode)) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "Warning: %s: recursive directory loop\n", filename);
+	    /* skip it */
+	    return APR_SUCCESS;
+	}
+
+	dir = apr_palloc(walker->pool, sizeof(struct ft_dir_t));
+	dir->parent = parent;
+	dir->named = is_option_set(conf->mask, OPTION_OPMEM) && (NULL != parent);
+	dir->path = apr_pstrdup(walker->pool, dir->named ? strrchr(filename, '/') + 1 : filename);
+	dir->device = finfo->device;
+	dir->inode = finfo->inode;
+	dir->sum = NULL;
+	dir->checked = 1;
+
+	return ft_walk_push(walk, dir);
+    }
+    else if (APR_REG == finfo->filetype
+	     || ((APR_LNK == finfo->filetype) && (is_option_set(conf->mask, OPTION_FSYML)))) {
+	return ft_walk_file(walk, walker, filename, finfo, parent);
+    }
+
+    return APR_SUCCESS;
+}
+
+/* Same as ft_walk_stated, on a path to stat */
+static apr_status_t ft_walk_entry(ft_walk_ctx_t *walk, ft_walker_t *walker, const char *filename,
+				  const ft_dir_t *parent)
+{
+    char errbuf[128];
+    ft_conf_t *conf = walk->conf;
+    apr_finfo_t finfo;
+    apr_int32_t statmask =
+	APR_FINFO_SIZE | APR_FINFO_MTIME | APR_FINFO_IDENT | APR_FINFO_TYPE | APR_FINFO_USER | APR_FINFO_GROUP |
+	APR_FINFO_UPROT | APR_FINFO_GPROT;
+    apr_status_t status;
+
+    /* Step 1 : Check if it's a directory and get the size if not */
+    if (!is_option_set(conf->mask, OPTION_FSYML))
+	statmask |= APR_FINFO_LINK;
+
+    walker->stats.nb_stats++;
+    if (APR_SUCCESS != (status = apr_stat(&finfo, filename, statmask, walker->gc_pool))) {
+	if (is_option_set(conf->mask, OPTION_FSYML)) {
+	    statmask ^= APR_FINFO_LINK;
+	    walker->stats.nb_stats++;
+	    if ((APR_SUCCESS == apr_stat(&finfo, filename, statmask, walker->gc_pool)) && (finfo.filetype & APR_LNK)) {
+		if (is_option_set(conf->mask, OPTION_VERBO))
+		    fprintf(stderr, "Skipping : [%s] (broken link)\n", filename);
+		return APR_SUCCESS;
+	    }
+	}
+
+	DEBUG_ERR("error calling apr_stat on filename %s : %s", filename, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return ft_walk_stated(walk, walker, filename, &finfo, parent);
+}
+
+/*
+ * Is the entry called fullname left out by a glob, or by the -e / -w regex if
+ * it is not a directory. Its path relative to its root starts at rel, its
+ * name is the last name_len bytes.
+ */
+static int ft_walk_is_filtered(const ft_conf_t *conf, const char *fullname, apr_size_t fullname_len, apr_size_t rel,
+			       apr_size_t name_len, int is_dir)
+{
+    if (ft_filter_entry(conf->filter, fullname + rel, fullname_len - rel, name_len, is_dir))
+	return 1;
+
+    return !is_dir && ft_filter_path(conf->filter, fullname, fullname_len);
+}
+
+#if FT_DIRFD_SCAN
+#define FT_DENTS_LEN 32768
+
+struct ft_dirent64
+{
+    apr_uint64_t d_ino;
+    apr_int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static apr_fileperms_t ft_mode2perms(mode_t mode)
+{
+    apr_fileperms_t perms = 0;
+
+    if (mode & S_IRUSR)
+	perms |= APR_UREAD;
+    if (mode & S_IWUSR)
+	perms |= APR_UWRITE;
+    if (mode & S_IXUSR)
+	perms |= APR_UEXECUTE;
+    if (mode & S_IRGRP)
+	perms |= APR_GREAD;
+    if (mode & S_IWGRP)
+	perms |= APR_GWRITE;
+    if (mode & S_IXGRP)
+	perms |= APR_GEXECUTE;
+    if (mode & S_IROTH)
+	perms |= APR_WREAD;
+    if (mode & S_IWOTH)
+	perms |= APR_WWRITE;
+    if (mode & S_IXOTH)
+	perms |= APR_WEXECUTE;
+
+    return perms;
+}
+
+/* Fill the fields of finfo used by the walk the way apr_stat does */
+static void ft_finfo_from_stat(apr_finfo_t *finfo, const struct stat *st)
+{
+    if (S_ISREG(st->st_mode))
+	finfo->filetype = APR_REG;
+    else if (S_ISDIR(st->st_mode))
+	finfo->filetype = APR_DIR;
+    else if (S_ISLNK(st->st_mode))
+	finfo->filetype = APR_LNK;
+    else
+	finfo->filetype = APR_UNKFILE;
+    finfo->protection = ft_mode2perms(st->st_mode);
+    finfo->user = st->st_uid;
+    finfo->group = st->st_gid;
+    finfo->size = st->st_size;
+    finfo->device = st->st_dev;
+    finfo->inode = st->st_ino;
+    finfo->mtime = apr_time_from_sec(st->st_mtime) + st->st_mtim.tv_nsec / APR_TIME_C(1000);
+}
+
+/*
+ * Browse dir through a descriptor: entries are read with getdents64 and
+ * stat'ed relatively to the directory, only if d_type tells they may be kept
+ * (or does not tell anything), their full path is built in a walker buffer and
+ * only duplicated for the files and directories that are kept.
+ */
+static apr_status_t ft_walk_dir(ft_walk_ctx_t *walk, ft_walker_t *walker, ft_dir_t *dir)
+{
+    char errbuf[128];
+    ft_conf_t *conf = walk->conf;
+    struct ft_dirent64 *dent;
+    struct stat st;
+    apr_finfo_t finfo;
+    ft_dir_t *subdir;
+    apr_size_t dir_len, path_len, name_len, rel;
+    apr_status_t status;
+    long nread, off;
+    int fd, flags, is_dir;
+
+    dir_len = ft_dir_path_buf(dir, &(walker->fullname), &(walker->fullname_size), walker->pool);
+    if (0 > (fd = open(walker->fullname, O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+	/* queued on the faith of d_type, it is skipped as ft_walk_stated would have */
+	if ((EACCES == errno) || (EPERM == errno)) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "Skipping : [%s] (bad permission)\n", walker->fullname);
+	    return APR_SUCCESS;
+	}
+	status = APR_FROM_OS_ERROR(errno);
+	DEBUG_ERR("error calling open(%s): %s", walker->fullname, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    walker->stats.nb_dirs++;
+    /* directories queued on the faith of d_type are checked now that they are open */
+    if (!dir->checked) {
+	walker->stats.nb_stats++;
+	if (0 != fstat(fd, &st)) {
+	    status = APR_FROM_OS_ERROR(errno);
+	    if ((EACCES == errno) || (EPERM == errno)) {
+		if (is_option_set(conf->mask, OPTION_VERBO))
+		    fprintf(stderr, "Skipping : [%s] (bad permission)\n", walker->fullname);
+		close(fd);
+		return APR_SUCCESS;
+	    }
+	    DEBUG_ERR("error calling fstat(%s): %s", walker->fullname, apr_strerror(status, errbuf, 128));
+	    close(fd);
+	    return status;
+	}
+	ft_finfo_from_stat(&finfo, &st);
+	if (!ft_conf_is_granted(conf, &finfo, APR_UREAD, APR_GREAD, APR_WREAD)
+	    || !ft_conf_is_granted(conf, &finfo, APR_UEXECUTE, APR_GEXECUTE, APR_WEXECUTE)) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "Skipping : [%s] (bad permission)\n", walker->fullname);
+	    close(fd);
+	    return APR_SUCCESS;
+	}
+	if (ft_walk_is_loop(dir->parent, finfo.device, finfo.inode)) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "Warning: %s: recursive directory loop\n", walker->fullname);
+	    close(fd);
+	    return APR_SUCCESS;
+	}
+	dir->device = finfo.device;
+	dir->inode = finfo.inode;
+	dir->checked = 1;
+    }
+
+    /* the directories are digested under --dirs once their files are, and watched under --watch */
+    if (NULL != conf->dirs)
+	APR_ARRAY_PUSH(walker->dirs, ft_dir_t *) = dir;
+
+    /* fullname holds the path of dir, the names of the entries are appended to it */
+    path_len = dir_len;
+    if (walker->fullname_size < path_len + 2) {
+	char *old = walker->fullname;
+
+	walker->fullname_size = 2 * (path_len + 2);
+	walker->fullname = apr_palloc(walker->pool, walker->fullname_size);
+	memcpy(walker->fullname, old, path_len);
+    }
+    if (ft_dir_needs_sep(dir))
+	walker->fullname[path_len++] = '/';
+    rel = ft_filter_rel_offset(conf->filter, walker->fullname, path_len);
+
+    flags = is_option_set(conf->mask, OPTION_FSYML) ? 0 : AT_SYMLINK_NOFOLLOW;
+    status = APR_SUCCESS;
+    while ((APR_SUCCESS == status) && (0 < (nread = syscall(SYS_getdents64, fd, walker->dents, FT_DENTS_LEN)))) {
+	for (off = 0; (APR_SUCCESS == status) && (off < nread); off += dent->d_reclen) {
+	    dent = (struct ft_dirent64 *) (walker->dents + off);
+	    name_len = strlen(dent->d_name);
+
+	    /* Check if it has to be ignored, without any syscall */
+	    if (ft_filter_name(conf->filter, dent->d_name, name_len))
+		continue;
+	    if ((DT_DIR == dent->d_type) && !is_option_set(conf->mask, OPTION_RECSD))
+		continue;
+	    /* fifos, sockets and devices are never reported */
+	    if ((DT_UNKNOWN != dent->d_type) && (DT_DIR != dent->d_type) && (DT_REG != dent->d_type)
+		&& (DT_LNK != dent->d_type))
+		continue;
+
+	    if (walker->fullname_size < path_len + name_len + 1) {
+		char *old = walker->fullname;
+
+		walker->fullname_size = 2 * (path_len + name_len + 1);
+		walker->fullname = apr_palloc(walker->pool, walker->fullname_size);
+		memcpy(walker->fullname, old, path_len);
+	    }
+	    memcpy(walker->fullname + path_len, dent->d_name, name_len + 1);
+
+	    /* a directory left out is never opened */
+	    is_dir = (DT_DIR == dent->d_type);
+	    if ((DT_UNKNOWN != dent->d_type)
+		&& ft_walk_is_filtered(conf, walker->fullname, path_len + name_len, rel, name_len, is_dir)) {
+		walker->stats.nb_pruned += is_dir;
+		continue;
+	    }
+
+	    /* the directory itself will be stat'ed once opened */
+	    if (DT_DIR == dent->d_type) {
+		subdir = apr_palloc(walker->pool, sizeof(struct ft_dir_t));
+		subdir->parent = dir;
+		subdir->named = is_option_set(conf->mask, OPTION_OPMEM);
+		if (subdir->named)
+		    subdir->path = apr_pstrmemdup(walker->pool, dent->d_name, name_len);
+		else
+		    subdir->path = apr_pstrmemdup(walker->pool, walker->fullname, path_len + name_len);
+		subdir->sum = NULL;
+		subdir->checked = 0;
+		status = ft_walk_push(walk, subdir);
+		continue;
+	    }
+
+	    walker->stats.nb_stats++;
+	    if (0 != fstatat(fd, dent->d_name, &st, flags)) {
+		status = APR_FROM_OS_ERROR(errno);
+		walker->stats.nb_stats++;
+		if (is_option_set(conf->mask, OPTION_FSYML) && (0 == fstatat(fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW))
+		    && S_ISLNK(st.st_mode)) {
+		    if (is_option_set(conf->mask, OPTION_VERBO))
+			fprintf(stderr, "Skipping : [%s] (broken link)\n", walker->fullname);
+		    status = APR_SUCCESS;
+		    continue;
+		}
+		DEBUG_ERR("error calling fstatat on filename %s : %s", walker->fullname,
+			  apr_strerror(status, errbuf, 128));
+		break;
+	    }
+	    /* d_type did not tell, apply the same rules as above */
+	    if (DT_UNKNOWN == dent->d_type) {
+		if (S_ISDIR(st.st_mode) && !is_option_set(conf->mask, OPTION_RECSD))
+		    continue;
+		is_dir = S_ISDIR(st.st_mode);
+		if (ft_walk_is_filtered(conf, walker->fullname, path_len + name_len, rel, name_len, is_dir)) {
+		    walker->stats.nb_pruned += is_dir;
+		    continue;
+		}
+	    }
+	    ft_finfo_from_stat(&finfo, &st);
+	    status = ft_walk_stated(walk, walker, walker->fullname, &finfo, dir);
+	}
+    }
+    if ((APR_SUCCESS == status) && (0 > nread)) {
+	status = APR_FROM_OS_ERROR(errno);
+	walker->fullname[dir_len] = '\0';
+	DEBUG_ERR("error calling getdents64(%s): %s", walker->fullname, apr_strerror(status, errbuf, 128));
+    }
+    close(fd);
+
+    return status;
+}
+#else
+static apr_status_t ft_walk_dir(ft_walk_ctx_t *walk, ft_walker_t *walker, ft_dir_t *dir)
+{
+    char errbuf[128];
+    ft_conf_t *conf = walk->conf;
+    apr_finfo_t finfo;
+    apr_dir_t *apr_dir;
+    char *dirpath = NULL;
+    apr_size_t dirpath_size = 0;
+    apr_status_t status;
+
+    ft_dir_path_buf(dir, &dirpath, &dirpath_size, walker->gc_pool);
+    if (APR_SUCCESS != (status = apr_dir_open(&apr_dir, dirpath, walker->gc_pool))) {
+	DEBUG_ERR("error calling apr_dir_open(%s): %s", dirpath, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    walker->stats.nb_dirs++;
+    /* the directories are digested under --dirs once their files are, and watched under --watch */
+    if (NULL != conf->dirs)
+	APR_ARRAY_PUSH(walker->dirs, ft_dir_t *) = dir;
+    while ((APR_SUCCESS == (status = apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, apr_dir)))
+	   && (NULL != finfo.name)) {
+	/* Check if it has to be ignored */
+	char *fullname;
+	apr_size_t name_len = strlen(finfo.name), fullname_len, rel;
+	int is_dir = (APR_DIR == finfo.filetype);
+
+	if (ft_filter_name(conf->filter, finfo.name, name_len))
+	    continue;
+
+	if (is_dir && !is_option_set(conf->mask, OPTION_RECSD))
+	    continue;
+
+	fullname = apr_pstrcat(walker->gc_pool, dirpath, ft_dir_needs_sep(dir) ? "/" : "", finfo.name, NULL);
+	fullname_len = strlen(fullname);
+	rel = ft_filter_rel_offset(conf->filter, fullname, fullname_len);
+
+	/* a directory left out is never opened */
+	if (ft_walk_is_filtered(conf, fullname, fullname_len, rel, name_len, is_dir)) {
+	    walker->stats.nb_pruned += is_dir;
+	    continue;
+	}
+
+	if (APR_SUCCESS != (status = ft_walk_entry(walk, walker, fullname, dir))) {
+	    DEBUG_ERR("error calling ft_walk_entry: %s", apr_strerror(status, errbuf, 128));
+	    apr_dir_close(apr_dir);
+	    return status;
+	}
+    }
+    if ((APR_SUCCESS != status) && (APR_ENOENT != status)) {
+	DEBUG_ERR("error calling apr_dir_read: %s", apr_strerror(status, errbuf, 128));
+	apr_dir_close(apr_dir);
+	return status;
+    }
+
+    if (APR_SUCCESS != (status = apr_dir_close(apr_dir))) {
+	DEBUG_ERR("error calling apr_dir_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
+#endif
+
+static apr_status_t ft_walk_worker(void *ctx, void *data)
+{
+    ft_walk_ctx_t *walk = ctx;
+    ft_walker_t *walker;
+    apr_status_t status;
+
+    /* once an error is met, the remaining directories are only drained */
+    apr_thread_mutex_lock(walk->mutex);
+    status = walk->status;
+    apr_thread_mutex_unlock(walk->mutex);
+    if (APR_SUCCESS != status)
+	return APR_SUCCESS;
+
+    walker = ft_walker_get(walk);
+    status = ft_walk_dir(walk, walker, data);
+    ft_walker_put(walk, walker, status);
+
+    return status;
+}
+
+/*
+ * Reference a file found by the walk, a hardlink of a file already referenced
+ * is chained to it instead, so that each inode is hashed and compared once.
+ */
+static void ft_conf_add_file(ft_conf_t *conf, ft_file_t *file)
+{
+    char errbuf[128];
+    ft_file_t *first;
+    const ft_dir_t *dir;
+    char *path;
+    apr_status_t status;
+
+#if HAVE_ARCHIVE
+    if ((NULL != conf->inodes) && (NULL == file->subpath)) {
+#else
+    if (NULL != conf->inodes) {
+#endif
+	if (NULL != (first = napr_inthash_get(conf->inodes, (apr_uint64_t) file->device, (apr_uint64_t) file->inode))) {
+	    /* the first path, the one displayed first, should honor the priority path */
+	    if (file->prioritized && !first->prioritized) {
+		path = first->path;
+		first->path = file->path;
+		file->path = path;
+		dir = first->dir;
+		first->dir = file->dir;
+		file->dir = dir;
+		dir = first->parent;
+		first->parent = file->parent;
+		file->parent = dir;
+		first->prioritized |= 0x1;
+		file->prioritized &= 0x0;
+	    }
+	    file->links = first->links;
+	    first->links = file;
+	    first->fresh |= 0x1;
+	    conf->nb_links++;
+	    if (NULL != conf->stats)
+		conf->stats->links_bytes += file->size;
+	    return;
+	}
+	status = napr_inthash_set(conf->inodes, (apr_uint64_t) file->device, (apr_uint64_t) file->inode, file);
+	/* not fatal, a hardlink of file would only be hashed and reported again */
+	if (APR_SUCCESS != status)
+	    DEBUG_ERR("error calling napr_inthash_set: %s", apr_strerror(status, errbuf, 128));
+    }
+
+    file->fresh |= 0x1;
+    file->reported &= 0x0;
+    APR_ARRAY_PUSH(conf->files, ft_file_t *) = file;
+}
+
+static int ft_off_cmp(const void *param1, const void *param2)
+{
+    apr_off_t off1 = *(const apr_off_t *) param1;
+    apr_off_t off2 = *(const apr_off_t *) param2;
+
+    return (off1 < off2) ? -1 : ((off2 < off1) ? 1 : 0);
+}
+
+/*
+ * Reference the files found under -o: the sizes of the records are sorted to
+ * find the ones shared by several files, only those files become a ft_file_t
+ * (all of them if the images are compared, or under --stream since a size
+ * may be shared with a file walked later), still pointing to their name.
+ */
+static apr_status_t ft_conf_add_chunks(ft_conf_t *conf, const ft_files_chunk_t *chunks)
+{
+    char errbuf[128];
+    const ft_files_chunk_t *chunk;
+    ft_file_t *file;
+    apr_off_t *sizes;
+    apr_pool_t *gc_pool;
+    apr_size_t i, j, nb_sizes, nb_shared;
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    /* the files already referenced, the archived ones, may share their size with a record */
+    for (chunk = chunks, nb_sizes = conf->files->nelts; NULL != chunk; chunk = chunk->next)
+	nb_sizes += chunk->nb_files;
+    sizes = apr_palloc(gc_pool, (nb_sizes ? nb_sizes : 1) * sizeof(apr_off_t));
+    for (nb_sizes = 0; nb_sizes < conf->files->nelts; nb_sizes++)
+	sizes[nb_sizes] = APR_ARRAY_IDX(conf->files, nb_sizes, ft_file_t *)->size;
+    for (chunk = chunks; NULL != chunk; chunk = chunk->next) {
+	memcpy(sizes + nb_sizes, chunk->size, chunk->nb_files * sizeof(apr_off_t));
+	nb_sizes += chunk->nb_files;
+    }
+    /* keep once each size found more than once, in place */
+    qsort(sizes, nb_sizes, sizeof(apr_off_t), ft_off_cmp);
+    for (i = 0, nb_shared = 0; i < nb_sizes; i = j) {
+	for (j = i + 1; (j < nb_sizes) && (sizes[j] == sizes[i]); j++);
+	if (1 < j - i)
+	    sizes[nb_shared++] = sizes[i];
+    }
+
+    for (chunk = chunks; NULL != chunk; chunk = chunk->next) {
+	for (i = 0; i < chunk->nb_files; i++) {
+	    /* the directories of --dirs are digested from all their files */
+	    if ((NULL != conf->inodes) && (0 == conf->stream_len) && !is_option_set(conf->mask, OPTION_DIRS)
+		&& (NULL == conf->index) && (NULL == bsearch(&(chunk->size[i]), sizes, nb_shared, sizeof(apr_off_t), ft_off_cmp))) {
+		if (NULL != conf->stats) {
+		    conf->stats->nb_dropped++;
+		    conf->stats->dropped_bytes += chunk->size[i];
+		}
+		continue;
+	    }
+	    file = apr_palloc(conf->pool, sizeof(struct ft_file_t));
+	    file->path = chunk->name[i];
+	    file->dir = chunk->dir[i];
+	    file->parent = chunk->dir[i];
+	    file->twin = NULL;
+	    file->size = chunk->size[i];
+	    file->mtime = chunk->mtime[i];
+	    file->device = chunk->device[i];
+	    file->inode = chunk->inode[i];
+	    file->location = 0;
+	    file->cache_rec = NULL;
+	    file->links = NULL;
+	    file->clones = NULL;
+#if HAVE_ARCHIVE
+	    file->subpath = NULL;
+	    file->ar_digests = NULL;
+#endif
+	    if (chunk->prioritized[i])
+		file->prioritized |= 0x1;
+	    else
+		file->prioritized &= 0x0;
+#if HAVE_PUZZLE
+	    file->cvec_ok &= 0x0;
+#endif
+	    ft_conf_add_file(conf, file);
+	}
+    }
+    apr_pool_destroy(gc_pool);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Reference the files found by the walkers since the last merge, the walkers
+ * go on with empty lists.
+ */
+static apr_status_t ft_walk_merge(ft_walk_ctx_t *walk)
+{
+    char errbuf[128];
+    ft_conf_t *conf = walk->conf;
+    ft_walker_t *walker;
+    ft_files_chunk_t *chunks, *last_chunk;
+    apr_size_t i, nb_files;
+    int j;
+    apr_status_t status;
+
+    /* once a run was spilled, the records left are spilled too, to be merged with it */
+    if ((NULL != conf->spills) && (0 < conf->spills->nelts)) {
+	for (i = 0; i < walk->nb_walkers; i++)
+	    if (APR_SUCCESS != (status = ft_walker_spill(walk, &(walk->walkers[i]))))
+		return status;
+    }
+    /* the inodes of all the files walked are inserted at once */
+    if (NULL != conf->inodes) {
+	for (i = 0, nb_files = napr_inthash_count(conf->inodes); i < walk->nb_walkers; i++)
+	    nb_files += walk->walkers[i].files->nelts;
+	if (APR_SUCCESS != (status = napr_inthash_reserve(conf->inodes, nb_files))) {
+	    DEBUG_ERR("error calling napr_inthash_reserve: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    }
+    for (i = 0, chunks = last_chunk = NULL; i < walk->nb_walkers; i++) {
+	walker = &(walk->walkers[i]);
+	for (j = 0; j < walker->files->nelts; j++)
+	    ft_conf_add_file(conf, APR_ARRAY_IDX(walker->files, j, ft_file_t *));
+	walker->files->nelts = 0;
+	if (NULL != conf->dirs) {
+	    apr_array_cat(conf->dirs, walker->dirs);
+	    walker->dirs->nelts = 0;
+	}
+	if (NULL != walker->chunks) {
+	    if (NULL == last_chunk)
+		chunks = walker->chunks;
+	    else
+		last_chunk->next = walker->chunks;
+	    last_chunk = walker->last_chunk;
+	}
+    }
+    if (is_option_set(conf->mask, OPTION_OPMEM)) {
+	if (APR_SUCCESS != (status = ft_conf_add_chunks(conf, chunks)))
+	    return status;
+	/* the names of the records are kept in the pools of the walkers */
+	for (i = 0; i < walk->nb_walkers; i++) {
+	    walker = &(walk->walkers[i]);
+	    apr_pool_clear(walker->chunk_pool);
+	    walker->chunks = NULL;
+	    walker->last_chunk = NULL;
+	    walker->nb_records = 0;
+	    walker->records_len = 0;
+	}
+    }
+
+    return APR_SUCCESS;
+}
+
+/* directories given to each thread between two checks of --stream */
+#define FT_STREAM_DIRS 16
+
+static apr_status_t ft_conf_stream_round(ft_conf_t *conf);
+
+/*
+ * Under --stream, browse the directories of the stack a few at a time, the
+ * deepest first so that the subtrees are completed one after the other, and
+ * report the twins of the files found every conf->stream_len files. A round
+ * also waits for a quarter of the files already referenced, since each one
+ * sorts them all again.
+ */
+static apr_status_t ft_walk_stream(ft_walk_ctx_t *walk)
+{
+    char errbuf[128];
+    ft_conf_t *conf = walk->conf;
+    ft_walker_t *walker;
+    ft_dir_t **batch;
+    apr_size_t i, nb_batch, max_batch, nb_found;
+    apr_status_t status;
+
+    max_batch = (NULL != walk->threadpool) ? FT_STREAM_DIRS * conf->nb_worker : 1;
+    batch = apr_palloc(conf->pool, max_batch * sizeof(ft_dir_t *));
+    do {
+	/* the threads are idle between two batches, the stack is not shared */
+	for (nb_batch = 0; (nb_batch < max_batch) && (0 < walk->stack->nelts); nb_batch++)
+	    batch[nb_batch] = *(ft_dir_t **) apr_array_pop(walk->stack);
+	if (NULL == walk->threadpool) {
+	    for (i = 0; i < nb_batch; i++) {
+		walker = ft_walker_get(walk);
+		status = ft_walk_dir(walk, walker, batch[i]);
+		ft_walker_put(walk, walker, status);
+	    }
+	}
+	else if (0 < nb_batch) {
+	    /* the rounds hash with the same threads */
+	    napr_threadpool_set_process(walk->threadpool, walk, ft_walk_worker);
+	    status = napr_threadpool_add_batch(walk->threadpool, (void *const *) batch, nb_batch, NULL);
+	    if (APR_SUCCESS != status) {
+		DEBUG_ERR("error calling napr_threadpool_add_batch: %s", apr_strerror(status, errbuf, 128));
+		return status;
+	    }
+	    if (APR_SUCCESS != (status = napr_threadpool_wait(walk->threadpool))) {
+		DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(status, errbuf, 128));
+		return status;
+	    }
+	}
+	if (APR_SUCCESS != walk->status)
+	    return walk->status;
+
+	for (i = 0, nb_found = 0; i < walk->nb_walkers; i++)
+	    nb_found += walk->walkers[i].files->nelts + walk->walkers[i].nb_records;
+	if ((0 == nb_found)
+	    || ((0 < walk->stack->nelts) && ((nb_found < conf->stream_len) || (nb_found < conf->files->nelts / 4))))
+	    continue;
+	if (APR_SUCCESS != (status = ft_walk_merge(walk)))
+	    return status;
+	if (APR_SUCCESS != (status = ft_conf_stream_round(conf))) {
+	    DEBUG_ERR("error calling ft_conf_stream_round: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    } while (0 < walk->stack->nelts);
+
+    return APR_SUCCESS;
+}
+
+/**
+ * The function used to add recursively or not files and dirs.
+ * @param conf Configuration structure.
+ * @param filenames names of files or directories to add to the list of twinchecker.
+ * @param nb_filenames number of filenames.
+ * @return APR_SUCCESS if no error occured.
+ */
+static apr_status_t ft_conf_add_files(ft_conf_t *conf, const char *const *filenames, int nb_filenames)
+{
+    char errbuf[128];
+    ft_walk_ctx_t walk;
+    ft_walker_t *walker;
+    ft_dir_t *dir;
+    apr_size_t i;
+    int j;
+    apr_status_t status;
+
+    walk.conf = conf;
+    walk.threadpool = NULL;
+    walk.stack = apr_array_make(conf->pool, 64, sizeof(ft_dir_t *));
+    walk.status = APR_SUCCESS;
+    /* one walker per thread, plus the one of the caller */
+    walk.nb_walkers = (1 < conf->nb_worker) ? conf->nb_worker + 1 : 1;
+    walk.walkers = apr_palloc(conf->pool, walk.nb_walkers * sizeof(struct ft_walker_t));
+    walk.free_walkers = NULL;
+    for (i = 0; i < walk.nb_walkers; i++) {
+	walker = &(walk.walkers[i]);
+	if ((APR_SUCCESS != (status = apr_pool_create(&(walker->pool), conf->pool)))
+	    || (APR_SUCCESS != (status = apr_pool_create(&(walker->gc_pool), walker->pool)))) {
+	    DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	walker->files = apr_array_make(walker->pool, 1024, sizeof(ft_file_t *));
+	walker->chunk_pool = NULL;
+	if (is_option_set(conf->mask, OPTION_OPMEM)
+	    && (APR_SUCCESS != (status = apr_pool_create(&(walker->chunk_pool), conf->pool)))) {
+	    DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	walker->chunks = NULL;
+	walker->last_chunk = NULL;
+	walker->names = NULL;
+	walker->names_len = 0;
+	/* the names are released with the records they are spilled with */
+	walker->names_pool = walker->pool;
+	if ((0 != conf->mem_limit) && (APR_SUCCESS != (status = apr_pool_create(&(walker->names_pool), conf->pool)))) {
+	    DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	walker->nb_records = 0;
+	walker->records_len = 0;
+	walker->dirs = apr_array_make(walker->pool, 64, sizeof(ft_dir_t *));
+	memset(&(walker->stats), 0, sizeof(ft_walk_stats_t));
+#if HAVE_ARCHIVE
+	walker->ar_samples = NULL;
+#endif
+#if FT_DIRFD_SCAN
+	walker->dents = apr_palloc(walker->pool, FT_DENTS_LEN);
+	walker->fullname = NULL;
+	walker->fullname_size = 0;
+#endif
+	walker->next = walk.free_walkers;
+	walk.free_walkers = walker;
+    }
+    status = apr_thread_mutex_create(&(walk.mutex), APR_THREAD_MUTEX_DEFAULT, conf->pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_mutex_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (NULL != conf->threadpool) {
+	walk.threadpool = conf->threadpool;
+	napr_threadpool_set_process(walk.threadpool, &walk, ft_walk_worker);
+    }
+
+    for (j = 0; (j < nb_filenames) && (APR_SUCCESS == status); j++) {
+	walker = ft_walker_get(&walk);
+	status = ft_walk_entry(&walk, walker, filenames[j], NULL);
+	ft_walker_put(&walk, walker, status);
+    }
+    if ((APR_SUCCESS == status) && (0 != conf->stream_len))
+	status = ft_walk_stream(&walk);
+    /* without threads, browse the directories depth first */
+    while ((APR_SUCCESS == status) && (0 < walk.stack->nelts)) {
+	dir = *(ft_dir_t **) apr_array_pop(walk.stack);
+	walker = ft_walker_get(&walk);
+	status = ft_walk_dir(&walk, walker, dir);
+	ft_walker_put(&walk, walker, status);
+    }
+    /* the threads reference walk, it is always waited for */
+    if (NULL != walk.threadpool) {
+	if (APR_SUCCESS != (status = napr_threadpool_wait(walk.threadpool))) {
+	    DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    }
+    if (APR_SUCCESS != walk.status)
+	return walk.status;
+    if (APR_SUCCESS != status)
+	return status;
+
+    if ((0 == conf->stream_len) && (APR_SUCCESS != (status = ft_walk_merge(&walk))))
+	return status;
+    for (i = 0; i < walk.nb_walkers; i++) {
+	if (NULL != conf->stats) {
+	    conf->stats->walk.nb_dirs += walk.walkers[i].stats.nb_dirs;
+	    conf->stats->walk.nb_files += walk.walkers[i].stats.nb_files;
+	    conf->stats->walk.nb_stats += walk.walkers[i].stats.nb_stats;
+	    conf->stats->walk.nb_pruned += walk.walkers[i].stats.nb_pruned;
+	}
+	apr_pool_destroy(walk.walkers[i].gc_pool);
+	if (NULL != walk.walkers[i].chunk_pool)
+	    apr_pool_destroy(walk.walkers[i].chunk_pool);
+    }
+
+    return APR_SUCCESS;
+}
+
+#if HAVE_ARCHIVE
+/* ft_stream_ops_t of the members of a run, read from their archive instead of being extracted */
+static apr_status_t ft_member_open(void *ctx, apr_size_t k, void **stream, apr_pool_t *pool)
+{
+    const ft_file_t *file = ((const ft_chksum_t *) ctx)[k].file;
+    struct archive_entry *entry = NULL;
+    ft_archive_data_t *ad;
+    struct archive *a;
+    int rv;
+
+    if (NULL == file->subpath)
+	return APR_SUCCESS;
+    if (NULL == (a = ft_archive_open(file->path)))
+	return APR_EGENERAL;
+
+    for (;;) {
+	rv = archive_read_next_header(a, &entry);
+	if (ARCHIVE_EOF == rv) {
+	    DEBUG_ERR("subpath [%s] not found in archive [%s]", file->subpath, file->path);
+	    archive_read_free(a);
+	    return APR_ENOENT;
+	}
+	if (ARCHIVE_OK != rv) {
+	    DEBUG_ERR("error in archive (%s): %s", file->path, archive_error_string(a));
+	    archive_read_free(a);
+	    return APR_EGENERAL;
+	}
+	if (!strcmp(file->subpath, archive_entry_pathname(entry)))
+	    break;
+    }
+
+    ad = apr_palloc(pool, sizeof(struct ft_archive_data_t));
+    ft_archive_data_init(ad, a, file->size);
+    *stream = ad;
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t ft_member_read(void *stream, unsigned char *buf, apr_size_t len, apr_size_t *rbytes)
+{
+    const unsigned char *data;
+    apr_size_t got;
+    apr_status_t status;
+
+    for (*rbytes = 0; *rbytes < len; *rbytes += got) {
+	status = ft_archive_data_next(stream, len - *rbytes, &data, &got);
+	if (APR_EOF == status)
+	    break;
+	if (APR_SUCCESS != status)
+	    return status;
+	memcpy(buf + *rbytes, data, got);
+    }
+
+    return APR_SUCCESS;
+}
+
+static void ft_member_close(void *stream)
+{
+    archive_read_free(((ft_archive_data_t *) stream)->a);
+}
+
+static const ft_stream_ops_t ft_member_ops = { ft_member_open, ft_member_read, ft_member_close };
+#endif
+
+/* location of the files whose extents are unknown, sorted by inode after the others */
+#define FT_LOCATION_INODE ((apr_uint64_t) 1 << 63)
+
+/*
+ * Sort key of a file on its device for --schedule=physical: the physical
+ * offset of its first extent where FIEMAP tells it, its inode number
+ * otherwise, which most filesystems allocate close to the data.
+ */
+static apr_uint64_t ft_file_location(const ft_file_t *file, const char *path)
+{
+#if HAVE_LINUX_FIEMAP_H
+    struct
+    {
+	struct fiemap map;
+	struct fiemap_extent extent;
+    } fiemap;
+    int fd, rc;
+
+    if (0 <= (fd = open(path, O_RDONLY | O_CLOEXEC))) {
+	memset(&fiemap, 0, sizeof(fiemap));
+	fiemap.map.fm_length = FIEMAP_MAX_OFFSET;
+	fiemap.map.fm_extent_count = 1;
+	rc = ioctl(fd, FS_IOC_FIEMAP, &(fiemap.map));
+	close(fd);
+	if ((0 == rc) && (1 == fiemap.map.fm_mapped_extents) && !(fiemap.extent.fe_flags & FIEMAP_EXTENT_UNKNOWN)
+	    && (0 != fiemap.extent.fe_physical) && (fiemap.extent.fe_physical < FT_LOCATION_INODE))
+	    return fiemap.extent.fe_physical;
+    }
+#endif
+
+    return FT_LOCATION_INODE | (apr_uint64_t) file->inode;
+}
+
+static int chksum_location_cmp(const void *chksum1, const void *chksum2)
+{
+    const ft_file_t *file1 = (*(ft_chksum_t * const *) chksum1)->file;
+    const ft_file_t *file2 = (*(ft_chksum_t * const *) chksum2)->file;
+
+    if (file1->device != file2->device)
+	return (file1->device < file2->device) ? -1 : 1;
+    if (file1->location != file2->location)
+	return (file1->location < file2->location) ? -1 : 1;
+
+    return 0;
+}
+
+/* the digest of chksum was computed, for the cache slot of its stage and round, or status tells why it could not be */
+static void ft_conf_chksum_done(ft_conf_t *conf, apr_uint32_t slot, ft_chksum_t *chksum, const char *path,
+				apr_status_t status)
+{
+    char errbuf[128];
+
+    if (APR_SUCCESS != status) {
+	if (is_option_set(conf->mask, OPTION_VERBO))
+	    fprintf(stderr, "\nskipping %s because: %s\n", path, apr_strerror(status, errbuf, 128));
+	/* mark the slot as unusable, it will be dropped by ft_fsize_split */
+	chksum->file = NULL;
+    }
+    else if (NULL != chksum->file->cache_rec) {
+	ft_cache_put(conf->cache, chksum->file->cache_rec, slot, chksum->val_array);
+    }
+}
+
+static apr_status_t ft_conf_chksum_file(ft_conf_t *conf, int stage, int round, ft_chksum_t *chksum,
+					apr_pool_t *gc_pool)
+{
+    apr_off_t offsets[FT_STAGE_MAX_SAMPLES];
+    ft_file_t *file = chksum->file;
+    const char *filepath;
+    apr_uint32_t slot = ft_round_slot(stage, round, file->size);
+    apr_size_t nb_blocks;
+    apr_status_t status;
+
+    /* unchanged since the previous run */
+    if ((NULL != file->cache_rec) && ft_cache_get(conf->cache, file->cache_rec, slot, chksum->val_array))
+	return APR_SUCCESS;
+
+#if HAVE_ARCHIVE
+    /* digested while the archive was walked */
+    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath)) {
+	if (NULL != file->ar_digests)
+	    memcpy(chksum->val_array, file->ar_digests + slot * HASHSTATE, sizeof(chksum->val_array));
+	ft_conf_chksum_done(conf, slot, chksum, file->path, (NULL != file->ar_digests) ? APR_SUCCESS : APR_EGENERAL);
+	return APR_SUCCESS;
+    }
+#endif
+    filepath = ft_file_path(file, gc_pool);
+    ft_stage_seed(stage, round, chksum->val_array);
+    nb_blocks = ft_stage_offsets(conf, stage, round, file->size, offsets);
+    status = checksum_file_blocks(filepath, offsets, nb_blocks,
+				  (apr_size_t) ft_round_len(conf, stage, round, file->size) / nb_blocks, &(conf->io),
+				  conf->hash, chksum->val_array, gc_pool);
+    /*
+     * no return status if != APR_SUCCESS , because : 
+     * Fault-check has been removed in case files disappear
+     * between collecting and comparing or special files (like
+     * device or /proc) are tried to access
+     */
+    ft_conf_chksum_done(conf, slot, chksum, filepath, status);
+
+    return APR_SUCCESS;
+}
+
+/* a checksum_files job, with room for the offsets of the blocks of a stage and the path of the file */
+typedef struct ft_stage_job_t
+{
+    ft_checksum_job_t job;
+    apr_off_t offsets[FT_STAGE_MAX_SAMPLES];
+    char *path;
+    apr_size_t path_size;
+    struct ft_stage_job_t *next_free;
+} ft_stage_job_t;
+
+struct checksum_ctx_t {
+    apr_thread_mutex_t *mutex;
+    ft_conf_t *conf;
+    int stage;
+    int round;			/* of the full stage */
+    apr_size_t nb_files, nb_processed;
+    apr_status_t status;
+    /* files of the stage, listed first when they are read through io.uring or in physical order */
+    ft_chksum_t **todo;
+    apr_size_t nb_todo, next_todo;
+    ft_stage_job_t *free_jobs;
+    apr_pool_t *pool, *gc_pool;
+};
+typedef struct checksum_ctx_t checksum_ctx_t;
+
+static void checksum_progress(checksum_ctx_t *ck_ctx)
+{
+    ck_ctx->nb_processed += 1;
+    if (is_option_set(ck_ctx->conf->mask, OPTION_VERBO)) {
+	fprintf(stderr, "\rProgress [%" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT "] %d%% ", ck_ctx->nb_processed,
+		ck_ctx->nb_files, (int) ((float) ck_ctx->nb_processed / (float) ck_ctx->nb_files * 100.0));
+    }
+}
+
+static apr_status_t checksum_worker(void *ctx, void *data)
+{
+    char errbuf[128];
+    checksum_ctx_t *ck_ctx = ctx;
+    ft_chksum_t *chksum = data;
+    apr_pool_t *gc_pool;
+    apr_status_t status, rv;
+
+    if (APR_SUCCESS != (status = ft_job_pool_create(&gc_pool))) {
+	DEBUG_ERR("error calling ft_job_pool_create: %s", apr_strerror(status, errbuf, 128));
+	chksum->file = NULL;
+	return status;
+    }
+    rv = ft_conf_chksum_file(ck_ctx->conf, ck_ctx->stage, ck_ctx->round, chksum, gc_pool);
+    apr_pool_destroy(gc_pool);
+
+    return rv;
+}
+
+/* napr_threadpool_job_done callback of checksum_worker, also called after it without threads */
+static void checksum_worker_done(void *ctx, void *data, apr_status_t rv)
+{
+    char errbuf[128];
+    checksum_ctx_t *ck_ctx = ctx;
+    apr_status_t status;
+
+    status = apr_thread_mutex_lock(ck_ctx->mutex);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+	return;
+    }
+    /* keep the first error, it will be returned once the pool is drained */
+    if ((APR_SUCCESS != rv) && (APR_SUCCESS == ck_ctx->status))
+	ck_ctx->status = rv;
+    checksum_progress(ck_ctx);
+    status = apr_thread_mutex_unlock(ck_ctx->mutex);
+    if (APR_SUCCESS != status)
+	DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
+}
+
+/* files of a device in physical order, checksummed one after the other by a worker */
+typedef struct ft_chksum_run_t
+{
+    ft_chksum_t **chksums;
+    apr_size_t nb_chksums;
+} ft_chksum_run_t;
+
+static apr_status_t checksum_run_worker(void *ctx, void *data)
+{
+    ft_chksum_run_t *run = data;
+    apr_size_t i;
+    apr_status_t status;
+
+    for (i = 0; i < run->nb_chksums; i++) {
+	status = checksum_worker(ctx, run->chksums[i]);
+	checksum_worker_done(ctx, run->chksums[i], status);
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * checksum_files callback: the files of the stage that are neither cached nor
+ * archived, the ones that are being checksummed meanwhile.
+ */
+static ft_checksum_job_t *checksum_next(void *ctx)
+{
+    checksum_ctx_t *ck_ctx = ctx;
+    ft_conf_t *conf = ck_ctx->conf;
+    ft_stage_job_t *sjob;
+    ft_chksum_t *chksum;
+    ft_file_t *file;
+    apr_status_t status;
+
+    while (ck_ctx->next_todo < ck_ctx->nb_todo) {
+	chksum = ck_ctx->todo[ck_ctx->next_todo++];
+	file = chksum->file;
+	/* cached digests and archive members, digested by the walk, are not read */
+	if (((NULL != file->cache_rec)
+	     && ft_cache_has(conf->cache, file->cache_rec, ft_round_slot(ck_ctx->stage, ck_ctx->round, file->size)))
+#if HAVE_ARCHIVE
+	    || (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath))
+#endif
+	    ) {
+	    status = ft_conf_chksum_file(conf, ck_ctx->stage, ck_ctx->round, chksum, ck_ctx->gc_pool);
+	    apr_pool_clear(ck_ctx->gc_pool);
+	    if ((APR_SUCCESS != status) && (APR_SUCCESS == ck_ctx->status))
+		ck_ctx->status = status;
+	    checksum_progress(ck_ctx);
+	    continue;
+	}
+
+	if (NULL != (sjob = ck_ctx->free_jobs)) {
+	    ck_ctx->free_jobs = sjob->next_free;
+	}
+	else {
+	    sjob = apr_palloc(ck_ctx->pool, sizeof(struct ft_stage_job_t));
+	    sjob->path = NULL;
+	    sjob->path_size = 0;
+	}
+	if (NULL == file->dir) {
+	    sjob->job.filename = file->path;
+	}
+	else {
+	    ft_path_build(file->dir, file->path, &(sjob->path), &(sjob->path_size), ck_ctx->pool);
+	    sjob->job.filename = sjob->path;
+	}
+	sjob->job.size = file->size;
+	sjob->job.digest = chksum->val_array;
+	sjob->job.data = chksum;
+	ft_stage_seed(ck_ctx->stage, ck_ctx->round, chksum->val_array);
+	sjob->job.offsets = sjob->offsets;
+	sjob->job.nb_blocks = ft_stage_offsets(conf, ck_ctx->stage, ck_ctx->round, file->size, sjob->offsets);
+	sjob->job.block_len =
+	    (apr_size_t) ft_round_len(conf, ck_ctx->stage, ck_ctx->round, file->size) / sjob->job.nb_blocks;
+
+	return &(sjob->job);
+    }
+
+    return NULL;
+}
+
+static void checksum_done(void *ctx, ft_checksum_job_t *job, apr_status_t status)
+{
+    checksum_ctx_t *ck_ctx = ctx;
+    ft_stage_job_t *sjob = (ft_stage_job_t *) job;
+
+    ft_conf_chksum_done(ck_ctx->conf, ft_round_slot(ck_ctx->stage, ck_ctx->round, job->size), job->data,
+			job->filename, status);
+    checksum_progress(ck_ctx);
+    sjob->next_free = ck_ctx->free_jobs;
+    ck_ctx->free_jobs = sjob;
+}
+
+static int chksum_val_cmp(const void *chksum1, const void *chksum2)
+{
+    const ft_chksum_t *chk1 = chksum1;
+    const ft_chksum_t *chk2 = chksum2;
+
+    return memcmp(chk1->val_array, chk2->val_array, HASHSTATE * sizeof(apr_uint32_t));
+}
+
+/*
+ * Split the active files of a size class that just went through a stage,
+ * according to their digests:
+ * - a digest owned by a single file rules it out, unless its hardlinks are
+ *   reported as its twins,
+ * - a digest shared by two files means that anyway we must read the both, so
+ *   we will cmp them at report time instead of going on hashing,
+ * - the others go on to the next stage or round, if any.
+ * Under --export, every file goes through every stage, its digests are exported.
+ * Active files are kept at the beginning of chksum_array, followed by the
+ * ones that wait for the report. tmp must hold nb_active elements.
+ */
+static void ft_fsize_split(ft_conf_t *conf, ft_fsize_t *fsize, int stage, int round, ft_stage_stats_t *stats,
+			   ft_chksum_t *tmp)
+{
+    apr_off_t remaining;
+    apr_uint32_t i, j, n, nb_active, nb_waiting, nb_old_waiting;
+    int s, last;
+
+    /* drop the files that could not be read */
+    for (i = 0, n = 0; i < fsize->nb_active; i++) {
+	if (NULL == fsize->chksum_array[i].file)
+	    continue;
+	if (i != n)
+	    fsize->chksum_array[n] = fsize->chksum_array[i];
+	n++;
+    }
+    qsort(fsize->chksum_array, n, sizeof(ft_chksum_t), chksum_val_cmp);
+
+    /* bytes of each file that are not read by the full hash if the file leaves now */
+    remaining = fsize->val;
+    for (s = FT_STAGE_HEAD; (s <= stage) && (s < FT_STAGE_FULL); s++)
+	remaining -= ft_stage_len(conf, s, fsize->val);
+    if (FT_STAGE_FULL == stage)
+	remaining = fsize->val - ft_chunk_end(round, fsize->val);
+    if (remaining < 0)
+	remaining = 0;
+    last = ft_stage_is_last(conf, stage, round, fsize->val);
+
+    /* active files are packed from the start of tmp, waiting ones from its end */
+    nb_active = 0;
+    nb_waiting = 0;
+    for (i = 0; i < n; i = j) {
+	for (j = i + 1; (j < n) && (0 == chksum_val_cmp(&(fsize->chksum_array[i]), &(fsize->chksum_array[j]))); j++);
+	if ((1 == j - i) && !ft_file_has_listed_links(conf, fsize->chksum_array[i].file) && (NULL == conf->index)) {
+	    stats->nb_ruled_out++;
+	    stats->bytes_avoided += remaining;
+	}
+	else if (((2 >= j - i) && (NULL == conf->index)) || last) {
+	    stats->bytes_avoided += (j - i) * remaining;
+	    for (; i < j; i++)
+		tmp[n - ++nb_waiting] = fsize->chksum_array[i];
+	}
+	else {
+	    for (; i < j; i++)
+		tmp[nb_active++] = fsize->chksum_array[i];
+	}
+    }
+
+    nb_old_waiting = fsize->nb_checksumed - fsize->nb_active;
+    memmove(&(fsize->chksum_array[nb_active + nb_waiting]), &(fsize->chksum_array[fsize->nb_active]),
+	    nb_old_waiting * sizeof(ft_chksum_t));
+    memcpy(fsize->chksum_array, tmp, nb_active * sizeof(ft_chksum_t));
+    memcpy(&(fsize->chksum_array[nb_active]), &(tmp[n - nb_waiting]), nb_waiting * sizeof(ft_chksum_t));
+    for (i = nb_active + nb_waiting + nb_old_waiting; i < fsize->nb_checksumed; i++)
+	fsize->chksum_array[i].file = NULL;
+    fsize->nb_checksumed = nb_active + nb_waiting + nb_old_waiting;
+    fsize->nb_active = nb_active;
+}
+
+#if HAVE_LINUX_FIEMAP_H
+/* extents read at once by FIEMAP */
+#define FT_CLONE_EXTENTS 64
+
+/* a file of a size run whose extents are all shared, under --dedupe */
+typedef struct ft_clone_t
+{
+    apr_size_t idx;		/* of its pair */
+    apr_uint64_t device;
+    apr_uint64_t *extents;	/* logical offset, physical offset and length of each one */
+    apr_size_t nb_extents;
+} ft_clone_t;
+
+/*
+ * Read the extents of path into clone, 0 unless they are all shared with
+ * other files and plainly mapped: the files of the same size with the same
+ * extents on the same device are then reflinks, or deduplicated, of each other.
+ */
+static int ft_file_shared_extents(const char *path, ft_clone_t *clone, apr_pool_t *pool)
+{
+    struct
+    {
+	struct fiemap map;
+	struct fiemap_extent extents[FT_CLONE_EXTENTS];
+    } fiemap;
+    const struct fiemap_extent *extent = NULL;
+    apr_array_header_t *extents;
+    apr_uint32_t i;
+    int fd, shared = 1, last = 0;
+
+    if (0 > (fd = open(path, O_RDONLY | O_CLOEXEC)))
+	return 0;
+    extents = apr_array_make(pool, 3 * FT_CLONE_EXTENTS, sizeof(apr_uint64_t));
+    memset(&fiemap, 0, sizeof(fiemap));
+    while (shared && !last) {
+	fiemap.map.fm_length = FIEMAP_MAX_OFFSET - fiemap.map.fm_start;
+	fiemap.map.fm_extent_count = FT_CLONE_EXTENTS;
+	if (0 != ioctl(fd, FS_IOC_FIEMAP, &(fiemap.map))) {
+	    shared = 0;
+	    break;
+	}
+	if (0 == fiemap.map.fm_mapped_extents)
+	    break;
+	for (i = 0; shared && (i < fiemap.map.fm_mapped_extents); i++) {
+	    extent = &(fiemap.extents[i]);
+	    /* a compressed extent is shared as a whole whatever the part of it mapped */
+	    if (!(extent->fe_flags & FIEMAP_EXTENT_SHARED)
+		|| (extent->fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_ENCODED
+					| FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED))) {
+		shared = 0;
+		break;
+	    }
+	    APR_ARRAY_PUSH(extents, apr_uint64_t) = extent->fe_logical;
+	    APR_ARRAY_PUSH(extents, apr_uint64_t) = extent->fe_physical;
+	    APR_ARRAY_PUSH(extents, apr_uint64_t) = extent->fe_length;
+	    last = extent->fe_flags & FIEMAP_EXTENT_LAST;
+	}
+	fiemap.map.fm_start = extent->fe_logical + extent->fe_length;
+    }
+    close(fd);
+    clone->extents = (apr_uint64_t *) extents->elts;
+    clone->nb_extents = extents->nelts / 3;
+
+    return shared && (0 != clone->nb_extents);
+}
+
+static int clone_cmp(const void *p1, const void *p2)
+{
+    const ft_clone_t *clone1 = p1;
+    const ft_clone_t *clone2 = p2;
+    int i;
+
+    if (clone1->device != clone2->device)
+	return (clone1->device < clone2->device) ? -1 : 1;
+    if (clone1->nb_extents != clone2->nb_extents)
+	return (clone1->nb_extents < clone2->nb_extents) ? -1 : 1;
+    if (0 != (i = memcmp(clone1->extents, clone2->extents, 3 * clone1->nb_extents * sizeof(apr_uint64_t))))
+	return i;
+
+    /* the first pair of each extent list stays first */
+    return (clone1->idx < clone2->idx) ? -1 : 1;
+}
+#endif
+
+/*
+ * Under --dedupe, the files of pairs[0 .. nb - 1], of the same size, that
+ * share all their extents with a previous one are already deduplicated: they
+ * are chained to its clones, reported along with it whatever --hardlinks
+ * says, and never read nor deduplicated again. Returns the number of pairs kept, packed at the
+ * start of pairs.
+ */
+static apr_size_t ft_conf_fold_clones(ft_conf_t *conf, napr_radix_pair_t *pairs, apr_size_t nb, apr_pool_t *pool)
+{
+#if HAVE_LINUX_FIEMAP_H
+    ft_clone_t *clones;
+    ft_file_t *file, *link;
+    apr_size_t i, j, nb_shared, nb_kept;
+
+    clones = apr_palloc(pool, nb * sizeof(ft_clone_t));
+    for (i = 0, nb_shared = 0; i < nb; i++) {
+	file = pairs[i].value;
+#if HAVE_ARCHIVE
+	if (NULL != file->subpath)
+	    continue;
+#endif
+	clones[nb_shared].idx = i;
+	clones[nb_shared].device = (apr_uint64_t) file->device;
+	if (ft_file_shared_extents(ft_conf_file_path(conf, file), &(clones[nb_shared]), pool))
+	    nb_shared++;
+    }
+    if (2 > nb_shared)
+	return nb;
+
+    qsort(clones, nb_shared, sizeof(ft_clone_t), clone_cmp);
+    for (i = 0; i < nb_shared; i = j) {
+	for (j = i + 1; (j < nb_shared) && (clones[j].device == clones[i].device)
+	     && (clones[j].nb_extents == clones[i].nb_extents)
+	     && !memcmp(clones[j].extents, clones[i].extents, 3 * clones[i].nb_extents * sizeof(apr_uint64_t)); j++) {
+	    file = pairs[clones[j].idx].value;
+	    for (link = pairs[clones[i].idx].value; NULL != link->clones; link = link->clones);
+	    link->clones = file;
+	    pairs[clones[j].idx].value = NULL;
+	    conf->nb_clones++;
+	}
+    }
+    for (i = 0, nb_kept = 0; i < nb; i++) {
+	if (NULL != pairs[i].value)
+	    pairs[nb_kept++] = pairs[i];
+    }
+
+    return nb_kept;
+#else
+
+    return nb;
+#endif
+}
+
+/*
+ * Group the referenced files by size: the (size, file) pairs are radix
+ * sorted in a flat array, so that each size is a run of it, and the runs of
+ * a single file are dropped in the same linear pass, unless the file has
+ * hardlinks to report or is exported. The files of each size kept get their slots in a
+ * single array of checksums, allocated from pool. Under --stream, the sizes
+ * without a fresh file were reported by a previous round and are dropped too.
+ * Under --dedupe, the files already deduplicated are folded first.
+ */
+static apr_status_t ft_conf_group_sizes(ft_conf_t *conf, apr_pool_t *pool)
+{
+    char errbuf[128];
+    napr_radix_pair_t *pairs, *tmp;
+    ft_fsize_t *fsize;
+    ft_chksum_t *chksums;
+    ft_file_t *file;
+    apr_size_t i, j, k, first, end, nb_files, nb_kept;
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+
+    conf->nb_clones = 0;
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    nb_files = conf->files->nelts;
+    pairs = apr_palloc(gc_pool, (nb_files ? nb_files : 1) * sizeof(napr_radix_pair_t));
+    tmp = apr_palloc(gc_pool, (nb_files ? nb_files : 1) * sizeof(napr_radix_pair_t));
+    for (i = 0; i < nb_files; i++) {
+	file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+	pairs[i].key = (apr_uint64_t) file->size;
+	pairs[i].value = file;
+    }
+    napr_radix_sort(pairs, tmp, nb_files);
+
+    /* count the sizes kept and their files, packing the pairs of the files kept in place */
+    conf->nb_fsizes = 0;
+    for (i = 0, nb_kept = 0; i < nb_files; i = j) {
+	for (j = i + 1; (j < nb_files) && (pairs[j].key == pairs[i].key); j++);
+	end = j;
+	if (is_option_set(conf->mask, OPTION_DEDUP) && (1 < j - i))
+	    end = i + ft_conf_fold_clones(conf, pairs + i, j - i, gc_pool);
+	if ((1 == end - i) && !ft_file_has_listed_links(conf, pairs[i].value) && (NULL == conf->index)) {
+	    if (NULL != conf->stats) {
+		conf->stats->nb_alone++;
+		conf->stats->alone_bytes += (apr_off_t) pairs[i].key;
+	    }
+	    continue;
+	}
+	if (0 != conf->stream_len) {
+	    for (k = i; (k < end) && !((ft_file_t *) pairs[k].value)->fresh; k++);
+	    if (k == end)
+		continue;
+	}
+	for (k = i; k < end; k++)
+	    pairs[nb_kept++] = pairs[k];
+	conf->nb_fsizes++;
+    }
+
+    conf->fsizes = apr_palloc(pool, (conf->nb_fsizes ? conf->nb_fsizes : 1) * sizeof(struct ft_fsize_t));
+    chksums = apr_palloc(pool, (nb_kept ? nb_kept : 1) * sizeof(struct ft_chksum_t));
+    /* the largest sizes first, the order they have always been reported in */
+    for (end = nb_kept, k = 0; 0 < end; end = first, k++) {
+	for (first = end - 1; (0 < first) && (pairs[first - 1].key == pairs[end - 1].key); first--);
+	fsize = &(conf->fsizes[k]);
+	fsize->val = (apr_off_t) pairs[first].key;
+	fsize->chksum_array = chksums + first;
+	fsize->nb_files = (apr_uint32_t) (end - first);
+	fsize->nb_checksumed = fsize->nb_files;
+	fsize->nb_active = ft_fsize_is_hashed(conf, fsize) ? fsize->nb_files : 0;
+	/* Each file owns its slot, so the checksum can be computed by any worker */
+	for (i = first; i < end; i++) {
+	    file = pairs[i].value;
+	    chksums[i].file = file;
+	    if (0 == fsize->nb_active)
+		memset(chksums[i].val_array, 0, HASHSTATE * sizeof(apr_int32_t));
+	    /* a file of a previous round of --stream keeps its record */
+#if HAVE_ARCHIVE
+	    else if ((NULL != conf->cache) && (NULL == file->subpath) && (NULL == file->cache_rec))
+#else
+	    else if ((NULL != conf->cache) && (NULL == file->cache_rec))
+#endif
+		file->cache_rec = ft_cache_add(conf->cache, file->device, file->inode, file->size, file->mtime);
+	}
+    }
+    apr_pool_destroy(gc_pool);
+
+    return APR_SUCCESS;
+}
+
+/* hash the files of the sizes shared by several of them, the sizes being allocated from pool */
+static apr_status_t ft_conf_process_sizes(ft_conf_t *conf, apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_stage_stats_t stats[FT_STAGE_NB];
+    checksum_ctx_t ck_ctx;
+    ft_file_t *file;
+    ft_fsize_t *fsize;
+    ft_chksum_t *tmp;
+    ft_chksum_run_t *run;
+    napr_threadpool_t *threadpool = NULL;
+    apr_pool_t *gc_pool;
+    apr_uint32_t max_active;
+    apr_status_t status;
+    apr_off_t len;
+    apr_size_t i, j, k;
+    int step, stage, listed, phase;
+
+    phase = ft_stats_phase(conf, FT_PHASE_SIZES);
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	fprintf(stderr, "Using %s content hash (%s)\n", ft_hash_name(conf->hash), ft_hash_impl(conf->hash));
+	if (0 != conf->nb_links)
+	    fprintf(stderr, "%" APR_SIZE_T_FMT " hardlinks of already referenced files won't be read\n",
+		    conf->nb_links);
+	fprintf(stderr, "Referencing files and sizes:\n");
+    }
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	apr_terminate();
+	return -1;
+    }
+
+    ck_ctx.conf = conf;
+    ck_ctx.status = APR_SUCCESS;
+    /* the workers are done with it once waited for, it goes with gc_pool on each return */
+    status = apr_thread_mutex_create(&(ck_ctx.mutex), APR_THREAD_MUTEX_DEFAULT, gc_pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_mutex_create: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    /* a ring keeps the disks busy from a single thread */
+    if ((NULL != conf->threadpool) && (NULL == conf->io.uring)) {
+	threadpool = conf->threadpool;
+	napr_threadpool_set_process(threadpool, &ck_ctx,
+				    is_option_set(conf->mask, OPTION_PHYS) ? checksum_run_worker : checksum_worker);
+    }
+
+    if (APR_SUCCESS != (status = ft_conf_group_sizes(conf, pool))) {
+	DEBUG_ERR("error calling ft_conf_group_sizes: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    if (is_option_set(conf->mask, OPTION_VERBO) && (0 != conf->nb_clones))
+	fprintf(stderr, "%" APR_SIZE_T_FMT " files already sharing their extents with a twin won't be read\n",
+		conf->nb_clones);
+
+    /*
+     * Each stage, then each round of the full one, hashes a few more bytes
+     * of the files that still have a possible twin, the stages being run one
+     * after the other for all the size classes, so that the workers are fed
+     * with the whole stage at once.
+     */
+    memset(stats, 0, sizeof(stats));
+    listed = (NULL != conf->io.uring) || is_option_set(conf->mask, OPTION_PHYS);
+    for (step = FT_STAGE_HEAD; step < FT_STAGE_FULL + FT_CHUNK_NB; step++) {
+	stage = FTWIN_MIN(step, FT_STAGE_FULL);
+	ck_ctx.stage = stage;
+	ck_ctx.round = step - stage;
+	ck_ctx.nb_files = 0;
+	ck_ctx.nb_processed = 0;
+	max_active = 0;
+	for (k = 0; k < conf->nb_fsizes; k++) {
+	    fsize = &(conf->fsizes[k]);
+	    if ((0 != fsize->nb_active) && (0 != (len = ft_round_len(conf, stage, ck_ctx.round, fsize->val)))) {
+		ck_ctx.nb_files += fsize->nb_active;
+		/* a file counts once for the full stage, whatever its rounds */
+		if (0 == ck_ctx.round)
+		    stats[stage].nb_hashed += fsize->nb_active;
+		for (i = 0; i < fsize->nb_active; i++) {
+		    file = fsize->chksum_array[i].file;
+		    if ((NULL != file->cache_rec)
+			&& ft_cache_has(conf->cache, file->cache_rec, ft_round_slot(stage, ck_ctx.round, fsize->val))) {
+			if (0 == ck_ctx.round)
+			    stats[stage].nb_cached++;
+		    }
+		    else
+			stats[stage].bytes_read += len;
+		}
+		if (fsize->nb_active > max_active)
+		    max_active = fsize->nb_active;
+	    }
+	}
+	if (0 == ck_ctx.nb_files)
+	    continue;
+
+	ft_stats_phase(conf, FT_PHASE_STAGE + stage);
+	if (is_option_set(conf->mask, OPTION_VERBO) && (FT_STAGE_FULL == stage))
+	    fprintf(stderr, "Computing %s digests, round %d:\n", ft_stage_name[stage], ck_ctx.round + 1);
+	else if (is_option_set(conf->mask, OPTION_VERBO))
+	    fprintf(stderr, "Computing %s digests:\n", ft_stage_name[stage]);
+	/* the workers are given the whole stage at once */
+	if (listed || (NULL != threadpool))
+	    ck_ctx.todo = apr_palloc(gc_pool, ck_ctx.nb_files * sizeof(ft_chksum_t *));
+	ck_ctx.nb_todo = 0;
+	for (k = 0; k < conf->nb_fsizes; k++) {
+	    fsize = &(conf->fsizes[k]);
+	    if (0 == ft_round_len(conf, stage, ck_ctx.round, fsize->val))
+		continue;
+	    for (i = 0; i < fsize->nb_active; i++) {
+		if (listed || (NULL != threadpool)) {
+		    ck_ctx.todo[ck_ctx.nb_todo++] = &(fsize->chksum_array[i]);
+		}
+		else {
+		    status = checksum_worker(&ck_ctx, &(fsize->chksum_array[i]));
+		    checksum_worker_done(&ck_ctx, &(fsize->chksum_array[i]), status);
+		    if (APR_SUCCESS != ck_ctx.status) {
+			DEBUG_ERR("error calling checksum_worker: %s", apr_strerror(ck_ctx.status, errbuf, 128));
+			apr_pool_destroy(gc_pool);
+			return ck_ctx.status;
+		    }
+		}
+	    }
+	}
+	if (!listed && (NULL != threadpool)) {
+	    status = napr_threadpool_add_batch(threadpool, (void *const *) ck_ctx.todo, ck_ctx.nb_todo,
+					       checksum_worker_done);
+	    if (APR_SUCCESS != status) {
+		DEBUG_ERR("error calling napr_threadpool_add_batch: %s", apr_strerror(status, errbuf, 128));
+		apr_pool_destroy(gc_pool);
+		return status;
+	    }
+	}
+	if (is_option_set(conf->mask, OPTION_PHYS)) {
+	    for (i = 0; i < ck_ctx.nb_todo; i++) {
+		file = ck_ctx.todo[i]->file;
+		if (0 == file->location)
+		    file->location = ft_file_location(file, ft_conf_file_path(conf, file));
+	    }
+	    qsort(ck_ctx.todo, ck_ctx.nb_todo, sizeof(ft_chksum_t *), chksum_location_cmp);
+	}
+	if (NULL != conf->io.uring) {
+	    /* the whole stage is read through the ring by this thread, the jobs are recycled */
+	    if ((APR_SUCCESS != (status = apr_pool_create(&(ck_ctx.pool), gc_pool)))
+		|| (APR_SUCCESS != (status = apr_pool_create(&(ck_ctx.gc_pool), ck_ctx.pool)))) {
+		DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+		apr_pool_destroy(gc_pool);
+		return status;
+	    }
+	    ck_ctx.next_todo = 0;
+	    ck_ctx.free_jobs = NULL;
+	    status = checksum_files(&(conf->io), conf->hash, checksum_next, checksum_done, &ck_ctx, ck_ctx.pool);
+	    apr_pool_destroy(ck_ctx.pool);
+	    if (APR_SUCCESS != status) {
+		DEBUG_ERR("error calling checksum_files: %s", apr_strerror(status, errbuf, 128));
+		apr_pool_destroy(gc_pool);
+		return status;
+	    }
+	}
+	else if (listed) {
+	    /* a single worker reads each device in sequence, distinct devices are read in parallel */
+	    for (i = 0; i < ck_ctx.nb_todo; i = j) {
+		file = ck_ctx.todo[i]->file;
+		for (j = i + 1; (j < ck_ctx.nb_todo) && (ck_ctx.todo[j]->file->device == file->device); j++);
+		run = apr_palloc(gc_pool, sizeof(struct ft_chksum_run_t));
+		run->chksums = &(ck_ctx.todo[i]);
+		run->nb_chksums = j - i;
+		if (NULL != threadpool)
+		    status = napr_threadpool_add(threadpool, run);
+		else
+		    status = checksum_run_worker(&ck_ctx, run);
+		if (APR_SUCCESS != status) {
+		    DEBUG_ERR("error calling checksum_run_worker: %s", apr_strerror(status, errbuf, 128));
+		    apr_pool_destroy(gc_pool);
+		    return status;
+		}
+	    }
+	}
+	if (NULL != threadpool) {
+	    status = napr_threadpool_wait(threadpool);
+	    if (APR_SUCCESS != status) {
+		DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(status, errbuf, 128));
+		apr_pool_destroy(gc_pool);
+		return status;
+	    }
+	}
+	if (APR_SUCCESS != ck_ctx.status) {
+	    DEBUG_ERR("error calling ft_conf_chksum_file: %s", apr_strerror(ck_ctx.status, errbuf, 128));
+	    apr_pool_destroy(gc_pool);
+	    return ck_ctx.status;
+	}
+	if (is_option_set(conf->mask, OPTION_VERBO))
+	    fprintf(stderr, "\n");
+
+	tmp = apr_palloc(gc_pool, max_active * sizeof(struct ft_chksum_t));
+	for (k = 0; k < conf->nb_fsizes; k++) {
+	    fsize = &(conf->fsizes[k]);
+	    if ((0 != fsize->nb_active) && (0 != ft_round_len(conf, stage, ck_ctx.round, fsize->val)))
+		ft_fsize_split(conf, fsize, stage, ck_ctx.round, &(stats[stage]), tmp);
+	}
+    }
+
+    if (NULL != conf->stats) {
+	for (stage = FT_STAGE_HEAD; stage < FT_STAGE_NB; stage++) {
+	    conf->stats->stages[stage].nb_hashed += stats[stage].nb_hashed;
+	    conf->stats->stages[stage].nb_cached += stats[stage].nb_cached;
+	    conf->stats->stages[stage].nb_ruled_out += stats[stage].nb_ruled_out;
+	    conf->stats->stages[stage].bytes_read += stats[stage].bytes_read;
+	    conf->stats->stages[stage].bytes_avoided += stats[stage].bytes_avoided;
+	}
+    }
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	for (stage = FT_STAGE_HEAD; stage < FT_STAGE_NB; stage++) {
+	    if (0 == stats[stage].nb_hashed)
+		continue;
+	    fprintf(stderr, "%s stage: %" APR_SIZE_T_FMT " files hashed (%" APR_SIZE_T_FMT " cached), %" APR_SIZE_T_FMT
+		    " ruled out, %" APR_OFF_T_FMT " bytes read, %" APR_OFF_T_FMT " bytes not read\n",
+		    ft_stage_name[stage], stats[stage].nb_hashed, stats[stage].nb_cached, stats[stage].nb_ruled_out,
+		    stats[stage].bytes_read, stats[stage].bytes_avoided);
+	}
+    }
+
+    /* The report only needs the files that still have a possible twin */
+    for (k = 0; k < conf->nb_fsizes; k++) {
+	fsize = &(conf->fsizes[k]);
+	for (i = 0, j = 0; i < fsize->nb_checksumed; i++) {
+	    if (NULL == fsize->chksum_array[i].file)
+		continue;
+	    if (i != j)
+		fsize->chksum_array[j] = fsize->chksum_array[i];
+	    j++;
+	}
+	fsize->nb_checksumed = j;
+	for (; j < fsize->nb_files; j++)
+	    fsize->chksum_array[j].file = NULL;
+    }
+
+    apr_pool_destroy(gc_pool);
+    ft_stats_phase(conf, phase);
+
+    return APR_SUCCESS;
+}
+
+/* the whole digest, so that the runs of equal ones are not merged by a shared prefix, the prioritized files first */
+static int chksum_cmp(const void *chksum1, const void *chksum2)
+{
+    const ft_chksum_t *chk1 = chksum1;
+    const ft_chksum_t *chk2 = chksum2;
+    int i;
+
+    if (0 == (i = memcmp(chk1->val_array, chk2->val_array, HASHSTATE * sizeof(apr_uint32_t)))) {
+	return chk1->file->prioritized - chk2->file->prioritized;
+    }
+    else {
+	i <<= 1;
+    }
+
+    return i;
+}
+
+#if HAVE_PUZZLE
+
+/* the settings of the signatures, the cached ones depend on them */
+#define FT_IMAGE_MAX_SIZE 5000
+#define FT_IMAGE_LAMBDAS 13
+/* a cached signature is compressed by libpuzzle, 3 values a byte, after its length */
+#define FT_IMAGE_CVEC_MAX_LEN 512
+#define FT_IMAGE_SLOT_LEN (sizeof(apr_uint32_t) + FT_IMAGE_CVEC_MAX_LEN)
+
+/* words of the signatures indexed, as suggested by libpuzzle */
+#define FT_IMAGE_NB_WORDS 100
+#define FT_IMAGE_WORD_LEN 10
+/* candidate pairs compared by a job */
+#define FT_IMAGE_CMP_JOB 4096
+
+struct compute_vector_ctx_t {
+    apr_thread_mutex_t *mutex;
+    PuzzleContext *contextp;
+    ft_conf_t *conf;
+    int nb_files, nb_processed;
+};
+typedef struct compute_vector_ctx_t compute_vector_ctx_t;
+
+/* the signature of file from the cache, if the image did not change */
+static int ft_image_cvec_load(compute_vector_ctx_t *cv_ctx, ft_file_t *file)
+{
+    PuzzleCompressedCvec compressed;
+    const unsigned char *slot;
+    apr_uint32_t len;
+
+    if ((NULL == file->cache_rec) || (NULL == (slot = ft_cache_slot(cv_ctx->conf->cache, file->cache_rec, 0))))
+	return 0;
+    memcpy(&len, slot, sizeof(apr_uint32_t));
+    compressed.sizeof_compressed_vec = len;
+    compressed.vec = (unsigned char *) slot + sizeof(apr_uint32_t);
+    if (0 != puzzle_uncompress_cvec(cv_ctx->contextp, &compressed, &(file->cvec))) {
+	puzzle_free_cvec(cv_ctx->contextp, &(file->cvec));
+	puzzle_init_cvec(cv_ctx->contextp, &(file->cvec));
+	return 0;
+    }
+
+    return 1;
+}
+
+static void ft_image_cvec_store(compute_vector_ctx_t *cv_ctx, ft_file_t *file)
+{
+    unsigned char slot[FT_IMAGE_SLOT_LEN];
+    PuzzleCompressedCvec compressed;
+    apr_uint32_t len;
+
+    puzzle_init_compressed_cvec(cv_ctx->contextp, &compressed);
+    if ((0 == puzzle_compress_cvec(cv_ctx->contextp, &compressed, &(file->cvec)))
+	&& (FT_IMAGE_CVEC_MAX_LEN >= compressed.sizeof_compressed_vec)) {
+	memset(slot, 0, sizeof(slot));
+	len = (apr_uint32_t) compressed.sizeof_compressed_vec;
+	memcpy(slot, &len, sizeof(apr_uint32_t));
+	memcpy(slot + sizeof(apr_uint32_t), compressed.vec, len);
+	ft_cache_put(cv_ctx->conf->cache, file->cache_rec, 0, slot);
+    }
+    puzzle_free_compressed_cvec(cv_ctx->contextp, &compressed);
+}
+
+static apr_status_t compute_vector(void *ctx, void *data)
+{
+    char errbuf[128];
+    compute_vector_ctx_t *cv_ctx = ctx;
+    ft_file_t *file = data;
+    const char *path;
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+
+    puzzle_init_cvec(cv_ctx->contextp, &(file->cvec));
+    /* an unchanged image is not decoded again */
+    if (ft_image_cvec_load(cv_ctx, file)) {
+	file->cvec_ok |= 0x1;
+    }
+    else {
+	if (APR_SUCCESS != (status = ft_job_pool_create(&gc_pool))) {
+	    DEBUG_ERR("error calling ft_job_pool_create: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	path = ft_file_path(file, gc_pool);
+	if (0 == puzzle_fill_cvec_from_file(cv_ctx->contextp, &(file->cvec), path)) {
+	    file->cvec_ok |= 0x1;
+	    if (NULL != file->cache_rec)
+		ft_image_cvec_store(cv_ctx, file);
+	}
+	else {
+	    DEBUG_ERR("error calling puzzle_fill_cvec_from_file, ignoring file: %s", path);
+	}
+	apr_pool_destroy(gc_pool);
+    }
+
+    status = apr_thread_mutex_lock(cv_ctx->mutex);
+    if (APR_SUCCESS != status) {
+        DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+        return status;
+    }
+    if (is_option_set(cv_ctx->conf->mask, OPTION_VERBO)) {
+      fprintf(stderr, "\rProgress [%i/%i] %d%% ", cv_ctx->nb_processed, cv_ctx->nb_files,
+              (int) ((float) cv_ctx->nb_processed / (float) cv_ctx->nb_files * 100.0));
+    }
+    cv_ctx->nb_processed += 1;
+    status = apr_thread_mutex_unlock(cv_ctx->mutex);
+    if (APR_SUCCESS != status) {
+        DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
+        return status;
+    }
+
+    return APR_SUCCESS;
+}
+
+/* a slice of the candidate pairs of images, compared by a worker */
+typedef struct ft_image_cmp_job_t
+{
+    const ft_lsh_pair_t *pairs;
+    unsigned char *similar;	/* one per pair, set if the distance is below the threshold */
+    apr_size_t nb_pairs;
+} ft_image_cmp_job_t;
+
+static apr_status_t compare_vectors(void *ctx, void *data)
+{
+    char errbuf[128];
+    compute_vector_ctx_t *cv_ctx = ctx;
+    ft_image_cmp_job_t *job = data;
+    ft_conf_t *conf = cv_ctx->conf;
+    const ft_file_t *file, *file_cmp;
+    apr_size_t k;
+    apr_status_t status;
+
+    for (k = 0; k < job->nb_pairs; k++) {
+	file = APR_ARRAY_IDX(conf->files, job->pairs[k].first, ft_file_t *);
+	file_cmp = APR_ARRAY_IDX(conf->files, job->pairs[k].second, ft_file_t *);
+	if (puzzle_vector_normalized_distance(cv_ctx->contextp, &(file->cvec), &(file_cmp->cvec), 0) < conf->threshold)
+	    job->similar[k] = 1;
+    }
+
+    status = apr_thread_mutex_lock(cv_ctx->mutex);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    cv_ctx->nb_processed += (int) job->nb_pairs;
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	fprintf(stderr, "\rCompare progress [%10i/%10i] %02.2f%% ", cv_ctx->nb_processed, cv_ctx->nb_files,
+		(double) cv_ctx->nb_processed / (double) cv_ctx->nb_files * 100.0);
+    }
+    status = apr_thread_mutex_unlock(cv_ctx->mutex);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Report the similar images: their signatures are indexed by ft_lsh, so only
+ * the pairs sharing a word of them are compared with the -T threshold, instead
+ * of every pair of images. The images linked by similar pairs are a group.
+ */
+static apr_status_t ft_conf_image_twin_report(ft_conf_t *conf)
+{
+    char errbuf[128];
+    PuzzleContext context;
+    compute_vector_ctx_t cv_ctx;
     ft_file_t *file;
+    ft_lsh_t *lsh;
+    ft_lsh_pair_t *pairs;
+    ft_image_cmp_job_t **jobs;
+    unsigned char *similar;
+    napr_threadpool_t *threadpool;
+    apr_pool_t *gc_pool;
+    apr_uint32_t *leader, *next, id;
+    apr_size_t k, nb_pairs, nb_jobs;
+    int j, nb_files;
+    apr_status_t status;
+
+    puzzle_init_context(&context);
+    puzzle_set_max_width(&context, FT_IMAGE_MAX_SIZE);
+    puzzle_set_max_height(&context, FT_IMAGE_MAX_SIZE);
+    puzzle_set_lambdas(&context, FT_IMAGE_LAMBDAS);
+
+    cv_ctx.contextp = &context;
+    cv_ctx.nb_files = nb_files = conf->files->nelts;
+    cv_ctx.nb_processed = 0;
+    cv_ctx.conf = conf;
+    status = apr_thread_mutex_create(&(cv_ctx.mutex), APR_THREAD_MUTEX_DEFAULT, conf->pool);
+    if (APR_SUCCESS != status) {
+        DEBUG_ERR("error calling apr_thread_mutex_create: %s", apr_strerror(status, errbuf, 128));
+        return status;
+    }
+    /* the records are made before the threads share the cache */
+    if (NULL != conf->cache) {
+	for (j = 0; j < nb_files; j++) {
+	    file = APR_ARRAY_IDX(conf->files, j, ft_file_t *);
+#if HAVE_ARCHIVE
+	    if (NULL != file->subpath)
+		continue;
+#endif
+	    file->cache_rec = ft_cache_add(conf->cache, file->device, file->inode, file->size, file->mtime);
+	}
+    }
+
+    /* the threads of the walk are reused, -j defaults to the number of CPUs in image cmp mode */
+    if (NULL != (threadpool = conf->threadpool)) {
+	napr_threadpool_set_process(threadpool, &cv_ctx, compute_vector);
+	status = napr_threadpool_add_batch(threadpool, (void *const *) conf->files->elts, nb_files, NULL);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling napr_threadpool_add_batch: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	if (APR_SUCCESS != (status = napr_threadpool_wait(threadpool))) {
+	    DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    }
+    else {
+	for (j = 0; j < nb_files; j++) {
+	    if (APR_SUCCESS != (status = compute_vector(&cv_ctx, APR_ARRAY_IDX(conf->files, j, ft_file_t *))))
+		return status;
+	}
+    }
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	fprintf(stderr, "\rProgress [%i/%i] %d%% ", nb_files, nb_files, 100);
+	fprintf(stderr, "\n");
+    }
+
+    /* only the pairs of images sharing a word of their signatures are compared */
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (APR_SUCCESS != (status = ft_lsh_make(&lsh, FT_IMAGE_NB_WORDS, FT_IMAGE_WORD_LEN, gc_pool))) {
+	DEBUG_ERR("error calling ft_lsh_make: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    for (j = 0; j < nb_files; j++) {
+	file = APR_ARRAY_IDX(conf->files, j, ft_file_t *);
+	if (file->cvec_ok & 0x1)
+	    ft_lsh_add(lsh, file->cvec.vec, file->cvec.sizeof_vec, (apr_uint32_t) j);
+    }
+    if (APR_SUCCESS != (status = ft_lsh_pairs(lsh, &pairs, &nb_pairs, gc_pool))) {
+	DEBUG_ERR("error calling ft_lsh_pairs: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+
+    /* the candidates are compared in parallel, a slice of them per job */
+    similar = apr_pcalloc(gc_pool, nb_pairs ? nb_pairs : 1);
+    nb_jobs = (nb_pairs + FT_IMAGE_CMP_JOB - 1) / FT_IMAGE_CMP_JOB;
+    jobs = apr_palloc(gc_pool, (nb_jobs ? nb_jobs : 1) * sizeof(ft_image_cmp_job_t *));
+    for (k = 0; k < nb_jobs; k++) {
+	jobs[k] = apr_palloc(gc_pool, sizeof(struct ft_image_cmp_job_t));
+	jobs[k]->pairs = pairs + k * FT_IMAGE_CMP_JOB;
+	jobs[k]->similar = similar + k * FT_IMAGE_CMP_JOB;
+	jobs[k]->nb_pairs = FTWIN_MIN(FT_IMAGE_CMP_JOB, nb_pairs - k * FT_IMAGE_CMP_JOB);
+    }
+    cv_ctx.nb_files = (int) nb_pairs;
+    cv_ctx.nb_processed = 0;
+    if (NULL != threadpool) {
+	napr_threadpool_set_process(threadpool, &cv_ctx, compare_vectors);
+	status = napr_threadpool_add_batch(threadpool, (void *const *) jobs, nb_jobs, NULL);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling napr_threadpool_add_batch: %s", apr_strerror(status, errbuf, 128));
+	    apr_pool_destroy(gc_pool);
+	    return status;
+	}
+	if (APR_SUCCESS != (status = napr_threadpool_wait(threadpool))) {
+	    DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(status, errbuf, 128));
+	    apr_pool_destroy(gc_pool);
+	    return status;
+	}
+    }
+    else {
+	for (k = 0; (k < nb_jobs) && (APR_SUCCESS == status); k++)
+	    status = compare_vectors(&cv_ctx, jobs[k]);
+	if (APR_SUCCESS != status) {
+	    apr_pool_destroy(gc_pool);
+	    return status;
+	}
+    }
+    status = apr_thread_mutex_destroy(cv_ctx.mutex);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_mutex_destroy: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	fprintf(stderr, "\rCompare progress [%10" APR_SIZE_T_FMT "/%10" APR_SIZE_T_FMT "] %02.2f%% ", nb_pairs, nb_pairs,
+		100.0);
+	fprintf(stderr, "\n");
+    }
+
+    /* the images linked by similar pairs make a group, in the order of the walk */
+    leader = apr_palloc(gc_pool, (nb_files ? nb_files : 1) * sizeof(apr_uint32_t));
+    next = apr_palloc(gc_pool, (nb_files ? nb_files : 1) * sizeof(apr_uint32_t));
+    ft_lsh_components(pairs, similar, nb_pairs, leader, next, (apr_size_t) nb_files);
+    for (j = 0; j < nb_files; j++) {
+	if ((leader[j] != (apr_uint32_t) j) || (next[j] == (apr_uint32_t) nb_files))
+	    continue;
+	ft_out_group(conf, "images", -1, NULL);
+	for (id = (apr_uint32_t) j; id != (apr_uint32_t) nb_files; id = next[id]) {
+	    file = APR_ARRAY_IDX(conf->files, id, ft_file_t *);
+	    ft_out_path(conf, ft_conf_file_path(conf, file), NULL, "", file->prioritized);
+	}
+	ft_out_group_end(conf);
+    }
+    ft_out_flush(conf);
+    apr_pool_destroy(gc_pool);
+
+    for (j = 0; j < nb_files; j++) {
+	file = APR_ARRAY_IDX(conf->files, j, ft_file_t *);
+	if (file->cvec_ok & 0x1)
+	    puzzle_free_cvec(&context, &(file->cvec));
+    }
+    puzzle_free_context(&context);
+
+    return APR_SUCCESS;
+}
+#endif
+
+/*
+ * Write the path of file, followed by the ones of its hardlinks unless they
+ * are hidden, then by its clones with their own hardlinks.
+ */
+static void ft_report_file(ft_conf_t *conf, const ft_file_t *file)
+{
+    const ft_file_t *clone, *link;
+
+#if HAVE_ARCHIVE
+    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath))
+	ft_out_path(conf, file->path, file->subpath, "", file->prioritized);
+    else
+#endif
+	ft_out_path(conf, ft_conf_file_path(conf, file), NULL, "", file->prioritized);
+    for (clone = file; NULL != clone; clone = clone->clones) {
+	if ((clone != file) && !ft_file_is_collapsed(conf, clone))
+	    ft_out_path(conf, ft_conf_file_path(conf, clone), NULL, "", clone->prioritized);
+	if (is_option_set(conf->mask, OPTION_HLINK))
+	    continue;
+	for (link = clone->links; NULL != link; link = link->links) {
+	    if (!ft_file_is_collapsed(conf, link))
+		ft_out_path(conf, ft_conf_file_path(conf, link), NULL, "", link->prioritized);
+	}
+    }
+}
+
+/*
+ * The twins of a run as filecmp_group gives them, from the ones recorded by
+ * the first pass of --dirs, the files collapsed in their directory left out.
+ */
+static void ft_run_recorded_twins(const ft_conf_t *conf, const ft_chksum_t *run, apr_size_t nb_files,
+				  apr_size_t *twins, apr_status_t *statuses)
+{
+    const ft_file_t *twin;
+    apr_size_t k, l;
+
+    for (k = 0; k < nb_files; k++) {
+	twins[k] = k;
+	statuses[k] = APR_SUCCESS;
+	if (NULL == (twin = run[k].file->twin)) {
+	    statuses[k] = APR_EGENERAL;
+	    continue;
+	}
+	if (ft_file_is_collapsed(conf, run[k].file))
+	    continue;
+	for (l = 0; l < k; l++) {
+	    if ((twins[l] == l) && (APR_SUCCESS == statuses[l]) && (twin == run[l].file->twin)
+		&& !ft_file_is_collapsed(conf, run[l].file)) {
+		twins[k] = l;
+		break;
+	    }
+	}
+    }
+}
+
+/*
+ * Find the twins of the nb_files files of run as filecmp_group does, *deduped
+ * being the bytes the kernel deduplicated, or -1 if the files were compared.
+ * Under --dedupe, the kernel deduplicates them instead, comparing them on its
+ * own, unless some are archive members or the filesystem can't. It may be run
+ * by any thread, gc_pool being its own.
+ */
+static apr_status_t ft_conf_cmp_run(const ft_conf_t *conf, ft_chksum_t *run, apr_size_t nb_files, apr_off_t size,
+				    apr_size_t *twins, apr_status_t *statuses, apr_off_t *deduped, apr_pool_t *gc_pool)
+{
+    const char **paths;
+    apr_size_t k;
+    apr_status_t status;
+
+    paths = apr_palloc(gc_pool, nb_files * sizeof(const char *));
+    for (k = 0; k < nb_files; k++)
+	paths[k] = ft_file_path(run[k].file, gc_pool);
+
+    *deduped = -1;
+    if (is_option_set(conf->mask, OPTION_DEDUP)) {
+#if HAVE_ARCHIVE
+	for (k = 0; (k < nb_files) && (NULL == run[k].file->subpath); k++);
+#endif
+	if (k == nb_files) {
+	    status = filededupe_group(gc_pool, paths, nb_files, size, twins, statuses, deduped);
+	    if (APR_ENOTIMPL != status)
+		return status;
+	    *deduped = -1;
+	}
+    }
+
+#if HAVE_ARCHIVE
+    /* the members are compared as they are read from their archives, along with the plain files */
+    if (is_option_set(conf->mask, OPTION_UNTAR))
+	return filecmp_group_streams(gc_pool, paths, nb_files, size, &(conf->io), &ft_member_ops, run, twins,
+				     statuses);
+#endif
+
+    return filecmp_group(gc_pool, paths, nb_files, size, &(conf->io), twins, statuses);
+}
+
+/* files of a run compared by a thread, larger runs are split in parts compared concurrently */
+#define FT_VERIFY_PART_LEN 64
+/* runs verified ahead of the one being reported, for each thread */
+#define FT_VERIFY_AHEAD 4
+
+/* a run of files sharing a digest, verified by the threads while the ones before it are reported */
+typedef struct ft_verify_run_t
+{
+    ft_fsize_t *fsize;
+    apr_size_t first;
+    apr_size_t end;
+    apr_pool_t *pool;		/* a job pool, of the twins and statuses, NULL if the files are not compared */
+    apr_size_t *twins;
+    apr_status_t *statuses;
+    apr_off_t deduped;		/* see ft_conf_cmp_run */
+    apr_size_t nb_parts;
+    apr_size_t nb_left;		/* parts not compared yet, the thread of the last one joins them */
+    apr_status_t status;
+    int done;
+} ft_verify_run_t;
+
+typedef struct ft_verify_part_t
+{
+    ft_verify_run_t *vrun;
+    apr_size_t first;		/* in the run */
+    apr_size_t nb_files;
+} ft_verify_part_t;
+
+typedef struct ft_verify_ctx_t
+{
+    ft_conf_t *conf;
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;	/* signaled once a run is done */
+} ft_verify_ctx_t;
+
+/*
+ * The twins of the parts of vrun, each compared on its own, are joined by
+ * comparing the first file of each content found in each part: the first file
+ * of a content in the run is the first one of its part.
+ */
+static apr_status_t ft_conf_join_parts(const ft_conf_t *conf, ft_verify_run_t *vrun, apr_pool_t *gc_pool)
+{
+    ft_chksum_t *run = vrun->fsize->chksum_array + vrun->first, *reps;
+    apr_size_t *rep_of, *rep_idx, *rep_twins;
+    apr_status_t *rep_statuses;
+    apr_size_t k, r, nb_reps, nb_files = vrun->end - vrun->first;
+    apr_off_t deduped;
+    apr_status_t status;
+
+    reps = apr_palloc(gc_pool, nb_files * sizeof(ft_chksum_t));
+    rep_of = apr_palloc(gc_pool, nb_files * sizeof(apr_size_t));
+    rep_idx = apr_palloc(gc_pool, nb_files * sizeof(apr_size_t));
+    for (k = 0, nb_reps = 0; k < nb_files; k++) {
+	if ((APR_SUCCESS == vrun->statuses[k]) && (k == vrun->twins[k])) {
+	    rep_of[k] = nb_reps;
+	    rep_idx[nb_reps] = k;
+	    reps[nb_reps++] = run[k];
+	}
+    }
+    if (2 > nb_reps)
+	return APR_SUCCESS;
+
+    rep_twins = apr_palloc(gc_pool, nb_reps * sizeof(apr_size_t));
+    rep_statuses = apr_palloc(gc_pool, nb_reps * sizeof(apr_status_t));
+    status = ft_conf_cmp_run(conf, reps, nb_reps, vrun->fsize->val, rep_twins, rep_statuses, &deduped, gc_pool);
+    if (APR_SUCCESS != status)
+	return status;
+    for (k = 0; k < nb_files; k++) {
+	if (APR_SUCCESS != vrun->statuses[k])
+	    continue;
+	r = rep_of[vrun->twins[k]];
+	if (APR_SUCCESS != rep_statuses[r])
+	    vrun->statuses[k] = rep_statuses[r];
+	else
+	    vrun->twins[k] = rep_idx[rep_twins[r]];
+    }
+
+    return APR_SUCCESS;
+}
+
+/* napr_threadpool callback comparing a part of a run, also called without threads */
+static apr_status_t ft_verify_worker(void *ctx, void *data)
+{
+    char errbuf[128];
+    ft_verify_ctx_t *vctx = ctx;
+    ft_verify_part_t *part = data;
+    ft_verify_run_t *vrun = part->vrun;
+    apr_pool_t *gc_pool;
+    apr_size_t k, nb_left;
+    apr_off_t deduped;
+    apr_status_t status, rv;
+
+    if (APR_SUCCESS == (rv = ft_job_pool_create(&gc_pool))) {
+	rv = ft_conf_cmp_run(vctx->conf, vrun->fsize->chksum_array + vrun->first + part->first, part->nb_files,
+			     vrun->fsize->val, vrun->twins + part->first, vrun->statuses + part->first, &deduped,
+			     gc_pool);
+	for (k = part->first; k < part->first + part->nb_files; k++)
+	    vrun->twins[k] += part->first;
+	if (1 == vrun->nb_parts)
+	    vrun->deduped = deduped;
+    }
+    else {
+	DEBUG_ERR("error calling ft_job_pool_create: %s", apr_strerror(rv, errbuf, 128));
+	gc_pool = NULL;
+    }
+
+    /* without the mutex, the run is updated all the same, or its reporter would wait for it forever */
+    if (APR_SUCCESS != (status = apr_thread_mutex_lock(vctx->mutex))) {
+	DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+	if (APR_SUCCESS == rv)
+	    rv = status;
+    }
+    /* keep the first error, it is returned once the run is reported */
+    if ((APR_SUCCESS != rv) && (APR_SUCCESS == vrun->status))
+	vrun->status = rv;
+    nb_left = --vrun->nb_left;
+    if ((0 == nb_left) && (1 < vrun->nb_parts) && (APR_SUCCESS == vrun->status)) {
+	apr_thread_mutex_unlock(vctx->mutex);
+	apr_pool_clear(gc_pool);
+	rv = ft_conf_join_parts(vctx->conf, vrun, gc_pool);
+	if (APR_SUCCESS != (status = apr_thread_mutex_lock(vctx->mutex))) {
+	    DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+	    if (APR_SUCCESS == rv)
+		rv = status;
+	}
+	if (APR_SUCCESS != rv)
+	    vrun->status = rv;
+    }
+    if (0 == nb_left) {
+	vrun->done = 1;
+	apr_thread_cond_broadcast(vctx->cond);
+    }
+    if (APR_SUCCESS == status)
+	apr_thread_mutex_unlock(vctx->mutex);
+    if (NULL != gc_pool)
+	apr_pool_destroy(gc_pool);
+
+    return status;
+}
+
+/*
+ * Whether the run fsize->chksum_array[first .. end - 1] has nothing to
+ * report: under --stream, a run without a fresh file was verified by a
+ * previous round, and the first pass of --dirs only records the twins.
+ */
+static int ft_conf_run_is_done(const ft_conf_t *conf, const ft_fsize_t *fsize, apr_size_t first, apr_size_t end)
+{
+    apr_size_t k;
+
+    if (0 != conf->stream_len) {
+	for (k = first; (k < end) && !fsize->chksum_array[k].file->fresh; k++);
+	if (k == end)
+	    return 1;
+    }
+
+    return is_option_set(conf->mask, OPTION_DIRS) && !conf->dirs_report && (1 == end - first);
+}
+
+/*
+ * Queue the files of vrun to be compared, split in parts if they are many
+ * and there are threads to compare them. The files alone in their run, and
+ * the ones whose twins were recorded by the first pass of --dirs, are not.
+ */
+static apr_status_t ft_conf_verify_run(ft_conf_t *conf, ft_verify_ctx_t *vctx, ft_verify_run_t *vrun)
+{
+    char errbuf[128];
+    ft_verify_part_t *parts, **todo;
+    apr_size_t i, nb_files = vrun->end - vrun->first;
+    apr_status_t status;
+
+    vrun->pool = NULL;
+    vrun->status = APR_SUCCESS;
+    vrun->deduped = -1;
+    vrun->done = 1;
+    if ((1 == nb_files) || (is_option_set(conf->mask, OPTION_DIRS) && conf->dirs_report))
+	return APR_SUCCESS;
+
+    if (APR_SUCCESS != (status = ft_job_pool_create(&(vrun->pool)))) {
+	DEBUG_ERR("error calling ft_job_pool_create: %s", apr_strerror(status, errbuf, 128));
+	vrun->pool = NULL;
+	return status;
+    }
+    vrun->twins = apr_palloc(vrun->pool, nb_files * sizeof(apr_size_t));
+    vrun->statuses = apr_palloc(vrun->pool, nb_files * sizeof(apr_status_t));
+    /* the kernel deduplicates a run against its first file, it is not split */
+    if ((NULL != conf->threadpool) && (NULL == conf->io.uring) && !is_option_set(conf->mask, OPTION_DEDUP))
+	vrun->nb_parts = (nb_files + FT_VERIFY_PART_LEN - 1) / FT_VERIFY_PART_LEN;
+    else
+	vrun->nb_parts = 1;
+    vrun->nb_left = vrun->nb_parts;
+    vrun->done = 0;
+    parts = apr_palloc(vrun->pool, vrun->nb_parts * sizeof(ft_verify_part_t));
+    todo = apr_palloc(vrun->pool, vrun->nb_parts * sizeof(ft_verify_part_t *));
+    for (i = 0; i < vrun->nb_parts; i++) {
+	parts[i].vrun = vrun;
+	parts[i].first = i * FT_VERIFY_PART_LEN;
+	parts[i].nb_files = (1 == vrun->nb_parts) ? nb_files : FTWIN_MIN(FT_VERIFY_PART_LEN, nb_files - parts[i].first);
+	todo[i] = &(parts[i]);
+    }
+
+    /* a ring is driven by this thread only */
+    if ((NULL == conf->threadpool) || (NULL != conf->io.uring))
+	return ft_verify_worker(vctx, todo[0]);
+
+    status = napr_threadpool_add_batch(conf->threadpool, (void *const *) todo, vrun->nb_parts, NULL);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling napr_threadpool_add_batch: %s", apr_strerror(status, errbuf, 128));
+	/* none of them was queued */
+	vrun->done = 1;
+    }
+
+    return status;
+}
+
+/*
+ * Report the groups of twins of vrun, once it is verified. Under --stream, a
+ * group is only reported again if it has a fresh file, after one of its files
+ * already reported if any, followed by the files not reported yet.
+ */
+static apr_status_t ft_conf_report_run(ft_conf_t *conf, ft_verify_run_t *vrun, apr_pool_t *gc_pool)
+{
+    char errbuf[128];
+    ft_fsize_t *fsize = vrun->fsize;
+    ft_chksum_t *run = fsize->chksum_array + vrun->first;
+    apr_size_t *twins = vrun->twins;
+    apr_status_t *statuses = vrun->statuses;
+    apr_size_t k, l, head, nb_files = vrun->end - vrun->first;
+    unsigned char already_printed, fresh;
+
+    /* alone, it can only be reported for its links */
+    if (1 == nb_files) {
+	if (!ft_file_is_collapsed(conf, run[0].file) && ft_file_has_listed_links(conf, run[0].file)) {
+	    ft_out_group(conf, "files", fsize->val, NULL);
+	    ft_report_file(conf, run[0].file);
+	    ft_out_group_end(conf);
+	    run[0].file->reported |= 0x1;
+	}
+	return APR_SUCCESS;
+    }
+
+    if (NULL == vrun->pool) {
+	twins = apr_palloc(gc_pool, nb_files * sizeof(apr_size_t));
+	statuses = apr_palloc(gc_pool, nb_files * sizeof(apr_status_t));
+	ft_run_recorded_twins(conf, run, nb_files, twins, statuses);
+    }
+    else {
+	if (APR_SUCCESS != vrun->status) {
+	    DEBUG_ERR("error calling ft_conf_cmp_run: %s", apr_strerror(vrun->status, errbuf, 128));
+	    return vrun->status;
+	}
+	if (0 <= vrun->deduped) {
+	    conf->deduped_bytes += vrun->deduped;
+	}
+	else if (NULL != conf->stats) {
+	    conf->stats->nb_runs++;
+	    conf->stats->nb_compared += nb_files;
+	    conf->stats->compared_bytes += nb_files * fsize->val;
+	}
+	/* the directories are digested from the contents of their files before anything is reported */
+	if (is_option_set(conf->mask, OPTION_DIRS)) {
+	    for (k = 0; k < nb_files; k++)
+		run[k].file->twin = (APR_SUCCESS == statuses[k]) ? run[twins[k]].file : NULL;
+	    return APR_SUCCESS;
+	}
+    }
+
+    for (k = 0; k < nb_files; k++) {
+	/*
+	 * no return status if != APR_SUCCESS , because : 
+	 * Fault-check has been removed in case files disappear
+	 * between collecting and comparing or special files (like
+	 * device or /proc) are tried to access
+	 */
+	if (APR_SUCCESS != statuses[k]) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "\nskipping %s comparison because: %s\n", ft_conf_file_path(conf, run[k].file),
+			apr_strerror(statuses[k], errbuf, 128));
+	    continue;
+	}
+	/* already reported as the twin of a previous file, or along with its directory */
+	if ((k != twins[k]) || ft_file_is_collapsed(conf, run[k].file))
+	    continue;
+
+	head = k;
+	if (0 != conf->stream_len) {
+	    for (l = k, fresh = 0, head = nb_files; l < nb_files; l++) {
+		if ((APR_SUCCESS != statuses[l]) || (k != twins[l]))
+		    continue;
+		if (run[l].file->fresh)
+		    fresh = 1;
+		if ((nb_files == head) && run[l].file->reported)
+		    head = l;
+	    }
+	    if (!fresh)
+		continue;
+	    if (nb_files == head)
+		head = k;
+	}
+
+	already_printed = 0;
+	/* the links of an inode are twins, even without another inode of the same content */
+	if (ft_file_has_listed_links(conf, run[head].file)) {
+	    ft_out_group(conf, "files", fsize->val, ft_fsize_is_hashed(conf, fsize) ? run[head].val_array : NULL);
+	    ft_report_file(conf, run[head].file);
+	    already_printed = 1;
+	}
+	for (l = k; l < nb_files; l++) {
+	    if ((l == head) || (APR_SUCCESS != statuses[l]) || (k != twins[l]))
+		continue;
+	    if (run[l].file->reported && !run[l].file->fresh)
+		continue;
+	    if (!already_printed) {
+		ft_out_group(conf, "files", fsize->val,
+			     ft_fsize_is_hashed(conf, fsize) ? run[head].val_array : NULL);
+		ft_report_file(conf, run[head].file);
+		already_printed = 1;
+	    }
+	    ft_report_file(conf, run[l].file);
+	    run[l].file->reported |= 0x1;
+	}
+	if (already_printed) {
+	    ft_out_group_end(conf);
+	    run[head].file->reported |= 0x1;
+	}
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Verify and report each run of files sharing a digest, a size after the
+ * other. The threads verify the runs ahead while this one reports them in
+ * order, keeping the output as deterministic as without threads.
+ */
+static apr_status_t ft_conf_twin_report(ft_conf_t *conf)
+{
+    char errbuf[128];
+    ft_verify_ctx_t vctx;
+    ft_verify_run_t *ring, *vrun;
+    ft_fsize_t *fsize;
+    apr_pool_t *gc_pool, *run_pool;
+    apr_size_t i, j, k, nb_ring, head, nb_queued;
+    apr_status_t status, rv;
+    apr_uint32_t chksum_array_sz = 0U;
+    int phase;
+
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, (is_option_set(conf->mask, OPTION_DIRS) && !conf->dirs_report) ? "Verifying duplicate files:\n"
+		: "Reporting duplicate files:\n");
+    phase = ft_stats_phase(conf, FT_PHASE_VERIFY);
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    vctx.conf = conf;
+    if ((APR_SUCCESS != (status = apr_pool_create(&run_pool, gc_pool)))
+	|| (APR_SUCCESS != (status = apr_thread_mutex_create(&(vctx.mutex), APR_THREAD_MUTEX_DEFAULT, gc_pool)))
+	|| (APR_SUCCESS != (status = apr_thread_cond_create(&(vctx.cond), gc_pool)))) {
+	DEBUG_ERR("error calling apr_thread_cond_create: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    nb_ring = 1;
+    if ((NULL != conf->threadpool) && (NULL == conf->io.uring)) {
+	nb_ring = FT_VERIFY_AHEAD * conf->nb_worker;
+	napr_threadpool_set_process(conf->threadpool, &vctx, ft_verify_worker);
+    }
+    ring = apr_palloc(gc_pool, nb_ring * sizeof(ft_verify_run_t));
+
+    /* each size is a contiguous run of files, the runs queued are reported in the order they were queued */
+    head = nb_queued = i = 0;
+    for (k = 0; ((k < conf->nb_fsizes) && (APR_SUCCESS == status)) || (0 < nb_queued);) {
+	while ((nb_queued < nb_ring) && (k < conf->nb_fsizes) && (APR_SUCCESS == status)) {
+	    fsize = &(conf->fsizes[k]);
+	    if (0 == i) {
+		chksum_array_sz = FTWIN_MIN(fsize->nb_files, fsize->nb_checksumed);
+		qsort(fsize->chksum_array, chksum_array_sz, sizeof(ft_chksum_t), chksum_cmp);
+	    }
+	    if (i >= chksum_array_sz) {
+		k++;
+		i = 0;
+		continue;
+	    }
+	    /* hash are ordered, each run of equal ones is verified in a single pass */
+	    for (j = i + 1; (j < chksum_array_sz) && (0 == chksum_val_cmp(fsize->chksum_array + i,
+									  fsize->chksum_array + j)); j++);
+	    vrun = &(ring[(head + nb_queued) % nb_ring]);
+	    vrun->fsize = fsize;
+	    vrun->first = i;
+	    vrun->end = j;
+	    i = j;
+	    if (ft_conf_run_is_done(conf, fsize, vrun->first, vrun->end))
+		continue;
+	    nb_queued++;
+	    status = ft_conf_verify_run(conf, &vctx, vrun);
+	}
+	if (0 == nb_queued)
+	    continue;
+
+	vrun = &(ring[head]);
+	if (APR_SUCCESS == (rv = apr_thread_mutex_lock(vctx.mutex))) {
+	    while (!vrun->done)
+		apr_thread_cond_wait(vctx.cond, vctx.mutex);
+	    apr_thread_mutex_unlock(vctx.mutex);
+	}
+	else {
+	    DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(rv, errbuf, 128));
+	    if (APR_SUCCESS == status)
+		status = rv;
+	    /* the pool of the run is only released once no worker uses it */
+	    if ((1 < nb_ring) && (APR_SUCCESS != (rv = napr_threadpool_wait(conf->threadpool))))
+		DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(rv, errbuf, 128));
+	}
+	/* once an error occurred, the runs queued are only drained */
+	if (APR_SUCCESS == status)
+	    status = ft_conf_report_run(conf, vrun, run_pool);
+	apr_pool_clear(run_pool);
+	if (NULL != vrun->pool)
+	    apr_pool_destroy(vrun->pool);
+	head = (head + 1) % nb_ring;
+	nb_queued--;
+    }
+    if ((1 < nb_ring) && (APR_SUCCESS != (rv = napr_threadpool_wait(conf->threadpool)))) {
+	DEBUG_ERR("error calling napr_threadpool_wait: %s", apr_strerror(rv, errbuf, 128));
+	if (APR_SUCCESS == status)
+	    status = rv;
+    }
+    apr_pool_destroy(gc_pool);
+    if (APR_SUCCESS != status)
+	return status;
+    ft_out_flush(conf);
+    ft_stats_phase(conf, phase);
+    if (is_option_set(conf->mask, OPTION_VERBO) && is_option_set(conf->mask, OPTION_DEDUP))
+	fprintf(stderr, "%" APR_OFF_T_FMT " bytes deduplicated by the kernel\n", conf->deduped_bytes);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * --export: write a record per path of the files hashed, the largest first,
+ * with the digests of the stages they went through, see ft_index.h. The
+ * hardlinks and the clones of a file share its digests.
+ */
+static apr_status_t ft_conf_export_sizes(ft_conf_t *conf)
+{
+    char errbuf[128];
+    ft_index_rec_t rec;
     ft_fsize_t *fsize;
-    napr_heap_t *tmp_heap;
+    ft_file_t *file, *clone, *link;
+    apr_size_t i, k;
+    apr_status_t status;
+    int stage;
+
+    for (k = 0; k < conf->nb_fsizes; k++) {
+	fsize = &(conf->fsizes[k]);
+	for (i = 0; i < fsize->nb_checksumed; i++) {
+	    file = fsize->chksum_array[i].file;
+	    memset(&rec, 0, sizeof(rec));
+	    rec.size = file->size;
+	    rec.mtime = file->mtime;
+	    for (stage = FT_STAGE_HEAD; stage < FT_STAGE_NB; stage++) {
+		if (0 == ft_stage_len(conf, stage, file->size))
+		    continue;
+#if HAVE_ARCHIVE
+		if (NULL != file->subpath) {
+		    memcpy(rec.digests[stage], file->ar_digests + stage * HASHSTATE, sizeof(rec.digests[stage]));
+		    rec.mask |= 1U << stage;
+		    continue;
+		}
+#endif
+		if ((NULL != file->cache_rec) && ft_cache_get(conf->cache, file->cache_rec, stage, rec.digests[stage]))
+		    rec.mask |= 1U << stage;
+	    }
+#if HAVE_ARCHIVE
+	    rec.subpath = file->subpath;
+#endif
+	    for (clone = file; NULL != clone; clone = clone->clones) {
+		for (link = clone; NULL != link; link = is_option_set(conf->mask, OPTION_HLINK) ? NULL : link->links) {
+		    rec.path = ft_conf_file_path(conf, link);
+		    if (APR_SUCCESS != (status = ft_index_write(conf->index, &rec))) {
+			DEBUG_ERR("error calling ft_index_write: %s", apr_strerror(status, errbuf, 128));
+			return status;
+		    }
+		}
+	    }
+	}
+    }
+
+    return APR_SUCCESS;
+}
+
+/* --export the sizes left and close the index, the batches of --mem-limit export their own sizes */
+static apr_status_t ft_conf_export(ft_conf_t *conf)
+{
+    char errbuf[128];
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = ft_conf_export_sizes(conf)))
+	return status;
+    if (APR_SUCCESS != (status = ft_index_close(conf->index))) {
+	DEBUG_ERR("error calling ft_index_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, "%" APR_UINT64_T_FMT " paths exported\n", ft_index_nb_recs(conf->index));
+
+    return APR_SUCCESS;
+}
+
+/* an index merged by --merge, its next record read ahead */
+typedef struct ft_merge_src_t
+{
+    ft_index_t *index;
+    ft_index_rec_t rec;
+} ft_merge_src_t;
+
+/* a path of the size being merged */
+typedef struct ft_merge_rec_t
+{
+    apr_uint32_t digest[HASHSTATE];	/* of the last stage, that tells the content apart */
+    const char *host;
+    char *path;
+    char *subpath;
+    int gone;			/* changed since exported, see ft_merge_verify */
+} ft_merge_rec_t;
+
+/* the largest size first */
+static int ft_merge_src_cmp(const void *param1, const void *param2)
+{
+    const ft_merge_src_t *src1 = param1;
+    const ft_merge_src_t *src2 = param2;
+
+    if (src1->rec.size != src2->rec.size)
+	return (src1->rec.size < src2->rec.size) ? -1 : 1;
+
+    return 0;
+}
+
+static int ft_merge_rec_cmp(const void *param1, const void *param2)
+{
+    const ft_merge_rec_t *rec1 = param1;
+    const ft_merge_rec_t *rec2 = param2;
+    int rv;
+
+    if (0 != (rv = memcmp(rec1->digest, rec2->digest, sizeof(rec1->digest))))
+	return rv;
+    if (0 != (rv = strcmp(rec1->host, rec2->host)))
+	return rv;
+
+    return strcmp(rec1->path, rec2->path);
+}
+
+/* number of hosts of recs[first .. end - 1], sorted by host, the paths gone left out */
+static apr_size_t ft_merge_nb_hosts(const ft_merge_rec_t *recs, apr_size_t first, apr_size_t end)
+{
+    const char *host = NULL;
+    apr_size_t i, nb_hosts = 0;
+
+    for (i = first; i < end; i++) {
+	if (recs[i].gone)
+	    continue;
+	if ((NULL == host) || strcmp(host, recs[i].host))
+	    nb_hosts++;
+	host = recs[i].host;
+    }
+
+    return nb_hosts;
+}
+
+/*
+ * --verify: hash again a file of this host, the same way the stages did, a
+ * plain file of more than two blocks being fully hashed, and tell whether its
+ * content is still the one exported. The members of archives are trusted.
+ */
+static int ft_merge_verify(ft_conf_t *conf, const ft_merge_rec_t *mrec, apr_off_t size, apr_pool_t *gc_pool)
+{
+    ft_chksum_t chksum;
+    ft_file_t file;
+    apr_finfo_t finfo;
+    int stage, round;
+
+    if (NULL != mrec->subpath)
+	return 1;
+    if ((APR_SUCCESS != apr_stat(&finfo, mrec->path, APR_FINFO_SIZE, gc_pool)) || (finfo.size != size))
+	return 0;
+
+    memset(&file, 0, sizeof(file));
+    file.path = mrec->path;
+    file.size = size;
+    chksum.file = &file;
+    for (stage = FT_STAGE_HEAD; stage < FT_STAGE_NB; stage++) {
+	if ((0 == ft_stage_len(conf, stage, size)) || (FT_STAGE_SAMPLES == stage)
+	    || ((FT_STAGE_FULL != stage) && (0 != ft_stage_len(conf, FT_STAGE_FULL, size))))
+	    continue;
+	for (round = 0; 0 != ft_round_len(conf, stage, round, size); round++) {
+	    ft_conf_chksum_file(conf, stage, round, &chksum, gc_pool);
+	    if (NULL == chksum.file)
+		return 0;
+	}
+    }
+    if (0 == size)
+	memset(chksum.val_array, 0, sizeof(chksum.val_array));
+
+    return 0 == memcmp(chksum.val_array, mrec->digest, sizeof(chksum.val_array));
+}
+
+/*
+ * Report the paths of recs sharing the same content on several hosts, under
+ * --verify once the ones of this host (localhost, NULL without --verify) that
+ * changed since exported are left out.
+ */
+static void ft_merge_report_size(ft_conf_t *conf, apr_off_t size, ft_merge_rec_t *recs, apr_size_t nb_recs,
+				 const char *localhost, apr_pool_t *gc_pool)
+{
+    const char *path;
+    apr_size_t i, j, k;
+
+    qsort(recs, nb_recs, sizeof(ft_merge_rec_t), ft_merge_rec_cmp);
+    for (i = 0; i < nb_recs; i = j) {
+	for (j = i + 1; (j < nb_recs) && (0 == memcmp(recs[i].digest, recs[j].digest, sizeof(recs[i].digest))); j++);
+	if (2 > ft_merge_nb_hosts(recs, i, j))
+	    continue;
+	if (NULL != localhost) {
+	    for (k = i; k < j; k++) {
+		if (strcmp(recs[k].host, localhost) || ft_merge_verify(conf, &(recs[k]), size, gc_pool))
+		    continue;
+		recs[k].gone = 1;
+		if (is_option_set(conf->mask, OPTION_VERBO))
+		    fprintf(stderr, "\n%s changed since exported\n", recs[k].path);
+	    }
+	    if (2 > ft_merge_nb_hosts(recs, i, j))
+		continue;
+	}
+	ft_out_group(conf, "files", size, recs[i].digest);
+	for (k = i; k < j; k++) {
+	    if (recs[k].gone)
+		continue;
+	    path = apr_pstrcat(gc_pool, recs[k].host, ":", recs[k].path, NULL);
+	    ft_out_path(conf, path, recs[k].subpath, "", ft_conf_is_prioritized(conf, recs[k].path));
+	}
+	ft_out_group_end(conf);
+    }
+}
+
+/*
+ * --merge: the indexes exported by several hosts are merged as streams, the
+ * largest size first, only the records of a single size being held at once,
+ * and the contents found on several hosts are reported. The indexes must
+ * have been exported with the same hash.
+ */
+static apr_status_t ft_conf_merge(ft_conf_t *conf, const char *const *paths, int nb_paths, int verify)
+{
+    char errbuf[128];
+    char localhost[APRMAXHOSTLEN + 1];
+    ft_merge_src_t *srcs, *src;
+    ft_merge_rec_t *mrec;
+    apr_array_header_t *recs;
+    napr_heap_t *heap;
+    apr_pool_t *gc_pool;
+    apr_off_t size;
+    apr_status_t status;
+    apr_int32_t slot;
+    int i;
+
+    if (verify && (APR_SUCCESS != (status = apr_gethostname(localhost, sizeof(localhost), conf->pool)))) {
+	DEBUG_ERR("error calling apr_gethostname: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (NULL == (heap = napr_heap_make(conf->pool, ft_merge_src_cmp))) {
+	DEBUG_ERR("error calling napr_heap_make");
+	return APR_ENOMEM;
+    }
+    srcs = apr_pcalloc(conf->pool, nb_paths * sizeof(ft_merge_src_t));
+    for (i = 0; i < nb_paths; i++) {
+	src = &(srcs[i]);
+	if (APR_SUCCESS != (status = ft_index_open(&(src->index), paths[i], conf->pool))) {
+	    DEBUG_ERR("error calling ft_index_open: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	if ((0 != i) && strcmp(ft_index_hash_name(srcs[0].index), ft_index_hash_name(src->index))) {
+	    DEBUG_ERR("%s and %s were exported with distinct hashes", paths[0], paths[i]);
+	    return APR_EINVAL;
+	}
+	if (is_option_set(conf->mask, OPTION_VERBO))
+	    fprintf(stderr, "Index %s of %s: %" APR_UINT64_T_FMT " paths\n", paths[i], ft_index_host(src->index),
+		    ft_index_nb_recs(src->index));
+	status = ft_index_read(src->index, &(src->rec));
+	if (APR_SUCCESS == status)
+	    napr_heap_insert(heap, src);
+	else if (!APR_STATUS_IS_EOF(status))
+	    return status;
+    }
+    /* the digests are hashed again and reported with the hash of the indexes */
+    if ((0 < nb_paths) && (NULL == (conf->hash = ft_hash_get(ft_index_hash_name(srcs[0].index))))) {
+	DEBUG_ERR("unknown hash %s in %s", ft_index_hash_name(srcs[0].index), paths[0]);
+	return APR_EINVAL;
+    }
+
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    recs = apr_array_make(conf->pool, 64, sizeof(ft_merge_rec_t));
+    while (NULL != (src = napr_heap_extract(heap))) {
+	size = src->rec.size;
+	recs->nelts = 0;
+	/* the records of this size, from each index having some */
+	for (;;) {
+	    do {
+		mrec = apr_array_push(recs);
+		for (slot = FT_INDEX_MAX_SLOTS - 1; (0 <= slot) && !(src->rec.mask & (1U << slot)); slot--);
+		if (0 <= slot)
+		    memcpy(mrec->digest, src->rec.digests[slot], sizeof(mrec->digest));
+		else
+		    memset(mrec->digest, 0, sizeof(mrec->digest));
+		mrec->host = ft_index_host(src->index);
+		mrec->path = apr_pstrdup(gc_pool, src->rec.path);
+		mrec->subpath = (NULL != src->rec.subpath) ? apr_pstrdup(gc_pool, src->rec.subpath) : NULL;
+		mrec->gone = 0;
+	    } while ((APR_SUCCESS == (status = ft_index_read(src->index, &(src->rec)))) && (size == src->rec.size));
+	    if (APR_SUCCESS == status) {
+		napr_heap_insert(heap, src);
+	    }
+	    else if (!APR_STATUS_IS_EOF(status)) {
+		apr_pool_destroy(gc_pool);
+		return status;
+	    }
+	    if ((NULL == (src = napr_heap_get_nth(heap, 0))) || (size != src->rec.size))
+		break;
+	    napr_heap_extract(heap);
+	}
+	ft_merge_report_size(conf, size, (ft_merge_rec_t *) recs->elts, recs->nelts, verify ? localhost : NULL,
+			     gc_pool);
+	apr_pool_clear(gc_pool);
+    }
+    apr_pool_destroy(gc_pool);
+    ft_out_flush(conf);
+
+    return APR_SUCCESS;
+}
+
+/* the name of file in its directory, file->parent being set */
+static const char *ft_file_name(const ft_file_t *file)
+{
+    return (NULL == file->dir) ? strrchr(file->path, '/') + 1 : file->path;
+}
+
+/* the first file verified of the content of file, itself if it has no twin */
+static const ft_file_t *ft_file_content(const ft_file_t *file)
+{
+    return (NULL != file->twin) ? file->twin : file;
+}
+
+static int ft_dirsum_depth_cmp(const void *param1, const void *param2)
+{
+    const ft_dirsum_t *sum1 = param1;
+    const ft_dirsum_t *sum2 = param2;
+
+    return (sum1->depth < sum2->depth) ? -1 : ((sum2->depth < sum1->depth) ? 1 : 0);
+}
+
+static int ft_dirent_cmp(const void *param1, const void *param2)
+{
+    const ft_dirent_t *dirent1 = param1;
+    const ft_dirent_t *dirent2 = param2;
+    int rv;
+
+    if (0 != (rv = strcmp(dirent1->name, dirent2->name)))
+	return rv;
+    /* the members of an archive follow each other */
+    if ((NULL == dirent1->subpath) || (NULL == dirent2->subpath))
+	return (NULL != dirent1->subpath) - (NULL != dirent2->subpath);
+
+    return strcmp(dirent1->subpath, dirent2->subpath);
+}
+
+static int ft_dirsum_digest_cmp(const void *param1, const void *param2)
+{
+    const ft_dirsum_t *sum1 = *(ft_dirsum_t * const *) param1;
+    const ft_dirsum_t *sum2 = *(ft_dirsum_t * const *) param2;
+
+    return memcmp(sum1->digest, sum2->digest, HASHSTATE * sizeof(apr_uint32_t));
+}
+
+/*
+ * Under --dirs, sum up the directories browsed once the walk is over: each one
+ * gets its entries, the files (hardlinks included) and subdirectories found
+ * in it, sorted by name, and the number and size of the files below it.
+ */
+static void ft_conf_dirs_make(ft_conf_t *conf)
+{
+    ft_dirsum_t *sum;
+    ft_dirent_t *dirent;
+    const ft_dir_t *dir;
+    ft_file_t *file, *link;
+    apr_size_t i, j, nb_dirsums;
+    int k;
+
+    nb_dirsums = conf->nb_dirsums = conf->dirs->nelts;
+    conf->dirsums = apr_palloc(conf->pool, (nb_dirsums ? nb_dirsums : 1) * sizeof(struct ft_dirsum_t));
+    for (i = 0; i < nb_dirsums; i++) {
+	sum = &(conf->dirsums[i]);
+	sum->dir = APR_ARRAY_IDX(conf->dirs, i, ft_dir_t *);
+	for (sum->depth = 0, dir = sum->dir->parent; NULL != dir; dir = dir->parent)
+	    sum->depth++;
+	sum->path = NULL;
+	sum->nb_entries = 0;
+	sum->nb_files = 0;
+	sum->size = 0;
+	sum->shown = NULL;
+	sum->nb_shown = 0;
+	sum->matched &= 0x0;
+	sum->collapsed &= 0x0;
+    }
+    /* a directory is summed up after its subdirectories when the array is read backward */
+    qsort(conf->dirsums, nb_dirsums, sizeof(struct ft_dirsum_t), ft_dirsum_depth_cmp);
+    for (i = 0; i < nb_dirsums; i++) {
+	conf->dirsums[i].dir->sum = &(conf->dirsums[i]);
+	conf->dirsums[i].rep = &(conf->dirsums[i]);
+    }
+
+    /* count the entries of each directory, then fill them in place */
+    conf->nb_dirents = 0;
+    for (k = 0; k < conf->files->nelts; k++) {
+	for (link = APR_ARRAY_IDX(conf->files, k, ft_file_t *); NULL != link; link = link->links) {
+	    if ((NULL != link->parent) && (NULL != link->parent->sum)) {
+		link->parent->sum->nb_entries++;
+		conf->nb_dirents++;
+	    }
+	}
+    }
+    for (i = 0; i < nb_dirsums; i++) {
+	if ((NULL != (dir = conf->dirsums[i].dir->parent)) && (NULL != dir->sum)) {
+	    dir->sum->nb_entries++;
+	    conf->nb_dirents++;
+	}
+    }
+    conf->dirents = apr_palloc(conf->pool, (conf->nb_dirents ? conf->nb_dirents : 1) * sizeof(struct ft_dirent_t));
+    for (i = 0, j = 0; i < nb_dirsums; i++) {
+	conf->dirsums[i].first_entry = j;
+	j += conf->dirsums[i].nb_entries;
+	conf->dirsums[i].nb_entries = 0;
+    }
+    for (k = 0; k < conf->files->nelts; k++) {
+	file = APR_ARRAY_IDX(conf->files, k, ft_file_t *);
+	for (link = file; NULL != link; link = link->links) {
+	    if ((NULL == link->parent) || (NULL == (sum = link->parent->sum)))
+		continue;
+	    dirent = &(conf->dirents[sum->first_entry + sum->nb_entries++]);
+	    dirent->parent = sum;
+	    dirent->name = ft_file_name(link);
+#if HAVE_ARCHIVE
+	    dirent->subpath = link->subpath;
+#else
+	    dirent->subpath = NULL;
+#endif
+	    dirent->file = file;
+	    dirent->sub = NULL;
+	}
+    }
+    for (i = 0; i < nb_dirsums; i++) {
+	if ((NULL == (dir = conf->dirsums[i].dir->parent)) || (NULL == (sum = dir->sum)))
+	    continue;
+	dirent = &(conf->dirents[sum->first_entry + sum->nb_entries++]);
+	dirent->parent = sum;
+	dir = conf->dirsums[i].dir;
+	dirent->name = dir->named ? dir->path : strrchr(dir->path, '/') + 1;
+	dirent->subpath = NULL;
+	dirent->file = NULL;
+	dirent->sub = &(conf->dirsums[i]);
+    }
+
+    for (i = nb_dirsums; 0 < i; i--) {
+	sum = &(conf->dirsums[i - 1]);
+	dirent = &(conf->dirents[sum->first_entry]);
+	qsort(dirent, sum->nb_entries, sizeof(struct ft_dirent_t), ft_dirent_cmp);
+	for (j = 0; j < sum->nb_entries; j++) {
+	    if (NULL != dirent[j].file) {
+		sum->nb_files++;
+		sum->size += dirent[j].file->size;
+	    }
+	    else {
+		sum->nb_files += dirent[j].sub->nb_files;
+		sum->size += dirent[j].sub->size;
+	    }
+	}
+    }
+}
+
+/*
+ * Digest the entries of sum, each one by its kind, its name and what content
+ * tells: the first file verified of its content or the first directory of
+ * its content for the digest of ft_conf_dirs_report, its size or the digest
+ * of the subdirectory for the one of ft_conf_dirs_prune.
+ */
+static void ft_dirsum_digest(const ft_conf_t *conf, ft_dirsum_t *sum, int by_content)
+{
+    const ft_dirent_t *dirent;
+    ft_hash_state_t state;
+    const void *content;
+    apr_size_t j;
+    unsigned char kind;
+
+    ft_hash_init(conf->hash, &state);
+    for (j = 0; j < sum->nb_entries; j++) {
+	dirent = &(conf->dirents[sum->first_entry + j]);
+	kind = (NULL != dirent->sub) ? 'd' : ((NULL != dirent->subpath) ? 'm' : 'f');
+	ft_hash_update(conf->hash, &state, &kind, 1);
+	ft_hash_update(conf->hash, &state, (const unsigned char *) dirent->name, strlen(dirent->name) + 1);
+	if (NULL != dirent->subpath)
+	    ft_hash_update(conf->hash, &state, (const unsigned char *) dirent->subpath, strlen(dirent->subpath) + 1);
+	if (by_content) {
+	    if (NULL != dirent->sub)
+		content = dirent->sub->rep;
+	    else
+		content = ft_file_content(dirent->file);
+	    ft_hash_update(conf->hash, &state, (const unsigned char *) &content, sizeof(content));
+	}
+	else if (NULL != dirent->sub) {
+	    ft_hash_update(conf->hash, &state, (const unsigned char *) dirent->sub->digest,
+			   HASHSTATE * sizeof(apr_uint32_t));
+	}
+	else {
+	    ft_hash_update(conf->hash, &state, (const unsigned char *) &(dirent->file->size), sizeof(apr_off_t));
+	}
+    }
+    ft_hash_final(conf->hash, &state, sum->digest);
+}
+
+/* have the directories the same entries, of the same contents, their subdirectories being resolved */
+static int ft_dirsum_is_same(const ft_conf_t *conf, const ft_dirsum_t *sum1, const ft_dirsum_t *sum2)
+{
+    const ft_dirent_t *dirent1, *dirent2;
+    apr_size_t j;
+
+    if ((sum1->nb_entries != sum2->nb_entries) || (sum1->size != sum2->size))
+	return 0;
+    for (j = 0; j < sum1->nb_entries; j++) {
+	dirent1 = &(conf->dirents[sum1->first_entry + j]);
+	dirent2 = &(conf->dirents[sum2->first_entry + j]);
+	if (0 != ft_dirent_cmp(dirent1, dirent2))
+	    return 0;
+	if ((NULL != dirent1->sub) || (NULL != dirent2->sub)) {
+	    if ((NULL == dirent1->sub) || (NULL == dirent2->sub) || (dirent1->sub->rep != dirent2->sub->rep))
+		return 0;
+	}
+	else if (ft_file_content(dirent1->file) != ft_file_content(dirent2->file)) {
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * Under --dirs-only, only the directories are reported, and a directory can
+ * only have a twin if another one has entries of the same names and sizes,
+ * recursively: the files that are not in such a directory are not hashed.
+ */
+static void ft_conf_dirs_prune(ft_conf_t *conf)
+{
+    ft_dirsum_t **sorted;
+    ft_file_t *file, *link;
+    apr_size_t i, j, nb_pruned;
+    int k, l;
+
+    for (i = conf->nb_dirsums; 0 < i; i--)
+	ft_dirsum_digest(conf, &(conf->dirsums[i - 1]), 0);
+    sorted = apr_palloc(conf->pool, (conf->nb_dirsums ? conf->nb_dirsums : 1) * sizeof(ft_dirsum_t *));
+    for (i = 0; i < conf->nb_dirsums; i++)
+	sorted[i] = &(conf->dirsums[i]);
+    qsort(sorted, conf->nb_dirsums, sizeof(ft_dirsum_t *), ft_dirsum_digest_cmp);
+    for (i = 0; i < conf->nb_dirsums; i = j) {
+	for (j = i + 1; (j < conf->nb_dirsums) && (0 == ft_dirsum_digest_cmp(&(sorted[i]), &(sorted[j]))); j++);
+	if (1 < j - i)
+	    for (; i < j; i++)
+		sorted[i]->matched |= 0x1;
+    }
+
+    /* a file is kept if one of its paths is in a matched directory */
+    for (k = 0, l = 0, nb_pruned = 0; k < conf->files->nelts; k++) {
+	file = APR_ARRAY_IDX(conf->files, k, ft_file_t *);
+	for (link = file; NULL != link; link = link->links)
+	    if ((NULL != link->parent) && (NULL != link->parent->sum) && link->parent->sum->matched)
+		break;
+	if (NULL == link) {
+	    nb_pruned++;
+	    continue;
+	}
+	APR_ARRAY_IDX(conf->files, l++, ft_file_t *) = file;
+    }
+    conf->files->nelts = l;
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, "%" APR_SIZE_T_FMT " files are in directories without a twin of the same names and sizes,"
+		" they won't be read\n", nb_pruned);
+}
+
+static int ft_dirsum_shown_cmp(const void *param1, const void *param2)
+{
+    const ft_dirsum_t *sum1 = *(ft_dirsum_t * const *) param1;
+    const ft_dirsum_t *sum2 = *(ft_dirsum_t * const *) param2;
+
+    /* the largest first, as the files are, each content after the other, the shallowest first */
+    if (sum1->size != sum2->size)
+	return (sum1->size > sum2->size) ? -1 : 1;
+    if (sum1->rep != sum2->rep)
+	return (sum1->rep < sum2->rep) ? -1 : 1;
+
+    return (sum1 < sum2) ? -1 : ((sum2 < sum1) ? 1 : 0);
+}
+
+/*
+ * Under --dirs, once the twins of the files are verified, digest the content
+ * of the directories bottom-up so that each one gets the first directory of
+ * its content, and report the identical directories: a directory is only
+ * reported at the highest level, the ones below a directory reported as the
+ * twin of another one, and their files, are collapsed in it.
+ */
+static apr_status_t ft_conf_dirs_report(ft_conf_t *conf)
+{
+    char errbuf[128];
+    napr_inthash_t *reps;
+    ft_dirsum_t *sum, *rep, **shown;
+    apr_uint64_t key1, key2;
+    apr_size_t i, j, nb_shown, nb_groups;
     apr_pool_t *gc_pool;
-    apr_uint32_t hash_value;
     apr_status_t status;
-    apr_size_t nb_processed, nb_files;
 
+    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (NULL == (reps = napr_inthash_make(gc_pool, conf->nb_dirsums))) {
+	apr_pool_destroy(gc_pool);
+	return APR_ENOMEM;
+    }
+    /* the subdirectories first, so that their own first directory is known */
+    for (i = conf->nb_dirsums; 0 < i; i--) {
+	sum = &(conf->dirsums[i - 1]);
+	ft_dirsum_digest(conf, sum, 1);
+	key1 = ((apr_uint64_t) sum->digest[0] << 32) | sum->digest[1];
+	key2 = ((apr_uint64_t) sum->digest[2] << 32) | sum->digest[3];
+	if (NULL == (rep = napr_inthash_get(reps, key1, key2))) {
+	    if (APR_SUCCESS != (status = napr_inthash_set(reps, key1, key2, sum))) {
+		DEBUG_ERR("error calling napr_inthash_set: %s", apr_strerror(status, errbuf, 128));
+		apr_pool_destroy(gc_pool);
+		return status;
+	    }
+	}
+	else if (ft_dirsum_is_same(conf, rep, sum)) {
+	    sum->rep = rep;
+	}
+    }
+
+    /* the shallowest first, a directory with files is shown unless it is below a collapsed one */
+    shown = apr_palloc(gc_pool, (conf->nb_dirsums ? conf->nb_dirsums : 1) * sizeof(ft_dirsum_t *));
+    for (i = 0, nb_shown = 0; i < conf->nb_dirsums; i++) {
+	sum = &(conf->dirsums[i]);
+	if ((NULL != sum->dir->parent) && (NULL != sum->dir->parent->sum) && sum->dir->parent->sum->collapsed) {
+	    sum->collapsed |= 0x1;
+	    continue;
+	}
+	if (0 == sum->nb_files)
+	    continue;
+	rep = sum->rep;
+	if (NULL == rep->shown)
+	    rep->shown = sum;
+	else
+	    sum->collapsed |= 0x1;
+	rep->nb_shown++;
+	shown[nb_shown++] = sum;
+    }
+    qsort(shown, nb_shown, sizeof(ft_dirsum_t *), ft_dirsum_shown_cmp);
+
+    for (i = 0, nb_groups = 0; i < nb_shown; i = j) {
+	for (j = i + 1; (j < nb_shown) && (shown[j]->rep == shown[i]->rep); j++);
+	if (1 == j - i)
+	    continue;
+	ft_out_group(conf, "dirs", shown[i]->size, shown[i]->rep->digest);
+	for (; i < j; i++) {
+	    ft_dir_path_buf(shown[i]->dir, &(conf->path_buf), &(conf->path_size), conf->pool);
+	    ft_out_path(conf, conf->path_buf, NULL, ft_dir_needs_sep(shown[i]->dir) ? "/" : "",
+			ft_conf_is_prioritized(conf, conf->path_buf));
+	}
+	ft_out_group_end(conf);
+	nb_groups++;
+    }
+    ft_out_flush(conf);
     if (is_option_set(conf->mask, OPTION_VERBO))
-	fprintf(stderr, "Referencing files and sizes:\n");
+	fprintf(stderr, "%" APR_SIZE_T_FMT " groups of identical directories reported\n", nb_groups);
+    apr_pool_destroy(gc_pool);
+
+    return APR_SUCCESS;
+}
+
+/* Hash and report the sizes of the files referenced since the previous round of --stream */
+static apr_status_t ft_conf_stream_round(ft_conf_t *conf)
+{
+    char errbuf[128];
+    apr_pool_t *gc_pool;
+    apr_status_t status;
+    int i;
 
     if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
 	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
-	apr_terminate();
-	return -1;
+	return status;
     }
-    nb_processed = 0;
-    nb_files = napr_heap_size(conf->heap);
-
-    tmp_heap = napr_heap_make(conf->pool, ft_file_cmp);
-    while (NULL != (file = napr_heap_extract(conf->heap))) {
-	if (NULL != (fsize = napr_hash_search(conf->sizes, &file->size, 1, &hash_value))) {
-	    /* More than two files, we will need to checksum because :
-	     * - 1 file of a size means no twin.
-	     * - 2 files of a size means that anyway we must read the both, so
-	     *   we will probably cmp them at that time instead of running CPU
-	     *   intensive function like checksum.
-	     */
-	    if (1 == fsize->nb_files) {
-		/* No twin possible, remove the entry */
-		/*DEBUG_DBG("only one file of size %"APR_OFF_T_FMT, fsize->val); */
-		napr_hash_remove(conf->sizes, fsize, hash_value);
-	    }
-	    else {
-		if (NULL == fsize->chksum_array)
-		    fsize->chksum_array = apr_palloc(conf->pool, fsize->nb_files * sizeof(struct ft_chksum_t));
-
-		fsize->chksum_array[fsize->nb_checksumed].file = file;
-		/* no multiple check, just a memcmp will be needed, don't call checksum on 0-length file too */
-		if ((2 == fsize->nb_files) || (0 == fsize->val)) {
-		    /*DEBUG_DBG("two files of size %"APR_OFF_T_FMT, fsize->val); */
-		    memset(fsize->chksum_array[fsize->nb_checksumed].val_array, 0, HASHSTATE * sizeof(apr_int32_t));
-		}
-		else {
-		    char *filepath;
+    if (APR_SUCCESS != (status = ft_conf_process_sizes(conf, gc_pool))) {
+	DEBUG_ERR("error calling ft_conf_process_sizes: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    if (APR_SUCCESS != (status = ft_conf_twin_report(conf))) {
+	DEBUG_ERR("error calling ft_conf_twin_report: %s", apr_strerror(status, errbuf, 128));
+	apr_pool_destroy(gc_pool);
+	return status;
+    }
+    apr_pool_destroy(gc_pool);
+    conf->fsizes = NULL;
+    conf->nb_fsizes = 0;
+
+    for (i = 0; i < conf->files->nelts; i++)
+	APR_ARRAY_IDX(conf->files, i, ft_file_t *)->fresh &= 0x0;
+
+    return APR_SUCCESS;
+}
+
+/* bytes held by a file of a batch of --mem-limit, its name aside, the tables of its batch included */
+#define FT_BATCH_FILE_LEN (sizeof(struct ft_file_t) + sizeof(ft_chksum_t) + 4 * sizeof(napr_radix_pair_t))
+
+/* the largest first */
+static int ft_file_size_cmp(const void *param1, const void *param2)
+{
+    const ft_file_t *file1 = *(ft_file_t * const *) param1;
+    const ft_file_t *file2 = *(ft_file_t * const *) param2;
+
+    return (file1->size < file2->size) ? 1 : ((file2->size < file1->size) ? -1 : 0);
+}
+
+/* reference the file of a record read back from the runs of --mem-limit */
+static void ft_conf_add_spilled(ft_conf_t *conf, const ft_spill_rec_t *rec, apr_pool_t *pool)
+{
+    ft_file_t *file;
+
+    file = apr_palloc(pool, sizeof(struct ft_file_t));
+    file->path = apr_pstrdup(pool, rec->name);
+    file->dir = rec->dir;
+    file->parent = rec->dir;
+    file->twin = NULL;
+    file->size = rec->size;
+    file->mtime = rec->mtime;
+    file->device = rec->device;
+    file->inode = rec->inode;
+    file->location = 0;
+    file->cache_rec = NULL;
+    file->links = NULL;
+    file->clones = NULL;
 #if HAVE_ARCHIVE
-		    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath)) {
-			filepath = ft_untar_file(file, gc_pool);
-			if (NULL == filepath) {
-			    DEBUG_ERR("error calling ft_untar_file");
-			    apr_pool_destroy(gc_pool);
-			    return APR_EGENERAL;
-			}
-		    }
-		    else {
-			filepath = file->path;
-		    }
-#else
-		    filepath = file->path;
+    file->subpath = NULL;
+    file->ar_digests = NULL;
 #endif
-		    status =
-			checksum_file(filepath, file->size, conf->excess_size,
-				      fsize->chksum_array[fsize->nb_checksumed].val_array, gc_pool);
-#if HAVE_ARCHIVE
-		    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath))
-			apr_file_remove(filepath, gc_pool);
+    if (rec->prioritized)
+	file->prioritized |= 0x1;
+    else
+	file->prioritized &= 0x0;
+#if HAVE_PUZZLE
+    file->cvec_ok &= 0x0;
 #endif
-		    /*
-		     * no return status if != APR_SUCCESS , because : 
-		     * Fault-check has been removed in case files disappear
-		     * between collecting and comparing or special files (like
-		     * device or /proc) are tried to access
-		     */
-		    if ((APR_SUCCESS != status) && (is_option_set(conf->mask, OPTION_VERBO)))
-			fprintf(stderr, "\nskipping %s because: %s\n", file->path, apr_strerror(status, errbuf, 128));
+    ft_conf_add_file(conf, file);
+}
+
+/*
+ * Under --mem-limit, once the walk spilled records: the runs are merged as a
+ * stream, the largest size first, and the files are hashed and reported a
+ * batch of whole sizes at a time, each batch holding about the budget and
+ * being released once reported. The first record of a size is held aside
+ * until another one shares it, a record alone of its size is never
+ * referenced. The files kept in memory, the archived ones, join the batch
+ * of their size.
+ */
+static apr_status_t ft_conf_spill_report(ft_conf_t *conf)
+{
+    char errbuf[128];
+    apr_array_header_t *kept = conf->files;
+    napr_inthash_t *inodes = conf->inodes;
+    ft_cache_t *cache = conf->cache;
+    ft_spill_merge_t *merge;
+    ft_spill_rec_t rec, first;
+    apr_pool_t *batch_pool;
+    ft_file_t *file;
+    char *first_name = NULL;
+    apr_size_t first_size = 0, len;
+    apr_off_t size, batch_len;
+    apr_status_t status, rv = APR_EOF;
+    int i, k, nb_kept, held;
+
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, "Merging %d runs of spilled records\n", conf->spills->nelts);
+    qsort(kept->elts, kept->nelts, sizeof(ft_file_t *), ft_file_size_cmp);
+    nb_kept = kept->nelts;
+    if (APR_SUCCESS != (status = apr_pool_create(&batch_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    status = ft_spill_merge_open(&merge, (ft_spill_t * const *) conf->spills->elts, conf->spills->nelts, conf->pool);
+    if (APR_SUCCESS == status)
+	status = rv = ft_spill_merge_read(merge, &rec);
+    if (APR_STATUS_IS_EOF(status))
+	status = APR_SUCCESS;
+
+    for (k = 0; (APR_SUCCESS == status) && ((APR_SUCCESS == rv) || (k < nb_kept));) {
+	conf->files = apr_array_make(batch_pool, 1024, sizeof(ft_file_t *));
+	if ((NULL != inodes) && (NULL == (conf->inodes = napr_inthash_make(batch_pool, 1024)))) {
+	    status = APR_ENOMEM;
+	    break;
+	}
+	/* the digests exported are held by a cache of the batch */
+	if ((NULL != conf->index) && (NULL == cache)) {
+	    status = ft_cache_open(&(conf->cache), NULL, conf->hash, FT_SLOT_NB, FT_STAGE_BLOCK_LEN, conf->nb_samples,
+				   batch_pool);
+	    if (APR_SUCCESS != status)
+		break;
+	}
+	for (batch_len = 0; ((APR_SUCCESS == rv) || (k < nb_kept)) && (batch_len < conf->mem_limit);) {
+	    size = (APR_SUCCESS == rv) ? rec.size : -1;
+	    if ((k < nb_kept) && (size < APR_ARRAY_IDX(kept, k, ft_file_t *)->size))
+		size = APR_ARRAY_IDX(kept, k, ft_file_t *)->size;
+	    for (held = 1; (k < nb_kept) && (size == (file = APR_ARRAY_IDX(kept, k, ft_file_t *))->size); k++) {
+		ft_conf_add_file(conf, file);
+		batch_len += FT_BATCH_FILE_LEN;
+		held = 0;
+	    }
+	    /* every file is referenced to be exported */
+	    held = held && (NULL == conf->index) && (APR_SUCCESS == rv);
+	    if (held) {
+		first = rec;
+		len = strlen(rec.name);
+		if (first_size <= len) {
+		    first_size = 2 * (len + 1);
+		    first_name = apr_palloc(conf->pool, first_size);
 		}
-		if (APR_SUCCESS == status) {
-		    fsize->nb_checksumed++;
-		    napr_heap_insert(tmp_heap, file);
+		memcpy(first_name, rec.name, len + 1);
+		first.name = first_name;
+		rv = ft_spill_merge_read(merge, &rec);
+	    }
+	    for (; (APR_SUCCESS == rv) && (size == rec.size); rv = ft_spill_merge_read(merge, &rec)) {
+		if (held) {
+		    ft_conf_add_spilled(conf, &first, batch_pool);
+		    batch_len += FT_BATCH_FILE_LEN + strlen(first.name) + 1;
+		    held = 0;
 		}
+		ft_conf_add_spilled(conf, &rec, batch_pool);
+		batch_len += FT_BATCH_FILE_LEN + strlen(rec.name) + 1;
+	    }
+	    /* alone of its size, as ft_conf_group_sizes counts it */
+	    if (held && (NULL != conf->stats)) {
+		conf->stats->nb_alone++;
+		conf->stats->alone_bytes += size;
 	    }
-	    if (is_option_set(conf->mask, OPTION_VERBO)) {
-		fprintf(stderr, "\rProgress [%" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT "] %d%% ", nb_processed, nb_files,
-			(int) ((float) nb_processed / (float) nb_files * 100.0));
-		nb_processed++;
+	    if ((APR_SUCCESS != rv) && !APR_STATUS_IS_EOF(rv)) {
+		status = rv;
+		break;
 	    }
 	}
-	else {
-	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->path);
-	    apr_pool_destroy(gc_pool);
-	    return APR_EGENERAL;
+	if (APR_SUCCESS != status)
+	    break;
+
+	if (NULL != conf->stats)
+	    conf->stats->nb_batches++;
+	if (APR_SUCCESS != (status = ft_conf_process_sizes(conf, batch_pool))) {
+	    DEBUG_ERR("error calling ft_conf_process_sizes: %s", apr_strerror(status, errbuf, 128));
+	    break;
 	}
-    }
-    if (is_option_set(conf->mask, OPTION_VERBO)) {
-	fprintf(stderr, "\rProgress [%" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT "] %d%% ", nb_processed, nb_files,
-		(int) ((float) nb_processed / (float) nb_files * 100.0));
-	fprintf(stderr, "\n");
+	if ((NULL != conf->index) && (APR_SUCCESS != (status = ft_conf_export_sizes(conf))))
+	    break;
+	if (APR_SUCCESS != (status = ft_conf_twin_report(conf))) {
+	    DEBUG_ERR("error calling ft_conf_twin_report: %s", apr_strerror(status, errbuf, 128));
+	    break;
+	}
+	conf->fsizes = NULL;
+	conf->nb_fsizes = 0;
+	conf->cache = cache;
+	apr_pool_clear(batch_pool);
     }
 
-    apr_pool_destroy(gc_pool);
-    conf->heap = tmp_heap;
+    conf->fsizes = NULL;
+    conf->nb_fsizes = 0;
+    conf->files = kept;
+    conf->inodes = inodes;
+    conf->cache = cache;
+    apr_pool_destroy(batch_pool);
+    for (i = 0; i < conf->spills->nelts; i++)
+	ft_spill_close(APR_ARRAY_IDX(conf->spills, i, ft_spill_t *));
+    conf->spills->nelts = 0;
+
+    return status;
+}
 
-    return APR_SUCCESS;
+#if HAVE_SYS_INOTIFY_H
+/*
+ * --watch: once the twins of the walk are reported, the directories walked
+ * are watched through inotify. The paths changed are gathered until the
+ * events settle, forgotten, and walked again as a round of --stream: only
+ * the files changed are read, the digests of the others being cached. A path
+ * leaving a group it was reported in is reported in a "left" record, the
+ * groups it joins are reported again. The events lost by an overflow of the
+ * queue are caught up with by walking everything again.
+ */
+#define FT_WATCH_MASK (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+		       | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define FT_WATCH_SETTLE 500	/* ms without an event before the paths gathered are walked */
+#define FT_WATCH_BATCH 65536	/* paths gathered at most before they are walked */
+#define FT_WATCH_BUF_LEN 65536
+
+typedef struct ft_watch_dir_t
+{
+    int wd;			/* -1 once the watch is removed */
+    char *path;
+} ft_watch_dir_t;
+
+/* a path changed, the events of the batch being or'ed */
+typedef struct ft_watch_path_t
+{
+    char *path;
+    apr_uint32_t mask;
+} ft_watch_path_t;
+
+typedef struct ft_watch_t
+{
+    int fd;
+    napr_inthash_t *wds;	/* ft_watch_dir_t * by watch descriptor */
+    apr_array_header_t *wdirs;	/* ft_watch_dir_t * */
+    napr_hash_t *paths;		/* ft_file_t * by path, hardlinks included, rebuilt by each batch */
+    apr_pool_t *paths_pool;
+    const char *const *roots;
+    int nb_roots;
+    apr_size_t nb_gone;		/* files of conf->files forgotten by the batch */
+    int left;			/* a "left" record is being written */
+} ft_watch_t;
+
+static volatile sig_atomic_t ft_watch_stopped = 0;
+
+static void ft_watch_stop(int signum)
+{
+    ft_watch_stopped = 1;
 }
 
-static int chksum_cmp(const void *chksum1, const void *chksum2)
+static const void *ft_file_get_path(const void *opaque)
 {
-    const ft_chksum_t *chk1 = chksum1;
-    const ft_chksum_t *chk2 = chksum2;
-    int i;
+    return ((const ft_file_t *) opaque)->path;
+}
 
-    if (0 == (i = memcmp(chk1->val_array, chk2->val_array, HASHSTATE))) {
-	return chk1->file->prioritized - chk2->file->prioritized;
-    }
-    else {
-	i <<= 1;
-    }
+static apr_size_t ft_file_get_path_len(const void *opaque)
+{
+    return strlen(((const ft_file_t *) opaque)->path);
+}
 
-    return i;
+static const void *ft_watch_path_get_key(const void *opaque)
+{
+    return ((const ft_watch_path_t *) opaque)->path;
 }
 
-#if HAVE_PUZZLE
+static apr_size_t ft_watch_path_get_key_len(const void *opaque)
+{
+    return strlen(((const ft_watch_path_t *) opaque)->path);
+}
 
-#define NB_WORKER 4
+static int ft_path_cmp(const void *key1, const void *key2, apr_size_t len)
+{
+    return memcmp(key1, key2, len);
+}
 
-struct compute_vector_ctx_t {
-    apr_thread_mutex_t *mutex;
-    PuzzleContext *contextp;
-    ft_conf_t *conf;
-    int heap_size, nb_processed;
-};
-typedef struct compute_vector_ctx_t compute_vector_ctx_t;
+static apr_uint32_t ft_path_hash(register const void *key, register apr_size_t len)
+{
+    return hashlittle(key, len, 0);
+}
 
-static apr_status_t compute_vector(void *ctx, void *data)
+/* is path below the directory dir (of dir_len bytes), or dir itself */
+static int ft_path_is_below(const char *path, const char *dir, apr_size_t dir_len)
+{
+    return !strncmp(path, dir, dir_len)
+	&& (('\0' == path[dir_len]) || ('/' == path[dir_len]) || ((0 < dir_len) && ('/' == dir[dir_len - 1])));
+}
+
+/* watch the directories walked since the previous call */
+static void ft_watch_dirs(ft_conf_t *conf, ft_watch_t *watch)
 {
     char errbuf[128];
-    compute_vector_ctx_t *cv_ctx = ctx;
-    ft_file_t *file = data;
+    ft_watch_dir_t *wdir;
+    ft_dir_t *dir;
     apr_status_t status;
-
-    puzzle_init_cvec(cv_ctx->contextp, &(file->cvec));
-    if (0 == puzzle_fill_cvec_from_file(cv_ctx->contextp, &(file->cvec), file->path)) {
-      file->cvec_ok |= 0x1;
-    }
-    else {
-      DEBUG_ERR("error calling puzzle_fill_cvec_from_file, ignoring file: %s", file->path);
+    int i, wd;
+
+    for (i = 0; i < conf->dirs->nelts; i++) {
+	dir = APR_ARRAY_IDX(conf->dirs, i, ft_dir_t *);
+	ft_dir_path_buf(dir, &(conf->path_buf), &(conf->path_size), conf->pool);
+	if (0 > (wd = inotify_add_watch(watch->fd, conf->path_buf, FT_WATCH_MASK))) {
+	    /* not fatal, the changes of this directory are missed */
+	    status = APR_FROM_OS_ERROR(errno);
+	    DEBUG_ERR("error calling inotify_add_watch(%s): %s%s", conf->path_buf, apr_strerror(status, errbuf, 128),
+		      (ENOSPC == errno) ? " (see fs.inotify.max_user_watches)" : "");
+	    continue;
+	}
+	/* a directory walked again keeps its watch descriptor */
+	if (NULL == (wdir = napr_inthash_get(watch->wds, (apr_uint64_t) wd, 0))) {
+	    wdir = apr_palloc(conf->pool, sizeof(struct ft_watch_dir_t));
+	    APR_ARRAY_PUSH(watch->wdirs, ft_watch_dir_t *) = wdir;
+	    if (APR_SUCCESS != (status = napr_inthash_set(watch->wds, (apr_uint64_t) wd, 0, wdir)))
+		DEBUG_ERR("error calling napr_inthash_set: %s", apr_strerror(status, errbuf, 128));
+	}
+	wdir->wd = wd;
+	wdir->path = apr_pstrdup(conf->pool, conf->path_buf);
     }
+    conf->dirs->nelts = 0;
+}
 
-    status = apr_thread_mutex_lock(cv_ctx->mutex);
-    if (APR_SUCCESS != status) {
-        DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
-        return status;
-    }
-    if (is_option_set(cv_ctx->conf->mask, OPTION_VERBO)) {
-      fprintf(stderr, "\rProgress [%i/%i] %d%% ", cv_ctx->nb_processed, cv_ctx->heap_size,
-              (int) ((float) cv_ctx->nb_processed / (float) cv_ctx->heap_size * 100.0));
+/* stop watching the directory path and the ones below it */
+static void ft_watch_unwatch_below(ft_watch_t *watch, const char *path)
+{
+    ft_watch_dir_t *wdir;
+    apr_size_t len = strlen(path);
+    int i;
+
+    for (i = 0; i < watch->wdirs->nelts; i++) {
+	wdir = APR_ARRAY_IDX(watch->wdirs, i, ft_watch_dir_t *);
+	if ((0 <= wdir->wd) && ft_path_is_below(wdir->path, path, len)) {
+	    inotify_rm_watch(watch->fd, wdir->wd);
+	    napr_inthash_set(watch->wds, (apr_uint64_t) wdir->wd, 0, NULL);
+	    wdir->wd = -1;
+	}
     }
-    cv_ctx->nb_processed += 1;
-    status = apr_thread_mutex_unlock(cv_ctx->mutex);
-    if (APR_SUCCESS != status) {
-        DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
-        return status;
+}
+
+/* index the paths of the files referenced, the priority path may have swapped some since the previous batch */
+static apr_status_t ft_watch_index(ft_conf_t *conf, ft_watch_t *watch)
+{
+    char errbuf[128];
+    ft_file_t *file, *link;
+    apr_uint32_t hash_value;
+    apr_status_t status;
+    int i;
+
+    apr_pool_clear(watch->paths_pool);
+    watch->paths = napr_hash_make(watch->paths_pool, conf->files->nelts + conf->nb_links, 8, ft_file_get_path,
+				  ft_file_get_path_len, ft_path_cmp, ft_path_hash);
+    if (NULL == watch->paths)
+	return APR_ENOMEM;
+    for (i = 0; i < conf->files->nelts; i++) {
+	file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+#if HAVE_ARCHIVE
+	/* the members of an archive share its path, see ft_watch_forget_members */
+	if (NULL != file->subpath)
+	    continue;
+#endif
+	for (link = file; NULL != link; link = link->links) {
+	    if (NULL != napr_hash_search(watch->paths, link->path, strlen(link->path), &hash_value))
+		continue;
+	    if (APR_SUCCESS != (status = napr_hash_set(watch->paths, link, hash_value))) {
+		DEBUG_ERR("error calling napr_hash_set: %s", apr_strerror(status, errbuf, 128));
+		return status;
+	    }
+	}
     }
 
     return APR_SUCCESS;
 }
 
-static apr_status_t ft_conf_image_twin_report(ft_conf_t *conf)
+static void ft_watch_unindex(ft_watch_t *watch, ft_file_t *file)
+{
+    apr_uint32_t hash_value;
+
+    if (file == napr_hash_search(watch->paths, file->path, strlen(file->path), &hash_value))
+	napr_hash_remove(watch->paths, file, hash_value);
+}
+
+/*
+ * Forget the path of file: a hardlink of the same inode takes its place if it
+ * was the first path of the inode. The path is written in the "left" record
+ * if it was reported.
+ */
+static void ft_watch_forget(ft_conf_t *conf, ft_watch_t *watch, ft_file_t *file)
 {
     char errbuf[128];
-    PuzzleContext context;
-    compute_vector_ctx_t cv_ctx;
-    double d;
-    ft_file_t *file, *file_cmp;
-    napr_threadpool_t *threadpool;
-    unsigned long nb_cmp, cnt_cmp;
-    int i, heap_size;
+    ft_file_t *first, *link;
+    const char *subpath = NULL;
     apr_status_t status;
-    unsigned char already_printed;
-
-    puzzle_init_context(&context);
-    puzzle_set_max_width(&context, 5000);
-    puzzle_set_max_height(&context, 5000);
-    puzzle_set_lambdas(&context, 13);
 
-    cv_ctx.contextp = &context;
-    cv_ctx.heap_size = heap_size = napr_heap_size(conf->heap);
-    cv_ctx.nb_processed = 0;
-    cv_ctx.conf = conf;
-    status = apr_thread_mutex_create(&(cv_ctx.mutex), APR_THREAD_MUTEX_DEFAULT, conf->pool);
-    if (APR_SUCCESS != status) {
-        DEBUG_ERR("error calling apr_thread_mutex_create: %s", apr_strerror(status, errbuf, 128));
-        return status;
+    first = file;
+#if HAVE_ARCHIVE
+    subpath = file->subpath;
+    if (NULL == subpath)
+#endif
+	if (NULL == (first = napr_inthash_get(conf->inodes, (apr_uint64_t) file->device, (apr_uint64_t) file->inode)))
+	    first = file;
+    if (first->reported) {
+	if (!watch->left)
+	    ft_out_event(conf, "left");
+	watch->left = 1;
+	ft_out_path(conf, file->path, subpath, "", file->prioritized);
     }
-    status = napr_threadpool_init(&threadpool, &cv_ctx, NB_WORKER, compute_vector, conf->pool);
-    if (APR_SUCCESS != status) {
-        DEBUG_ERR("error calling napr_threadpool_init: %s", apr_strerror(status, errbuf, 128));
-        return status;
+    if (NULL == subpath)
+	ft_watch_unindex(watch, file);
+
+    /* a hardlink is unchained */
+    if (first != file) {
+	for (link = first; (NULL != link->links) && (file != link->links); link = link->links);
+	link->links = file->links;
+	conf->nb_links--;
+	return;
     }
+    /* the next one holds the inode */
+    if (NULL != (link = file->links)) {
+	ft_watch_unindex(watch, link);
+	file->path = link->path;
+	file->dir = link->dir;
+	file->parent = link->parent;
+	file->prioritized = link->prioritized;
+	file->links = link->links;
+	conf->nb_links--;
+	if (APR_SUCCESS != (status = napr_hash_set(watch->paths, file, ft_path_hash(file->path, strlen(file->path)))))
+	    DEBUG_ERR("error calling napr_hash_set: %s", apr_strerror(status, errbuf, 128));
+	return;
+    }
+    if (NULL == subpath)
+	napr_inthash_set(conf->inodes, (apr_uint64_t) file->device, (apr_uint64_t) file->inode, NULL);
+    file->gone |= 0x1;
+    watch->nb_gone++;
+}
 
-    for (i = 0; i < heap_size; i++) {
+/* forget the files below the directory path */
+static void ft_watch_forget_below(ft_conf_t *conf, ft_watch_t *watch, const char *path)
+{
+    ft_file_t *file, *link, *next;
+    apr_size_t len = strlen(path);
+    int i;
 
-	file = napr_heap_get_nth(conf->heap, i);
-        status = napr_threadpool_add(threadpool, file);
-        if (APR_SUCCESS != status) {
-          DEBUG_ERR("error calling napr_threadpool_add: %s", apr_strerror(status, errbuf, 128));
-          return status;
-        }
-    }
-    napr_threadpool_wait(threadpool);
-    status = apr_thread_mutex_destroy(cv_ctx.mutex);
-    if (APR_SUCCESS != status) {
-        DEBUG_ERR("error calling apr_thread_mutex_destroy: %s", apr_strerror(status, errbuf, 128));
-        return status;
+    for (i = 0; i < conf->files->nelts; i++) {
+	file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+	if (file->gone)
+	    continue;
+	/* the hardlinks first, the one of file may take its place */
+	for (link = file->links; NULL != link; link = next) {
+	    next = link->links;
+	    if (ft_path_is_below(link->path, path, len))
+		ft_watch_forget(conf, watch, link);
+	}
+	if (ft_path_is_below(file->path, path, len))
+	    ft_watch_forget(conf, watch, file);
     }
-    if (is_option_set(conf->mask, OPTION_VERBO)) {
-	fprintf(stderr, "\rProgress [%i/%i] %d%% ", i, heap_size, (int) ((float) i / (float) heap_size * 100.0));
-	fprintf(stderr, "\n");
+}
+
+#if HAVE_ARCHIVE
+/* forget the members of the archive path */
+static void ft_watch_forget_members(ft_conf_t *conf, ft_watch_t *watch, const char *path)
+{
+    ft_file_t *file;
+    int i;
+
+    for (i = 0; i < conf->files->nelts; i++) {
+	file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+	if (!file->gone && (NULL != file->subpath) && !strcmp(file->path, path))
+	    ft_watch_forget(conf, watch, file);
     }
+}
+#endif
+
+/* queue path to be walked again, unless it is filtered */
+static void ft_watch_queue(ft_conf_t *conf, napr_hash_t *queued, apr_array_header_t *walked, const char *path,
+			   const struct stat *st)
+{
+    const char *name;
+    apr_uint32_t hash_value;
+    apr_size_t len = strlen(path), name_len;
+
+    if (S_ISDIR(st->st_mode) && !is_option_set(conf->mask, OPTION_RECSD))
+	return;
+    name = (NULL != (name = strrchr(path, '/'))) ? name + 1 : path;
+    name_len = strlen(name);
+    if (ft_filter_name(conf->filter, name, name_len))
+	return;
+    if (ft_walk_is_filtered(conf, path, len, ft_filter_rel_offset(conf->filter, path, len), name_len,
+			    S_ISDIR(st->st_mode)))
+	return;
+    if (NULL != napr_hash_search(queued, path, len, &hash_value))
+	return;
+    napr_hash_set(queued, (void *) path, hash_value);
+    APR_ARRAY_PUSH(walked, const char *) = path;
+}
+
+/* stat path as the walk would */
+static int ft_watch_stat(const ft_conf_t *conf, const char *path, struct stat *st)
+{
+    return is_option_set(conf->mask, OPTION_FSYML) ? stat(path, st) : lstat(path, st);
+}
+
+/* forget the paths changed by a batch of events, walk again the ones that still exist and report the twins */
+static apr_status_t ft_watch_batch(ft_conf_t *conf, ft_watch_t *watch, apr_array_header_t *changed, apr_pool_t *pool)
+{
+    char errbuf[128];
+    struct stat st;
+    ft_watch_path_t *wpath;
+    ft_file_t *file, *first, *link, *next;
+    napr_hash_t *queued;
+    apr_array_header_t *walked;
+    apr_status_t status;
+    int i, j, exists;
 
-    nb_cmp = napr_heap_size(conf->heap) * (napr_heap_size(conf->heap) - 1) / 2;
-    cnt_cmp = 0;
-    while (NULL != (file = napr_heap_extract(conf->heap))) {
-	if (!(file->cvec_ok & 0x1))
+    if (APR_SUCCESS != (status = ft_watch_index(conf, watch)))
+	return status;
+    queued = napr_hash_str_make(pool, changed->nelts, 8);
+    walked = apr_array_make(pool, changed->nelts, sizeof(const char *));
+    watch->nb_gone = 0;
+    watch->left = 0;
+    for (i = 0; i < changed->nelts; i++) {
+	wpath = APR_ARRAY_IDX(changed, i, ft_watch_path_t *);
+	exists = (0 == ft_watch_stat(conf, wpath->path, &st));
+	if (wpath->mask & IN_ISDIR) {
+	    ft_watch_forget_below(conf, watch, wpath->path);
+	    ft_watch_unwatch_below(watch, wpath->path);
+	    if (exists && S_ISDIR(st.st_mode))
+		ft_watch_queue(conf, queued, walked, wpath->path, &st);
 	    continue;
-	already_printed = 0;
-	heap_size = napr_heap_size(conf->heap);
-	for (i = 0; i < heap_size; i++) {
-	    file_cmp = napr_heap_get_nth(conf->heap, i);
-	    if (!(file_cmp->cvec_ok & 0x1))
+	}
+	if (NULL != (file = napr_hash_search(watch->paths, wpath->path, strlen(wpath->path), NULL))) {
+	    if (exists && (st.st_dev == file->device) && (st.st_ino == file->inode) && (st.st_size == file->size)
+		&& (apr_time_from_sec(st.st_mtime) + st.st_mtim.tv_nsec / APR_TIME_C(1000) == file->mtime))
 		continue;
-
-	    d = puzzle_vector_normalized_distance(&context, &(file->cvec), &(file_cmp->cvec), 0);
-	    if (d < conf->threshold) {
-		if (!already_printed) {
-		    printf("%s%c", file->path, conf->sep);
-		    already_printed = 1;
-		}
-		else {
-		    printf("%c", conf->sep);
+	    first = napr_inthash_get(conf->inodes, (apr_uint64_t) file->device, (apr_uint64_t) file->inode);
+	    if (!exists || (NULL == first)) {
+		ft_watch_forget(conf, watch, file);
+	    }
+	    else {
+		/* the content of the inode changed, under each of its paths */
+		for (link = first->links; NULL != link; link = next) {
+		    next = link->links;
+		    if ((0 == ft_watch_stat(conf, link->path, &st)))
+			ft_watch_queue(conf, queued, walked, link->path, &st);
+		    ft_watch_forget(conf, watch, link);
 		}
-		printf("%s", file_cmp->path);
+		if ((0 == ft_watch_stat(conf, first->path, &st)))
+		    ft_watch_queue(conf, queued, walked, first->path, &st);
+		ft_watch_forget(conf, watch, first);
+		exists = (0 == ft_watch_stat(conf, wpath->path, &st));
 	    }
-            if (is_option_set(conf->mask, OPTION_VERBO)) {
-                fprintf(stderr, "\rCompare progress [%10lu/%10lu] %02.2f%% ", cnt_cmp, nb_cmp,
-                        (double) ((double) cnt_cmp / (double) nb_cmp * 100.0));
-            }
-            cnt_cmp++;
 	}
+	/* a file just created is walked once written, unless it is a hardlink */
+	else if (exists && !(wpath->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)) && (1 == st.st_nlink)) {
+	    continue;
+	}
+#if HAVE_ARCHIVE
+	if (is_option_set(conf->mask, OPTION_UNTAR))
+	    ft_watch_forget_members(conf, watch, wpath->path);
+#endif
+	if (exists && !S_ISDIR(st.st_mode))
+	    ft_watch_queue(conf, queued, walked, wpath->path, &st);
+    }
+    if (watch->left)
+	ft_out_group_end(conf);
+    ft_out_flush(conf);
+
+    if (0 != watch->nb_gone) {
+	for (i = 0, j = 0; i < conf->files->nelts; i++) {
+	    file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+	    if (!file->gone)
+		APR_ARRAY_IDX(conf->files, j++, ft_file_t *) = file;
+	}
+	conf->files->nelts = j;
+    }
+    if (0 < walked->nelts) {
+	/* not fatal, a path that vanished meanwhile is walked again by its next event */
+	status = ft_conf_add_files(conf, (const char *const *) walked->elts, walked->nelts);
+	if (APR_SUCCESS != status)
+	    DEBUG_ERR("error calling ft_conf_add_files: %s", apr_strerror(status, errbuf, 128));
+    }
+    ft_watch_dirs(conf, watch);
 
-	if (already_printed)
-	    printf("\n\n");
+    return APR_SUCCESS;
+}
+
+/* after an overflow of the queue of events, forget everything and walk the roots again */
+static apr_status_t ft_watch_rescan(ft_conf_t *conf, ft_watch_t *watch)
+{
+    char errbuf[128];
+    ft_watch_dir_t *wdir;
+    apr_status_t status;
+    int i;
 
-	puzzle_free_cvec(&context, &(file->cvec));
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, "Too many changes at once, walking everything again\n");
+    ft_out_event(conf, "rescan");
+    ft_out_group_end(conf);
+    ft_out_flush(conf);
+
+    for (i = 0; i < watch->wdirs->nelts; i++) {
+	wdir = APR_ARRAY_IDX(watch->wdirs, i, ft_watch_dir_t *);
+	if (0 <= wdir->wd) {
+	    inotify_rm_watch(watch->fd, wdir->wd);
+	    napr_inthash_set(watch->wds, (apr_uint64_t) wdir->wd, 0, NULL);
+	    wdir->wd = -1;
+	}
     }
-    if (is_option_set(conf->mask, OPTION_VERBO)) {
-        fprintf(stderr, "\rCompare progress [%10lu/%10lu] %02.2f%% ", cnt_cmp, nb_cmp, (double) ((double) cnt_cmp / (double) nb_cmp * 100.0));
-	fprintf(stderr, "\n");
+    watch->wdirs->nelts = 0;
+    conf->files->nelts = 0;
+    conf->nb_links = 0;
+    if (NULL == (conf->inodes = napr_inthash_make(conf->pool, 4096)))
+	return APR_ENOMEM;
+    if (APR_SUCCESS != (status = ft_conf_add_files(conf, watch->roots, watch->nb_roots))) {
+	DEBUG_ERR("error calling ft_conf_add_files: %s", apr_strerror(status, errbuf, 128));
+	return status;
     }
-
-    puzzle_free_context(&context);
+    ft_watch_dirs(conf, watch);
 
     return APR_SUCCESS;
 }
-#endif
 
-static apr_status_t ft_conf_twin_report(ft_conf_t *conf)
+/* gather the path of an event in changed, once */
+static void ft_watch_event(ft_watch_t *watch, const struct inotify_event *event, napr_hash_t *gathered,
+			   apr_array_header_t *changed, apr_pool_t *pool)
 {
-    char errbuf[128];
-    apr_off_t old_size = -1;
-    ft_file_t *file;
-    ft_fsize_t *fsize;
+    ft_watch_dir_t *wdir;
+    ft_watch_path_t *wpath;
     apr_uint32_t hash_value;
-    apr_size_t i, j;
-    int rv;
-    apr_status_t status;
-    unsigned char already_printed;
-    apr_uint32_t chksum_array_sz = 0U;
+    char *path;
 
-    if (is_option_set(conf->mask, OPTION_VERBO))
-	fprintf(stderr, "Reporting duplicate files:\n");
+    if (NULL == (wdir = napr_inthash_get(watch->wds, (apr_uint64_t) event->wd, 0)))
+	return;
+    /* the watch is gone along with its directory */
+    if (event->mask & IN_IGNORED) {
+	napr_inthash_set(watch->wds, (apr_uint64_t) event->wd, 0, NULL);
+	wdir->wd = -1;
+	return;
+    }
+    /* the events of the entries of a directory tell the directory, but the roots */
+    if (0 == event->len) {
+	if (!(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+	    return;
+	path = wdir->path;
+    }
+    else {
+	path = apr_pstrcat(pool, wdir->path, ('/' == wdir->path[strlen(wdir->path) - 1]) ? "" : "/", event->name,
+			   NULL);
+    }
+    if (NULL == (wpath = napr_hash_search(gathered, path, strlen(path), &hash_value))) {
+	wpath = apr_palloc(pool, sizeof(struct ft_watch_path_t));
+	wpath->path = path;
+	wpath->mask = 0;
+	napr_hash_set(gathered, wpath, hash_value);
+	APR_ARRAY_PUSH(changed, ft_watch_path_t *) = wpath;
+    }
+    wpath->mask |= event->mask;
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+	wpath->mask |= IN_ISDIR;
+}
 
-    while (NULL != (file = napr_heap_extract(conf->heap))) {
-	if (file->size == old_size)
-	    continue;
+/**
+ * Report the changes of the twins, from the events on the directories walked,
+ * until SIGINT or SIGTERM.
+ * @param conf Configuration structure, the twins of the walk being reported.
+ * @param roots The files and directories given on the command line.
+ * @param nb_roots Their number.
+ * @return APR_SUCCESS if no error occured.
+ */
+static apr_status_t ft_conf_watch(ft_conf_t *conf, const char *const *roots, int nb_roots)
+{
+    char errbuf[128];
+    char *buf, *p;
+    const struct inotify_event *event;
+    struct pollfd pfd;
+    ft_watch_t watch;
+    napr_hash_t *gathered;
+    apr_array_header_t *changed;
+    apr_pool_t *pool;
+    apr_status_t status;
+    ssize_t len;
+    int rc, timeout, overflow;
 
-	old_size = file->size;
-	if (NULL != (fsize = napr_hash_search(conf->sizes, &file->size, 1, &hash_value))) {
-	    chksum_array_sz = FTWIN_MIN(fsize->nb_files, fsize->nb_checksumed);
-	    qsort(fsize->chksum_array, chksum_array_sz, sizeof(ft_chksum_t), chksum_cmp);
-	    for (i = 0; i < fsize->nb_files; i++) {
-		if (NULL == fsize->chksum_array[i].file)
+    if (0 > (watch.fd = inotify_init1(IN_CLOEXEC))) {
+	status = APR_FROM_OS_ERROR(errno);
+	DEBUG_ERR("error calling inotify_init1: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if ((APR_SUCCESS != (status = apr_pool_create(&pool, conf->pool)))
+	|| (APR_SUCCESS != (status = apr_pool_create(&(watch.paths_pool), conf->pool)))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	close(watch.fd);
+	return status;
+    }
+    watch.wds = napr_inthash_make(conf->pool, 1024);
+    watch.wdirs = apr_array_make(conf->pool, 1024, sizeof(ft_watch_dir_t *));
+    watch.roots = roots;
+    watch.nb_roots = nb_roots;
+    ft_watch_dirs(conf, &watch);
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, "Watching %d directories\n", watch.wdirs->nelts);
+
+    apr_signal(SIGINT, ft_watch_stop);
+    apr_signal(SIGTERM, ft_watch_stop);
+    buf = apr_palloc(conf->pool, FT_WATCH_BUF_LEN);
+    status = APR_SUCCESS;
+    while (!ft_watch_stopped && (APR_SUCCESS == status)) {
+	apr_pool_clear(pool);
+	gathered = napr_hash_make(pool, 64, 8, ft_watch_path_get_key, ft_watch_path_get_key_len, ft_path_cmp,
+				  ft_path_hash);
+	changed = apr_array_make(pool, 64, sizeof(ft_watch_path_t *));
+	overflow = 0;
+	/* the first event is waited for, the next ones until they settle */
+	for (timeout = -1; !ft_watch_stopped && !overflow && (changed->nelts < FT_WATCH_BATCH); timeout = FT_WATCH_SETTLE) {
+	    pfd.fd = watch.fd;
+	    pfd.events = POLLIN;
+	    if (0 == (rc = poll(&pfd, 1, timeout)))
+		break;
+	    if ((0 > rc) || (0 > (len = read(watch.fd, buf, FT_WATCH_BUF_LEN)))) {
+		if ((EINTR == errno) || (EAGAIN == errno))
 		    continue;
-		already_printed = 0;
-		for (j = i + 1; j < fsize->nb_files; j++) {
-		    if (0 == memcmp(fsize->chksum_array[i].val_array, fsize->chksum_array[j].val_array, HASHSTATE)) {
-			char *fpathi, *fpathj;
-#if HAVE_ARCHIVE
-			if (is_option_set(conf->mask, OPTION_UNTAR)) {
-			    if (NULL != fsize->chksum_array[i].file->subpath) {
-				fpathi = ft_untar_file(fsize->chksum_array[i].file, conf->pool);
-				if (NULL == fpathi) {
-				    DEBUG_ERR("error calling ft_untar_file");
-				    return APR_EGENERAL;
-				}
-			    }
-			    else {
-				fpathi = fsize->chksum_array[i].file->path;
-			    }
-			    if (NULL != fsize->chksum_array[j].file->subpath) {
-				fpathj = ft_untar_file(fsize->chksum_array[j].file, conf->pool);
-				if (NULL == fpathj) {
-				    DEBUG_ERR("error calling ft_untar_file");
-				    return APR_EGENERAL;
-				}
-			    }
-			    else {
-				fpathj = fsize->chksum_array[j].file->path;
-			    }
-			}
-			else {
-			    fpathi = fsize->chksum_array[i].file->path;
-			    fpathj = fsize->chksum_array[j].file->path;
-			}
-#else
-			fpathi = fsize->chksum_array[i].file->path;
-			fpathj = fsize->chksum_array[j].file->path;
-#endif
-			status = filecmp(conf->pool, fpathi, fpathj, fsize->val, conf->excess_size, &rv);
-#if HAVE_ARCHIVE
-			if (is_option_set(conf->mask, OPTION_UNTAR)) {
-			    if (NULL != fsize->chksum_array[i].file->subpath)
-				apr_file_remove(fpathi, conf->pool);
-			    if (NULL != fsize->chksum_array[j].file->subpath)
-				apr_file_remove(fpathj, conf->pool);
-			}
-#endif
-			/*
-			 * no return status if != APR_SUCCESS , because : 
-			 * Fault-check has been removed in case files disappear
-			 * between collecting and comparing or special files (like
-			 * device or /proc) are tried to access
-			 */
-			if (APR_SUCCESS != status) {
-			    if (is_option_set(conf->mask, OPTION_VERBO))
-				fprintf(stderr, "\nskipping %s and %s comparison because: %s\n",
-					fsize->chksum_array[i].file->path, fsize->chksum_array[j].file->path,
-					apr_strerror(status, errbuf, 128));
-			    rv = 1;
-			}
-
-			if (0 == rv) {
-			    if (!already_printed) {
-				if (is_option_set(conf->mask, OPTION_SIZED))
-				    printf("size [%" APR_OFF_T_FMT "]:\n", fsize->val);
-#if HAVE_ARCHIVE
-				if (is_option_set(conf->mask, OPTION_UNTAR)
-				    && (NULL != fsize->chksum_array[i].file->subpath))
-				    printf("%s%c%s%c", fsize->chksum_array[i].file->path, (':' != conf->sep) ? ':' : '|',
-					   fsize->chksum_array[i].file->subpath, conf->sep);
-				else
-#endif
-				    printf("%s%c", fsize->chksum_array[i].file->path, conf->sep);
-				already_printed = 1;
-			    }
-			    else {
-				printf("%c", conf->sep);
-			    }
-#if HAVE_ARCHIVE
-			    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != fsize->chksum_array[j].file->subpath))
-				printf("%s%c%s", fsize->chksum_array[j].file->path, (':' != conf->sep) ? ':' : '|',
-				       fsize->chksum_array[j].file->subpath);
-			    else
-#endif
-				printf("%s", fsize->chksum_array[j].file->path);
-			    /* mark j as a twin ! */
-			    fsize->chksum_array[j].file = NULL;
-			    fflush(stdout);
-			}
-		    }
-		    else {
-			/* hash are ordered, so at first mismatch we check the next */
-			break;
-		    }
-		}
-		if (already_printed)
-		    printf("\n\n");
+		status = APR_FROM_OS_ERROR(errno);
+		DEBUG_ERR("error reading the inotify events: %s", apr_strerror(status, errbuf, 128));
+		break;
+	    }
+	    for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+		event = (const struct inotify_event *) p;
+		if (event->mask & IN_Q_OVERFLOW)
+		    overflow = 1;
+		else
+		    ft_watch_event(&watch, event, gathered, changed, pool);
 	    }
 	}
-	else {
-	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->path);
-	    return APR_EGENERAL;
-	}
+	if (ft_watch_stopped || (APR_SUCCESS != status))
+	    break;
+	if (overflow)
+	    status = ft_watch_rescan(conf, &watch);
+	else if (0 < changed->nelts)
+	    status = ft_watch_batch(conf, &watch, changed, pool);
     }
+    apr_signal(SIGINT, SIG_DFL);
+    apr_signal(SIGTERM, SIG_DFL);
+    close(watch.fd);
+    apr_pool_destroy(pool);
+    apr_pool_destroy(watch.paths_pool);
 
-    return APR_SUCCESS;
+    return status;
 }
+#endif
 
 static void version()
 {
@@ -1030,40 +5642,19 @@ static void usage(const char *name, const apr_getopt_option_t *opt_option)
     fprintf(stdout, "\n");
 
     for (i = 0; NULL != opt_option[i].name; i++) {
-	fprintf(stdout, "-%c,\t--%s\t%s\n", opt_option[i].optch, opt_option[i].name, opt_option[i].description);
+	if (opt_option[i].optch > 255)
+	    fprintf(stdout, "\t--%s\t%s\n", opt_option[i].name, opt_option[i].description);
+	else
+	    fprintf(stdout, "-%c,\t--%s\t%s\n", opt_option[i].optch, opt_option[i].name, opt_option[i].description);
     }
 }
 
-static apr_status_t ft_pcre_free_cleanup(void *pcre_space)
-{
-    pcre_free(pcre_space);
-    return APR_SUCCESS;
-}
-
-static pcre *ft_pcre_compile(const char *regex, int caseless, apr_pool_t *p)
-{
-    const char *errptr;
-    int erroffset, options = PCRE_DOLLAR_ENDONLY | PCRE_DOTALL;
-    pcre *result;
-
-    if (caseless)
-	options |= PCRE_CASELESS;
-
-    result = pcre_compile(regex, options, &errptr, &erroffset, NULL);
-    if (NULL == result)
-	DEBUG_ERR("can't parse %s at [%.*s] for -e / --regex-ignore-file: %s", regex, erroffset, regex, errptr);
-    else
-	apr_pool_cleanup_register(p, result, ft_pcre_free_cleanup, apr_pool_cleanup_null);
-
-
-    return result;
-}
-
-static apr_status_t fill_gids_ht(const char *username, napr_hash_t *gids, apr_pool_t *p)
+static apr_status_t fill_gids_ht(const char *username, napr_inthash_t *gids, apr_pool_t *p)
 {
+    char errbuf[128];
     gid_t list[256];
     ft_gid_t *gid;
-    apr_uint32_t hash_value;
+    apr_status_t status;
     int i, nb_gid;
 
     nb_gid = getgroups(sizeof(list) / sizeof(gid_t), list);
@@ -1083,24 +5674,198 @@ static apr_status_t fill_gids_ht(const char *username, napr_hash_t *gids, apr_po
     }
 
     for (i = 0; i < nb_gid; i++) {
-	gid = napr_hash_search(gids, &(list[i]), 1, &hash_value);
-	if (NULL == gid) {
+	if (NULL == napr_inthash_get(gids, (apr_uint64_t) list[i], 0)) {
 	    gid = apr_palloc(p, sizeof(struct ft_gid_t));
 	    gid->val = list[i];
-	    napr_hash_set(gids, gid, hash_value);
+	    if (APR_SUCCESS != (status = napr_inthash_set(gids, (apr_uint64_t) list[i], 0, gid))) {
+		DEBUG_ERR("error calling napr_inthash_set: %s", apr_strerror(status, errbuf, 128));
+		return status;
+	    }
 	}
     }
 
     return APR_SUCCESS;
 }
 
+#define FT_STATS_SEC(t) ((double) (t) / APR_USEC_PER_SEC)
+
+/* --stats: what was done and avoided, on stderr as text or a json object */
+static void ft_stats_print(const ft_conf_t *conf)
+{
+    const ft_stats_t *stats = conf->stats;
+    const ft_stage_stats_t *st;
+    apr_interval_time_t queued = 0, idle = 0;
+    apr_size_t nb_jobs = 0, nb_rebuild, nb_grow;
+    int phase, stage, json = stats->json;
+
+    if (NULL != conf->threadpool)
+	napr_threadpool_times(conf->threadpool, &nb_jobs, &queued, &idle);
+    nb_rebuild = ft_filter_nb_rebuild(conf->filter);
+    nb_grow = napr_inthash_nb_grow(conf->gids) + ((NULL != conf->inodes) ? napr_inthash_nb_grow(conf->inodes) : 0);
+
+    fprintf(stderr, json ? "{\"phases\": {" : "Time spent (wall, cpu):\n");
+    for (phase = 0; phase < FT_PHASE_NB; phase++) {
+	if (json)
+	    fprintf(stderr, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", (0 == phase) ? "" : ", ", ft_phase_name[phase],
+		    FT_STATS_SEC(stats->wall[phase]), FT_STATS_SEC(stats->cpu[phase]));
+	else if (0 != stats->wall[phase])
+	    fprintf(stderr, "  %-8s %10.3fs %10.3fs\n", ft_phase_name[phase], FT_STATS_SEC(stats->wall[phase]),
+		    FT_STATS_SEC(stats->cpu[phase]));
+    }
+
+    fprintf(stderr,
+	    json ? "}, \"walk\": {\"dirs\": %" APR_SIZE_T_FMT ", \"files\": %" APR_SIZE_T_FMT ", \"stats\": %"
+	    APR_SIZE_T_FMT ", \"pruned\": %" APR_SIZE_T_FMT "}, \"stages\": {" : "Walk: %" APR_SIZE_T_FMT
+	    " directories, %" APR_SIZE_T_FMT " files, %" APR_SIZE_T_FMT " stat calls, %" APR_SIZE_T_FMT
+	    " directories pruned\n", stats->walk.nb_dirs, stats->walk.nb_files, stats->walk.nb_stats,
+	    stats->walk.nb_pruned);
+    for (stage = FT_STAGE_HEAD; stage < FT_STAGE_NB; stage++) {
+	st = &(stats->stages[stage]);
+	if (json)
+	    fprintf(stderr, "%s\"%s\": {\"hashed\": %" APR_SIZE_T_FMT ", \"cached\": %" APR_SIZE_T_FMT
+		    ", \"ruled_out\": %" APR_SIZE_T_FMT ", \"bytes_read\": %" APR_OFF_T_FMT ", \"bytes_avoided\": %"
+		    APR_OFF_T_FMT "}", (FT_STAGE_HEAD == stage) ? "" : ", ", ft_stage_name[stage], st->nb_hashed,
+		    st->nb_cached, st->nb_ruled_out, st->bytes_read, st->bytes_avoided);
+	else if (0 != st->nb_hashed)
+	    fprintf(stderr, "%s stage: %" APR_SIZE_T_FMT " files hashed (%" APR_SIZE_T_FMT " cached, %.1f%%), %"
+		    APR_SIZE_T_FMT " ruled out, %" APR_OFF_T_FMT " bytes read, %" APR_OFF_T_FMT " bytes not read\n",
+		    ft_stage_name[stage], st->nb_hashed, st->nb_cached, 100.0 * st->nb_cached / st->nb_hashed,
+		    st->nb_ruled_out, st->bytes_read, st->bytes_avoided);
+    }
+
+    fprintf(stderr,
+	    json ? "}, \"verify\": {\"groups\": %" APR_SIZE_T_FMT ", \"files\": %" APR_SIZE_T_FMT ", \"bytes\": %"
+	    APR_OFF_T_FMT "}" : "Verify: %" APR_SIZE_T_FMT " groups, %" APR_SIZE_T_FMT " files, %" APR_OFF_T_FMT
+	    " bytes at most\n", stats->nb_runs, stats->nb_compared, stats->compared_bytes);
+    fprintf(stderr,
+	    json ? ", \"not_read\": {\"alone\": %" APR_SIZE_T_FMT ", \"alone_bytes\": %" APR_OFF_T_FMT ", \"dropped\": %"
+	    APR_SIZE_T_FMT ", \"dropped_bytes\": %" APR_OFF_T_FMT ", \"hardlinks\": %" APR_SIZE_T_FMT
+	    ", \"hardlinks_bytes\": %" APR_OFF_T_FMT "}" : "Not read: %" APR_SIZE_T_FMT " files alone of their size (%"
+	    APR_OFF_T_FMT " bytes), %" APR_SIZE_T_FMT " dropped by -o (%" APR_OFF_T_FMT " bytes), %" APR_SIZE_T_FMT
+	    " hardlinks (%" APR_OFF_T_FMT " bytes)\n", stats->nb_alone, stats->alone_bytes, stats->nb_dropped,
+	    stats->dropped_bytes, conf->nb_links, stats->links_bytes);
+    if (json || (0 != stats->nb_spills))
+	fprintf(stderr,
+		json ? ", \"spill\": {\"records\": %" APR_SIZE_T_FMT ", \"runs\": %" APR_SIZE_T_FMT ", \"batches\": %"
+		APR_SIZE_T_FMT "}" : "Spill: %" APR_SIZE_T_FMT " records, %" APR_SIZE_T_FMT " runs, %" APR_SIZE_T_FMT
+		" batches\n", stats->nb_spilled, stats->nb_spills, stats->nb_batches);
+    fprintf(stderr,
+	    json ? ", \"tables\": {\"rebuilds\": %" APR_SIZE_T_FMT ", \"resizes\": %" APR_SIZE_T_FMT "}" :
+	    "Tables: %" APR_SIZE_T_FMT " rebuilds, %" APR_SIZE_T_FMT " resizes\n", nb_rebuild, nb_grow);
+    fprintf(stderr,
+	    json ? ", \"threads\": {\"jobs\": %" APR_SIZE_T_FMT ", \"queued\": %.6f, \"idle\": %.6f}}\n" :
+	    "Threads: %" APR_SIZE_T_FMT " jobs, %.3fs queued, %.3fs idle\n", nb_jobs, FT_STATS_SEC(queued),
+	    FT_STATS_SEC(idle));
+}
+
+/* the defaults of conf, before the options are parsed */
+static void ft_conf_init(ft_conf_t *conf, apr_pool_t *pool)
+{
+    conf->pool = pool;
+    conf->files = apr_array_make(pool, 1024, sizeof(ft_file_t *));
+    conf->fsizes = NULL;
+    conf->nb_fsizes = 0;
+    conf->filter = ft_filter_make(pool);
+    conf->gids = napr_inthash_make(pool, 64);
+    conf->inodes = NULL;
+    conf->threadpool = NULL;
+    conf->stats = NULL;
+    conf->out.buf = apr_palloc(pool, FT_OUT_LEN);
+    conf->out.len = 0;
+    conf->out.format = FT_FORMAT_TEXT;
+    conf->ar_regex = NULL;
+    conf->p_path = NULL;
+    conf->p_path_len = 0;
+    conf->minsize = 0;
+    conf->sep = '\n';
+    ft_io_init(&(conf->io));
+    conf->mask = 0x0000;
+    conf->nb_worker = 0;
+    conf->nb_samples = 0;
+    conf->hash = ft_hash_default();
+    conf->cache = NULL;
+    conf->index = NULL;
+    conf->nb_links = 0;
+    conf->nb_clones = 0;
+    conf->deduped_bytes = 0;
+    conf->stream_len = 0;
+    conf->mem_limit = 0;
+    conf->spill_dir = NULL;
+    conf->spills = NULL;
+    conf->spill_merging = 0;
+    conf->dirs = NULL;
+    conf->dirsums = NULL;
+    conf->nb_dirsums = 0;
+    conf->dirents = NULL;
+    conf->nb_dirents = 0;
+    conf->dirs_report = 0;
+    conf->path_buf = NULL;
+    conf->path_size = 0;
+#if HAVE_PUZZLE
+    conf->threshold = PUZZLE_CVEC_SIMILARITY_LOWER_THRESHOLD;
+#endif
+}
+
+/* a number of bytes, with a K, M, G or T suffix for the powers of 1024 */
+static apr_status_t ft_size_parse(const char *str, apr_off_t *size)
+{
+    char *end;
+    unsigned long val;
+    int shift;
+
+    val = strtoul(str, &end, 10);
+    if ((end == str) || (ULONG_MAX == val))
+	return APR_EINVAL;
+    switch (*end) {
+    case '\0':
+	shift = 0;
+	break;
+    case 'K':
+    case 'k':
+	shift = 10;
+	break;
+    case 'M':
+    case 'm':
+	shift = 20;
+	break;
+    case 'G':
+    case 'g':
+	shift = 30;
+	break;
+    case 'T':
+    case 't':
+	shift = 40;
+	break;
+    default:
+	return APR_EINVAL;
+    }
+    if (((0 != shift) && ('\0' != end[1])) || (val > ((apr_uint64_t) APR_INT64_MAX >> shift)))
+	return APR_EINVAL;
+    *size = (apr_off_t) val << shift;
+
+    return APR_SUCCESS;
+}
+
 int main(int argc, const char **argv)
 {
     static const apr_getopt_option_t opt_option[] = {
+	{"block-size", OPT_BLOCK_SIZE, TRUE, "\t\tread size, rounded up to a power of two,\n\t\t\t\tdefault: 65536."},
 	{"case-unsensitive", 'c', FALSE, "this option applies to regex match."},
+	{"cache", OPT_CACHE, TRUE, "\t\tfile keeping the checksums of unchanged files\n\t\t\t\tfrom one run to the next."},
+	{"dedupe", OPT_DEDUPE, FALSE, "\t\thave the kernel deduplicate the twins, which it\n\t\t\t\tcompares instead of ftwin (FIDEDUPERANGE)."},
+	{"direct-io", OPT_DIRECT_IO, FALSE, "\t\tread files with O_DIRECT, bypassing the page cache."},
+	{"dirs", OPT_DIRS, FALSE, "\t\treport whole identical directories once, at the\n\t\t\t\thighest level, before the other duplicates."},
+	{"dirs-only", OPT_DIRS_ONLY, FALSE, "\t\tonly report identical directories, files below\n\t\t\t\tdirectories without a twin are not read."},
 	{"display-size", 'd', FALSE, "\tdisplay size before duplicates."},
+	{"export", OPT_EXPORT, TRUE, "\t\twrite the sizes, digests and paths of all the\n\t\t\t\tfiles to this index, to be merged with --merge."},
 	{"regex-ignore-file", 'e', TRUE, "filenames that match this are ignored."},
+	{"exclude-from", OPT_EXCLUDE_FROM, TRUE,
+	 "\tfile of globs of the names or paths to ignore, one\n\t\t\t\tper line, directories matching are not browsed."},
+	{"fadvise", OPT_FADVISE, FALSE, "\t\tread files sequentially and drop them from the\n\t\t\t\tpage cache once read."},
 	{"follow-symlink", 'f', FALSE, "follow symbolic links."},
+	{"format", OPT_FORMAT, TRUE, "\t\toutput format: text, null (NUL-terminated fields)\n\t\t\t\tor jsonl (a json object per group), default: text."},
+	{"hardlinks", OPT_HARDLINKS, TRUE,
+	 "\thardlinks of a file are listed as its twins (list)\n\t\t\t\tor not reported (hide), default: list."},
 	{"help", 'h', FALSE, "\t\tdisplay usage."},
 #if HAVE_PUZZLE
 	{"image-cmp", 'I', FALSE, "\twill run ftwin in image cmp mode (using libpuzzle)."},
@@ -1108,26 +5873,53 @@ int main(int argc, const char **argv)
 	 "will change the image similarity threshold\n\t\t\t\t (default is [1], accepted [2/3/4/5])."},
 #endif
 	{"ignore-list", 'i', TRUE, "\tcomma-separated list of file names to ignore."},
+	{"io-uring", OPT_IO_URING, TRUE,
+	 "\t\tnumber of reads kept in flight through io_uring,\n\t\t\t\t0 to read synchronously, default: 0."},
+	{"jobs", 'j', TRUE, "\t\tnumber of threads used to browse directories and\n\t\t\t\tchecksum files, default: 1 (the number of CPUs\n\t\t\t\tin image cmp mode)."},
+	{"mem-limit", OPT_MEM_LIMIT, TRUE,
+	 "\tbytes of records held in memory (K, M, G suffix),\n\t\t\t\tthe others are spilled to sorted runs in $TMPDIR."},
+	{"merge", OPT_MERGE, FALSE, "\t\tthe arguments are indexes written by --export on\n\t\t\t\tseveral hosts, report the files found on several."},
 	{"minimal-length", 'm', TRUE, "minimum size of file to process."},
-	{"optimize-memory", 'o', FALSE, "reduce memory usage, but increase process time."},
+	{"mmap-window", OPT_MMAP_WINDOW, TRUE,
+	 "\t\tfiles are mmap'ed this many bytes at a time, 0 to\n\t\t\t\tread them instead, default: 16777216."},
+	{"hash", OPT_HASH, TRUE, "\t\tcontent hash (" FT_HASH_NAMES "), default: xxh3."},
+	{"optimize-memory", 'o', FALSE, "reduce memory usage, but increase process time:\n\t\t\t\tpaths are kept as names in their directory."},
 	{"priority-path", 'p', TRUE, "\tfile in this path are displayed first when\n\t\t\t\tduplicates are reported."},
+	{"prune", OPT_PRUNE, TRUE, "\t\tglob of the names or paths of the directories\n\t\t\t\tnot to browse, can be given several times."},
 	{"recurse-subdir", 'r', FALSE, "recurse subdirectories."},
+	{"samples", OPT_SAMPLES, TRUE,
+	 "\tnumber of blocks sampled in the middle of large\n\t\t\t\tfiles before hashing them fully, default: 0."},
+	{"schedule", OPT_SCHEDULE, TRUE,
+	 "\t\tfiles are hashed by size or in their physical\n\t\t\t\torder on each device (physical), default: size."},
 	{"separator", 's', TRUE, "\tseparator character between twins, default: \\n."},
+	{"stats", OPT_STATS, TRUE, "\t\tprint statistics on stderr once done, as text or\n\t\t\t\tas a json object."},
+	{"stream", OPT_STREAM, TRUE,
+	 "\t\treport the twins found every this many files while\n\t\t\t\tthe walk goes on, 0 to wait for it, default: 0."},
 #if HAVE_ARCHIVE
 	{"tar-cmp", 't', FALSE, "\twill process files archived in .tar default: off."},
 #endif
 	{"verbose", 'v', FALSE, "\tdisplay a progress bar."},
+	{"verify", OPT_VERIFY, FALSE, "\t\tunder --merge, hash again the files of this host\n\t\t\t\tbefore they are reported."},
 	{"version", 'V', FALSE, "\tdisplay version."},
+#if HAVE_SYS_INOTIFY_H
+	{"watch", OPT_WATCH, FALSE, "\t\tonce reported, report the twins made and broken\n\t\t\t\tby the changes of the directories until interrupted."},
+#endif
 	{"whitelist-regex-file", 'w', TRUE, "filenames that doesn't match this are ignored."},
 	{"excessive-size", 'x', TRUE, "excessive size of file that switch off mmap use."},
 	{NULL, 0, 0, NULL},	/* end (a.k.a. sentinel) */
     };
     char errbuf[128];
-    char *regex = NULL, *wregex = NULL, *arregex = NULL;
+    char host[APRMAXHOSTLEN + 1];
+    char *regex = NULL, *wregex = NULL, *arregex = NULL, *cache_path = NULL, *export_path = NULL;
     ft_conf_t conf;
     apr_getopt_t *os;
-    apr_pool_t *pool, *gc_pool;
-    apr_uint32_t hash_value;
+    apr_pool_t *pool;
+    apr_size_t read_len;
+    unsigned long uring_depth = 0;
+    int watch = 0, merge = 0, verify = 0, spilled;
+#if HAVE_PUZZLE
+    long nb_cpus;
+#endif
     const char *optarg;
     int optch, i;
     apr_status_t status;
@@ -1149,48 +5941,100 @@ int main(int argc, const char **argv)
 	return -1;
     }
 
-    conf.pool = pool;
-    conf.heap = napr_heap_make(pool, ft_file_cmp);
-    conf.ig_files = napr_hash_str_make(pool, 32, 8);
-    conf.sizes = napr_hash_make(pool, 4096, 8, ft_fsize_get_key, get_one, apr_uint32_key_cmp, apr_uint32_key_hash);
-    conf.gids = napr_hash_make(pool, 4096, 8, ft_gids_get_key, get_one, apr_uint32_key_cmp, apr_uint32_key_hash);
-    /* To avoid endless loop, ignore looping directory ;) */
-    napr_hash_search(conf.ig_files, ".", 1, &hash_value);
-    napr_hash_set(conf.ig_files, ".", hash_value);
-    napr_hash_search(conf.ig_files, "..", 2, &hash_value);
-    napr_hash_set(conf.ig_files, "..", hash_value);
-    conf.ig_regex = NULL;
-    conf.wl_regex = NULL;
-    conf.ar_regex = NULL;
-    conf.p_path = NULL;
-    conf.p_path_len = 0;
-    conf.minsize = 0;
-    conf.sep = '\n';
-    conf.excess_size = 50 * 1024 * 1024;
-    conf.mask = 0x0000;
-#if HAVE_PUZZLE
-    conf.threshold = PUZZLE_CVEC_SIMILARITY_LOWER_THRESHOLD;
-#endif
+    ft_conf_init(&conf, pool);
 
     while (APR_SUCCESS == (status = apr_getopt_long(os, opt_option, &optch, &optarg))) {
 	switch (optch) {
+	case OPT_BLOCK_SIZE:
+	    conf.io.block_len = strtoul(optarg, NULL, 10);
+	    if ((ULONG_MAX == conf.io.block_len) || (0 == conf.io.block_len)
+		|| (((apr_size_t) 1 << 30) < conf.io.block_len)) {
+		DEBUG_ERR("can't parse %s for --block-size", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    /* mmap windows and O_DIRECT reads are aligned on it */
+	    for (read_len = 4096; read_len < conf.io.block_len; read_len <<= 1);
+	    conf.io.block_len = read_len;
+	    break;
 	case 'c':
 	    set_option(&conf.mask, OPTION_ICASE, 1);
 	    break;
+	case OPT_CACHE:
+	    cache_path = apr_pstrdup(pool, optarg);
+	    break;
+	case OPT_DEDUPE:
+	    set_option(&conf.mask, OPTION_DEDUP, 1);
+	    break;
+	case OPT_DIRECT_IO:
+	    conf.io.flags |= FT_IO_DIRECT;
+	    break;
+	case OPT_DIRS_ONLY:
+	    set_option(&conf.mask, OPTION_DIRSO, 1);
+	    /* fall through */
+	case OPT_DIRS:
+	    set_option(&conf.mask, OPTION_DIRS, 1);
+	    break;
 	case 'd':
 	    set_option(&conf.mask, OPTION_SIZED, 1);
 	    break;
 	case 'e':
 	    regex = apr_pstrdup(pool, optarg);
 	    break;
+	case OPT_EXPORT:
+	    export_path = apr_pstrdup(pool, optarg);
+	    break;
+	case OPT_EXCLUDE_FROM:
+	    if (APR_SUCCESS != ft_filter_read(conf.filter, optarg)) {
+		DEBUG_ERR("can't read %s for --exclude-from", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_FORMAT:
+	    if (!strcmp(optarg, "text"))
+		conf.out.format = FT_FORMAT_TEXT;
+	    else if (!strcmp(optarg, "null"))
+		conf.out.format = FT_FORMAT_NULL;
+	    else if (!strcmp(optarg, "jsonl"))
+		conf.out.format = FT_FORMAT_JSONL;
+	    else {
+		DEBUG_ERR("can't parse %s for --format", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_FADVISE:
+	    conf.io.flags |= FT_IO_FADVISE;
+	    break;
 	case 'f':
 	    set_option(&conf.mask, OPTION_FSYML, 1);
 	    break;
 	case 'h':
 	    usage(argv[0], opt_option);
 	    return 0;
+	case OPT_HARDLINKS:
+	    if (!strcmp(optarg, "list")) {
+		set_option(&conf.mask, OPTION_HLINK, 0);
+	    }
+	    else if (!strcmp(optarg, "hide")) {
+		set_option(&conf.mask, OPTION_HLINK, 1);
+	    }
+	    else {
+		DEBUG_ERR("can't parse %s for --hardlinks", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_HASH:
+	    if (NULL == (conf.hash = ft_hash_get(optarg))) {
+		DEBUG_ERR("can't parse %s for --hash", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'i':
-	    ft_hash_add_ignore_list(conf.ig_files, optarg);
+	    ft_filter_add_names(conf.filter, optarg);
 	    break;
 #if HAVE_PUZZLE
 	case 'I':
@@ -1223,6 +6067,14 @@ int main(int argc, const char **argv)
 	    }
 	    break;
 #endif
+	case 'j':
+	    conf.nb_worker = strtoul(optarg, NULL, 10);
+	    if ((0 == conf.nb_worker) || (ULONG_MAX == conf.nb_worker)) {
+		DEBUG_ERR("can't parse %s for -j / --jobs", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'm':
 	    conf.minsize = strtoul(optarg, NULL, 10);
 	    if (ULONG_MAX == conf.minsize) {
@@ -1231,6 +6083,16 @@ int main(int argc, const char **argv)
 		return -1;
 	    }
 	    break;
+	case OPT_MEM_LIMIT:
+	    if ((APR_SUCCESS != ft_size_parse(optarg, &(conf.mem_limit))) || (0 == conf.mem_limit)) {
+		DEBUG_ERR("can't parse %s for --mem-limit", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_MERGE:
+	    merge = 1;
+	    break;
 	case 'o':
 	    set_option(&conf.mask, OPTION_OPMEM, 1);
 	    break;
@@ -1238,12 +6100,75 @@ int main(int argc, const char **argv)
 	    conf.p_path = apr_pstrdup(pool, optarg);
 	    conf.p_path_len = strlen(conf.p_path);
 	    break;
+	case OPT_PRUNE:
+	    if (APR_SUCCESS != ft_filter_add_glob(conf.filter, optarg, 1)) {
+		DEBUG_ERR("can't parse %s for --prune", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'r':
 	    set_option(&conf.mask, OPTION_RECSD, 1);
 	    break;
 	case 's':
 	    conf.sep = *optarg;
 	    break;
+	case OPT_IO_URING:
+	    uring_depth = strtoul(optarg, NULL, 10);
+	    if (FT_URING_MAX_DEPTH < uring_depth) {
+		DEBUG_ERR("can't parse %s for --io-uring (at most %d)", optarg, FT_URING_MAX_DEPTH);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_MMAP_WINDOW:
+	    conf.io.mmap_window = strtoul(optarg, NULL, 10);
+	    if (ULONG_MAX == conf.io.mmap_window) {
+		DEBUG_ERR("can't parse %s for --mmap-window", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_SCHEDULE:
+	    if (!strcmp(optarg, "size")) {
+		set_option(&conf.mask, OPTION_PHYS, 0);
+	    }
+	    else if (!strcmp(optarg, "physical")) {
+		set_option(&conf.mask, OPTION_PHYS, 1);
+	    }
+	    else {
+		DEBUG_ERR("can't parse %s for --schedule", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_STATS:
+	    conf.stats = apr_pcalloc(pool, sizeof(ft_stats_t));
+	    conf.stats->phase = -1;
+	    if (!strcmp(optarg, "json"))
+		conf.stats->json = 1;
+	    else if (strcmp(optarg, "text")) {
+		DEBUG_ERR("can't parse %s for --stats", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_STREAM:
+	    conf.stream_len = strtoul(optarg, NULL, 10);
+	    if (ULONG_MAX == conf.stream_len) {
+		DEBUG_ERR("can't parse %s for --stream", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case OPT_SAMPLES:
+	    conf.nb_samples = strtoul(optarg, NULL, 10);
+	    if (FT_STAGE_MAX_SAMPLES < conf.nb_samples) {
+		DEBUG_ERR("can't parse %s for --samples (at most %d)", optarg, FT_STAGE_MAX_SAMPLES);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 #if HAVE_ARCHIVE
 	case 't':
 	    set_option(&conf.mask, OPTION_UNTAR, 1);
@@ -1256,12 +6181,20 @@ int main(int argc, const char **argv)
 	case 'V':
 	    version();
 	    return 0;
+	case OPT_VERIFY:
+	    verify = 1;
+	    break;
 	case 'w':
 	    wregex = apr_pstrdup(pool, optarg);
 	    break;
+#if HAVE_SYS_INOTIFY_H
+	case OPT_WATCH:
+	    watch = 1;
+	    break;
+#endif
 	case 'x':
-	    conf.excess_size = strtoul(optarg, NULL, 10);
-	    if (ULONG_MAX == conf.minsize) {
+	    conf.io.excess_size = strtoul(optarg, NULL, 10);
+	    if (ULONG_MAX == conf.io.excess_size) {
 		DEBUG_ERR("can't parse %s for -x / --excessive-size", optarg);
 		apr_terminate();
 		return -1;
@@ -1270,6 +6203,32 @@ int main(int argc, const char **argv)
 	}
     }
 
+    /* -j defaults to a single thread, or to a thread per CPU to decode the images */
+    if (0 == conf.nb_worker) {
+	conf.nb_worker = 1;
+#if HAVE_PUZZLE
+	if (is_option_set(conf.mask, OPTION_PUZZL) && (0 < (nb_cpus = sysconf(_SC_NPROCESSORS_ONLN))))
+	    conf.nb_worker = (unsigned long) nb_cpus;
+#endif
+    }
+
+    /* the indexes exported by the hosts are merged, nothing is walked */
+    if (merge) {
+	if (argc <= os->ind) {
+	    fprintf(stderr, "Please submit at least one index...\n");
+	    usage(argv[0], opt_option);
+	    return -1;
+	}
+	status = ft_conf_merge(&conf, (const char *const *) argv + os->ind, argc - os->ind, verify);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling ft_conf_merge: %s", apr_strerror(status, errbuf, 128));
+	    apr_terminate();
+	    return -1;
+	}
+	apr_terminate();
+	return 0;
+    }
+
     if (APR_SUCCESS != (status = apr_uid_current(&(conf.userid), &(conf.groupid), pool))) {
 	DEBUG_ERR("error calling apr_uid_current: %s", apr_strerror(status, errbuf, 128));
 	apr_terminate();
@@ -1288,46 +6247,189 @@ int main(int argc, const char **argv)
 	return -1;
     }
 
-    if (NULL != regex) {
-	conf.ig_regex = ft_pcre_compile(regex, is_option_set(conf.mask, OPTION_ICASE), pool);
-	if (NULL == conf.ig_regex) {
+    if ((NULL != regex)
+	&& (APR_SUCCESS != ft_filter_set_regex(conf.filter, regex, 0, is_option_set(conf.mask, OPTION_ICASE)))) {
+	DEBUG_ERR("can't parse %s for -e / --regex-ignore-file", regex);
+	apr_terminate();
+	return -1;
+    }
+
+    if ((NULL != wregex)
+	&& (APR_SUCCESS != ft_filter_set_regex(conf.filter, wregex, 1, is_option_set(conf.mask, OPTION_ICASE)))) {
+	DEBUG_ERR("can't parse %s for -w / --whitelist-regex-file", wregex);
+	apr_terminate();
+	return -1;
+    }
+
+    if ((NULL != arregex)
+	&& (APR_SUCCESS != ft_regex_compile(&(conf.ar_regex), arregex, is_option_set(conf.mask, OPTION_ICASE), pool))) {
+	apr_terminate();
+	return -1;
+    }
+
+    /* the globs holding a '/' are relative to the arguments */
+    for (i = os->ind; i < argc; i++)
+	ft_filter_add_root(conf.filter, argv[i]);
+    if (APR_SUCCESS != (status = ft_filter_compile(conf.filter))) {
+	DEBUG_ERR("error calling ft_filter_compile: %s", apr_strerror(status, errbuf, 128));
+	apr_terminate();
+	return -1;
+    }
+
+    if (NULL != cache_path) {
+#if HAVE_PUZZLE
+	/* in image cmp mode, it keeps the signatures of the images */
+	if (is_option_set(conf.mask, OPTION_PUZZL))
+	    status = ft_cache_open_slots(&(conf.cache), cache_path, "puzzle", FT_IMAGE_SLOT_LEN, 1, FT_IMAGE_LAMBDAS, 0,
+					 pool);
+	else
+#endif
+	    status = ft_cache_open(&(conf.cache), cache_path, conf.hash, FT_SLOT_NB, FT_STAGE_BLOCK_LEN,
+				   conf.nb_samples, pool);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling ft_cache_open: %s", apr_strerror(status, errbuf, 128));
+	    apr_terminate();
+	    return -1;
+	}
+	/* samples digests depend on their number */
+	if ((0 != ft_cache_size(conf.cache)) && (ft_cache_nb_samples(conf.cache) != conf.nb_samples))
+	    ft_cache_ignore_slot(conf.cache, FT_STAGE_SAMPLES);
+	if (is_option_set(conf.mask, OPTION_VERBO))
+	    fprintf(stderr, "Cache %s: %" APR_SIZE_T_FMT " files\n", cache_path, ft_cache_size(conf.cache));
+    }
+#if HAVE_PUZZLE
+    /* the images are clustered all at once */
+    if (is_option_set(conf.mask, OPTION_PUZZL)) {
+	conf.stream_len = 0;
+	conf.mem_limit = 0;
+	set_option(&conf.mask, OPTION_DIRS, 0);
+	set_option(&conf.mask, OPTION_DIRSO, 0);
+	set_option(&conf.mask, OPTION_DEDUP, 0);
+	watch = 0;
+	export_path = NULL;
+    }
+#endif
+    /* the twins are deduplicated once, the files already deduplicated being folded as they are grouped */
+    if (is_option_set(conf.mask, OPTION_DEDUP)) {
+	conf.stream_len = 0;
+	set_option(&conf.mask, OPTION_DIRS, 0);
+	set_option(&conf.mask, OPTION_DIRSO, 0);
+	watch = 0;
+    }
+    /* every file goes through all the stages at once, to be exported */
+    if (NULL != export_path) {
+	conf.stream_len = 0;
+	set_option(&conf.mask, OPTION_DIRS, 0);
+	set_option(&conf.mask, OPTION_DIRSO, 0);
+	watch = 0;
+    }
+    /* the directories are digested once all their files are verified */
+    if (is_option_set(conf.mask, OPTION_DIRS)) {
+	conf.stream_len = 0;
+	conf.mem_limit = 0;
+	conf.dirs = apr_array_make(pool, 64, sizeof(ft_dir_t *));
+	watch = 0;
+    }
+    /* the changes are walked as rounds of --stream, the first one once the walk is over, on full paths */
+    if (watch) {
+	if (0 == conf.stream_len)
+	    conf.stream_len = (apr_size_t) -1;
+	set_option(&conf.mask, OPTION_OPMEM, 0);
+	conf.dirs = apr_array_make(pool, 64, sizeof(ft_dir_t *));
+    }
+    /* the rounds of --stream hash the files of each size found so far, they are all kept */
+    if (0 != conf.stream_len)
+	conf.mem_limit = 0;
+    /* the records are spilled as names in their directory, see ft_walker_spill */
+    if (0 != conf.mem_limit) {
+	set_option(&conf.mask, OPTION_OPMEM, 1);
+	conf.spills = apr_array_make(pool, FT_SPILL_MAX_RUNS, sizeof(ft_spill_t *));
+	if (APR_SUCCESS != (status = apr_temp_dir_get(&(conf.spill_dir), pool))) {
+	    DEBUG_ERR("error calling apr_temp_dir_get: %s", apr_strerror(status, errbuf, 128));
+	    apr_terminate();
+	    return -1;
+	}
+    }
+    /*
+     * the rounds of --stream hash the files of each size again, their digests are kept in memory at least,
+     * as the digests of each stage exported (by each batch of sizes under --mem-limit, see ft_conf_spill_report)
+     */
+    if (((0 != conf.stream_len) || ((NULL != export_path) && (0 == conf.mem_limit))) && (NULL == conf.cache)) {
+	status = ft_cache_open(&(conf.cache), NULL, conf.hash, FT_SLOT_NB, FT_STAGE_BLOCK_LEN, conf.nb_samples, pool);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling ft_cache_open: %s", apr_strerror(status, errbuf, 128));
 	    apr_terminate();
 	    return -1;
 	}
     }
 
-    if (NULL != wregex) {
-	conf.wl_regex = ft_pcre_compile(wregex, is_option_set(conf.mask, OPTION_ICASE), pool);
-	if (NULL == conf.wl_regex) {
+    if (NULL != export_path) {
+	if (APR_SUCCESS != (status = apr_gethostname(host, sizeof(host), pool))) {
+	    DEBUG_ERR("error calling apr_gethostname: %s", apr_strerror(status, errbuf, 128));
+	    apr_terminate();
+	    return -1;
+	}
+	status = ft_index_create(&(conf.index), export_path, host, conf.hash, FT_STAGE_NB, FT_STAGE_BLOCK_LEN,
+				 conf.nb_samples, pool);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling ft_index_create: %s", apr_strerror(status, errbuf, 128));
 	    apr_terminate();
 	    return -1;
 	}
     }
 
-    if (NULL != arregex) {
-	conf.ar_regex = ft_pcre_compile(arregex, is_option_set(conf.mask, OPTION_ICASE), pool);
-	if (NULL == conf.ar_regex) {
+    if (0 != uring_depth) {
+	status = ft_uring_create(&(conf.io.uring), (unsigned int) uring_depth, pool);
+	if (APR_SUCCESS != status) {
+	    /* not fatal, the files are read synchronously */
+	    if (is_option_set(conf.mask, OPTION_VERBO))
+		fprintf(stderr, "io_uring not available (%s), reading synchronously\n",
+			apr_strerror(status, errbuf, 128));
+	    conf.io.uring = NULL;
+	}
+    }
+
+    /* images are compared by their content only, hardlinks included */
+    conf.inodes = NULL;
+#if HAVE_PUZZLE
+    if (!is_option_set(conf.mask, OPTION_PUZZL))
+#endif
+	conf.inodes = napr_inthash_make(pool, 4096);
+
+    /* the threads are created once, for all the steps */
+    conf.threadpool = NULL;
+    if (1 < conf.nb_worker) {
+	if (APR_SUCCESS != (status = napr_threadpool_init(&(conf.threadpool), NULL, conf.nb_worker, NULL, pool))) {
+	    DEBUG_ERR("error calling napr_threadpool_init: %s", apr_strerror(status, errbuf, 128));
 	    apr_terminate();
 	    return -1;
 	}
+	if (NULL != conf.stats)
+	    napr_threadpool_set_timed(conf.threadpool, 1);
     }
 
+    /* resolve the hash implementation once, before the checksum threads use it */
+    ft_hash_impl(conf.hash);
+
     /* Step 1 : Browse the file */
-    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, pool))) {
-	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+    ft_stats_phase(&conf, FT_PHASE_WALK);
+    if (APR_SUCCESS != (status = ft_conf_add_files(&conf, (const char *const *) argv + os->ind, argc - os->ind))) {
+	DEBUG_ERR("error calling ft_conf_add_files: %s", apr_strerror(status, errbuf, 128));
 	apr_terminate();
 	return -1;
     }
-    for (i = os->ind; i < argc; i++) {
-	if (APR_SUCCESS != (status = ft_conf_add_file(&conf, argv[i], gc_pool, NULL))) {
-	    DEBUG_ERR("error calling ft_conf_add_file: %s", apr_strerror(status, errbuf, 128));
+    spilled = (NULL != conf.spills) && (0 < conf.spills->nelts);
+    /* the records of --mem-limit all held in memory, the digests exported are kept for all the files */
+    if (!spilled && (NULL != conf.index) && (NULL == conf.cache)) {
+	status = ft_cache_open(&(conf.cache), NULL, conf.hash, FT_SLOT_NB, FT_STAGE_BLOCK_LEN, conf.nb_samples, pool);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling ft_cache_open: %s", apr_strerror(status, errbuf, 128));
 	    apr_terminate();
 	    return -1;
 	}
     }
-    apr_pool_destroy(gc_pool);
 
-    if (0 < napr_heap_size(conf.heap)) {
+    if ((0 < conf.files->nelts) || watch || spilled) {
 #if HAVE_PUZZLE
 	if (is_option_set(conf.mask, OPTION_PUZZL)) {
 	    /* Step 2: Report the image twins */
@@ -1336,22 +6438,80 @@ int main(int argc, const char **argv)
 		apr_terminate();
 		return status;
 	    }
+	    if ((NULL != conf.cache) && (APR_SUCCESS != (status = ft_cache_save(conf.cache, pool)))) {
+		DEBUG_ERR("error calling ft_cache_save: %s", apr_strerror(status, errbuf, 128));
+		apr_terminate();
+		return -1;
+	    }
 	}
 	else {
 #endif
-	    /* Step 2: Process the sizes set */
-	    if (APR_SUCCESS != (status = ft_conf_process_sizes(&conf))) {
+	    if (is_option_set(conf.mask, OPTION_DIRS)) {
+		ft_stats_phase(&conf, FT_PHASE_DIRS);
+		ft_conf_dirs_make(&conf);
+		if (is_option_set(conf.mask, OPTION_DIRSO))
+		    ft_conf_dirs_prune(&conf);
+	    }
+	    /* Steps 2 and 3 a batch of sizes at a time, once records were spilled under --mem-limit */
+	    if (spilled && (APR_SUCCESS != (status = ft_conf_spill_report(&conf)))) {
+		DEBUG_ERR("error calling ft_conf_spill_report: %s", apr_strerror(status, errbuf, 128));
+		apr_terminate();
+		return -1;
+	    }
+	    /* Step 2: Process the sizes set, already done by the rounds of --stream */
+	    if ((0 == conf.stream_len) && !spilled && (APR_SUCCESS != (status = ft_conf_process_sizes(&conf, pool)))) {
 		DEBUG_ERR("error calling ft_conf_process_sizes: %s", apr_strerror(status, errbuf, 128));
 		apr_terminate();
 		return -1;
 	    }
+	    if ((NULL != conf.cache) && (APR_SUCCESS != (status = ft_cache_save(conf.cache, pool)))) {
+		DEBUG_ERR("error calling ft_cache_save: %s", apr_strerror(status, errbuf, 128));
+		apr_terminate();
+		return -1;
+	    }
+	    if ((NULL != conf.index) && (APR_SUCCESS != (status = ft_conf_export(&conf)))) {
+		DEBUG_ERR("error calling ft_conf_export: %s", apr_strerror(status, errbuf, 128));
+		apr_terminate();
+		return -1;
+	    }
 
 	    /* Step 3: Report the twins */
-	    if (APR_SUCCESS != (status = ft_conf_twin_report(&conf))) {
+	    if ((0 == conf.stream_len) && !spilled && (APR_SUCCESS != (status = ft_conf_twin_report(&conf)))) {
 		DEBUG_ERR("error calling ft_conf_twin_report: %s", apr_strerror(status, errbuf, 128));
 		apr_terminate();
 		return status;
 	    }
+	    /* under --dirs, the twins above were only verified, the directories are reported first */
+	    if (is_option_set(conf.mask, OPTION_DIRS)) {
+		ft_stats_phase(&conf, FT_PHASE_DIRS);
+		if (APR_SUCCESS != (status = ft_conf_dirs_report(&conf))) {
+		    DEBUG_ERR("error calling ft_conf_dirs_report: %s", apr_strerror(status, errbuf, 128));
+		    apr_terminate();
+		    return status;
+		}
+		conf.dirs_report = 1;
+		if (!is_option_set(conf.mask, OPTION_DIRSO) && (APR_SUCCESS != (status = ft_conf_twin_report(&conf)))) {
+		    DEBUG_ERR("error calling ft_conf_twin_report: %s", apr_strerror(status, errbuf, 128));
+		    apr_terminate();
+		    return status;
+		}
+	    }
+#if HAVE_SYS_INOTIFY_H
+	    /* Step 4: Report the changes of the twins until interrupted */
+	    if (watch) {
+		status = ft_conf_watch(&conf, (const char *const *) argv + os->ind, argc - os->ind);
+		if (APR_SUCCESS != status) {
+		    DEBUG_ERR("error calling ft_conf_watch: %s", apr_strerror(status, errbuf, 128));
+		    apr_terminate();
+		    return -1;
+		}
+		if ((NULL != conf.cache) && (APR_SUCCESS != (status = ft_cache_save(conf.cache, pool)))) {
+		    DEBUG_ERR("error calling ft_cache_save: %s", apr_strerror(status, errbuf, 128));
+		    apr_terminate();
+		    return -1;
+		}
+	    }
+#endif
 #if HAVE_PUZZLE
 	}
 #endif
@@ -1362,6 +6522,11 @@ int main(int argc, const char **argv)
 	return -1;
     }
 
+    if (NULL != conf.stats) {
+	ft_stats_phase(&conf, -1);
+	ft_stats_print(&conf);
+    }
+
     apr_terminate();
 
     return 0;
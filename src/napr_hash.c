@@ -80,6 +80,8 @@ struct napr_hash_t
     /* the binary mask to apply to the result of a hash function that return a
      * number < size */
     apr_uint32_t mask;
+    /* the number of times the table grew, see napr_hash_rebuild */
+    apr_size_t nb_rebuild;
     /* size of the hash is hashsize(power) as mask is hashmask(power) */
     unsigned char power;
 };
@@ -195,6 +197,7 @@ static inline apr_status_t napr_hash_rebuild(napr_hash_t *hash)
     hash->power = tmp->power;
     apr_pool_destroy(hash->own_pool);
     hash->own_pool = tmp->own_pool;
+    hash->nb_rebuild++;
 
     return APR_SUCCESS;
 }
@@ -289,6 +292,11 @@ extern apr_size_t napr_hash_get_size(const napr_hash_t *hash)
     return hash->size;
 }
 
+extern apr_size_t napr_hash_get_nb_rebuild(const napr_hash_t *hash)
+{
+    return hash->nb_rebuild;
+}
+
 extern apr_size_t napr_hash_get_nel(const napr_hash_t *hash)
 {
     return hash->nel;
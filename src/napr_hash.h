@@ -77,6 +77,8 @@ apr_status_t napr_hash_set(napr_hash_t *hash, void *data, apr_uint32_t hash_valu
 apr_status_t napr_hash_apply_function(const napr_hash_t *hash, function_callback_fn_t function, void *param);
 apr_size_t napr_hash_get_size(const napr_hash_t *hash);
 apr_size_t napr_hash_get_nel(const napr_hash_t *hash);
+/* the number of times the table grew since it was made */
+apr_size_t napr_hash_get_nb_rebuild(const napr_hash_t *hash);
 
 /**
  * Get a pointer to the pool which the hash table was created in.
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "debug.h"
+#include "napr_inthash.h"
+
+#define NAPR_INTHASH_MIN_SIZE 16
+/* the table grows once 80% of its slots are used */
+#define NAPR_INTHASH_FULL(size) ((size) - (size) / 5)
+/* slots of the old table moved by each insertion during a resize, the old table is empty before the new one is full */
+#define NAPR_INTHASH_MOVES 4
+
+typedef struct napr_inthash_slot_t
+{
+    apr_uint64_t key1;
+    apr_uint64_t key2;
+    void *value;		/* NULL once moved to the new table, in the old table during a resize */
+    apr_size_t dist;		/* 1 + distance to the slot the key hashes to, 0 if the slot is free */
+} napr_inthash_slot_t;
+
+typedef struct napr_inthash_table_t
+{
+    napr_inthash_slot_t *slots;
+    apr_size_t mask;		/* number of slots - 1, a power of 2 - 1 */
+    apr_size_t nel;
+    apr_pool_t *pool;		/* the table only, destroyed with it once moved */
+} napr_inthash_table_t;
+
+struct napr_inthash_t
+{
+    apr_pool_t *pool;
+    napr_inthash_table_t table;	/* where the keys are inserted */
+    napr_inthash_table_t old;	/* table being moved to the new one during a resize, old.slots is NULL otherwise */
+    apr_size_t moved;		/* slots of the old table moved so far */
+    apr_size_t nb_grow;		/* resizes since the table was made */
+};
+
+/* the finalizer of MurmurHash3, all the bits of the keys end up in the mask */
+static inline apr_size_t napr_inthash_mix(apr_uint64_t key1, apr_uint64_t key2)
+{
+    apr_uint64_t h = key1 ^ (key2 * 0x9e3779b97f4a7c15ULL);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (apr_size_t) h;
+}
+
+static apr_status_t napr_inthash_table_make(napr_inthash_table_t *table, apr_pool_t *pool, apr_size_t size)
+{
+    char errbuf[128];
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_pool_create(&(table->pool), pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (NULL == (table->slots = apr_pcalloc(table->pool, size * sizeof(struct napr_inthash_slot_t)))) {
+	DEBUG_ERR("allocation error");
+	apr_pool_destroy(table->pool);
+	return APR_ENOMEM;
+    }
+    table->mask = size - 1;
+    table->nel = 0;
+
+    return APR_SUCCESS;
+}
+
+/* smallest power of 2 holding nel keys without growing */
+static apr_size_t napr_inthash_size(apr_size_t nel)
+{
+    apr_size_t size;
+
+    for (size = NAPR_INTHASH_MIN_SIZE; NAPR_INTHASH_FULL(size) <= nel; size <<= 1);
+
+    return size;
+}
+
+static napr_inthash_slot_t *napr_inthash_table_find(const napr_inthash_table_t *table, apr_uint64_t key1,
+						     apr_uint64_t key2)
+{
+    napr_inthash_slot_t *slot;
+    apr_size_t pos, dist;
+
+    /* a key is never further from its slot than the keys it went past, a free slot being at distance 0 */
+    pos = napr_inthash_mix(key1, key2) & table->mask;
+    for (dist = 1;; dist++) {
+	slot = &(table->slots[pos]);
+	if (slot->dist < dist)
+	    return NULL;
+	if ((slot->dist == dist) && (slot->key1 == key1) && (slot->key2 == key2))
+	    return slot;
+	pos = (pos + 1) & table->mask;
+    }
+}
+
+/* key is not in table, and table is not full */
+static void napr_inthash_table_put(napr_inthash_table_t *table, apr_uint64_t key1, apr_uint64_t key2, void *value)
+{
+    napr_inthash_slot_t cur, tmp, *slot;
+    apr_size_t pos;
+
+    cur.key1 = key1;
+    cur.key2 = key2;
+    cur.value = value;
+    cur.dist = 1;
+    pos = napr_inthash_mix(key1, key2) & table->mask;
+    for (;;) {
+	slot = &(table->slots[pos]);
+	if (0 == slot->dist) {
+	    *slot = cur;
+	    break;
+	}
+	/* the key that is the closest to its slot makes room for the other one */
+	if (slot->dist < cur.dist) {
+	    tmp = *slot;
+	    *slot = cur;
+	    cur = tmp;
+	}
+	cur.dist++;
+	pos = (pos + 1) & table->mask;
+    }
+    table->nel++;
+}
+
+/* shift the keys that follow back to their slot, no tombstone is left behind */
+static void napr_inthash_table_erase(napr_inthash_table_t *table, napr_inthash_slot_t *slot)
+{
+    apr_size_t pos, next;
+
+    pos = slot - table->slots;
+    for (next = (pos + 1) & table->mask; 1 < table->slots[next].dist; next = (pos + 1) & table->mask) {
+	table->slots[pos] = table->slots[next];
+	table->slots[pos].dist--;
+	pos = next;
+    }
+    table->slots[pos].dist = 0;
+    table->slots[pos].value = NULL;
+    table->nel--;
+}
+
+/*
+ * The moved keys are only marked (NULL value) in the old table: shifting
+ * them back could bring a key that is not moved yet before hash->moved.
+ */
+static void napr_inthash_move(napr_inthash_t *hash, apr_size_t nb_slots)
+{
+    napr_inthash_slot_t *slot;
+    apr_size_t size = hash->old.mask + 1;
+
+    for (; (0 < nb_slots) && (0 < hash->old.nel) && (hash->moved < size); nb_slots--) {
+	slot = &(hash->old.slots[hash->moved++]);
+	if ((0 != slot->dist) && (NULL != slot->value)) {
+	    napr_inthash_table_put(&(hash->table), slot->key1, slot->key2, slot->value);
+	    slot->value = NULL;
+	    hash->old.nel--;
+	}
+    }
+    if (0 == hash->old.nel) {
+	apr_pool_destroy(hash->old.pool);
+	hash->old.slots = NULL;
+    }
+}
+
+/* the current table becomes the old one, moved into a new one of size slots */
+static apr_status_t napr_inthash_grow(napr_inthash_t *hash, apr_size_t size)
+{
+    char errbuf[128];
+    napr_inthash_table_t table;
+    apr_status_t status;
+
+    /* a previous resize is never left pending, even if it can't be at the insertion rate */
+    if (NULL != hash->old.slots)
+	napr_inthash_move(hash, hash->old.mask + 1);
+    if (APR_SUCCESS != (status = napr_inthash_table_make(&table, hash->pool, size))) {
+	DEBUG_ERR("error calling napr_inthash_table_make: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    hash->old = hash->table;
+    hash->table = table;
+    hash->moved = 0;
+    hash->nb_grow++;
+    if (0 == hash->old.nel) {
+	apr_pool_destroy(hash->old.pool);
+	hash->old.slots = NULL;
+    }
+
+    return APR_SUCCESS;
+}
+
+extern napr_inthash_t *napr_inthash_make(apr_pool_t *pool, apr_size_t nel)
+{
+    char errbuf[128];
+    napr_inthash_t *result;
+    apr_status_t status;
+
+    if (NULL == (result = apr_pcalloc(pool, sizeof(struct napr_inthash_t)))) {
+	DEBUG_ERR("allocation error");
+	return NULL;
+    }
+    result->pool = pool;
+    if (APR_SUCCESS != (status = napr_inthash_table_make(&(result->table), pool, napr_inthash_size(nel)))) {
+	DEBUG_ERR("error calling napr_inthash_table_make: %s", apr_strerror(status, errbuf, 128));
+	return NULL;
+    }
+    result->old.slots = NULL;
+    result->old.nel = 0;
+
+    return result;
+}
+
+extern apr_status_t napr_inthash_reserve(napr_inthash_t *hash, apr_size_t nel)
+{
+    char errbuf[128];
+    apr_status_t status;
+
+    if (NAPR_INTHASH_FULL(hash->table.mask + 1) > nel)
+	return APR_SUCCESS;
+    if (APR_SUCCESS != (status = napr_inthash_grow(hash, napr_inthash_size(nel)))) {
+	DEBUG_ERR("error calling napr_inthash_grow: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    /* the keys are moved now, the insertions to come can't be slowed down by the room made for them */
+    if (NULL != hash->old.slots)
+	napr_inthash_move(hash, hash->old.mask + 1);
+
+    return APR_SUCCESS;
+}
+
+extern void *napr_inthash_get(const napr_inthash_t *hash, apr_uint64_t key1, apr_uint64_t key2)
+{
+    const napr_inthash_slot_t *slot;
+
+    if (NULL != (slot = napr_inthash_table_find(&(hash->table), key1, key2)))
+	return slot->value;
+    if ((NULL != hash->old.slots) && (NULL != (slot = napr_inthash_table_find(&(hash->old), key1, key2))))
+	return slot->value;
+
+    return NULL;
+}
+
+extern apr_status_t napr_inthash_set(napr_inthash_t *hash, apr_uint64_t key1, apr_uint64_t key2, void *value)
+{
+    char errbuf[128];
+    napr_inthash_slot_t *slot;
+    apr_size_t size;
+    apr_status_t status;
+
+    if (NULL != (slot = napr_inthash_table_find(&(hash->table), key1, key2))) {
+	if (NULL != value)
+	    slot->value = value;
+	else
+	    napr_inthash_table_erase(&(hash->table), slot);
+	return APR_SUCCESS;
+    }
+    /* a key of the old table is moved by its update */
+    if ((NULL != hash->old.slots) && (NULL != (slot = napr_inthash_table_find(&(hash->old), key1, key2)))
+	&& (NULL != slot->value)) {
+	slot->value = NULL;
+	if (0 == --hash->old.nel) {
+	    apr_pool_destroy(hash->old.pool);
+	    hash->old.slots = NULL;
+	}
+    }
+    if (NULL == value)
+	return APR_SUCCESS;
+
+    napr_inthash_table_put(&(hash->table), key1, key2, value);
+    if (NULL != hash->old.slots)
+	napr_inthash_move(hash, NAPR_INTHASH_MOVES);
+
+    size = hash->table.mask + 1;
+    if (NAPR_INTHASH_FULL(size) <= hash->table.nel + hash->old.nel) {
+	if (APR_SUCCESS != (status = napr_inthash_grow(hash, size << 1))) {
+	    DEBUG_ERR("error calling napr_inthash_grow: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    }
+
+    return APR_SUCCESS;
+}
+
+extern apr_size_t napr_inthash_count(const napr_inthash_t *hash)
+{
+    return hash->table.nel + hash->old.nel;
+}
+
+extern apr_size_t napr_inthash_nb_grow(const napr_inthash_t *hash)
+{
+    return hash->nb_grow;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NAPR_INTHASH_H
+#define NAPR_INTHASH_H
+
+#include <apr_pools.h>
+
+/*
+ * A hash table of integer keys, stored inline in an open addressed table
+ * probed with Robin Hood hashing: no callback, no bucket to allocate, and a
+ * lookup reads a few consecutive slots. A key is a pair of 64 bits words, a
+ * single integer being keyed with 0 as its second word.
+ * Growing is incremental: the keys of the old table are moved a few at a
+ * time by the next insertions, so that no insertion pays for the whole
+ * table.
+ */
+
+typedef struct napr_inthash_t napr_inthash_t;
+
+/** 
+ * Create an integer hash table.
+ * @param pool The pool to allocate the hash table out of.
+ * @param nel The number of keys expected, the table being sized to hold them
+ *	      without growing.
+ * @return The hash table just created, NULL on allocation error.
+ */
+napr_inthash_t *napr_inthash_make(apr_pool_t *pool, apr_size_t nel);
+
+/** 
+ * Make room for nel keys at once, before inserting many of them.
+ * @param hash The hash table your working on.
+ * @param nel The number of keys the table should hold without growing.
+ */
+apr_status_t napr_inthash_reserve(napr_inthash_t *hash, apr_size_t nel);
+
+/** 
+ * @return The value set for (key1, key2), NULL if there's none.
+ */
+void *napr_inthash_get(const napr_inthash_t *hash, apr_uint64_t key1, apr_uint64_t key2);
+
+/** 
+ * Set the value of (key1, key2), replacing the previous one.
+ * @remark A NULL value removes the key, as apr_hash_set does.
+ */
+apr_status_t napr_inthash_set(napr_inthash_t *hash, apr_uint64_t key1, apr_uint64_t key2, void *value);
+
+/** 
+ * @return The number of keys in the table.
+ */
+apr_size_t napr_inthash_count(const napr_inthash_t *hash);
+
+/** 
+ * @return The number of times the table was resized since it was made, napr_inthash_reserve included.
+ */
+apr_size_t napr_inthash_nb_grow(const napr_inthash_t *hash);
+
+#endif /* NAPR_INTHASH_H */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "napr_radix.h"
+
+#define NAPR_RADIX_BITS 8
+#define NAPR_RADIX_SIZE (1 << NAPR_RADIX_BITS)
+#define NAPR_RADIX_NB_DIGITS (64 / NAPR_RADIX_BITS)
+#define NAPR_RADIX_DIGIT(key, d) ((apr_size_t) (((key) >> ((d) * NAPR_RADIX_BITS)) & (NAPR_RADIX_SIZE - 1)))
+
+extern void napr_radix_sort(napr_radix_pair_t *pairs, napr_radix_pair_t *tmp, apr_size_t nel)
+{
+    apr_size_t counts[NAPR_RADIX_NB_DIGITS][NAPR_RADIX_SIZE];
+    napr_radix_pair_t *src, *dst, *swap;
+    apr_size_t i, d, sum, n;
+
+    if (2 > nel)
+	return;
+
+    /* the histograms of all the digits are built in a single pass */
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < nel; i++)
+	for (d = 0; d < NAPR_RADIX_NB_DIGITS; d++)
+	    counts[d][NAPR_RADIX_DIGIT(pairs[i].key, d)]++;
+
+    src = pairs;
+    dst = tmp;
+    for (d = 0; d < NAPR_RADIX_NB_DIGITS; d++) {
+	/* a digit shared by all the keys would not move anything, e.g. the high bytes of small sizes */
+	if (nel == counts[d][NAPR_RADIX_DIGIT(src[0].key, d)])
+	    continue;
+	for (i = 0, sum = 0; i < NAPR_RADIX_SIZE; i++) {
+	    n = counts[d][i];
+	    counts[d][i] = sum;
+	    sum += n;
+	}
+	for (i = 0; i < nel; i++)
+	    dst[counts[d][NAPR_RADIX_DIGIT(src[i].key, d)]++] = src[i];
+	swap = src;
+	src = dst;
+	dst = swap;
+    }
+
+    if (src != pairs)
+	memcpy(pairs, src, nel * sizeof(napr_radix_pair_t));
+}
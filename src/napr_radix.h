@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NAPR_RADIX_H
+#define NAPR_RADIX_H
+
+#include <apr.h>
+
+/*
+ * A least significant digit radix sort of (key, value) pairs, a byte at a
+ * time: sorting n pairs costs a few linear passes over two flat arrays,
+ * whatever the order of the keys, instead of n log n comparisons.
+ */
+
+typedef struct napr_radix_pair_t
+{
+    apr_uint64_t key;
+    void *value;
+} napr_radix_pair_t;
+
+/**
+ * Sort pairs by increasing key, pairs of equal keys keep their order.
+ * @param pairs The pairs to sort.
+ * @param tmp Room for nel pairs, used as the other half of each pass.
+ * @param nel Number of pairs.
+ */
+void napr_radix_sort(napr_radix_pair_t *pairs, napr_radix_pair_t *tmp, apr_size_t nel);
+
+#endif /* NAPR_RADIX_H */
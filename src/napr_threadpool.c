@@ -16,191 +16,127 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <apr_thread_proc.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
+#include <apr_time.h>
 
 #include "napr_threadpool.h"
 #include "debug.h"
 
-/* Definitions of some basic list methods, see further to find pure threadpool stuff */
-typedef struct napr_cell_t napr_cell_t;
+#define NAPR_DEQUE_MIN_SIZE 256
+/* jobs taken at once from another thread, half of its queue at most */
+#define NAPR_DEQUE_STEAL 32
 
-struct napr_cell_t
+typedef struct napr_job_t
 {
-    napr_cell_t *next;
     void *data;
-};
+    threadpool_job_done_callback_fn_t *done;
+    apr_time_t queued;		/* when it was added, if the pool is timed */
+} napr_job_t;
 
-typedef struct napr_list_t napr_list_t;
+typedef struct napr_worker_t napr_worker_t;
 
-struct napr_list_t
+/* a thread and its queue of jobs, a ring of jobs growing as needed */
+struct napr_worker_t
 {
-    apr_pool_t *p;
-    napr_cell_t *head;
-    napr_cell_t *tail;
-    unsigned long nb_cells;
+    napr_threadpool_t *threadpool;
+    apr_thread_t *thread;
+    /* This mutex protects the ring, only contended when the queue is stolen or filled from outside */
+    apr_thread_mutex_t *mutex;
+    napr_job_t *jobs;		/* malloc'ed, apr pools are not thread safe */
+    apr_size_t mask;		/* size of the ring - 1, a power of 2 - 1 */
+    apr_size_t head;		/* oldest job */
+    apr_size_t nel;		/* atomically stored, so that it can be peeked without the mutex */
+
+    /* summed by the thread itself if the pool is timed, atomically stored to be read once the pool is waited for */
+    apr_size_t nb_timed;	/* jobs processed */
+    apr_interval_time_t queued;	/* time they spent queued */
+    apr_interval_time_t idle;	/* time the thread slept */
 };
 
-static inline napr_list_t *napr_list_make(apr_pool_t *p)
-{
-    apr_pool_t *local_pool;
-    napr_list_t *napr_list;
-
-    apr_pool_create(&local_pool, p);
-    napr_list = apr_palloc(local_pool, sizeof(struct napr_list_t));
-
-    if (napr_list != NULL) {
-	napr_list->p = local_pool;
-	napr_list->head = NULL;
-	napr_list->tail = NULL;
-	napr_list->nb_cells = 0UL;
-    }
-
-    return napr_list;
-}
-
-static int napr_list_cons(napr_list_t *napr_list, void *element)
-{
-    napr_cell_t *cell;
-    int rc; /** return code. */
-
-    if (NULL != (cell = (napr_cell_t *) apr_palloc(napr_list->p, sizeof(struct napr_cell_t)))) {
-	cell->data = element;
-	cell->next = napr_list->head;
-	napr_list->head = cell;
-	napr_list->nb_cells += 1;
-
-	if (napr_list->nb_cells == 1)
-	    napr_list->tail = napr_list->head;
-
-	rc = 0;
-    }
-    else {
-	rc = -1;
-    }
-
-    return rc;
-}
-
-static inline void napr_list_cdr(napr_list_t *napr_list)
-{
-    void *cell;
-
-    cell = napr_list->head->next;
-    napr_list->nb_cells -= 1UL;
-    napr_list->head = cell;
-}
-
-static inline void napr_list_delete(napr_list_t *napr_list)
-{
-    while (napr_list->head != NULL)
-	napr_list_cdr(napr_list);
-
-    apr_pool_destroy(napr_list->p);
-}
-
-static inline int napr_list_enqueue(napr_list_t *napr_list, void *element)
-{
-    napr_cell_t *cell;
-    int rc = 0;
-
-    if (0 != napr_list->nb_cells) {
-	if (NULL != (cell = (napr_cell_t *) apr_palloc(napr_list->p, sizeof(struct napr_cell_t)))) {
-	    napr_list->nb_cells += 1UL;
-	    cell->data = element;
-	    cell->next = NULL;
-	    napr_list->tail->next = cell;
-	    napr_list->tail = cell;
-	}
-	else
-	    rc = -1;
-    }
-    else {
-	rc = napr_list_cons(napr_list, element);
-    }
-
-    return rc;
-}
-
-static inline napr_cell_t *napr_list_first(napr_list_t *napr_list)
-{
-    return napr_list->head;
-}
-
-static inline unsigned long napr_list_size(napr_list_t *napr_list)
-{
-    return napr_list->nb_cells;
-}
-
-#if 0
-static inline napr_cell_t *napr_list_next(napr_cell_t *cell)
-{
-    return cell->next;
-}
-#endif
-
-static inline void *napr_list_get(napr_cell_t *cell)
-{
-    return cell->data;
-}
-
 /* The threadpool structures and engine */
 struct napr_threadpool_t
 {
-    apr_thread_t **thread;
-
+    napr_worker_t *workers;
+    unsigned long nb_thread;
     void *ctx;
-    /* This mutex protects everything below in writing and reading */
+    threadpool_process_data_callback_fn_t *process_data;
+
+    /* atomically updated */
+    apr_size_t nb_jobs;		/* added and not processed yet */
+    apr_size_t nb_sleeping;	/* threads waiting for threadpool_update */
+    unsigned long next_worker;	/* the queue filled by the next job added from outside */
+    int shutdown;		/* the threads exit, the pool is being destroyed */
+    int timed;			/* the jobs and the sleeps are timed, see napr_threadpool_set_timed */
+
+    /* This mutex only protects the sleeping threads and the waiter from missing a signal */
     apr_thread_mutex_t *threadpool_mutex;
+    /* signaled when data is added while threads sleep */
     apr_thread_cond_t *threadpool_update;
-    unsigned long nb_thread;
-    unsigned long nb_waiting;
-    napr_list_t *list;
-    threadpool_process_data_callback_fn_t *process_data;
+    /* broadcast when the last job is processed, the caller of napr_threadpool_wait waits on it */
+    apr_thread_cond_t *threadpool_done;
     apr_pool_t *pool;
 
     /*
-     * run == 0x1 means we are currently processing data
-     * run == 0x0 means we are creating the pool, OR (exclusive) we were
-     *        processing data and encountered a end of list and all thread are
-     *        waiting (no more data).
-     * Algorithm : 
-     * run &= 0x0;
-     *     create the thread pool loops :
-     *         code in the loop say :
-     *         run at 0x0, we can be nb_thread == nb_waiting in a "wait" mode.
-     *         This doesn't matter.
-     *
-     * external caller function add all data to process, then call the napr_threadpool_wait:
-     *     napr_threadpool_add_data:
-     *         fill list.
+     * Algorithm :
+     *     napr_threadpool_add:
+     *         count the job, queue it in the queue of the calling thread if
+     *         it's a thread of the pool, in the next queue otherwise, then
+     *         wake up a sleeping thread, if any.
+     *     loop:
+     *         take the oldest job of the own queue, or steal the newest ones
+     *         of another queue, process it, and uncount it: the thread
+     *         uncounting the last job broadcasts threadpool_done. A thread
+     *         that finds nothing sleeps, unless a queue has been filled
+     *         meanwhile.
      *     napr_threadpool_wait:
-     *         run |= 0x1;
-     *
-     *         code in the loop say :
-     *         run at 0x1, if we are at nb_thread == nb_waiting I'd better warn
-     *         the caller of the napr_threadpool_wait function that the processing
-     *         is ended.
+     *         wait for threadpool_done until no job is counted.
+     * A thread counts itself sleeping before looking at the queues, and a
+     * job is queued before the caller of add looks at the sleeping threads,
+     * so that either the thread sees the job, or the caller sees the thread
+     * and signals it under the mutex the thread holds until it waits.
      */
-
-    unsigned int run:1;
-    unsigned int ended:1;
 };
 
+/* the worker running the calling thread, to queue the jobs a callback adds in its own queue */
+static __thread napr_worker_t *napr_threadpool_self = NULL;
+
 static void *APR_THREAD_FUNC napr_threadpool_loop(apr_thread_t *thd, void *rec);
 
+/* the threads are stopped before their mutexes and conditions are destroyed, once all the jobs are processed */
+static apr_status_t napr_threadpool_cleanup(void *data)
+{
+    napr_threadpool_t *threadpool = data;
+    apr_status_t rv;
+    unsigned long l;
+
+    apr_thread_mutex_lock(threadpool->threadpool_mutex);
+    __atomic_store_n(&(threadpool->shutdown), 1, __ATOMIC_SEQ_CST);
+    apr_thread_cond_broadcast(threadpool->threadpool_update);
+    apr_thread_mutex_unlock(threadpool->threadpool_mutex);
+    for (l = 0; l < threadpool->nb_thread; l++) {
+	if (NULL != threadpool->workers[l].thread)
+	    apr_thread_join(&rv, threadpool->workers[l].thread);
+	free(threadpool->workers[l].jobs);
+    }
+
+    return APR_SUCCESS;
+}
+
 extern apr_status_t napr_threadpool_init(napr_threadpool_t **threadpool, void *ctx, unsigned long nb_thread,
 					 threadpool_process_data_callback_fn_t *process_data, apr_pool_t *pool)
 {
     char errbuf[128];
     apr_pool_t *local_pool;
+    napr_worker_t *worker;
     unsigned long l;
     apr_status_t status;
 
     apr_pool_create(&local_pool, pool);
-    (*threadpool) = apr_palloc(local_pool, sizeof(struct napr_threadpool_t));
+    (*threadpool) = apr_pcalloc(local_pool, sizeof(struct napr_threadpool_t));
     (*threadpool)->pool = local_pool;
 
     if (APR_SUCCESS !=
@@ -213,20 +149,39 @@ extern apr_status_t napr_threadpool_init(napr_threadpool_t **threadpool, void *c
 	DEBUG_ERR("error calling apr_thread_cond_create: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
-    (*threadpool)->thread = apr_palloc((*threadpool)->pool, nb_thread * sizeof(apr_thread_mutex_t *));
+    if (APR_SUCCESS != (status = apr_thread_cond_create(&((*threadpool)->threadpool_done), (*threadpool)->pool))) {
+	DEBUG_ERR("error calling apr_thread_cond_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    (*threadpool)->workers = apr_pcalloc((*threadpool)->pool, nb_thread * sizeof(struct napr_worker_t));
     (*threadpool)->ctx = ctx;
     (*threadpool)->nb_thread = nb_thread;
-    (*threadpool)->nb_waiting = 0UL;
-    (*threadpool)->list = napr_list_make((*threadpool)->pool);
     (*threadpool)->process_data = process_data;
-    (*threadpool)->run &= 0x0;
-    (*threadpool)->ended &= 0x0;
 
+    /* all the queues exist before a thread may steal them */
+    for (l = 0; l < nb_thread; l++) {
+	worker = &((*threadpool)->workers[l]);
+	worker->threadpool = *threadpool;
+	status = apr_thread_mutex_create(&(worker->mutex), APR_THREAD_MUTEX_DEFAULT, (*threadpool)->pool);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling apr_thread_mutex_create: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    }
+    /* registered last, it's run before the mutexes and conditions are destroyed */
+    apr_pool_cleanup_register((*threadpool)->pool, *threadpool, napr_threadpool_cleanup, apr_pool_cleanup_null);
+    for (l = 0; l < nb_thread; l++) {
+	worker = &((*threadpool)->workers[l]);
+	if (NULL == (worker->jobs = malloc(NAPR_DEQUE_MIN_SIZE * sizeof(struct napr_job_t)))) {
+	    DEBUG_ERR("allocation error");
+	    return APR_ENOMEM;
+	}
+	worker->mask = NAPR_DEQUE_MIN_SIZE - 1;
+    }
     for (l = 0; l < nb_thread; l++) {
+	worker = &((*threadpool)->workers[l]);
 	if (APR_SUCCESS !=
-	    (status =
-	     apr_thread_create(&((*threadpool)->thread[l]), NULL, napr_threadpool_loop, (*threadpool),
-			       (*threadpool)->pool))) {
+	    (status = apr_thread_create(&(worker->thread), NULL, napr_threadpool_loop, worker, (*threadpool)->pool))) {
 	    DEBUG_ERR("error calling apr_thread_create: %s", apr_strerror(status, errbuf, 128));
 	    return status;
 	}
@@ -235,67 +190,187 @@ extern apr_status_t napr_threadpool_init(napr_threadpool_t **threadpool, void *c
     return APR_SUCCESS;
 }
 
-extern apr_status_t napr_threadpool_add(napr_threadpool_t *threadpool, void *data)
+extern void napr_threadpool_set_process(napr_threadpool_t *threadpool, void *ctx,
+					threadpool_process_data_callback_fn_t *process_data)
+{
+    /* the jobs added next are published to the threads with the counters, after these stores */
+    threadpool->ctx = ctx;
+    threadpool->process_data = process_data;
+}
+
+extern void napr_threadpool_set_timed(napr_threadpool_t *threadpool, int timed)
+{
+    __atomic_store_n(&(threadpool->timed), timed, __ATOMIC_RELAXED);
+}
+
+extern void napr_threadpool_times(const napr_threadpool_t *threadpool, apr_size_t *nb_jobs,
+				  apr_interval_time_t *queued, apr_interval_time_t *idle)
+{
+    unsigned long l;
+
+    *nb_jobs = 0;
+    *queued = 0;
+    *idle = 0;
+    for (l = 0; l < threadpool->nb_thread; l++) {
+	*nb_jobs += __atomic_load_n(&(threadpool->workers[l].nb_timed), __ATOMIC_RELAXED);
+	*queued += __atomic_load_n(&(threadpool->workers[l].queued), __ATOMIC_RELAXED);
+	*idle += __atomic_load_n(&(threadpool->workers[l].idle), __ATOMIC_RELAXED);
+    }
+}
+
+/* worker->mutex is held */
+static apr_status_t napr_worker_push(napr_worker_t *worker, const napr_job_t *job)
+{
+    napr_job_t *jobs;
+    apr_size_t i, size;
+
+    size = worker->mask + 1;
+    if (worker->nel == size) {
+	if (NULL == (jobs = malloc(2 * size * sizeof(struct napr_job_t))))
+	    return APR_ENOMEM;
+	for (i = 0; i < worker->nel; i++)
+	    jobs[i] = worker->jobs[(worker->head + i) & worker->mask];
+	free(worker->jobs);
+	worker->jobs = jobs;
+	worker->mask = 2 * size - 1;
+	worker->head = 0;
+    }
+    worker->jobs[(worker->head + worker->nel) & worker->mask] = *job;
+    __atomic_store_n(&(worker->nel), worker->nel + 1, __ATOMIC_RELAXED);
+
+    return APR_SUCCESS;
+}
+
+/* a thread is counted sleeping before this look, the jobs are queued before napr_threadpool_wake looks at it */
+static int napr_threadpool_has_queued(napr_threadpool_t *threadpool)
+{
+    unsigned long l;
+
+    for (l = 0; l < threadpool->nb_thread; l++)
+	if (0 != __atomic_load_n(&(threadpool->workers[l].nel), __ATOMIC_SEQ_CST))
+	    return 1;
+
+    return 0;
+}
+
+/* wake up to nb_jobs sleeping threads, once the jobs are queued */
+static apr_status_t napr_threadpool_wake(napr_threadpool_t *threadpool, apr_size_t nb_jobs)
 {
     char errbuf[128];
+    apr_size_t nb_sleeping;
     apr_status_t status;
 
+    /* orders the queued jobs before the look at the sleeping threads, see napr_threadpool_has_queued */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 == (nb_sleeping = __atomic_load_n(&(threadpool->nb_sleeping), __ATOMIC_SEQ_CST)))
+	return APR_SUCCESS;
+
+    /*
+     * a thread counted sleeping holds the mutex until it waits: once the
+     * mutex is taken, it's waiting, and it can be signaled without the mutex
+     * that it would contend for right away.
+     */
     if (APR_SUCCESS != (status = apr_thread_mutex_lock(threadpool->threadpool_mutex))) {
 	DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
-    threadpool->ended &= 0x0;
-    napr_list_enqueue(threadpool->list, data);
-    if (APR_SUCCESS != (status = apr_thread_mutex_unlock(threadpool->threadpool_mutex))) {
-	DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
+    apr_thread_mutex_unlock(threadpool->threadpool_mutex);
+    if (nb_jobs >= nb_sleeping)
+	status = apr_thread_cond_broadcast(threadpool->threadpool_update);
+    else
+	while ((0 < nb_jobs--) && (APR_SUCCESS == (status = apr_thread_cond_signal(threadpool->threadpool_update))));
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_thread_cond_signal: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
-    if (APR_SUCCESS != (status = apr_thread_cond_signal(threadpool->threadpool_update))) {
-	DEBUG_ERR("error calling apr_thread_cond_signal: %s", apr_strerror(status, errbuf, 128));
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t napr_threadpool_add_batch(napr_threadpool_t *threadpool, void *const *data, apr_size_t nel,
+					      threadpool_job_done_callback_fn_t *done)
+{
+    char errbuf[128];
+    napr_worker_t *worker;
+    napr_job_t job;
+    apr_size_t i;
+    unsigned long l, first, nb_workers;
+    apr_status_t status;
+
+    if (0 == nel)
+	return APR_SUCCESS;
+
+    job.done = done;
+    /* a single clock read for the whole batch */
+    job.queued = __atomic_load_n(&(threadpool->timed), __ATOMIC_RELAXED) ? apr_time_now() : 0;
+
+    /* counted before a thread can take them, so that the counter never goes below the jobs processed */
+    __atomic_add_fetch(&(threadpool->nb_jobs), nel, __ATOMIC_SEQ_CST);
+
+    if ((NULL != napr_threadpool_self) && (threadpool == napr_threadpool_self->threadpool)) {
+	/* the other threads will steal them if they are idle */
+	first = napr_threadpool_self - threadpool->workers;
+	nb_workers = 1;
+    }
+    else {
+	/* spread over the queues in the order they are given, each queue is locked once */
+	first = __atomic_fetch_add(&(threadpool->next_worker), nel, __ATOMIC_RELAXED) % threadpool->nb_thread;
+	nb_workers = (nel < threadpool->nb_thread) ? nel : threadpool->nb_thread;
+    }
+    for (l = 0; l < nb_workers; l++) {
+	worker = &(threadpool->workers[(first + l) % threadpool->nb_thread]);
+	if (APR_SUCCESS != (status = apr_thread_mutex_lock(worker->mutex))) {
+	    DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	for (i = l, status = APR_SUCCESS; (i < nel) && (APR_SUCCESS == status); i += nb_workers) {
+	    job.data = data[i];
+	    status = napr_worker_push(worker, &job);
+	}
+	apr_thread_mutex_unlock(worker->mutex);
+	if (APR_SUCCESS != status) {
+	    DEBUG_ERR("error calling napr_worker_push: %s", apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+    }
+
+    if (APR_SUCCESS != (status = napr_threadpool_wake(threadpool, nel))) {
+	DEBUG_ERR("error calling napr_threadpool_wake: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
 
     return APR_SUCCESS;
 }
 
+extern apr_status_t napr_threadpool_add_job(napr_threadpool_t *threadpool, void *data, threadpool_job_done_callback_fn_t *done)
+{
+    return napr_threadpool_add_batch(threadpool, &data, 1, done);
+}
+
+extern apr_status_t napr_threadpool_add(napr_threadpool_t *threadpool, void *data)
+{
+    return napr_threadpool_add_batch(threadpool, &data, 1, NULL);
+}
+
 extern apr_status_t napr_threadpool_wait(napr_threadpool_t *threadpool)
 {
     char errbuf[128];
     apr_status_t status;
-    int list_size = 0;
 
     /* DEBUG_DBG("Called"); */
     if (APR_SUCCESS != (status = apr_thread_mutex_lock(threadpool->threadpool_mutex))) {
 	DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
 	return status;
     }
-    list_size = napr_list_size(threadpool->list);
-    if ((0 != list_size) || (threadpool->nb_waiting != threadpool->nb_thread)) {
-	/* DEBUG_DBG("After lock before wait"); */
-	/*
-	 * Because the caller of this function has added all data we are now
-	 * running, the line after, (cond_wait), make us wait to the end of
-	 * processing.
-	 */
-	threadpool->run |= 0x1;
-
-	if (APR_SUCCESS != (status = apr_thread_cond_wait(threadpool->threadpool_update, threadpool->threadpool_mutex))) {
+    /* loop, as a condition may be spuriously signaled */
+    while (0 != __atomic_load_n(&(threadpool->nb_jobs), __ATOMIC_SEQ_CST)) {
+	if (APR_SUCCESS != (status = apr_thread_cond_wait(threadpool->threadpool_done, threadpool->threadpool_mutex))) {
 	    DEBUG_ERR("error calling apr_thread_cond_wait: %s", apr_strerror(status, errbuf, 128));
+	    apr_thread_mutex_unlock(threadpool->threadpool_mutex);
 	    return status;
 	}
 	/* DEBUG_DBG("Awake"); */
-	/* Because all data have been processed, we are no more running  */
-	threadpool->run &= 0x0;
     }
-    /*
-     * garbage collecting under lock protection to avoid list manipulation
-     * during this freeing.
-     * We are doing this garbage collecting because if not, we will re-using
-     * the same pool to very-often alloc cell_t structures in list.
-     * This could lead to a memory leak if not regularly cleaned.
-     */
-    napr_list_delete(threadpool->list);
-    threadpool->list = napr_list_make(threadpool->pool);
     if (APR_SUCCESS != (status = apr_thread_mutex_unlock(threadpool->threadpool_mutex))) {
 	DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
 	return status;
@@ -304,73 +379,127 @@ extern apr_status_t napr_threadpool_wait(napr_threadpool_t *threadpool)
     return APR_SUCCESS;
 }
 
+/* take the oldest job of the own queue */
+static int napr_worker_pop(napr_worker_t *worker, napr_job_t *job)
+{
+    int found = 0;
+
+    /* unlocked peek, a job being queued is found at the next look */
+    if (0 == __atomic_load_n(&(worker->nel), __ATOMIC_RELAXED))
+	return 0;
+    apr_thread_mutex_lock(worker->mutex);
+    if (0 != worker->nel) {
+	*job = worker->jobs[worker->head];
+	worker->head = (worker->head + 1) & worker->mask;
+	__atomic_store_n(&(worker->nel), worker->nel - 1, __ATOMIC_RELAXED);
+	found = 1;
+    }
+    apr_thread_mutex_unlock(worker->mutex);
+
+    return found;
+}
+
+/* take the newest jobs of another queue, the first one to process it, the others into the own queue */
+static int napr_worker_steal(napr_worker_t *worker, napr_job_t *job)
+{
+    napr_threadpool_t *threadpool = worker->threadpool;
+    napr_job_t stolen[NAPR_DEQUE_STEAL];
+    napr_worker_t *victim;
+    apr_size_t i, nb_stolen;
+    unsigned long l, self;
+
+    self = worker - threadpool->workers;
+    for (l = 1; l < threadpool->nb_thread; l++) {
+	victim = &(threadpool->workers[(self + l) % threadpool->nb_thread]);
+	/* unlocked peek, a queue seen empty while being filled is found at the next look */
+	if (0 == __atomic_load_n(&(victim->nel), __ATOMIC_RELAXED))
+	    continue;
+	apr_thread_mutex_lock(victim->mutex);
+	nb_stolen = (victim->nel + 1) / 2;
+	if (nb_stolen > NAPR_DEQUE_STEAL)
+	    nb_stolen = NAPR_DEQUE_STEAL;
+	__atomic_store_n(&(victim->nel), victim->nel - nb_stolen, __ATOMIC_RELAXED);
+	for (i = 0; i < nb_stolen; i++)
+	    stolen[i] = victim->jobs[(victim->head + victim->nel + i) & victim->mask];
+	apr_thread_mutex_unlock(victim->mutex);
+	if (0 == nb_stolen)
+	    continue;
+
+	*job = stolen[0];
+	if (1 < nb_stolen) {
+	    apr_thread_mutex_lock(worker->mutex);
+	    /* the own queue is empty, its ring holds more than NAPR_DEQUE_STEAL jobs without growing */
+	    for (i = 1; i < nb_stolen; i++)
+		napr_worker_push(worker, &(stolen[i]));
+	    apr_thread_mutex_unlock(worker->mutex);
+	    /* the threads that went to sleep while they were moved can steal them in turn */
+	    napr_threadpool_wake(threadpool, nb_stolen - 1);
+	}
+	return 1;
+    }
+
+    return 0;
+}
+
 static void *APR_THREAD_FUNC napr_threadpool_loop(apr_thread_t *thd, void *rec)
 {
     char errbuf[128];
-    napr_threadpool_t *threadpool = rec;
+    napr_worker_t *worker = rec;
+    napr_threadpool_t *threadpool = worker->threadpool;
+    napr_job_t job;
+    apr_time_t start = 0;
     apr_status_t status;
 
-    /* lock the mutex, to access the list exclusively. */
-    if (APR_SUCCESS != (status = apr_thread_mutex_lock(threadpool->threadpool_mutex))) {
-	DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
-	return NULL;
-    }
+    napr_threadpool_self = worker;
 
-    /* do forever.... */
-    while (1) {
-	/* DEBUG_DBG("list_size: %lu", napr_list_size(threadpool->list)); */
-	if ((0 < napr_list_size(threadpool->list)) && !(threadpool->ended & 0x1)) {
-	    napr_cell_t *cell;
-	    void *data;
-
-	    cell = napr_list_first(threadpool->list);
-	    data = napr_list_get(cell);
-	    napr_list_cdr(threadpool->list);
-	    if (data) {
-		/*
-		 * unlock mutex - because other threads would be able to handle
-		 * other data waiting in the queue paralelly.
-		 */
-		if (APR_SUCCESS != (status = apr_thread_mutex_unlock(threadpool->threadpool_mutex))) {
-		    DEBUG_ERR("error calling apr_thread_mutex_unlock: %s", apr_strerror(status, errbuf, 128));
-		    return NULL;
-		}
-		threadpool->process_data(threadpool->ctx, data);
-		if (APR_SUCCESS != (status = apr_thread_mutex_lock(threadpool->threadpool_mutex))) {
-		    DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
-		    return NULL;
-		}
+    /* do until the pool is destroyed */
+    while (0 == __atomic_load_n(&(threadpool->shutdown), __ATOMIC_SEQ_CST)) {
+	if (napr_worker_pop(worker, &job) || napr_worker_steal(worker, &job)) {
+	    /* jobs queued before the pool was timed are not counted */
+	    if (0 != job.queued) {
+		__atomic_store_n(&(worker->nb_timed), worker->nb_timed + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&(worker->queued), worker->queued + (apr_time_now() - job.queued), __ATOMIC_RELAXED);
 	    }
-	}
-	else {			/* The waiting else */
-	    threadpool->nb_waiting += 1UL;
-
-	    /* DEBUG_DBG("run: %i waiting: %lu / thread: %lu", (threadpool->run & 0x1) ? 1 : 0, threadpool->nb_waiting, threadpool->nb_thread); */
-	    /* Should not broadcast if it's already ended, because it may lead to an infinite loop */
-	    if (!(threadpool->ended & 0x1) && (threadpool->run & 0x1) && (threadpool->nb_waiting == threadpool->nb_thread)) {
-		threadpool->ended |= 0x1;
-		if (APR_SUCCESS != (status = apr_thread_cond_broadcast(threadpool->threadpool_update))) {
-		    DEBUG_ERR("error calling apr_thread_cond_signal: %s", apr_strerror(status, errbuf, 128));
+	    status = threadpool->process_data(threadpool->ctx, job.data);
+	    if (NULL != job.done)
+		job.done(threadpool->ctx, job.data, status);
+	    if (0 == __atomic_sub_fetch(&(threadpool->nb_jobs), 1, __ATOMIC_SEQ_CST)) {
+		apr_thread_mutex_lock(threadpool->threadpool_mutex);
+		status = apr_thread_cond_broadcast(threadpool->threadpool_done);
+		apr_thread_mutex_unlock(threadpool->threadpool_mutex);
+		if (APR_SUCCESS != status) {
+		    DEBUG_ERR("error calling apr_thread_cond_broadcast: %s", apr_strerror(status, errbuf, 128));
 		    return NULL;
 		}
 	    }
+	    continue;
+	}
 
+	/* The waiting part, the jobs counted but not found yet are being queued or moved by a thief */
+	if (APR_SUCCESS != (status = apr_thread_mutex_lock(threadpool->threadpool_mutex))) {
+	    DEBUG_ERR("error calling apr_thread_mutex_lock: %s", apr_strerror(status, errbuf, 128));
+	    return NULL;
+	}
+	__atomic_add_fetch(&(threadpool->nb_sleeping), 1, __ATOMIC_SEQ_CST);
+	if (!napr_threadpool_has_queued(threadpool) && !threadpool->shutdown) {
+	    if (__atomic_load_n(&(threadpool->timed), __ATOMIC_RELAXED))
+		start = apr_time_now();
 	    /*
 	     * wait for a new data. note the mutex will be unlocked in
-	     * apr_thread_cond_wait(), thus allowing other threads access to data
-	     * list.
+	     * apr_thread_cond_wait(), thus allowing the callers of add to signal.
 	     */
 	    if (APR_SUCCESS != (status = apr_thread_cond_wait(threadpool->threadpool_update, threadpool->threadpool_mutex))) {
 		DEBUG_ERR("error calling apr_thread_cond_wait: %s", apr_strerror(status, errbuf, 128));
 		return NULL;
 	    }
-	    /*
-	     * after we return from apr_thread_cond_wait, the mutex is locked
-	     * again, so we don't need to lock it ourselves
-	     */
-	    threadpool->nb_waiting -= 1UL;
+	    if (0 != start) {
+		__atomic_store_n(&(worker->idle), worker->idle + (apr_time_now() - start), __ATOMIC_RELAXED);
+		start = 0;
+	    }
 	}
+	__atomic_sub_fetch(&(threadpool->nb_sleeping), 1, __ATOMIC_SEQ_CST);
+	apr_thread_mutex_unlock(threadpool->threadpool_mutex);
     }
-}
-
 
+    return NULL;
+}
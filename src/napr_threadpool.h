@@ -18,6 +18,16 @@
 #define NAPR_THREADPOOL_H
 
 #include <apr_pools.h>
+#include <apr_time.h>
+
+/*
+ * Each thread of the pool has its own queue of jobs, where the jobs added
+ * while processing are queued, and the jobs added from outside are spread
+ * over. A thread takes the oldest job of its queue, and once it's empty,
+ * steals the newest jobs of the others. A pool is reusable: once waited for,
+ * it can process other jobs, even with another callback. Destroying the apr
+ * pool of the threadpool, once waited for, stops its threads.
+ */
 
 typedef struct napr_threadpool_t napr_threadpool_t;
 
@@ -28,12 +38,21 @@ typedef struct napr_threadpool_t napr_threadpool_t;
  */
 typedef apr_status_t (threadpool_process_data_callback_fn_t) (void *ctx, void *data);
 
+/** 
+ * Function run by the thread that processed a job, once it's processed.
+ * @param ctx The context of the pool.
+ * @param data The data of the job.
+ * @param status What the processing returned.
+ */
+typedef void (threadpool_job_done_callback_fn_t) (void *ctx, void *data, apr_status_t status);
+
 /** 
  * Initialize a threadpool, it's an engine that keeps n threads running on data processing.
  * @param threadpool The addresse of a pointer to the opaque structure to allocate.
  * @param ctx A global context to pass as a first argument to callback function.
  * @param nb_thread The number of thread to allocate to your computation.
- * @param process_data A callback that will be run by a thread on a data added to the pool later.
+ * @param process_data A callback that will be run by a thread on a data added to the pool later, it may be NULL
+ *	  until napr_threadpool_set_process is called.
  * @param pool The apr_pool_t to allocate from.
  * @return APR_SUCCESS if no error occured.
  */
@@ -41,7 +60,17 @@ apr_status_t napr_threadpool_init(napr_threadpool_t **threadpool, void *ctx, uns
 				  threadpool_process_data_callback_fn_t *process_data, apr_pool_t *pool);
 
 /** 
- * Add data to process to the pool.
+ * Give another callback and context to the pool, to reuse its threads. It must not be processing anything, that
+ * is it has just been created or waited for.
+ * @param threadpool The opaque threadpool.
+ * @param ctx A global context to pass as a first argument to callback function.
+ * @param process_data The callback to run on the data added from now on.
+ */
+void napr_threadpool_set_process(napr_threadpool_t *threadpool, void *ctx,
+				 threadpool_process_data_callback_fn_t *process_data);
+
+/** 
+ * Add data to process to the pool, it may be called by the callback itself.
  * @param threadpool The opaque threadpool.
  * @param data The data of any type.
  * @return APR_SUCCESS if no error occured.
@@ -49,7 +78,47 @@ apr_status_t napr_threadpool_init(napr_threadpool_t **threadpool, void *ctx, uns
 apr_status_t napr_threadpool_add(napr_threadpool_t *threadpool, void *data);
 
 /** 
- * This function wait for the pool to process all the data that has been submitted.
+ * Add data to process to the pool, with a callback run once it's processed.
+ * @param threadpool The opaque threadpool.
+ * @param data The data of any type.
+ * @param done The callback run with the status of the processing, may be NULL.
+ * @return APR_SUCCESS if no error occured.
+ */
+apr_status_t napr_threadpool_add_job(napr_threadpool_t *threadpool, void *data, threadpool_job_done_callback_fn_t *done);
+
+/** 
+ * Add many data to process at once, each queue of the pool being locked once, and the idle threads being woken up
+ * once.
+ * @param threadpool The opaque threadpool.
+ * @param data The nel data to process, the array itself may be reused once the function returns.
+ * @param nel The number of data.
+ * @param done The callback run after each of them is processed, may be NULL.
+ * @return APR_SUCCESS if no error occured.
+ */
+apr_status_t napr_threadpool_add_batch(napr_threadpool_t *threadpool, void *const *data, apr_size_t nel,
+				       threadpool_job_done_callback_fn_t *done);
+
+/** 
+ * Time the jobs added from now on, from the moment they are queued to the moment a thread takes them, and the
+ * threads while they sleep. Each thread sums its own times, a single clock read is added per job and per sleep.
+ * @param threadpool The opaque threadpool.
+ * @param timed 1 to time them, 0 to stop.
+ */
+void napr_threadpool_set_timed(napr_threadpool_t *threadpool, int timed);
+
+/** 
+ * Sum the times of the threads, once the pool is waited for.
+ * @param threadpool The opaque threadpool.
+ * @param nb_jobs The number of jobs timed.
+ * @param queued The time they spent queued, in total.
+ * @param idle The time the threads slept waiting for jobs, in total.
+ */
+void napr_threadpool_times(const napr_threadpool_t *threadpool, apr_size_t *nb_jobs, apr_interval_time_t *queued,
+			   apr_interval_time_t *idle);
+
+/** 
+ * This function wait for the pool to process all the data that has been submitted, including the data added by
+ * the callback while processing.
  * @param threadpool The opaque threadpool.
  * @return APR_SUCCESS if no error occured.
  */
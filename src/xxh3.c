@@ -0,0 +1,732 @@
+/*
+--------------------------------------------------------------------
+xxh3.c, XXH3 128-bit hash of xxHash
+xxHash - Extremely Fast Hash algorithm
+Copyright (C) 2012-2021 Yann Collet
+BSD 2-Clause License (https://www.opensource.org/licenses/bsd-license.php)
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above
+     copyright notice, this list of conditions and the following disclaimer
+     in the documentation and/or other materials provided with the
+     distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+See https://github.com/Cyan4973/xxHash
+
+Only the unseeded 128-bit variant with the default secret is
+implemented. The long input loop (accumulate/scramble) has scalar,
+SSE2, AVX2 and NEON versions, the best one is picked at runtime.
+--------------------------------------------------------------------
+*/
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XXH3_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define XXH3_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "xxh3.h"
+
+#define XXH3_STRIPE_LEN 64
+#define XXH3_SECRET_CONSUME_RATE 8
+#define XXH3_ACC_NB (XXH3_STRIPE_LEN / sizeof(apr_uint64_t))
+#define XXH3_SECRET_SIZE 192
+#define XXH3_SECRET_SIZE_MIN 136
+#define XXH3_SECRET_LIMIT (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN)
+#define XXH3_STRIPES_PER_BLOCK (XXH3_SECRET_LIMIT / XXH3_SECRET_CONSUME_RATE)
+#define XXH3_BLOCK_LEN (XXH3_STRIPE_LEN * XXH3_STRIPES_PER_BLOCK)
+#define XXH3_SECRET_LASTACC_START 7
+#define XXH3_SECRET_MERGEACCS_START 11
+#define XXH3_MIDSIZE_MAX 240
+#define XXH3_MIDSIZE_STARTOFFSET 3
+#define XXH3_MIDSIZE_LASTOFFSET 17
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+/* Pseudorandom secret taken directly from FARSH, as in the reference */
+static const unsigned char kSecret[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+typedef struct xxh3_128_t
+{
+    apr_uint64_t low64;
+    apr_uint64_t high64;
+} xxh3_128_t;
+
+/*
+--------------------------------------------------------------------
+Byte and arithmetic helpers
+--------------------------------------------------------------------
+*/
+static inline apr_uint32_t swap32(apr_uint32_t x)
+{
+    return __builtin_bswap32(x);
+}
+
+static inline apr_uint64_t swap64(apr_uint64_t x)
+{
+    return __builtin_bswap64(x);
+}
+
+static inline apr_uint32_t read_le32(const unsigned char *p)
+{
+    apr_uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = swap32(v);
+#endif
+    return v;
+}
+
+static inline apr_uint64_t read_le64(const unsigned char *p)
+{
+    apr_uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = swap64(v);
+#endif
+    return v;
+}
+
+static inline apr_uint32_t rotl32(apr_uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline apr_uint64_t xorshift64(apr_uint64_t v, int shift)
+{
+    return v ^ (v >> shift);
+}
+
+static inline xxh3_128_t mult64to128(apr_uint64_t lhs, apr_uint64_t rhs)
+{
+    xxh3_128_t r;
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128) lhs * (unsigned __int128) rhs;
+
+    r.low64 = (apr_uint64_t) product;
+    r.high64 = (apr_uint64_t) (product >> 64);
+#else
+    apr_uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+    apr_uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+    apr_uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+    apr_uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+    apr_uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+    r.high64 = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    r.low64 = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+    return r;
+}
+
+static inline apr_uint64_t mul128_fold64(apr_uint64_t lhs, apr_uint64_t rhs)
+{
+    xxh3_128_t product = mult64to128(lhs, rhs);
+
+    return product.low64 ^ product.high64;
+}
+
+static apr_uint64_t xxh64_avalanche(apr_uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static apr_uint64_t xxh3_avalanche(apr_uint64_t h)
+{
+    h = xorshift64(h, 37);
+    h *= PRIME_MX1;
+    h = xorshift64(h, 32);
+    return h;
+}
+
+/*
+--------------------------------------------------------------------
+Short inputs (up to XXH3_MIDSIZE_MAX bytes)
+--------------------------------------------------------------------
+*/
+static xxh3_128_t len_1to3(const unsigned char *input, apr_size_t len, const unsigned char *secret)
+{
+    apr_uint32_t c1 = input[0], c2 = input[len >> 1], c3 = input[len - 1];
+    apr_uint32_t combinedl = (c1 << 16) | (c2 << 24) | (c3 << 0) | ((apr_uint32_t) len << 8);
+    apr_uint32_t combinedh = rotl32(swap32(combinedl), 13);
+    apr_uint64_t bitflipl = read_le32(secret) ^ read_le32(secret + 4);
+    apr_uint64_t bitfliph = read_le32(secret + 8) ^ read_le32(secret + 12);
+    xxh3_128_t h;
+
+    h.low64 = xxh64_avalanche((apr_uint64_t) combinedl ^ bitflipl);
+    h.high64 = xxh64_avalanche((apr_uint64_t) combinedh ^ bitfliph);
+    return h;
+}
+
+static xxh3_128_t len_4to8(const unsigned char *input, apr_size_t len, const unsigned char *secret)
+{
+    apr_uint32_t input_lo = read_le32(input);
+    apr_uint32_t input_hi = read_le32(input + len - 4);
+    apr_uint64_t input_64 = input_lo + ((apr_uint64_t) input_hi << 32);
+    apr_uint64_t bitflip = read_le64(secret + 16) ^ read_le64(secret + 24);
+    xxh3_128_t m = mult64to128(input_64 ^ bitflip, PRIME64_1 + (len << 2));
+
+    m.high64 += (m.low64 << 1);
+    m.low64 ^= (m.high64 >> 3);
+    m.low64 = xorshift64(m.low64, 35);
+    m.low64 *= PRIME_MX2;
+    m.low64 = xorshift64(m.low64, 28);
+    m.high64 = xxh3_avalanche(m.high64);
+    return m;
+}
+
+static xxh3_128_t len_9to16(const unsigned char *input, apr_size_t len, const unsigned char *secret)
+{
+    apr_uint64_t bitflipl = read_le64(secret + 32) ^ read_le64(secret + 40);
+    apr_uint64_t bitfliph = read_le64(secret + 48) ^ read_le64(secret + 56);
+    apr_uint64_t input_lo = read_le64(input);
+    apr_uint64_t input_hi = read_le64(input + len - 8);
+    xxh3_128_t m = mult64to128(input_lo ^ input_hi ^ bitflipl, PRIME64_1);
+    xxh3_128_t h;
+
+    m.low64 += (apr_uint64_t) (len - 1) << 54;
+    input_hi ^= bitfliph;
+    m.high64 += input_hi + (apr_uint64_t) (apr_uint32_t) input_hi * (PRIME32_2 - 1);
+    m.low64 ^= swap64(m.high64);
+
+    h = mult64to128(m.low64, PRIME64_2);
+    h.high64 += m.high64 * PRIME64_2;
+    h.low64 = xxh3_avalanche(h.low64);
+    h.high64 = xxh3_avalanche(h.high64);
+    return h;
+}
+
+static xxh3_128_t len_0to16(const unsigned char *input, apr_size_t len, const unsigned char *secret)
+{
+    xxh3_128_t h;
+
+    if (len > 8)
+	return len_9to16(input, len, secret);
+    if (len >= 4)
+	return len_4to8(input, len, secret);
+    if (len)
+	return len_1to3(input, len, secret);
+
+    h.low64 = xxh64_avalanche(read_le64(secret + 64) ^ read_le64(secret + 72));
+    h.high64 = xxh64_avalanche(read_le64(secret + 80) ^ read_le64(secret + 88));
+    return h;
+}
+
+static inline apr_uint64_t mix16B(const unsigned char *input, const unsigned char *secret)
+{
+    return mul128_fold64(read_le64(input) ^ read_le64(secret), read_le64(input + 8) ^ read_le64(secret + 8));
+}
+
+static inline xxh3_128_t mix32B(xxh3_128_t acc, const unsigned char *input_1, const unsigned char *input_2,
+				const unsigned char *secret)
+{
+    acc.low64 += mix16B(input_1, secret);
+    acc.low64 ^= read_le64(input_2) + read_le64(input_2 + 8);
+    acc.high64 += mix16B(input_2, secret + 16);
+    acc.high64 ^= read_le64(input_1) + read_le64(input_1 + 8);
+    return acc;
+}
+
+static xxh3_128_t mid_final(xxh3_128_t acc, apr_size_t len)
+{
+    xxh3_128_t h;
+
+    h.low64 = acc.low64 + acc.high64;
+    h.high64 = (acc.low64 * PRIME64_1) + (acc.high64 * PRIME64_4) + ((apr_uint64_t) len * PRIME64_2);
+    h.low64 = xxh3_avalanche(h.low64);
+    h.high64 = (apr_uint64_t) 0 - xxh3_avalanche(h.high64);
+    return h;
+}
+
+static xxh3_128_t len_17to128(const unsigned char *input, apr_size_t len, const unsigned char *secret)
+{
+    xxh3_128_t acc;
+
+    acc.low64 = len * PRIME64_1;
+    acc.high64 = 0;
+    if (len > 32) {
+	if (len > 64) {
+	    if (len > 96)
+		acc = mix32B(acc, input + 48, input + len - 64, secret + 96);
+	    acc = mix32B(acc, input + 32, input + len - 48, secret + 64);
+	}
+	acc = mix32B(acc, input + 16, input + len - 32, secret + 32);
+    }
+    acc = mix32B(acc, input, input + len - 16, secret);
+
+    return mid_final(acc, len);
+}
+
+static xxh3_128_t len_129to240(const unsigned char *input, apr_size_t len, const unsigned char *secret)
+{
+    xxh3_128_t acc;
+    apr_size_t i;
+
+    acc.low64 = len * PRIME64_1;
+    acc.high64 = 0;
+    for (i = 32; i < 160; i += 32)
+	acc = mix32B(acc, input + i - 32, input + i - 16, secret + i - 32);
+    acc.low64 = xxh3_avalanche(acc.low64);
+    acc.high64 = xxh3_avalanche(acc.high64);
+    for (i = 160; i <= len; i += 32)
+	acc = mix32B(acc, input + i - 32, input + i - 16, secret + XXH3_MIDSIZE_STARTOFFSET + i - 160);
+    /* last bytes */
+    acc = mix32B(acc, input + len - 16, input + len - 32,
+		 secret + XXH3_SECRET_SIZE_MIN - XXH3_MIDSIZE_LASTOFFSET - 16);
+
+    return mid_final(acc, len);
+}
+
+static xxh3_128_t xxh3_128_short(const unsigned char *input, apr_size_t len)
+{
+    if (len <= 16)
+	return len_0to16(input, len, kSecret);
+    if (len <= 128)
+	return len_17to128(input, len, kSecret);
+
+    return len_129to240(input, len, kSecret);
+}
+
+/*
+--------------------------------------------------------------------
+Long inputs: the accumulate / scramble loop, vectorized
+--------------------------------------------------------------------
+*/
+typedef void xxh3_accumulate_fn_t(apr_uint64_t *acc, const unsigned char *input, const unsigned char *secret,
+				  apr_size_t nb_stripes);
+typedef void xxh3_scramble_fn_t(apr_uint64_t *acc, const unsigned char *secret);
+
+typedef struct xxh3_impl_t
+{
+    const char *name;
+    xxh3_accumulate_fn_t *accumulate;
+    xxh3_scramble_fn_t *scramble;
+} xxh3_impl_t;
+
+static void accumulate_scalar(apr_uint64_t *acc, const unsigned char *input, const unsigned char *secret,
+			      apr_size_t nb_stripes)
+{
+    apr_uint64_t data_val, data_key;
+    apr_size_t n, i;
+
+    for (n = 0; n < nb_stripes; n++, input += XXH3_STRIPE_LEN, secret += XXH3_SECRET_CONSUME_RATE) {
+	for (i = 0; i < XXH3_ACC_NB; i++) {
+	    data_val = read_le64(input + i * 8);
+	    data_key = data_val ^ read_le64(secret + i * 8);
+	    acc[i ^ 1] += data_val;	/* swap adjacent lanes */
+	    acc[i] += (apr_uint64_t) (apr_uint32_t) data_key * (apr_uint64_t) (apr_uint32_t) (data_key >> 32);
+	}
+    }
+}
+
+static void scramble_scalar(apr_uint64_t *acc, const unsigned char *secret)
+{
+    apr_uint64_t acc64;
+    apr_size_t i;
+
+    for (i = 0; i < XXH3_ACC_NB; i++) {
+	acc64 = xorshift64(acc[i], 47);
+	acc64 ^= read_le64(secret + i * 8);
+	acc64 *= PRIME32_1;
+	acc[i] = acc64;
+    }
+}
+
+#if XXH3_X86
+__attribute__ ((target("sse2")))
+static void accumulate_sse2(apr_uint64_t *acc, const unsigned char *input, const unsigned char *secret,
+			    apr_size_t nb_stripes)
+{
+    __m128i xacc[4], data_vec, key_vec, data_key, product;
+    apr_size_t n, i;
+
+    for (i = 0; i < 4; i++)
+	xacc[i] = _mm_loadu_si128((const __m128i *) acc + i);
+    for (n = 0; n < nb_stripes; n++, input += XXH3_STRIPE_LEN, secret += XXH3_SECRET_CONSUME_RATE) {
+	for (i = 0; i < 4; i++) {
+	    data_vec = _mm_loadu_si128((const __m128i *) input + i);
+	    key_vec = _mm_loadu_si128((const __m128i *) secret + i);
+	    data_key = _mm_xor_si128(data_vec, key_vec);
+	    product = _mm_mul_epu32(data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1)));
+	    xacc[i] = _mm_add_epi64(xacc[i], _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2)));
+	    xacc[i] = _mm_add_epi64(xacc[i], product);
+	}
+    }
+    for (i = 0; i < 4; i++)
+	_mm_storeu_si128((__m128i *) acc + i, xacc[i]);
+}
+
+__attribute__ ((target("sse2")))
+static void scramble_sse2(apr_uint64_t *acc, const unsigned char *secret)
+{
+    const __m128i prime32 = _mm_set1_epi32((int) PRIME32_1);
+    __m128i acc_vec, data_key, prod_lo, prod_hi;
+    apr_size_t i;
+
+    for (i = 0; i < 4; i++) {
+	acc_vec = _mm_loadu_si128((const __m128i *) acc + i);
+	acc_vec = _mm_xor_si128(acc_vec, _mm_srli_epi64(acc_vec, 47));
+	data_key = _mm_xor_si128(acc_vec, _mm_loadu_si128((const __m128i *) secret + i));
+	prod_lo = _mm_mul_epu32(data_key, prime32);
+	prod_hi = _mm_mul_epu32(_mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1)), prime32);
+	_mm_storeu_si128((__m128i *) acc + i, _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32)));
+    }
+}
+
+__attribute__ ((target("avx2")))
+static void accumulate_avx2(apr_uint64_t *acc, const unsigned char *input, const unsigned char *secret,
+			    apr_size_t nb_stripes)
+{
+    __m256i xacc[2], data_vec, key_vec, data_key, product;
+    apr_size_t n, i;
+
+    for (i = 0; i < 2; i++)
+	xacc[i] = _mm256_loadu_si256((const __m256i *) acc + i);
+    for (n = 0; n < nb_stripes; n++, input += XXH3_STRIPE_LEN, secret += XXH3_SECRET_CONSUME_RATE) {
+	for (i = 0; i < 2; i++) {
+	    data_vec = _mm256_loadu_si256((const __m256i *) input + i);
+	    key_vec = _mm256_loadu_si256((const __m256i *) secret + i);
+	    data_key = _mm256_xor_si256(data_vec, key_vec);
+	    product = _mm256_mul_epu32(data_key, _mm256_srli_epi64(data_key, 32));
+	    xacc[i] = _mm256_add_epi64(xacc[i], _mm256_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2)));
+	    xacc[i] = _mm256_add_epi64(xacc[i], product);
+	}
+    }
+    for (i = 0; i < 2; i++)
+	_mm256_storeu_si256((__m256i *) acc + i, xacc[i]);
+}
+
+__attribute__ ((target("avx2")))
+static void scramble_avx2(apr_uint64_t *acc, const unsigned char *secret)
+{
+    const __m256i prime32 = _mm256_set1_epi32((int) PRIME32_1);
+    __m256i acc_vec, data_key, prod_lo, prod_hi;
+    apr_size_t i;
+
+    for (i = 0; i < 2; i++) {
+	acc_vec = _mm256_loadu_si256((const __m256i *) acc + i);
+	acc_vec = _mm256_xor_si256(acc_vec, _mm256_srli_epi64(acc_vec, 47));
+	data_key = _mm256_xor_si256(acc_vec, _mm256_loadu_si256((const __m256i *) secret + i));
+	prod_lo = _mm256_mul_epu32(data_key, prime32);
+	prod_hi = _mm256_mul_epu32(_mm256_srli_epi64(data_key, 32), prime32);
+	_mm256_storeu_si256((__m256i *) acc + i, _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32)));
+    }
+}
+#endif /* XXH3_X86 */
+
+#if XXH3_NEON
+static void accumulate_neon(apr_uint64_t *acc, const unsigned char *input, const unsigned char *secret,
+			    apr_size_t nb_stripes)
+{
+    uint64x2_t xacc[4], data_vec, data_key;
+    apr_size_t n, i;
+
+    for (i = 0; i < 4; i++)
+	xacc[i] = vld1q_u64(acc + 2 * i);
+    for (n = 0; n < nb_stripes; n++, input += XXH3_STRIPE_LEN, secret += XXH3_SECRET_CONSUME_RATE) {
+	for (i = 0; i < 4; i++) {
+	    data_vec = vreinterpretq_u64_u8(vld1q_u8(input + 16 * i));
+	    data_key = veorq_u64(data_vec, vreinterpretq_u64_u8(vld1q_u8(secret + 16 * i)));
+	    xacc[i] = vaddq_u64(xacc[i], vextq_u64(data_vec, data_vec, 1));
+	    xacc[i] = vmlal_u32(xacc[i], vmovn_u64(data_key), vshrn_n_u64(data_key, 32));
+	}
+    }
+    for (i = 0; i < 4; i++)
+	vst1q_u64(acc + 2 * i, xacc[i]);
+}
+
+static void scramble_neon(apr_uint64_t *acc, const unsigned char *secret)
+{
+    const uint32x2_t prime32 = vdup_n_u32(PRIME32_1);
+    uint64x2_t acc_vec, data_key, prod_hi;
+    apr_size_t i;
+
+    for (i = 0; i < 4; i++) {
+	acc_vec = vld1q_u64(acc + 2 * i);
+	acc_vec = veorq_u64(acc_vec, vshrq_n_u64(acc_vec, 47));
+	data_key = veorq_u64(acc_vec, vreinterpretq_u64_u8(vld1q_u8(secret + 16 * i)));
+	prod_hi = vshlq_n_u64(vmull_u32(vshrn_n_u64(data_key, 32), prime32), 32);
+	vst1q_u64(acc + 2 * i, vmlal_u32(prod_hi, vmovn_u64(data_key), prime32));
+    }
+}
+#endif /* XXH3_NEON */
+
+static const xxh3_impl_t impl_scalar = { "scalar", accumulate_scalar, scramble_scalar };
+#if XXH3_X86
+static const xxh3_impl_t impl_sse2 = { "sse2", accumulate_sse2, scramble_sse2 };
+static const xxh3_impl_t impl_avx2 = { "avx2", accumulate_avx2, scramble_avx2 };
+#endif
+#if XXH3_NEON
+static const xxh3_impl_t impl_neon = { "neon", accumulate_neon, scramble_neon };
+#endif
+
+static const xxh3_impl_t *impl = NULL;
+
+static const xxh3_impl_t *xxh3_impl(void)
+{
+    if (NULL == impl) {
+#if XXH3_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	    impl = &impl_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+	    impl = &impl_sse2;
+	else
+	    impl = &impl_scalar;
+#elif XXH3_NEON
+	impl = &impl_neon;
+#else
+	impl = &impl_scalar;
+#endif
+    }
+
+    return impl;
+}
+
+static apr_uint64_t merge_accs(const apr_uint64_t *acc, const unsigned char *secret, apr_uint64_t start)
+{
+    apr_uint64_t result64 = start;
+    apr_size_t i;
+
+    for (i = 0; i < 4; i++)
+	result64 += mul128_fold64(acc[2 * i] ^ read_le64(secret + 16 * i), acc[2 * i + 1] ^ read_le64(secret + 16 * i + 8));
+
+    return xxh3_avalanche(result64);
+}
+
+static xxh3_128_t long_final(const apr_uint64_t *acc, apr_uint64_t len)
+{
+    xxh3_128_t h;
+
+    h.low64 = merge_accs(acc, kSecret + XXH3_SECRET_MERGEACCS_START, len * PRIME64_1);
+    h.high64 = merge_accs(acc, kSecret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - XXH3_SECRET_MERGEACCS_START,
+			  ~(len * PRIME64_2));
+    return h;
+}
+
+static void init_acc(apr_uint64_t *acc)
+{
+    acc[0] = PRIME32_3;
+    acc[1] = PRIME64_1;
+    acc[2] = PRIME64_2;
+    acc[3] = PRIME64_3;
+    acc[4] = PRIME64_4;
+    acc[5] = PRIME32_2;
+    acc[6] = PRIME64_5;
+    acc[7] = PRIME32_1;
+}
+
+void xxh3_128(const unsigned char *input, apr_size_t len, apr_uint64_t *low64, apr_uint64_t *high64)
+{
+    const xxh3_impl_t *f;
+    apr_uint64_t acc[XXH3_ACC_NB];
+    apr_size_t nb_blocks, n;
+    xxh3_128_t h;
+
+    if (len <= XXH3_MIDSIZE_MAX) {
+	h = xxh3_128_short(input, len);
+    }
+    else {
+	f = xxh3_impl();
+	init_acc(acc);
+	nb_blocks = (len - 1) / XXH3_BLOCK_LEN;
+	for (n = 0; n < nb_blocks; n++) {
+	    f->accumulate(acc, input + n * XXH3_BLOCK_LEN, kSecret, XXH3_STRIPES_PER_BLOCK);
+	    f->scramble(acc, kSecret + XXH3_SECRET_LIMIT);
+	}
+	/* last partial block, then last stripe */
+	f->accumulate(acc, input + nb_blocks * XXH3_BLOCK_LEN, kSecret,
+		      ((len - 1) - (XXH3_BLOCK_LEN * nb_blocks)) / XXH3_STRIPE_LEN);
+	f->accumulate(acc, input + len - XXH3_STRIPE_LEN, kSecret + XXH3_SECRET_LIMIT - XXH3_SECRET_LASTACC_START, 1);
+	h = long_final(acc, len);
+    }
+
+    *low64 = h.low64;
+    *high64 = h.high64;
+}
+
+void xxh3_128_reset(xxh3_state_t *state)
+{
+    init_acc(state->acc);
+    state->buffered_size = 0;
+    state->nb_stripes_so_far = 0;
+    state->total_len = 0;
+}
+
+static const unsigned char *consume_stripes(const xxh3_impl_t *f, apr_uint64_t *acc, apr_size_t *nb_stripes_so_far,
+					    const unsigned char *input, apr_size_t nb_stripes)
+{
+    const unsigned char *initial_secret = kSecret + *nb_stripes_so_far * XXH3_SECRET_CONSUME_RATE;
+    apr_size_t nb_stripes_this_iter;
+
+    if (nb_stripes >= (XXH3_STRIPES_PER_BLOCK - *nb_stripes_so_far)) {
+	/* finish the current block, then process full blocks */
+	nb_stripes_this_iter = XXH3_STRIPES_PER_BLOCK - *nb_stripes_so_far;
+	do {
+	    f->accumulate(acc, input, initial_secret, nb_stripes_this_iter);
+	    f->scramble(acc, kSecret + XXH3_SECRET_LIMIT);
+	    input += nb_stripes_this_iter * XXH3_STRIPE_LEN;
+	    nb_stripes -= nb_stripes_this_iter;
+	    nb_stripes_this_iter = XXH3_STRIPES_PER_BLOCK;
+	    initial_secret = kSecret;
+	} while (nb_stripes >= XXH3_STRIPES_PER_BLOCK);
+	*nb_stripes_so_far = 0;
+    }
+    if (nb_stripes > 0) {
+	f->accumulate(acc, input, initial_secret, nb_stripes);
+	input += nb_stripes * XXH3_STRIPE_LEN;
+	*nb_stripes_so_far += nb_stripes;
+    }
+
+    return input;
+}
+
+void xxh3_128_update(xxh3_state_t *state, const unsigned char *input, apr_size_t len)
+{
+    const xxh3_impl_t *f;
+    const unsigned char *end = input + len;
+    apr_size_t load_size;
+
+    state->total_len += len;
+    /* small input: just fill in the buffer */
+    if (len <= XXH3_BUFFER_SIZE - state->buffered_size) {
+	memcpy(state->buffer + state->buffered_size, input, len);
+	state->buffered_size += len;
+	return;
+    }
+
+    /*
+     * The buffer is only consumed when there is more input, so that the
+     * last stripe is always available for the digest.
+     */
+    f = xxh3_impl();
+    if (state->buffered_size) {
+	load_size = XXH3_BUFFER_SIZE - state->buffered_size;
+	memcpy(state->buffer + state->buffered_size, input, load_size);
+	input += load_size;
+	consume_stripes(f, state->acc, &(state->nb_stripes_so_far), state->buffer, XXH3_BUFFER_SIZE / XXH3_STRIPE_LEN);
+	state->buffered_size = 0;
+    }
+    if (end - input > XXH3_BUFFER_SIZE) {
+	input = consume_stripes(f, state->acc, &(state->nb_stripes_so_far), input,
+				(apr_size_t) (end - 1 - input) / XXH3_STRIPE_LEN);
+	/* keep the last consumed stripe, the digest may need it */
+	memcpy(state->buffer + XXH3_BUFFER_SIZE - XXH3_STRIPE_LEN, input - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+    }
+    /* some remaining input (always): buffer it */
+    memcpy(state->buffer, input, (apr_size_t) (end - input));
+    state->buffered_size = (apr_size_t) (end - input);
+}
+
+void xxh3_128_digest(const xxh3_state_t *state, apr_uint64_t *low64, apr_uint64_t *high64)
+{
+    const xxh3_impl_t *f;
+    unsigned char last_stripe[XXH3_STRIPE_LEN];
+    const unsigned char *last_stripe_ptr;
+    apr_uint64_t acc[XXH3_ACC_NB];
+    apr_size_t nb_stripes_so_far, catchup_size;
+    xxh3_128_t h;
+
+    if (state->total_len <= XXH3_MIDSIZE_MAX) {
+	h = xxh3_128_short(state->buffer, (apr_size_t) state->total_len);
+    }
+    else {
+	f = xxh3_impl();
+	memcpy(acc, state->acc, sizeof(acc));
+	if (state->buffered_size >= XXH3_STRIPE_LEN) {
+	    nb_stripes_so_far = state->nb_stripes_so_far;
+	    consume_stripes(f, acc, &nb_stripes_so_far, state->buffer, (state->buffered_size - 1) / XXH3_STRIPE_LEN);
+	    last_stripe_ptr = state->buffer + state->buffered_size - XXH3_STRIPE_LEN;
+	}
+	else {
+	    /* the last stripe overlaps the previously consumed data */
+	    catchup_size = XXH3_STRIPE_LEN - state->buffered_size;
+	    memcpy(last_stripe, state->buffer + XXH3_BUFFER_SIZE - catchup_size, catchup_size);
+	    memcpy(last_stripe + catchup_size, state->buffer, state->buffered_size);
+	    last_stripe_ptr = last_stripe;
+	}
+	f->accumulate(acc, last_stripe_ptr, kSecret + XXH3_SECRET_LIMIT - XXH3_SECRET_LASTACC_START, 1);
+	h = long_final(acc, state->total_len);
+    }
+
+    *low64 = h.low64;
+    *high64 = h.high64;
+}
+
+const char *xxh3_impl_name(void)
+{
+    return xxh3_impl()->name;
+}
+
+int xxh3_impl_force(const char *name)
+{
+    const xxh3_impl_t *found = NULL;
+
+    /* detect the CPU features first */
+    xxh3_impl();
+    if (0 == strcmp(name, impl_scalar.name))
+	found = &impl_scalar;
+#if XXH3_X86
+    else if ((0 == strcmp(name, impl_sse2.name)) && __builtin_cpu_supports("sse2"))
+	found = &impl_sse2;
+    else if ((0 == strcmp(name, impl_avx2.name)) && __builtin_cpu_supports("avx2"))
+	found = &impl_avx2;
+#endif
+#if XXH3_NEON
+    else if (0 == strcmp(name, impl_neon.name))
+	found = &impl_neon;
+#endif
+    if (NULL == found)
+	return -1;
+    impl = found;
+
+    return 0;
+}
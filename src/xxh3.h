@@ -0,0 +1,69 @@
+/*
+--------------------------------------------------------------------
+xxh3.h, XXH3 128-bit hash of xxHash
+xxHash - Extremely Fast Hash algorithm
+Copyright (C) 2012-2021 Yann Collet
+BSD 2-Clause License (https://www.opensource.org/licenses/bsd-license.php)
+See https://github.com/Cyan4973/xxHash
+
+Independent implementation of the unseeded XXH3_128bits() using the
+default secret, adapted to work with apr types. Digests are the same
+as the reference implementation ones.
+--------------------------------------------------------------------
+*/
+#ifndef XXH3_H
+#define XXH3_H
+
+#include <apr.h>		/* define apr_uint64_t, apr_size_t */
+
+#define XXH3_BUFFER_SIZE 256
+
+/* Streaming state, may be allocated anywhere (no alignment constraint) */
+typedef struct xxh3_state_t
+{
+    apr_uint64_t acc[8];
+    unsigned char buffer[XXH3_BUFFER_SIZE];
+    apr_size_t buffered_size;
+    apr_size_t nb_stripes_so_far;
+    apr_uint64_t total_len;
+} xxh3_state_t;
+
+/*
+--------------------------------------------------------------------
+xxh3_128() -- hash a variable-length key into a 128-bit value
+  input : the key (the unaligned variable-length array of bytes)
+  len   : the length of the key, counting by bytes
+  low64, high64 : the two halves of the result, as XXH128_hash_t
+--------------------------------------------------------------------
+*/
+void xxh3_128(const unsigned char *input, apr_size_t len, apr_uint64_t *low64, apr_uint64_t *high64);
+
+/*
+--------------------------------------------------------------------
+Streaming interface, the digest does not depend on the way the input
+is split in calls to xxh3_128_update().
+--------------------------------------------------------------------
+*/
+void xxh3_128_reset(xxh3_state_t *state);
+void xxh3_128_update(xxh3_state_t *state, const unsigned char *input, apr_size_t len);
+void xxh3_128_digest(const xxh3_state_t *state, apr_uint64_t *low64, apr_uint64_t *high64);
+
+/*
+--------------------------------------------------------------------
+Name of the implementation picked according to the features of the
+CPU ("avx2", "sse2", "neon" or "scalar"). The first call does the
+detection, so make it before using the hash from several threads.
+--------------------------------------------------------------------
+*/
+const char *xxh3_impl_name(void);
+
+/*
+--------------------------------------------------------------------
+Use the implementation called name from now on, for the tests of the
+kernels the CPU would not pick. Return 0 if it is available on this
+CPU, -1 otherwise, the implementation in use is then left unchanged.
+--------------------------------------------------------------------
+*/
+int xxh3_impl_force(const char *name);
+
+#endif /* XXH3_H */